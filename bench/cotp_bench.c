@@ -0,0 +1,761 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cotp.h"
+
+#ifndef COTP_BENCH_BACKEND
+#define COTP_BENCH_BACKEND "unknown"
+#endif
+
+#define BENCH_MAX_RESULTS   256
+#define BENCH_BATCH_JOBS    4096
+#define BENCH_LOGINS        1024
+
+// Benchmarks are plain "run one operation" callbacks; the timing loop around them costs a few ns,
+// which is noise next to an HMAC but is visible in the smallest base32 cases.
+typedef void (*bench_fn)(void *arg);
+
+typedef struct {
+    char   name[64];
+    const char *algo;
+    long   param;
+    size_t iterations;
+    double ns_per_op;
+    double ops_per_sec;
+} bench_result;
+
+typedef struct {
+    const char *filter;
+    double      min_time_ns;
+    int         repeat;
+    int         threads;
+    int         json;
+    bench_result results[BENCH_MAX_RESULTS];
+    size_t       n_results;
+} bench_state;
+
+typedef struct {
+    const char *secret;
+    int         algo;
+    int         window;
+    cotp_key   *key;
+    const char *code;
+    const uint8_t *data;
+    size_t      len;
+    const char *text;
+    const cotp_otpauth_uri *uri;
+    cotp_otp_job *jobs;
+    cotp_pool  *pool;
+    cotp_queue *queue;
+    cotp_async_request *reqs;
+    void       *cache;
+    char      **codes;
+    const int  *order;
+    cotp_validate_job *checks;
+} bench_arg;
+
+static volatile size_t sink;
+
+static const char *secret = "HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ";
+static const long  base_ts = 1700000000;
+
+static const char *algo_names[] = { "SHA1", "SHA256", "SHA512" };
+
+
+static double
+now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+
+static double
+time_iterations (bench_fn fn, void *arg, size_t iterations)
+{
+    double start = now_ns ();
+    for (size_t i = 0; i < iterations; i++) {
+        fn (arg);
+    }
+    return now_ns () - start;
+}
+
+
+// Doubles the iteration count until one run takes min_time, then keeps the fastest of `repeat`
+// runs at that count. The fastest run is the least disturbed by scheduling and frequency noise.
+static void
+run_bench (bench_state *st,
+           const char  *name,
+           const char  *algo,
+           long         param,
+           bench_fn     fn,
+           void        *arg)
+{
+    if (st->filter != NULL && strstr (name, st->filter) == NULL) {
+        return;
+    }
+    if (st->n_results == BENCH_MAX_RESULTS) {
+        fprintf (stderr, "cotp_bench: too many results, skipping %s\n", name);
+        return;
+    }
+
+    fn (arg);
+    size_t iterations = 1;
+    double elapsed = time_iterations (fn, arg, iterations);
+    while (elapsed < st->min_time_ns && iterations < ((size_t)1 << 40)) {
+        iterations *= 2;
+        elapsed = time_iterations (fn, arg, iterations);
+    }
+    double best = elapsed;
+    for (int r = 1; r < st->repeat; r++) {
+        elapsed = time_iterations (fn, arg, iterations);
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    bench_result *res = &st->results[st->n_results++];
+    snprintf (res->name, sizeof (res->name), "%s", name);
+    res->algo = algo;
+    res->param = param;
+    res->iterations = iterations;
+    res->ns_per_op = best / (double)iterations;
+    res->ops_per_sec = 1e9 / res->ns_per_op;
+
+    if (!st->json) {
+        printf ("%-28s %-7s %8ld %14.1f %14.0f\n", res->name, algo ? algo : "-", param,
+                res->ns_per_op, res->ops_per_sec);
+        fflush (stdout);
+    }
+}
+
+
+static void
+consume (char *s)
+{
+    if (s != NULL) {
+        sink += (size_t)s[0];
+        free (s);
+    }
+}
+
+
+static void
+bench_get_hotp (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    consume (get_hotp (a->secret, 42, 6, a->algo, &err));
+}
+
+
+static void
+bench_get_totp_at (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    consume (get_totp_at (a->secret, base_ts, 6, 30, a->algo, &err));
+}
+
+
+static void
+bench_get_steam_totp_at (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    consume (get_steam_totp_at (a->secret, base_ts, 30, &err));
+}
+
+
+static void
+bench_key_totp_at (void *p)
+{
+    bench_arg *a = p;
+    char out[MAX_DIGITS + 1];
+    sink += (size_t)cotp_key_totp_at (a->key, base_ts, 6, 30, out, sizeof (out));
+}
+
+
+static void
+bench_key_steam_totp_at (void *p)
+{
+    bench_arg *a = p;
+    char out[COTP_STEAM_DIGITS + 1];
+    sink += (size_t)cotp_key_steam_totp_at (a->key, base_ts, 30, out, sizeof (out));
+}
+
+
+static void
+bench_key_totp (void *p)
+{
+    bench_arg *a = p;
+    char out[MAX_DIGITS + 1];
+    sink += (size_t)cotp_key_totp (a->key, 6, 30, out, sizeof (out));
+}
+
+
+static void
+bench_time_step (void *p)
+{
+    (void)p;
+    cotp_error_t err;
+    sink += (size_t)cotp_time_step (30, &err);
+}
+
+
+static void
+bench_key_create (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (a->secret, a->algo, &err);
+    sink += (size_t)err;
+    cotp_key_free (key);
+}
+
+
+static void
+bench_batch (void *p)
+{
+    bench_arg *a = p;
+    sink += (size_t)cotp_otp_batch (a->jobs, a->len, a->pool);
+}
+
+
+static void
+bench_queue (void *p)
+{
+    // Round trip of the whole set: submit, then collect every completion
+    bench_arg *a = p;
+    cotp_async_completion done[256];
+    cotp_error_t err;
+    size_t sent = 0, got = 0;
+    while (got < a->len) {
+        if (sent < a->len) {
+            sent += cotp_queue_submit (a->queue, a->reqs + sent, a->len - sent, &err);
+        }
+        got += cotp_queue_wait (a->queue, done, 256, -1);
+    }
+    sink += got;
+}
+
+
+static void
+bench_base32_encode (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    consume (base32_encode (a->data, a->len, &err));
+}
+
+
+static void
+bench_base32_decode (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    uint8_t *out = base32_decode (a->text, strlen (a->text) + 1, &err);
+    consume ((char *)out);
+}
+
+
+static void
+bench_uri_parse (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    cotp_otpauth_uri *u = cotp_otpauth_uri_parse (a->text, &err);
+    sink += (size_t)err;
+    cotp_otpauth_uri_free (u);
+}
+
+
+static void
+bench_uri_build (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    consume (cotp_otpauth_uri_build (a->uri, &err));
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+static void
+bench_validate_totp (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    int delta;
+    sink += (size_t)validate_totp_in_window (a->code, a->secret, base_ts, 6, 30, a->algo, a->window, &delta, &err);
+}
+
+
+static void
+bench_validate_totp_ct (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    int delta;
+    sink += (size_t)validate_totp_in_window_ct (a->code, a->secret, base_ts, 6, 30, a->algo, a->window, &delta, &err);
+}
+
+
+static void
+bench_validate_totp_pool (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    int delta;
+    sink += (size_t)validate_totp_in_window_pool (a->code, a->secret, base_ts, 6, 30, a->algo, a->window, a->pool,
+                                                  &delta, &err);
+}
+
+
+// Cycles through a->len codes; a->order of a->window entries, or the nearest-first order when NULL
+static void
+bench_validate_totp_order (void *p)
+{
+    bench_arg *a = p;
+    static size_t next;
+    const char *code = a->codes[next++ % a->len];
+    cotp_error_t err;
+    int delta;
+    if (a->order != NULL) {
+        sink += (size_t)validate_totp_in_order (code, a->secret, base_ts, 6, 30, a->algo, a->order, (size_t)a->window,
+                                                &delta, &err);
+    } else {
+        sink += (size_t)validate_totp_in_window_nearest (code, a->secret, base_ts, 6, 30, a->algo, a->window, &delta, &err);
+    }
+}
+
+
+static void
+bench_validate_totp_drift (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    int delta;
+    sink += (size_t)validate_totp_with_drift (a->cache, 7, a->code, a->secret, base_ts, 6, 30, a->algo, 1, a->window,
+                                              &delta, &err);
+}
+
+
+// One call per login, as a gateway without batching would do
+static void
+bench_validate_logins (void *p)
+{
+    bench_arg *a = p;
+    for (size_t i = 0; i < a->len; i++) {
+        const cotp_validate_job *j = &a->checks[i];
+        cotp_error_t err;
+        int delta;
+        sink += (size_t)validate_totp_in_window (j->user_code, j->base32_encoded_secret, j->timestamp, j->digits,
+                                                 j->period, j->sha_algo, j->window, &delta, &err);
+    }
+}
+
+
+static void
+bench_validate_batch (void *p)
+{
+    bench_arg *a = p;
+    sink += (size_t)cotp_validate_batch (a->checks, a->len, a->pool);
+}
+
+
+static void
+bench_cache_validate (void *p)
+{
+    bench_arg *a = p;
+    cotp_error_t err;
+    int delta;
+    sink += (size_t)cotp_totp_cache_validate (a->cache, 7, a->code, base_ts, 1, &delta, &err);
+}
+
+
+static void
+bench_replay_mark (void *p)
+{
+    // Every call marks a new step of one of 1024 accounts and moves the clock forward, so expired
+    // entries are reclaimed as they would be on a live verifier instead of filling the cache.
+    bench_arg *a = p;
+    static long step;
+    cotp_error_t err;
+    step++;
+    sink += (size_t)cotp_replay_cache_check_and_mark (a->cache, (uint64_t)(step % 1024), step, 30, 0, step * 30, &err);
+}
+#endif
+
+
+static void
+run_otp_benches (bench_state *st)
+{
+    for (int algo = COTP_SHA1; algo <= COTP_SHA512; algo++) {
+        bench_arg a = { .secret = secret, .algo = algo };
+        run_bench (st, "get_hotp", algo_names[algo], 6, bench_get_hotp, &a);
+        run_bench (st, "get_totp_at", algo_names[algo], 6, bench_get_totp_at, &a);
+        run_bench (st, "cotp_key_create", algo_names[algo], 0, bench_key_create, &a);
+
+        cotp_error_t err;
+        a.key = cotp_key_create (secret, algo, &err);
+        if (a.key == NULL) {
+            fprintf (stderr, "cotp_bench: cotp_key_create: %s\n", cotp_strerror (err));
+            continue;
+        }
+        run_bench (st, "cotp_key_totp_at", algo_names[algo], 6, bench_key_totp_at, &a);
+        run_bench (st, "cotp_key_totp", algo_names[algo], 6, bench_key_totp, &a);
+        cotp_key_free (a.key);
+    }
+
+    bench_arg a = { .secret = secret, .algo = COTP_SHA1 };
+    run_bench (st, "get_steam_totp_at", algo_names[COTP_SHA1], 5, bench_get_steam_totp_at, &a);
+    cotp_error_t err;
+    a.key = cotp_key_create (secret, COTP_SHA1, &err);
+    if (a.key != NULL) {
+        run_bench (st, "cotp_key_steam_totp_at", algo_names[COTP_SHA1], 5, bench_key_steam_totp_at, &a);
+        cotp_key_free (a.key);
+    }
+    run_bench (st, "cotp_time_step", NULL, 30, bench_time_step, &a);
+}
+
+
+static void
+run_batch_benches (bench_state *st)
+{
+    cotp_error_t err;
+    cotp_otp_job *jobs = calloc (BENCH_BATCH_JOBS, sizeof (cotp_otp_job));
+    cotp_key *key = cotp_key_create (secret, COTP_SHA1, &err);
+    if (jobs == NULL || key == NULL) {
+        fprintf (stderr, "cotp_bench: batch setup failed\n");
+        free (jobs);
+        cotp_key_free (key);
+        return;
+    }
+    for (size_t i = 0; i < BENCH_BATCH_JOBS; i++) {
+        jobs[i].type = COTP_JOB_TOTP;
+        jobs[i].key = key;
+        jobs[i].counter = base_ts + (long)i * 30;
+        jobs[i].digits = 6;
+        jobs[i].period = 30;
+        jobs[i].sha_algo = COTP_SHA1;
+    }
+
+    bench_arg a = { .jobs = jobs, .len = BENCH_BATCH_JOBS };
+    run_bench (st, "batch_totp_keyed_x4096", algo_names[COTP_SHA1], 1, bench_batch, &a);
+    a.pool = cotp_pool_create (st->threads, NULL, &err);
+    if (a.pool != NULL) {
+        run_bench (st, "batch_totp_keyed_x4096", algo_names[COTP_SHA1], st->threads, bench_batch, &a);
+        cotp_pool_free (a.pool);
+    }
+
+    a.reqs = calloc (BENCH_BATCH_JOBS, sizeof (cotp_async_request));
+    a.queue = cotp_queue_create (st->threads, BENCH_BATCH_JOBS, &err);
+    if (a.reqs != NULL && a.queue != NULL) {
+        for (size_t i = 0; i < BENCH_BATCH_JOBS; i++) {
+            a.reqs[i].op = COTP_ASYNC_GENERATE;
+            a.reqs[i].user_data = i;
+            a.reqs[i].job = jobs[i];
+        }
+        run_bench (st, "queue_totp_keyed_x4096", algo_names[COTP_SHA1], st->threads, bench_queue, &a);
+    }
+    cotp_queue_free (a.queue);
+    free (a.reqs);
+
+    cotp_key_free (key);
+    free (jobs);
+}
+
+
+static void
+run_base32_benches (bench_state *st)
+{
+    static const size_t sizes[] = { 10, 20, 64, 1024, 65536 };
+    for (size_t i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+        size_t len = sizes[i];
+        uint8_t *data = malloc (len);
+        if (data == NULL) {
+            return;
+        }
+        for (size_t j = 0; j < len; j++) {
+            data[j] = (uint8_t)(j * 131 + 7);
+        }
+        cotp_error_t err;
+        char *text = base32_encode (data, len, &err);
+        if (text == NULL) {
+            free (data);
+            return;
+        }
+
+        bench_arg a = { .data = data, .len = len, .text = text };
+        run_bench (st, "base32_encode", NULL, (long)len, bench_base32_encode, &a);
+        run_bench (st, "base32_decode", NULL, (long)len, bench_base32_decode, &a);
+
+        free (text);
+        free (data);
+    }
+}
+
+
+static void
+run_uri_benches (bench_state *st)
+{
+    cotp_error_t err;
+    const char *uri = "otpauth://totp/ACME%20Co:john.doe@example.com?secret=HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ"
+                      "&issuer=ACME%20Co&algorithm=SHA256&digits=8&period=30";
+    cotp_otpauth_uri *parsed = cotp_otpauth_uri_parse (uri, &err);
+    if (parsed == NULL) {
+        fprintf (stderr, "cotp_bench: cotp_otpauth_uri_parse: %s\n", cotp_strerror (err));
+        return;
+    }
+    bench_arg a = { .text = uri, .uri = parsed };
+    run_bench (st, "otpauth_uri_parse", NULL, 0, bench_uri_parse, &a);
+    run_bench (st, "otpauth_uri_build", NULL, 0, bench_uri_build, &a);
+    cotp_otpauth_uri_free (parsed);
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+static void
+run_validation_benches (bench_state *st)
+{
+    static const int windows[] = { 0, 1, 2, 5, 10, 50 };
+    cotp_error_t err;
+
+    for (int algo = COTP_SHA1; algo <= COTP_SHA512; algo++) {
+        for (size_t i = 0; i < sizeof (windows) / sizeof (windows[0]); i++) {
+            // A code that never matches makes every call scan the whole 2w+1 window (the worst case)
+            bench_arg a = { .secret = secret, .algo = algo, .window = windows[i], .code = "000000" };
+            run_bench (st, "validate_totp_window_miss", algo_names[algo], windows[i], bench_validate_totp, &a);
+            run_bench (st, "validate_totp_ct_miss", algo_names[algo], windows[i], bench_validate_totp_ct, &a);
+        }
+    }
+
+    // Recovery-sized window, on the calling thread and split over --threads workers (param = threads)
+    cotp_pool *pool = cotp_pool_create (st->threads, NULL, &err);
+    if (pool != NULL) {
+        bench_arg a = { .secret = secret, .algo = COTP_SHA1, .window = 1024, .code = "000000" };
+        run_bench (st, "validate_totp_w1024_miss", algo_names[COTP_SHA1], 1, bench_validate_totp_pool, &a);
+        a.pool = pool;
+        run_bench (st, "validate_totp_w1024_miss", algo_names[COTP_SHA1], st->threads, bench_validate_totp_pool, &a);
+        cotp_pool_free (pool);
+    }
+
+    // Matched offsets as seen on a login page: most codes are current, late typing makes -1 and -2
+    // far more common than a clock running ahead. Expected HMACs per login with a ±10 window:
+    // 10.76 ascending, 1.47 nearest-first, 1.46 with the offsets ordered by frequency.
+    static const struct { int delta; int percent; } seen[] = { {0, 70}, {-1, 20}, {-2, 5}, {1, 4}, {2, 1} };
+    static const int by_frequency[] = { 0, -1, -2, 1, 2, -3, 3, -4, 4, -5, 5, -6, 6, -7, 7, -8, 8, -9, 9, -10, 10 };
+    char *codes[100] = { NULL };
+    size_t n_codes = 0;
+    for (size_t i = 0; i < sizeof seen / sizeof seen[0]; i++) {
+        for (int k = 0; k < seen[i].percent; k++) {
+            codes[n_codes++] = get_totp_at (secret, base_ts + 30L * seen[i].delta, 6, 30, COTP_SHA1, &err);
+        }
+    }
+    int ascending[21];
+    for (int i = 0; i < 21; i++) {
+        ascending[i] = i - 10;
+    }
+    int codes_ok = 1;
+    for (size_t i = 0; i < n_codes; i++) {
+        codes_ok &= codes[i] != NULL;
+    }
+    if (codes_ok) {
+        // Shuffle deterministically so consecutive calls do not repeat an offset
+        for (size_t i = n_codes - 1; i > 0; i--) {
+            size_t j = (i * 2654435761u) % (i + 1);
+            char *tmp = codes[i];
+            codes[i] = codes[j];
+            codes[j] = tmp;
+        }
+        bench_arg a = { .secret = secret, .algo = COTP_SHA1, .window = 21, .codes = codes, .len = n_codes,
+                        .order = ascending };
+        run_bench (st, "validate_totp_order_ascending", algo_names[COTP_SHA1], 10, bench_validate_totp_order, &a);
+        a.order = by_frequency;
+        run_bench (st, "validate_totp_order_frequency", algo_names[COTP_SHA1], 10, bench_validate_totp_order, &a);
+        a.order = NULL;
+        a.window = 10;
+        run_bench (st, "validate_totp_order_nearest", algo_names[COTP_SHA1], 10, bench_validate_totp_order, &a);
+    }
+    for (size_t i = 0; i < n_codes; i++) {
+        free (codes[i]);
+    }
+
+    // A device five periods ahead inside a ±10 window: the plain scan computes 16 HMACs per login,
+    // the drift-centered one 2 once the offset has been learned
+    cotp_drift_tracker *dt = cotp_drift_tracker_create (16, &err);
+    char *ahead = get_totp_at (secret, base_ts + 150, 6, 30, COTP_SHA1, &err);
+    if (dt != NULL && ahead != NULL && cotp_drift_tracker_record (dt, 7, 5) == NO_ERROR) {
+        bench_arg a = { .secret = secret, .algo = COTP_SHA1, .window = 10, .code = ahead, .cache = dt };
+        run_bench (st, "validate_totp_drift_plain", algo_names[COTP_SHA1], 10, bench_validate_totp, &a);
+        run_bench (st, "validate_totp_drift_tracked", algo_names[COTP_SHA1], 10, bench_validate_totp_drift, &a);
+    }
+    free (ahead);
+    cotp_drift_tracker_free (dt);
+
+    // A gateway micro-batch: one login per account, a few of them retried, codes one step late
+    cotp_validate_job *checks = calloc (BENCH_LOGINS, sizeof (cotp_validate_job));
+    char **login_secrets = calloc (BENCH_LOGINS, sizeof (char *));
+    char **login_codes = calloc (BENCH_LOGINS, sizeof (char *));
+    int logins_ok = checks != NULL && login_secrets != NULL && login_codes != NULL;
+    for (size_t i = 0; logins_ok && i < BENCH_LOGINS; i++) {
+        uint8_t raw[20];
+        for (size_t b = 0; b < sizeof raw; b++) {
+            raw[b] = (uint8_t)(i * 31 + b * 7);
+        }
+        size_t account = i % 16 == 15 ? i - 1 : i;
+        login_secrets[i] = i == account ? base32_encode (raw, sizeof raw, &err) : NULL;
+        const char *s = login_secrets[account];
+        login_codes[i] = s != NULL ? get_totp_at (s, base_ts - 30, 6, 30, COTP_SHA1, &err) : NULL;
+        logins_ok = s != NULL && login_codes[i] != NULL;
+        checks[i] = (cotp_validate_job){ .base32_encoded_secret = s, .user_code = login_codes[i],
+                                         .timestamp = base_ts, .digits = 6, .period = 30,
+                                         .sha_algo = COTP_SHA1, .window = 1 };
+    }
+    if (logins_ok) {
+        bench_arg a = { .checks = checks, .len = BENCH_LOGINS };
+        run_bench (st, "validate_totp_x1024_calls", algo_names[COTP_SHA1], 1, bench_validate_logins, &a);
+        run_bench (st, "validate_batch_x1024", algo_names[COTP_SHA1], 1, bench_validate_batch, &a);
+        a.pool = cotp_pool_create (st->threads, NULL, &err);
+        if (a.pool != NULL) {
+            run_bench (st, "validate_batch_x1024", algo_names[COTP_SHA1], st->threads, bench_validate_batch, &a);
+            cotp_pool_free (a.pool);
+        }
+    }
+    for (size_t i = 0; login_secrets != NULL && login_codes != NULL && i < BENCH_LOGINS; i++) {
+        free (login_secrets[i]);
+        free (login_codes[i]);
+    }
+    free (login_codes);
+    free (login_secrets);
+    free (checks);
+
+    cotp_totp_cache *cache = cotp_totp_cache_create (16, 6, 30, COTP_SHA1, &err);
+    if (cache != NULL && cotp_totp_cache_add_key (cache, 7, secret) == NO_ERROR &&
+        cotp_totp_cache_refresh (cache, base_ts) == NO_ERROR) {
+        char *code = get_totp_at (secret, base_ts, 6, 30, COTP_SHA1, &err);
+        if (code != NULL) {
+            bench_arg a = { .cache = cache, .code = code };
+            run_bench (st, "totp_cache_validate_hit", algo_names[COTP_SHA1], 1, bench_cache_validate, &a);
+            free (code);
+        }
+    }
+    cotp_totp_cache_free (cache);
+
+    cotp_replay_cache *rc = cotp_replay_cache_create (4096, &err);
+    if (rc != NULL) {
+        bench_arg a = { .cache = rc };
+        run_bench (st, "replay_check_and_mark", NULL, 0, bench_replay_mark, &a);
+        cotp_replay_cache_free (rc);
+    }
+}
+#endif
+
+
+static void
+print_json (const bench_state *st)
+{
+    printf ("{\n  \"library\": \"cotp\",\n  \"version\": \"%s\",\n  \"backend\": \"%s\",\n",
+            COTP_VERSION_STRING, COTP_BENCH_BACKEND);
+    printf ("  \"min_time_ms\": %.0f,\n  \"repeat\": %d,\n  \"threads\": %d,\n  \"results\": [\n",
+            st->min_time_ns / 1e6, st->repeat, st->threads);
+    for (size_t i = 0; i < st->n_results; i++) {
+        const bench_result *r = &st->results[i];
+        printf ("    {\"name\": \"%s\", \"algo\": %s%s%s, \"param\": %ld, \"iterations\": %zu, "
+                "\"ns_per_op\": %.2f, \"ops_per_sec\": %.0f}%s\n",
+                r->name, r->algo ? "\"" : "", r->algo ? r->algo : "null", r->algo ? "\"" : "",
+                r->param, r->iterations, r->ns_per_op, r->ops_per_sec,
+                i + 1 < st->n_results ? "," : "");
+    }
+    printf ("  ]\n}\n");
+}
+
+
+#ifdef COTP_ENABLE_PROFILING
+static void
+print_stages (void)
+{
+    cotp_stage_stats st;
+    cotp_stage_stats_snapshot (&st);
+    double ns_per_tick = 1e9 / (double)cotp_stage_tick_rate ();
+
+    printf ("\n%-28s %14s %14s\n", "stage", "calls", "ns/call");
+    for (int i = 0; i < COTP_STAGE_COUNT; i++) {
+        double ns = st.calls[i] ? (double)st.ticks[i] * ns_per_tick / (double)st.calls[i] : 0.0;
+        printf ("%-28s %14llu %14.1f\n", cotp_stage_name (i), (unsigned long long)st.calls[i], ns);
+    }
+}
+#endif
+
+
+static void
+usage (const char *prog)
+{
+    fprintf (stderr,
+             "Usage: %s [--json] [--filter SUBSTRING] [--min-time MS] [--repeat N] [--threads N]\n"
+             "  --json       print results as a JSON document instead of a table\n"
+             "  --filter     only run benchmarks whose name contains SUBSTRING\n"
+             "  --min-time   minimum duration of one timed run, in milliseconds (default 200)\n"
+             "  --repeat     timed runs per benchmark; the fastest is reported (default 3)\n"
+             "  --threads    worker threads for the pooled batch benchmark (default 4)\n",
+             prog);
+}
+
+
+int
+main (int argc, char **argv)
+{
+    static bench_state st;
+    st.min_time_ns = 200e6;
+    st.repeat = 3;
+    st.threads = 4;
+
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp (opt, "--json") == 0) {
+            st.json = 1;
+        } else if (strcmp (opt, "--filter") == 0 && val != NULL) {
+            st.filter = val;
+            i++;
+        } else if (strcmp (opt, "--min-time") == 0 && val != NULL && atoi (val) > 0) {
+            st.min_time_ns = atoi (val) * 1e6;
+            i++;
+        } else if (strcmp (opt, "--repeat") == 0 && val != NULL && atoi (val) > 0) {
+            st.repeat = atoi (val);
+            i++;
+        } else if (strcmp (opt, "--threads") == 0 && val != NULL && atoi (val) > 0 &&
+                   atoi (val) <= COTP_POOL_MAX_THREADS) {
+            st.threads = atoi (val);
+            i++;
+        } else {
+            usage (argv[0]);
+            return 1;
+        }
+    }
+
+    if (!st.json) {
+        printf ("libcotp %s, HMAC backend: %s\n\n", COTP_VERSION_STRING, COTP_BENCH_BACKEND);
+        printf ("%-28s %-7s %8s %14s %14s\n", "benchmark", "algo", "param", "ns/op", "ops/s");
+    }
+
+    run_otp_benches (&st);
+    run_batch_benches (&st);
+    run_base32_benches (&st);
+    run_uri_benches (&st);
+#ifdef COTP_ENABLE_VALIDATION
+    run_validation_benches (&st);
+#endif
+
+    if (st.json) {
+        print_json (&st);
+    }
+#ifdef COTP_ENABLE_PROFILING
+    else {
+        print_stages ();
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cotp.h"
+
+// Training workload for profile-guided builds (COTP_PGO=GENERATE). It exercises every public path
+// with a mix that resembles a server: mostly one-shot TOTP generation and validation with a few
+// misses, pre-keyed keys and batches, and a smaller share of Base32, otpauth URI and error paths.
+// Whatever is not run here is treated as cold by the optimizer, so a new hot path belongs in here.
+
+#define TRAIN_BATCH_JOBS 1024
+
+static const char *secrets[] = {
+    "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ",
+    "HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ",
+    "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQGEZA====",
+    "gezd gnbv gy3t qojq gezd gnbv gy3t qojq",
+};
+#define N_SECRETS (sizeof (secrets) / sizeof (secrets[0]))
+
+static const int digit_lengths[] = { 6, 8, 6, 7 };
+
+static size_t failures;
+
+
+static void
+check (int ok, const char *what)
+{
+    if (!ok && failures++ < 10) {
+        fprintf (stderr, "cotp_train: unexpected result in %s\n", what);
+    }
+}
+
+
+static void
+train_one_shot (int rounds)
+{
+    cotp_error_t err;
+    for (int r = 0; r < rounds; r++) {
+        const char *s = secrets[r % N_SECRETS];
+        int algo = r % 3;
+        int digits = digit_lengths[r % 4];
+        long ts = 1700000000L + 30L * r;
+
+        char *totp = get_totp_at (s, ts, digits, 30, algo, &err);
+        check (totp != NULL, "get_totp_at");
+        free (totp);
+        char *hotp = get_hotp (s, r, digits, algo, &err);
+        check (hotp != NULL, "get_hotp");
+        free (hotp);
+        if (r % 16 == 0) {
+            char *now = get_totp (s, 6, 30, COTP_SHA1, &err);
+            check (now != NULL, "get_totp");
+            int64_t v = otp_to_int (now, &err);
+            check (v >= 0, "otp_to_int");
+            free (now);
+            char *steam = get_steam_totp_at (s, ts, 30, &err);
+            check (steam != NULL, "get_steam_totp_at");
+            free (steam);
+        }
+    }
+
+    cotp_ctx *ctx = cotp_ctx_create (6, 30, COTP_SHA256);
+    for (int r = 0; r < rounds / 4; r++) {
+        char *code = cotp_ctx_totp_at (ctx, secrets[r % N_SECRETS], 1700000000L + r, &err);
+        check (code != NULL, "cotp_ctx_totp_at");
+        free (code);
+    }
+    cotp_ctx_free (ctx);
+}
+
+
+static void
+train_keys_and_batches (int rounds)
+{
+    cotp_error_t err;
+    char code[MAX_DIGITS + 1];
+
+    for (int algo = COTP_SHA1; algo <= COTP_SHA512; algo++) {
+        cotp_key *key = cotp_key_create (secrets[algo], algo, &err);
+        check (key != NULL, "cotp_key_create");
+        for (int r = 0; key != NULL && r < rounds; r++) {
+            check (cotp_key_totp_at (key, 1700000000L + 30L * r, digit_lengths[r % 4], 30,
+                                     code, sizeof code) == NO_ERROR,
+                   "cotp_key_totp_at");
+            check (cotp_key_hotp (key, r, 6, code, sizeof code) == NO_ERROR, "cotp_key_hotp");
+            if (algo == COTP_SHA1 && r % 4 == 0) {
+                check (cotp_key_steam_totp_at (key, 1700000000L + 30L * r, 30, code, sizeof code) == NO_ERROR,
+                       "cotp_key_steam_totp_at");
+            }
+        }
+        cotp_key_free (key);
+    }
+
+    static cotp_otp_job jobs[TRAIN_BATCH_JOBS];
+    cotp_pool *pool = cotp_pool_create (2, NULL, &err);
+    for (int r = 0; r < rounds / 256 + 1; r++) {
+        for (int i = 0; i < TRAIN_BATCH_JOBS; i++) {
+            cotp_otp_job *j = &jobs[i];
+            memset (j, 0, sizeof *j);
+            j->type = i % 4 == 3 ? COTP_JOB_HOTP : i % 8 == 2 ? COTP_JOB_STEAM : COTP_JOB_TOTP;
+            j->base32_encoded_secret = secrets[i % N_SECRETS];
+            j->counter = i % 4 == 3 ? i : 1700000000L + 30L * i;
+            j->digits = digit_lengths[i % 4];
+            j->period = 30;
+            j->sha_algo = i % 3;
+        }
+        // Alternate the inline single-chunk path and the pooled path
+        size_t n = r % 2 ? TRAIN_BATCH_JOBS : 128;
+        check (cotp_otp_batch (jobs, n, r % 2 ? pool : NULL) == NO_ERROR, "cotp_otp_batch");
+    }
+    cotp_pool_free (pool);
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+static void
+train_validation (int rounds)
+{
+    cotp_error_t err;
+    for (int r = 0; r < rounds; r++) {
+        const char *s = secrets[r % N_SECRETS];
+        int algo = r % 3;
+        long ts = 1700000000L + 30L * r;
+        int delta = 0;
+        // Most users type the current code, some are a step off, a few are wrong
+        char *code = get_totp_at (s, ts + (r % 8 == 0 ? 30 : 0), 6, 30, algo, &err);
+        const char *typed = r % 32 == 0 ? "000000" : code;
+        static const int order[] = { 0, -1, 1 };
+        int ok;
+        switch (r % 4) {
+            case 0:  ok = validate_totp_in_window_ct (typed, s, ts, 6, 30, algo, 1, &delta, &err); break;
+            case 1:  ok = validate_totp_in_window_nearest (typed, s, ts, 6, 30, algo, 1, &delta, &err); break;
+            case 2:  ok = validate_totp_in_order (typed, s, ts, 6, 30, algo, order, 3, &delta, &err); break;
+            default: ok = validate_totp_in_window (typed, s, ts, 6, 30, algo, 1, &delta, &err); break;
+        }
+        check (code != NULL && (ok == 1 || r % 32 == 0), "validate_totp_in_window");
+        free (code);
+
+        if (r % 8 == 0) {
+            long matched;
+            char *hotp = get_hotp (s, r + 2, 6, algo, &err);
+            check (validate_hotp_in_window (hotp, s, r, 6, algo, 5, &matched, &err) == 1,
+                   "validate_hotp_in_window");
+            free (hotp);
+        }
+    }
+
+    // Micro-batches of logins, a fifth of them one step late
+    static cotp_validate_job checks[TRAIN_BATCH_JOBS];
+    static char check_codes[TRAIN_BATCH_JOBS][MAX_DIGITS + 1];
+    cotp_pool *pool = cotp_pool_create (2, NULL, &err);
+    for (int r = 0; r < rounds / 256 + 1; r++) {
+        for (int i = 0; i < TRAIN_BATCH_JOBS; i++) {
+            cotp_validate_job *j = &checks[i];
+            memset (j, 0, sizeof *j);
+            j->base32_encoded_secret = secrets[i % N_SECRETS];
+            j->timestamp = 1700000000L + 30L * r;
+            j->digits = 6;
+            j->period = 30;
+            j->sha_algo = i % 3;
+            j->window = 1;
+            char *code = get_totp_at (j->base32_encoded_secret, j->timestamp - (i % 5 == 0 ? 30 : 0), 6, 30,
+                                      j->sha_algo, &err);
+            check (code != NULL, "get_totp_at");
+            snprintf (check_codes[i], sizeof check_codes[i], "%s", code != NULL ? code : "");
+            free (code);
+            j->user_code = check_codes[i];
+        }
+        check (cotp_validate_batch (checks, TRAIN_BATCH_JOBS, r % 2 ? pool : NULL) == NO_ERROR,
+               "cotp_validate_batch");
+        check (checks[0].err == VALID, "cotp_validate_batch");
+    }
+
+    for (int r = 0; r < rounds / 1000 + 1; r++) {
+        int delta;
+        char *code = get_totp_at (secrets[0], 1700000000L - 30L * r, 6, 30, COTP_SHA1, &err);
+        check (validate_totp_in_window_pool (code, secrets[0], 1700000000L, 6, 30, COTP_SHA1, 100, pool, &delta, &err) == 1,
+               "validate_totp_in_window_pool");
+        free (code);
+    }
+    cotp_pool_free (pool);
+
+    // Accounts with a steady drift of -2..+2 periods validated through the drift tracker
+    cotp_drift_tracker *dt = cotp_drift_tracker_create (64, &err);
+    check (dt != NULL, "cotp_drift_tracker_create");
+    for (int r = 0; dt != NULL && r < rounds / 4; r++) {
+        uint64_t id = (uint64_t)(r % 64);
+        long ts = 1700000000L + 30L * r;
+        int delta;
+        char *code = get_totp_at (secrets[id % N_SECRETS], ts + 30L * ((long)(id % 5) - 2), 6, 30, COTP_SHA1, &err);
+        check (validate_totp_with_drift (dt, id, code, secrets[id % N_SECRETS], ts, 6, 30, COTP_SHA1, 1, 10,
+                                         &delta, &err) == 1,
+               "validate_totp_with_drift");
+        free (code);
+    }
+    cotp_drift_tracker_free (dt);
+
+    cotp_totp_cache *cache = cotp_totp_cache_create (64, 6, 30, COTP_SHA1, &err);
+    cotp_replay_cache *rc = cotp_replay_cache_create (1024, &err);
+    check (cache != NULL && rc != NULL, "cache create");
+    for (uint64_t id = 0; cache != NULL && id < 64; id++) {
+        check (cotp_totp_cache_add_key (cache, id, secrets[id % N_SECRETS]) == NO_ERROR, "cotp_totp_cache_add_key");
+    }
+    for (int r = 0; cache != NULL && rc != NULL && r < rounds; r++) {
+        long ts = 1700000000L + 30L * (r / 64);
+        if (r % 64 == 0) {
+            check (cotp_totp_cache_refresh (cache, ts) == NO_ERROR, "cotp_totp_cache_refresh");
+        }
+        char *code = get_totp_at (secrets[r % N_SECRETS], ts, 6, 30, COTP_SHA1, &err);
+        int delta;
+        if (cotp_totp_cache_validate (cache, (uint64_t)(r % 64), code, ts, 1, &delta, &err) == 1) {
+            int fresh = cotp_replay_cache_check_and_mark (rc, (uint64_t)(r % 64), ts / 30 + delta, 30, 1, ts, &err);
+            check (fresh >= 0, "cotp_replay_cache_check_and_mark");
+        }
+        free (code);
+    }
+    cotp_replay_cache_free (rc);
+    cotp_totp_cache_free (cache);
+}
+#endif
+
+
+static void
+train_base32_and_uri (int rounds)
+{
+    cotp_error_t err;
+    uint8_t data[256];
+    for (size_t i = 0; i < sizeof data; i++) {
+        data[i] = (uint8_t)(i * 131 + 7);
+    }
+
+    for (int r = 0; r < rounds; r++) {
+        size_t len = (size_t)(r % 64) + 1;
+        char *text = base32_encode (data, len, &err);
+        check (text != NULL, "base32_encode");
+        uint8_t *back = base32_decode (text, strlen (text), &err);
+        check (back != NULL && memcmp (back, data, len) == 0, "base32_decode");
+        free (back);
+        check (is_string_valid_b32 (text), "is_string_valid_b32");
+        free (text);
+    }
+
+    const char *uris[] = {
+        "otpauth://totp/ACME%20Co:john.doe@example.com?secret=HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ"
+        "&issuer=ACME%20Co&algorithm=SHA256&digits=8&period=30",
+        "otpauth://hotp/Example:alice?secret=GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ&counter=42",
+        "otpauth://totp/bob?secret=GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ",
+    };
+    for (int r = 0; r < rounds / 4; r++) {
+        cotp_otpauth_uri *u = cotp_otpauth_uri_parse (uris[r % 3], &err);
+        check (u != NULL, "cotp_otpauth_uri_parse");
+        if (u != NULL) {
+            char *built = cotp_otpauth_uri_build (u, &err);
+            check (built != NULL, "cotp_otpauth_uri_build");
+            free (built);
+            cotp_otpauth_uri_free (u);
+        }
+    }
+}
+
+
+// Rejected input is rare in production; a few calls keep the error paths from being laid out as hot
+static void
+train_errors (void)
+{
+    cotp_error_t err;
+    const char *bad[] = { "not base32!", "", "GEZDGNBV1" };
+    for (int r = 0; r < 64; r++) {
+        free (get_totp_at (bad[r % 3], 0, 6, 30, COTP_SHA1, &err));
+        free (get_totp_at (secrets[0], 0, 11, 30, COTP_SHA1, &err));
+        free (get_hotp (secrets[0], -1, 6, 9, &err));
+        free (base32_decode (bad[r % 3], strlen (bad[r % 3]), &err));
+        cotp_otpauth_uri_free (cotp_otpauth_uri_parse ("otpauth://totp/x?digits=6", &err));
+        check (cotp_strerror (err) != NULL, "cotp_strerror");
+    }
+}
+
+
+int
+main (int argc, char **argv)
+{
+    int scale = 1;
+    if (argc == 3 && strcmp (argv[1], "--scale") == 0 && atoi (argv[2]) > 0) {
+        scale = atoi (argv[2]);
+    } else if (argc != 1) {
+        fprintf (stderr, "Usage: %s [--scale N]\n", argv[0]);
+        return 1;
+    }
+
+    int rounds = 20000 * scale;
+    train_one_shot (rounds);
+    train_keys_and_batches (rounds);
+#ifdef COTP_ENABLE_VALIDATION
+    train_validation (rounds);
+#endif
+    train_base32_and_uri (rounds);
+    train_errors ();
+
+    if (failures != 0) {
+        fprintf (stderr, "cotp_train: %zu unexpected results\n", failures);
+        return 1;
+    }
+    return 0;
+}
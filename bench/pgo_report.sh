@@ -0,0 +1,96 @@
+#!/bin/sh
+# Builds libcotp three ways (plain -O3, LTO, LTO + PGO trained by cotp_train), runs cotp_bench on
+# each and prints ns/op side by side with the speedup over the plain build.
+#
+#   bench/pgo_report.sh [WORK_DIR] [-- extra cmake arguments]
+#
+# COTP_BENCH_ARGS is passed to cotp_bench (default "--min-time 200 --repeat 3"). The three builds are
+# benchmarked in turn COTP_REPORT_ROUNDS times (default 3) and the fastest ns/op of each is kept, so
+# drift in machine load hits every variant alike.
+set -eu
+
+src_dir=$(cd "$(dirname "$0")/.." && pwd)
+work_dir=${1:-pgo-report}
+[ $# -gt 0 ] && shift
+[ "${1:-}" = "--" ] && shift
+bench_args=${COTP_BENCH_ARGS:---min-time 200 --repeat 3}
+rounds=${COTP_REPORT_ROUNDS:-3}
+jobs=$(nproc 2>/dev/null || echo 2)
+
+mkdir -p "$work_dir"
+work_dir=$(cd "$work_dir" && pwd)
+
+configure () {
+    name=$1
+    shift
+    cmake -S "$src_dir" -B "$work_dir/$name" -DCMAKE_BUILD_TYPE=Release -DBUILD_BENCHMARKS=ON \
+          -DCOTP_ENABLE_VALIDATION=ON "$@" > "$work_dir/$name.log"
+}
+
+build () {
+    name=$1
+    shift
+    cmake --build "$work_dir/$name" -j"$jobs" "$@" >> "$work_dir/$name.log"
+}
+
+echo "== baseline"
+configure baseline -DCOTP_ENABLE_LTO=OFF -DCOTP_PGO=OFF "$@"
+build baseline
+
+echo "== lto"
+configure lto -DCOTP_ENABLE_LTO=ON -DCOTP_PGO=OFF "$@"
+build lto
+
+# Instrument, train, then rebuild the same tree with the profile (GCC keys profiles by object path)
+echo "== pgo (instrumented build + training)"
+configure pgo -DCOTP_ENABLE_LTO=ON -DCOTP_PGO=GENERATE "$@"
+build pgo
+build pgo --target cotp_pgo_train
+echo "== pgo (optimized build)"
+configure pgo -DCOTP_ENABLE_LTO=ON -DCOTP_PGO=USE "$@"
+build pgo
+
+round=1
+while [ "$round" -le "$rounds" ]; do
+    for v in baseline lto pgo; do
+        echo "== benchmarking $v ($round/$rounds)"
+        # shellcheck disable=SC2086
+        "$work_dir/$v/bench/cotp_bench" --json $bench_args > "$work_dir/$v.$round.json"
+    done
+    round=$((round + 1))
+done
+
+report="$work_dir/report.txt"
+awk '
+    # One result per line: {"name": "...", "algo": "SHA1", "param": 6, ..., "ns_per_op": 123.45, ...}
+    /"ns_per_op"/ {
+        line = $0
+        name = line; sub(/.*"name": "/, "", name); sub(/".*/, "", name)
+        algo = line; sub(/.*"algo": /, "", algo); sub(/,.*/, "", algo); gsub(/"/, "", algo)
+        param = line; sub(/.*"param": /, "", param); sub(/,.*/, "", param)
+        ns = line; sub(/.*"ns_per_op": /, "", ns); sub(/,.*/, "", ns)
+        key = name " " algo " " param
+        ns += 0
+        if (FILENAME ~ /\/baseline\.[0-9]+\.json$/) {
+            if (!(key in base)) { order[++n] = key; base[key] = ns } else if (ns < base[key]) { base[key] = ns }
+        } else if (FILENAME ~ /\/lto\.[0-9]+\.json$/) {
+            if (!(key in lto) || ns < lto[key]) { lto[key] = ns }
+        } else if (!(key in pgo) || ns < pgo[key]) {
+            pgo[key] = ns
+        }
+    }
+    END {
+        printf "%-28s %-7s %8s %12s %12s %12s %8s %8s\n", "benchmark", "algo", "param",
+               "base ns/op", "lto ns/op", "pgo ns/op", "lto", "pgo"
+        for (i = 1; i <= n; i++) {
+            k = order[i]; split(k, f, " ")
+            printf "%-28s %-7s %8s %12.1f %12.1f %12.1f %7.2fx %7.2fx\n", f[1], f[2], f[3],
+                   base[k], lto[k], pgo[k], base[k] / lto[k], base[k] / pgo[k]
+            lsum += log(base[k] / lto[k]); psum += log(base[k] / pgo[k])
+        }
+        if (n > 0) {
+            printf "\ngeometric mean speedup: lto %.3fx, lto+pgo %.3fx\n", exp(lsum / n), exp(psum / n)
+        }
+    }
+' "$work_dir"/baseline.*.json "$work_dir"/lto.*.json "$work_dir"/pgo.*.json | tee "$report"
+echo "report written to $report"
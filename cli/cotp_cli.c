@@ -0,0 +1,480 @@
+// cotp: generates or verifies OTP codes for a stream of secrets, one per input line.
+//
+// Input is read in chunks of --batch lines. Each chunk becomes one cotp_otp_batch() call, spread
+// over a cotp_pool when it is large, and its results are written, in input order, to a fully
+// buffered stdout before the next chunk is read. Memory therefore stays bounded by the chunk size
+// whatever the input length.
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cotp.h"
+
+#define CLI_DEFAULT_BATCH   4096
+#define CLI_MAX_WINDOW      100
+// Chunks with fewer jobs than this run on the main thread; the pool's hand-off isn't worth it
+#define CLI_POOL_THRESHOLD  512
+#define CLI_OUT_BUFFER      (64 * 1024)
+
+typedef struct {
+    long        timestamp;
+    long        counter;        // -1: bare secrets are TOTP; otherwise HOTP at this counter
+    int         digits;
+    int         period;
+    int         algo;
+    int         verify;
+    int         window;
+    int         threads;
+    size_t      batch;
+} cli_options;
+
+// One input line. Token offsets point into the chunk's text, which is NUL-terminated per token.
+typedef struct {
+    size_t            secret_off;
+    size_t            code_off;     // verify mode; SIZE_MAX when the line has no code
+    int               blank;        // empty or comment line: echoed as an empty output line
+    cotp_error_t      err;          // parse error
+    cotp_otpauth_uri *uri;
+    cotp_key         *key;          // verify mode: keyed once for all steps of the window
+    cotp_job_type     type;
+    long              counter;
+    int               digits;
+    int               period;
+    int               algo;
+    size_t            first_job;
+    size_t            n_jobs;
+    int               delta_lo;
+} cli_entry;
+
+typedef struct {
+    char         *text;
+    size_t        len, cap;
+    cli_entry    *entries;
+    size_t        n_entries, cap_entries;
+    cotp_otp_job *jobs;
+    size_t        n_jobs, cap_jobs;
+} cli_chunk;
+
+typedef struct {
+    const cli_options *opt;
+    cotp_pool         *pool;
+    int                failed;    // some line had an error, or a code that did not verify
+} cli_state;
+
+
+static int
+grow (void   **array,
+      size_t  *cap,
+      size_t   need,
+      size_t   elem)
+{
+    if (need <= *cap) {
+        return 0;
+    }
+    size_t n = *cap ? *cap : 256;
+    while (n < need) {
+        n *= 2;
+    }
+    void *p = realloc (*array, n * elem);
+    if (p == NULL) {
+        return -1;
+    }
+    *array = p;
+    *cap = n;
+    return 0;
+}
+
+
+static int
+parse_algo (const char *s)
+{
+    if (strcasecmp (s, "sha1") == 0) return COTP_SHA1;
+    if (strcasecmp (s, "sha256") == 0) return COTP_SHA256;
+    if (strcasecmp (s, "sha512") == 0) return COTP_SHA512;
+    return -1;
+}
+
+
+// Splits a line into its secret (or URI) and, in verify mode, the code to check
+static void
+tokenize (cli_chunk  *ch,
+          cli_entry  *e,
+          size_t      start)
+{
+    char *s = ch->text + start;
+    s += strspn (s, " \t");
+    e->code_off = SIZE_MAX;
+    if (*s == '\0' || *s == '#') {
+        e->blank = 1;
+        return;
+    }
+    e->secret_off = (size_t)(s - ch->text);
+    s += strcspn (s, " \t");
+    if (*s != '\0') {
+        *s++ = '\0';
+        s += strspn (s, " \t");
+        if (*s != '\0') {
+            e->code_off = (size_t)(s - ch->text);
+            s[strcspn (s, " \t")] = '\0';
+        }
+    }
+}
+
+
+// Reads up to opt->batch lines; returns how many were read, 0 at end of input
+static size_t
+read_chunk (FILE              *in,
+            cli_chunk         *ch,
+            const cli_options *opt,
+            char             **line,
+            size_t            *line_cap)
+{
+    ch->len = 0;
+    ch->n_entries = 0;
+    ssize_t n;
+    while (ch->n_entries < opt->batch && (n = getline (line, line_cap, in)) >= 0) {
+        while (n > 0 && ((*line)[n - 1] == '\n' || (*line)[n - 1] == '\r')) {
+            n--;
+        }
+        if (grow ((void **)&ch->text, &ch->cap, ch->len + (size_t)n + 1, 1) != 0 ||
+            grow ((void **)&ch->entries, &ch->cap_entries, ch->n_entries + 1, sizeof(cli_entry)) != 0) {
+            fprintf (stderr, "cotp: out of memory\n");
+            exit (2);
+        }
+        memcpy (ch->text + ch->len, *line, (size_t)n);
+        ch->text[ch->len + (size_t)n] = '\0';
+        cli_entry *e = &ch->entries[ch->n_entries++];
+        memset (e, 0, sizeof *e);
+        tokenize (ch, e, ch->len);
+        ch->len += (size_t)n + 1;
+    }
+    return ch->n_entries;
+}
+
+
+// Resolves an entry's secret and parameters: an otpauth URI carries its own, a bare Base32 secret
+// takes the command-line defaults
+static void
+resolve_entry (cli_chunk         *ch,
+               cli_entry         *e,
+               const cli_options *opt)
+{
+    const char *token = ch->text + e->secret_off;
+    e->algo = opt->algo;
+    e->digits = opt->digits;
+    e->period = opt->period;
+    e->type = opt->counter >= 0 ? COTP_JOB_HOTP : COTP_JOB_TOTP;
+    e->counter = opt->counter >= 0 ? opt->counter : opt->timestamp;
+
+    if (strncmp (token, "otpauth://", 10) == 0) {
+        e->uri = cotp_otpauth_uri_parse (token, &e->err);
+        if (e->uri == NULL) {
+            return;
+        }
+        e->algo = e->uri->algo;
+        e->digits = e->uri->digits;
+        e->period = e->uri->period;
+        if (e->uri->type == COTP_OTPAUTH_HOTP) {
+            e->type = COTP_JOB_HOTP;
+            e->counter = opt->counter >= 0 ? opt->counter : e->uri->counter;
+        } else {
+            e->type = COTP_JOB_TOTP;
+            e->counter = opt->timestamp;
+        }
+    }
+    if (opt->verify) {
+        if (e->code_off == SIZE_MAX) {
+            e->err = INVALID_USER_INPUT;
+            return;
+        }
+        e->key = cotp_key_create (e->uri ? e->uri->secret : token, e->algo, &e->err);
+    }
+}
+
+
+// Verification covers [-window, +window] steps for TOTP and counters [c, c + window] for HOTP;
+// steps whose time would overflow are dropped, which only trims the ends of the range
+static int
+add_jobs (cli_chunk         *ch,
+          cli_entry         *e,
+          const cli_options *opt)
+{
+    e->first_job = ch->n_jobs;
+    e->n_jobs = 0;
+    if (e->blank || e->err != NO_ERROR) {
+        return 0;
+    }
+    int hotp = e->type == COTP_JOB_HOTP;
+    int lo = 0, hi = 0;
+    if (opt->verify) {
+        lo = hotp ? 0 : -opt->window;
+        hi = opt->window;
+    }
+    if (grow ((void **)&ch->jobs, &ch->cap_jobs, ch->n_jobs + (size_t)(hi - lo + 1), sizeof(cotp_otp_job)) != 0) {
+        return -1;
+    }
+    for (int d = lo; d <= hi; d++) {
+        long step, t;
+        if (__builtin_mul_overflow ((long)d, hotp ? 1L : (long)e->period, &step) ||
+            __builtin_add_overflow (e->counter, step, &t)) {
+            continue;
+        }
+        if (e->n_jobs == 0) {
+            e->delta_lo = d;
+        }
+        cotp_otp_job *job = &ch->jobs[ch->n_jobs++];
+        memset (job, 0, sizeof *job);
+        job->type = e->type;
+        job->key = e->key;
+        job->base32_encoded_secret = e->uri ? e->uri->secret : ch->text + e->secret_off;
+        job->counter = t;
+        job->digits = e->digits;
+        job->period = e->period;
+        job->sha_algo = e->algo;
+        e->n_jobs++;
+    }
+    return 0;
+}
+
+
+static void
+emit_entry (const cli_chunk *ch,
+            const cli_entry *e,
+            cli_state       *st)
+{
+    if (e->blank) {
+        fputc ('\n', stdout);
+        return;
+    }
+    cotp_error_t err = e->err;
+    if (err == NO_ERROR && e->n_jobs == 0) {
+        err = INVALID_COUNTER;
+    }
+
+    if (!st->opt->verify) {
+        const cotp_otp_job *job = &ch->jobs[e->first_job];
+        if (err == NO_ERROR) err = job->err;
+        if (err != NO_ERROR) {
+            printf ("error: %s\n", cotp_strerror (err));
+            st->failed = 1;
+            return;
+        }
+        fputs (job->code, stdout);
+        fputc ('\n', stdout);
+        return;
+    }
+
+    // Every step is compared, so the time taken does not depend on where the code matched
+    const char *code = ch->text + e->code_off;
+    size_t code_len = err == NO_ERROR ? strlen (code) : 0;
+    int found = 0, delta = 0;
+    for (size_t j = 0; j < e->n_jobs && err == NO_ERROR; j++) {
+        const cotp_otp_job *job = &ch->jobs[e->first_job + j];
+        if (job->err != NO_ERROR) {
+            err = job->err;
+            break;
+        }
+        int ok = strlen (job->code) == code_len &&
+                 cotp_timing_safe_memcmp (job->code, code, code_len) == 0;
+        if (ok && !found) {
+            found = 1;
+            delta = e->delta_lo + (int)j;
+        }
+    }
+    if (err != NO_ERROR) {
+        printf ("error: %s\n", cotp_strerror (err));
+        st->failed = 1;
+    } else if (found) {
+        printf ("valid %d\n", delta);
+    } else {
+        fputs ("invalid\n", stdout);
+        st->failed = 1;
+    }
+}
+
+
+static void
+release_chunk (cli_chunk *ch)
+{
+    for (size_t i = 0; i < ch->n_entries; i++) {
+        cotp_key_free (ch->entries[i].key);
+        cotp_otpauth_uri_free (ch->entries[i].uri);
+    }
+    // The text holds secrets and the jobs hold codes
+    if (ch->text) cotp_secure_memzero (ch->text, ch->len);
+    if (ch->jobs) cotp_secure_memzero (ch->jobs, ch->n_jobs * sizeof(cotp_otp_job));
+    ch->n_jobs = 0;
+}
+
+
+static int
+process_stream (FILE      *in,
+                cli_state *st)
+{
+    const cli_options *opt = st->opt;
+    cli_chunk ch;
+    memset (&ch, 0, sizeof ch);
+    char *line = NULL;
+    size_t line_cap = 0;
+    int rc = 0;
+
+    while (rc == 0 && read_chunk (in, &ch, opt, &line, &line_cap) > 0) {
+        ch.n_jobs = 0;
+        for (size_t i = 0; i < ch.n_entries; i++) {
+            cli_entry *e = &ch.entries[i];
+            if (!e->blank) {
+                resolve_entry (&ch, e, opt);
+            }
+            if (add_jobs (&ch, e, opt) != 0) {
+                rc = -1;
+                break;
+            }
+        }
+
+        cotp_pool *pool = NULL;
+        if (rc == 0 && ch.n_jobs >= CLI_POOL_THRESHOLD && opt->threads != 1) {
+            if (st->pool == NULL) {
+                cotp_error_t err;
+                st->pool = cotp_pool_create (opt->threads, NULL, &err);
+            }
+            pool = st->pool;
+        }
+        if (rc == 0 && cotp_otp_batch (ch.jobs, ch.n_jobs, pool) != NO_ERROR) {
+            rc = -1;
+        }
+        for (size_t i = 0; rc == 0 && i < ch.n_entries; i++) {
+            emit_entry (&ch, &ch.entries[i], st);
+        }
+        release_chunk (&ch);
+    }
+
+    if (line) cotp_secure_memzero (line, line_cap);
+    free (line);
+    if (ch.text) cotp_secure_memzero (ch.text, ch.cap);
+    free (ch.text);
+    free (ch.entries);
+    free (ch.jobs);
+    if (rc != 0) {
+        fprintf (stderr, "cotp: out of memory\n");
+    }
+    return rc;
+}
+
+
+static void
+usage (FILE *out)
+{
+    fprintf (out,
+             "usage: cotp [OPTIONS] [FILE...]\n"
+             "Reads one otpauth:// URI or Base32 secret per line from the files (or stdin, or '-')\n"
+             "and prints one result per line, in order. Blank and '#' lines print an empty line.\n"
+             "\n"
+             "  -t, --time=TS        timestamp for TOTP (default: now)\n"
+             "  -c, --counter=N      HOTP counter; bare secrets become HOTP, overrides URI counters\n"
+             "  -d, --digits=N       digits for bare secrets (default 6)\n"
+             "  -p, --period=N       period for bare secrets (default 30)\n"
+             "  -a, --algo=ALGO      sha1, sha256 or sha512 for bare secrets (default sha1)\n"
+             "  -v, --verify         lines are '<secret> <code>': print 'valid <offset>' or 'invalid'\n"
+             "  -w, --window=N       verification window, at most %d (default 1)\n"
+             "  -j, --threads=N      worker threads for large chunks (default: one per CPU)\n"
+             "  -b, --batch=N        lines per chunk (default %d)\n"
+             "\n"
+             "Exit status: 0 if every line succeeded (and verified), 1 otherwise, 2 on usage or I/O errors.\n",
+             CLI_MAX_WINDOW, CLI_DEFAULT_BATCH);
+}
+
+
+static int
+parse_long (const char *s,
+            long        min,
+            long        max,
+            long       *out)
+{
+    char *end;
+    long v = strtol (s, &end, 10);
+    if (*s == '\0' || *end != '\0' || v < min || v > max) {
+        return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+
+int
+main (int argc, char **argv)
+{
+    cli_options opt = {
+        .timestamp = (long)time (NULL), .counter = -1, .digits = 6, .period = 30,
+        .algo = COTP_SHA1, .verify = 0, .window = 1, .threads = 0, .batch = CLI_DEFAULT_BATCH
+    };
+    static const struct option longopts[] = {
+        { "time",    required_argument, NULL, 't' },
+        { "counter", required_argument, NULL, 'c' },
+        { "digits",  required_argument, NULL, 'd' },
+        { "period",  required_argument, NULL, 'p' },
+        { "algo",    required_argument, NULL, 'a' },
+        { "verify",  no_argument,       NULL, 'v' },
+        { "window",  required_argument, NULL, 'w' },
+        { "threads", required_argument, NULL, 'j' },
+        { "batch",   required_argument, NULL, 'b' },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int c;
+    long v;
+    while ((c = getopt_long (argc, argv, "t:c:d:p:a:vw:j:b:h", longopts, NULL)) != -1) {
+        int bad = 0;
+        switch (c) {
+        case 't': bad = parse_long (optarg, 0, LONG_MAX, &opt.timestamp); break;
+        case 'c': bad = parse_long (optarg, 0, LONG_MAX, &opt.counter); break;
+        case 'd': bad = parse_long (optarg, MIN_DIGITS, MAX_DIGITS, &v); opt.digits = (int)v; break;
+        case 'p': bad = parse_long (optarg, 1, 120, &v); opt.period = (int)v; break;
+        case 'a': bad = (opt.algo = parse_algo (optarg)) < 0; break;
+        case 'v': opt.verify = 1; break;
+        case 'w': bad = parse_long (optarg, 0, CLI_MAX_WINDOW, &v); opt.window = (int)v; break;
+        case 'j': bad = parse_long (optarg, 0, COTP_POOL_MAX_THREADS, &v); opt.threads = (int)v; break;
+        case 'b': bad = parse_long (optarg, 1, 1L << 20, &v); opt.batch = (size_t)v; break;
+        case 'h': usage (stdout); return 0;
+        default: usage (stderr); return 2;
+        }
+        if (bad) {
+            fprintf (stderr, "cotp: invalid value for -%c: %s\n", c, optarg);
+            return 2;
+        }
+    }
+
+    static char outbuf[CLI_OUT_BUFFER];
+    setvbuf (stdout, outbuf, _IOFBF, sizeof outbuf);
+
+    cli_state st = { .opt = &opt, .pool = NULL, .failed = 0 };
+    int rc = 0;
+    if (optind == argc) {
+        rc = process_stream (stdin, &st);
+    }
+    for (int i = optind; rc == 0 && i < argc; i++) {
+        if (strcmp (argv[i], "-") == 0) {
+            rc = process_stream (stdin, &st);
+            continue;
+        }
+        FILE *f = fopen (argv[i], "r");
+        if (f == NULL) {
+            perror (argv[i]);
+            rc = -1;
+            break;
+        }
+        rc = process_stream (f, &st);
+        fclose (f);
+    }
+    if (fflush (stdout) != 0) {
+        perror ("cotp: stdout");
+        rc = -1;
+    }
+    cotp_pool_free (st.pool);
+    if (rc != 0) {
+        return 2;
+    }
+    return st.failed ? 1 : 0;
+}
@@ -0,0 +1,828 @@
+// cotp-verifyd: serves OTP generation and validation for a set of keys over a Unix socket, so
+// services can share one key store instead of each loading the secrets and linking libcotp.
+//
+// One thread runs an epoll loop. Each wakeup reads what the ready clients sent, parses every
+// complete frame into one round, turns the round into a single cotp_otp_batch() over pre-keyed
+// secrets (a validation contributes one job per step of its window), then writes the responses.
+// See verifyd_proto.h for the wire format.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "cotp.h"
+#include "verifyd_proto.h"
+
+#define VD_MAX_EVENTS       64
+#define VD_READ_CHUNK       (64 * 1024)
+// A client whose unsent responses exceed this is not read from until it catches up
+#define VD_MAX_PENDING_OUT  (1024 * 1024)
+// Largest response item: err, code_len, code
+#define VD_MAX_RESPONSE_ITEM  (2 + MAX_DIGITS)
+
+typedef struct {
+    uint8_t *data;
+    size_t   len;
+    size_t   cap;
+} vd_buf;
+
+typedef struct {
+    char      id[VERIFYD_MAX_KEY_ID + 1];
+    size_t    id_len;
+    uint64_t  hash;
+    cotp_key *key;
+    int       hotp;
+    int       digits;
+    int       period;
+} vd_key;
+
+// Open-addressing table over the loaded keys; slots hold index + 1, 0 is empty
+typedef struct {
+    vd_key *keys;
+    size_t  n;
+    size_t *slots;
+    size_t  mask;
+} vd_keystore;
+
+typedef struct vd_conn {
+    int             fd;
+    vd_buf          in;
+    size_t          in_off;     // parsed prefix of `in`
+    vd_buf          out;
+    size_t          out_off;    // sent prefix of `out`
+    uint32_t        events;     // current epoll interest
+    int             eof;        // peer stopped sending: close once the responses are out
+    int             dead;
+    struct vd_conn *prev;
+    struct vd_conn *next;
+} vd_conn;
+
+typedef struct {
+    vd_conn       *conn;
+    verifyd_header h;
+    size_t         first;       // index of the frame's first item
+} vd_frame;
+
+typedef struct {
+    const vd_key *key;          // NULL: unknown key
+    int64_t       at;
+    int           window;
+    size_t        code_len;
+    char          code[MAX_DIGITS + 1];
+    size_t        first_job;
+    size_t        n_jobs;
+    int           delta_lo;     // offset of the first job's step
+} vd_item;
+
+// Everything parsed since the last batch. The arrays keep their capacity between rounds.
+typedef struct {
+    vd_frame     *frames;
+    size_t        n_frames, cap_frames;
+    vd_item      *items;
+    size_t        n_items, cap_items;
+    cotp_otp_job *jobs;
+    size_t        n_jobs, cap_jobs;
+} vd_round;
+
+typedef struct {
+    int          epfd;
+    int          listen_fd;
+    int          signal_fd;
+    vd_keystore  store;
+    cotp_pool   *pool;
+    vd_round     round;
+    vd_conn     *conns;
+    vd_conn     *dead;
+    int          running;
+} vd_server;
+
+// epoll data for the two non-client descriptors
+static char listen_tag, signal_tag;
+
+
+static int
+grow (void   **array,
+      size_t  *cap,
+      size_t   need,
+      size_t   elem)
+{
+    if (need <= *cap) {
+        return 0;
+    }
+    size_t n = *cap ? *cap : 64;
+    while (n < need) {
+        n *= 2;
+    }
+    void *p = realloc (*array, n * elem);
+    if (p == NULL) {
+        return -1;
+    }
+    *array = p;
+    *cap = n;
+    return 0;
+}
+
+
+static int
+buf_reserve (vd_buf *b,
+             size_t  extra)
+{
+    return grow ((void **)&b->data, &b->cap, b->len + extra, 1);
+}
+
+
+static void
+buf_free (vd_buf *b)
+{
+    if (b->data != NULL) {
+        cotp_secure_memzero (b->data, b->cap);
+    }
+    free (b->data);
+    memset (b, 0, sizeof *b);
+}
+
+
+static uint64_t
+hash_id (const char *id,
+         size_t      len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)id[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+
+static const vd_key *
+store_find (const vd_keystore *s,
+            const char        *id,
+            size_t             len)
+{
+    if (s->n == 0) {
+        return NULL;
+    }
+    uint64_t h = hash_id (id, len);
+    for (size_t i = h & s->mask; s->slots[i] != 0; i = (i + 1) & s->mask) {
+        const vd_key *k = &s->keys[s->slots[i] - 1];
+        if (k->hash == h && k->id_len == len && memcmp (k->id, id, len) == 0) {
+            return k;
+        }
+    }
+    return NULL;
+}
+
+
+static void
+store_free (vd_keystore *s)
+{
+    for (size_t i = 0; i < s->n; i++) {
+        cotp_key_free (s->keys[i].key);
+    }
+    free (s->keys);
+    free (s->slots);
+    memset (s, 0, sizeof *s);
+}
+
+
+static int
+store_index (vd_keystore *s)
+{
+    size_t size = 16;
+    while (size < s->n * 2) {
+        size *= 2;
+    }
+    s->slots = calloc (size, sizeof(size_t));
+    if (s->slots == NULL) {
+        return -1;
+    }
+    s->mask = size - 1;
+    for (size_t k = 0; k < s->n; k++) {
+        if (store_find (s, s->keys[k].id, s->keys[k].id_len) != NULL) {
+            fprintf (stderr, "cotp-verifyd: duplicate key id '%s'\n", s->keys[k].id);
+            return -1;
+        }
+        size_t i = s->keys[k].hash & s->mask;
+        while (s->slots[i] != 0) {
+            i = (i + 1) & s->mask;
+        }
+        s->slots[i] = k + 1;
+    }
+    return 0;
+}
+
+
+// Key file: one "<key id> <otpauth URI>" per line; blank lines and lines starting with '#' are
+// skipped. Secrets are keyed once here and the line buffer is wiped afterwards.
+static int
+store_load (vd_keystore *s,
+            const char  *path)
+{
+    FILE *f = fopen (path, "re");
+    if (f == NULL) {
+        fprintf (stderr, "cotp-verifyd: %s: %s\n", path, strerror (errno));
+        return -1;
+    }
+
+    size_t cap_keys = 0, lineno = 0, line_cap = 0;
+    char *line = NULL;
+    ssize_t len;
+    int rc = 0;
+    while (rc == 0 && (len = getline (&line, &line_cap, f)) >= 0) {
+        lineno++;
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ')) {
+            line[--len] = '\0';
+        }
+        char *p = line + strspn (line, " \t");
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        size_t id_len = strcspn (p, " \t");
+        char *uri = p + id_len + strspn (p + id_len, " \t");
+        if (id_len > VERIFYD_MAX_KEY_ID || *uri == '\0') {
+            fprintf (stderr, "cotp-verifyd: %s:%zu: expected '<key id> <otpauth URI>'\n", path, lineno);
+            rc = -1;
+            break;
+        }
+
+        cotp_error_t err;
+        cotp_otpauth_uri *u = cotp_otpauth_uri_parse (uri, &err);
+        cotp_key *key = u ? cotp_key_create (u->secret, u->algo, &err) : NULL;
+        if (key == NULL || grow ((void **)&s->keys, &cap_keys, s->n + 1, sizeof(vd_key)) != 0) {
+            fprintf (stderr, "cotp-verifyd: %s:%zu: %s\n", path, lineno,
+                     key ? "out of memory" : cotp_strerror (err));
+            cotp_key_free (key);
+            cotp_otpauth_uri_free (u);
+            rc = -1;
+            break;
+        }
+        vd_key *k = &s->keys[s->n++];
+        memset (k, 0, sizeof *k);
+        memcpy (k->id, p, id_len);
+        k->id_len = id_len;
+        k->hash = hash_id (k->id, id_len);
+        k->key = key;
+        k->hotp = u->type == COTP_OTPAUTH_HOTP;
+        k->digits = u->digits;
+        k->period = u->period;
+        cotp_otpauth_uri_free (u);
+    }
+    if (line != NULL) {
+        cotp_secure_memzero (line, line_cap);
+    }
+    free (line);
+    fclose (f);
+
+    if (rc == 0 && store_index (s) != 0) {
+        rc = -1;
+    }
+    if (rc != 0) {
+        store_free (s);
+    }
+    return rc;
+}
+
+
+static void
+conn_kill (vd_server *s,
+           vd_conn   *c)
+{
+    if (c->dead) {
+        return;
+    }
+    c->dead = 1;
+    epoll_ctl (s->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    if (c->prev) c->prev->next = c->next; else s->conns = c->next;
+    if (c->next) c->next->prev = c->prev;
+    c->next = s->dead;
+    s->dead = c;
+}
+
+
+// Connections are freed between wakeups, since the round and later events may still refer to them
+static void
+reap_dead (vd_server *s)
+{
+    while (s->dead != NULL) {
+        vd_conn *c = s->dead;
+        s->dead = c->next;
+        close (c->fd);
+        buf_free (&c->in);
+        buf_free (&c->out);
+        free (c);
+    }
+}
+
+
+static void
+update_interest (vd_server *s,
+                 vd_conn   *c)
+{
+    size_t pending = c->out.len - c->out_off;
+    uint32_t want = 0;
+    if (!c->eof && pending <= VD_MAX_PENDING_OUT) want |= EPOLLIN;
+    if (pending > 0) want |= EPOLLOUT;
+    if (want != c->events) {
+        struct epoll_event ev = { .events = want, .data.ptr = c };
+        epoll_ctl (s->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->events = want;
+    }
+}
+
+
+static void
+flush_conn (vd_server *s,
+            vd_conn   *c)
+{
+    while (c->out_off < c->out.len) {
+        ssize_t w = send (c->fd, c->out.data + c->out_off, c->out.len - c->out_off, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            conn_kill (s, c);
+            return;
+        }
+        c->out_off += (size_t)w;
+    }
+    if (c->out_off == c->out.len) {
+        c->out.len = c->out_off = 0;
+        if (c->eof) {
+            conn_kill (s, c);
+            return;
+        }
+    }
+    update_interest (s, c);
+}
+
+
+// Parses one request body into the round. Malformed requests become an error frame.
+static int
+parse_request (vd_server     *s,
+               vd_conn       *c,
+               const uint8_t *body,
+               size_t         len)
+{
+    vd_round *r = &s->round;
+    if (grow ((void **)&r->frames, &r->cap_frames, r->n_frames + 1, sizeof(vd_frame)) != 0) {
+        return -1;
+    }
+    vd_frame *f = &r->frames[r->n_frames++];
+    f->conn = c;
+    f->first = r->n_items;
+    verifyd_get_header (body, &f->h);
+
+    int bad = f->h.version != VERIFYD_VERSION || f->h.count > VERIFYD_MAX_ITEMS ||
+              (f->h.op != VERIFYD_OP_GENERATE && f->h.op != VERIFYD_OP_VALIDATE);
+    if (!bad && grow ((void **)&r->items, &r->cap_items, r->n_items + f->h.count, sizeof(vd_item)) != 0) {
+        return -1;
+    }
+
+    const uint8_t *p = body + VERIFYD_HEADER_SIZE;
+    const uint8_t *end = body + len;
+    for (uint16_t i = 0; !bad && i < f->h.count; i++) {
+        if (end - p < 1 || (size_t)(end - p) < 1 + (size_t)p[0] + 8) {
+            bad = 1;
+            break;
+        }
+        vd_item *it = &r->items[r->n_items];
+        size_t key_len = p[0];
+        it->key = store_find (&s->store, (const char *)p + 1, key_len);
+        p += 1 + key_len;
+        it->at = verifyd_get_i64 (p);
+        p += 8;
+        it->window = 0;
+        it->code_len = 0;
+        if (f->h.op == VERIFYD_OP_VALIDATE) {
+            if (end - p < 2 || p[0] > VERIFYD_MAX_WINDOW || p[1] > MAX_DIGITS || end - p < 2 + p[1]) {
+                bad = 1;
+                break;
+            }
+            it->window = p[0];
+            it->code_len = p[1];
+            memcpy (it->code, p + 2, it->code_len);
+            p += 2 + it->code_len;
+        }
+        it->code[it->code_len] = '\0';
+        r->n_items++;
+    }
+    if (bad || p != end) {
+        r->n_items = f->first;
+        f->h.op = VERIFYD_OP_ERROR;
+        f->h.count = 0;
+    }
+    return 0;
+}
+
+
+static void
+parse_frames (vd_server *s,
+              vd_conn   *c)
+{
+    while (c->out.len - c->out_off <= VD_MAX_PENDING_OUT) {
+        size_t avail = c->in.len - c->in_off;
+        if (avail < 4) {
+            break;
+        }
+        const uint8_t *p = c->in.data + c->in_off;
+        uint32_t len = verifyd_get_u32 (p);
+        if (len < VERIFYD_HEADER_SIZE || len > VERIFYD_MAX_FRAME) {
+            // The framing can't be trusted any more
+            conn_kill (s, c);
+            return;
+        }
+        if (avail < 4 + (size_t)len) {
+            break;
+        }
+        if (parse_request (s, c, p + 4, len) != 0) {
+            conn_kill (s, c);
+            return;
+        }
+        c->in_off += 4 + len;
+    }
+    // Keep only the incomplete tail
+    size_t rest = c->in.len - c->in_off;
+    memmove (c->in.data, c->in.data + c->in_off, rest);
+    cotp_secure_memzero (c->in.data + rest, c->in.len - rest);
+    c->in.len = rest;
+    c->in_off = 0;
+}
+
+
+static void
+read_conn (vd_server *s,
+           vd_conn   *c)
+{
+    if (buf_reserve (&c->in, VD_READ_CHUNK) != 0) {
+        conn_kill (s, c);
+        return;
+    }
+    ssize_t n = recv (c->fd, c->in.data + c->in.len, c->in.cap - c->in.len, 0);
+    if (n > 0) {
+        c->in.len += (size_t)n;
+    } else if (n == 0) {
+        c->eof = 1;
+        update_interest (s, c);
+    } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+        conn_kill (s, c);
+        return;
+    }
+    parse_frames (s, c);
+
+    // A client that hung up is closed once its responses are out. If it still has frames in this
+    // round (always the last ones parsed), run_round() flushes and closes it instead.
+    vd_round *r = &s->round;
+    if (!c->dead && c->eof && (r->n_frames == 0 || r->frames[r->n_frames - 1].conn != c)) {
+        flush_conn (s, c);
+    }
+}
+
+
+static void
+accept_conns (vd_server *s)
+{
+    for (;;) {
+        int fd = accept4 (s->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        vd_conn *c = calloc (1, sizeof(vd_conn));
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+        if (c == NULL || epoll_ctl (s->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            free (c);
+            close (fd);
+            continue;
+        }
+        c->fd = fd;
+        c->events = EPOLLIN;
+        c->next = s->conns;
+        if (s->conns) s->conns->prev = c;
+        s->conns = c;
+    }
+}
+
+
+// Appends the jobs of one item. TOTP validations cover [-window, +window] steps around `at`,
+// HOTP validations the counters [at, at + window]; steps whose time would overflow are dropped,
+// which only trims the ends of the range.
+static int
+add_jobs (vd_round *r,
+          vd_item  *it,
+          int       op,
+          int64_t   now)
+{
+    it->first_job = r->n_jobs;
+    it->n_jobs = 0;
+    it->delta_lo = 0;
+    if (it->key == NULL) {
+        return 0;
+    }
+    const vd_key *k = it->key;
+    int64_t at = it->at == VERIFYD_AT_NOW ? now : it->at;
+    int lo = 0, hi = 0;
+    if (op == VERIFYD_OP_VALIDATE) {
+        lo = k->hotp ? 0 : -it->window;
+        hi = it->window;
+    }
+    if (grow ((void **)&r->jobs, &r->cap_jobs, r->n_jobs + (size_t)(hi - lo + 1), sizeof(cotp_otp_job)) != 0) {
+        return -1;
+    }
+    for (int d = lo; d <= hi; d++) {
+        long step, t;
+        if (__builtin_mul_overflow ((long)d, k->hotp ? 1L : (long)k->period, &step) ||
+            __builtin_add_overflow ((long)at, step, &t)) {
+            continue;
+        }
+        if (it->n_jobs == 0) {
+            it->delta_lo = d;
+        }
+        cotp_otp_job *job = &r->jobs[r->n_jobs++];
+        memset (job, 0, sizeof *job);
+        job->type = k->hotp ? COTP_JOB_HOTP : COTP_JOB_TOTP;
+        job->key = k->key;
+        job->counter = t;
+        job->digits = k->digits;
+        job->period = k->period;
+        it->n_jobs++;
+    }
+    return 0;
+}
+
+
+static void
+encode_item (vd_buf        *out,
+             int            op,
+             const vd_item *it,
+             const cotp_otp_job *jobs)
+{
+    uint8_t *p = out->data + out->len;
+    if (it->key == NULL) {
+        p[0] = VERIFYD_UNKNOWN_KEY;
+        p[1] = 0;
+        p[2] = 0;
+        out->len += op == VERIFYD_OP_GENERATE ? 2 : 3;
+        return;
+    }
+
+    if (op == VERIFYD_OP_GENERATE) {
+        const cotp_otp_job *job = &jobs[it->first_job];
+        size_t n = it->n_jobs ? strlen (job->code) : 0;
+        p[0] = (uint8_t)(it->n_jobs ? job->err : INVALID_COUNTER);
+        p[1] = (uint8_t)n;
+        memcpy (p + 2, job->code, n);
+        out->len += 2 + n;
+        return;
+    }
+
+    // Every step is compared, so the time taken does not depend on where the code matched
+    cotp_error_t err = it->n_jobs ? NO_ERROR : INVALID_COUNTER;
+    int found = 0, delta = 0;
+    for (size_t j = 0; j < it->n_jobs && err == NO_ERROR; j++) {
+        const cotp_otp_job *job = &jobs[it->first_job + j];
+        if (job->err != NO_ERROR) {
+            err = job->err;
+            break;
+        }
+        int ok = strlen (job->code) == it->code_len &&
+                 cotp_timing_safe_memcmp (job->code, it->code, it->code_len) == 0;
+        if (ok && !found) {
+            found = 1;
+            delta = it->delta_lo + (int)j;
+        }
+    }
+    if (err == NO_ERROR && found) {
+        err = VALID;
+    }
+    p[0] = (uint8_t)err;
+    verifyd_put_u16 (p + 1, (uint16_t)(int16_t)(err == VALID ? delta : 0));
+    out->len += 3;
+}
+
+
+static void
+run_round (vd_server *s)
+{
+    vd_round *r = &s->round;
+    if (r->n_frames == 0) {
+        return;
+    }
+
+    int64_t now = (int64_t)time (NULL);
+    r->n_jobs = 0;
+    int failed = 0;
+    for (size_t f = 0; f < r->n_frames && !failed; f++) {
+        vd_frame *fr = &r->frames[f];
+        for (size_t i = 0; i < fr->h.count; i++) {
+            if (add_jobs (r, &r->items[fr->first + i], fr->h.op, now) != 0) {
+                failed = 1;
+                break;
+            }
+        }
+    }
+    if (!failed && cotp_otp_batch (r->jobs, r->n_jobs, s->pool) != NO_ERROR) {
+        failed = 1;
+    }
+
+    for (size_t f = 0; f < r->n_frames; f++) {
+        vd_frame *fr = &r->frames[f];
+        vd_conn *c = fr->conn;
+        if (c->dead) {
+            continue;
+        }
+        if (failed) {
+            // Out of resources: the responses can't be produced, and skipping them would break
+            // the client's request/response pairing
+            conn_kill (s, c);
+            continue;
+        }
+        size_t body = VERIFYD_HEADER_SIZE + (size_t)fr->h.count * VD_MAX_RESPONSE_ITEM;
+        if (buf_reserve (&c->out, 4 + body) != 0) {
+            conn_kill (s, c);
+            continue;
+        }
+        size_t start = c->out.len;
+        verifyd_header h = fr->h;
+        h.op |= VERIFYD_OP_RESPONSE;
+        verifyd_put_header (c->out.data + start + 4, &h);
+        c->out.len += 4 + VERIFYD_HEADER_SIZE;
+        for (size_t i = 0; i < fr->h.count; i++) {
+            encode_item (&c->out, fr->h.op, &r->items[fr->first + i], r->jobs);
+        }
+        verifyd_put_u32 (c->out.data + start, (uint32_t)(c->out.len - start - 4));
+    }
+
+    for (size_t f = 0; f < r->n_frames; f++) {
+        vd_conn *c = r->frames[f].conn;
+        if (!c->dead && (f + 1 == r->n_frames || r->frames[f + 1].conn != c)) {
+            flush_conn (s, c);
+        }
+    }
+
+    // Generated codes and submitted codes don't outlive the round
+    cotp_secure_memzero (r->jobs, r->n_jobs * sizeof(cotp_otp_job));
+    cotp_secure_memzero (r->items, r->n_items * sizeof(vd_item));
+    r->n_frames = r->n_items = r->n_jobs = 0;
+}
+
+
+static int
+open_listener (const char *path,
+               mode_t      mode)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen (path) >= sizeof addr.sun_path) {
+        fprintf (stderr, "cotp-verifyd: socket path too long\n");
+        return -1;
+    }
+    strcpy (addr.sun_path, path);
+
+    // Replace a stale socket left by a previous instance, but never a regular file
+    struct stat st;
+    if (lstat (path, &st) == 0 && S_ISSOCK (st.st_mode)) {
+        unlink (path);
+    }
+
+    int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror ("cotp-verifyd: socket");
+        return -1;
+    }
+    mode_t old = umask (0777 & ~mode);
+    int rc = bind (fd, (struct sockaddr *)&addr, sizeof addr);
+    umask (old);
+    if (rc != 0 || listen (fd, SOMAXCONN) != 0) {
+        fprintf (stderr, "cotp-verifyd: %s: %s\n", path, strerror (errno));
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+static void
+usage (FILE *out)
+{
+    fprintf (out,
+             "usage: cotp-verifyd -s SOCKET -k KEYFILE [-t THREADS] [-m MODE]\n"
+             "  -s SOCKET   Unix socket path to listen on\n"
+             "  -k KEYFILE  lines of '<key id> <otpauth URI>'\n"
+             "  -t THREADS  batch workers (default 1: everything on the event loop thread)\n"
+             "  -m MODE     socket permissions, octal (default 600)\n");
+}
+
+
+int
+main (int argc, char **argv)
+{
+    const char *socket_path = NULL, *key_path = NULL;
+    int threads = 1;
+    mode_t mode = 0600;
+    int opt;
+    while ((opt = getopt (argc, argv, "s:k:t:m:h")) != -1) {
+        switch (opt) {
+        case 's': socket_path = optarg; break;
+        case 'k': key_path = optarg; break;
+        case 't': threads = atoi (optarg); break;
+        case 'm': mode = (mode_t)strtol (optarg, NULL, 8); break;
+        case 'h': usage (stdout); return 0;
+        default: usage (stderr); return 2;
+        }
+    }
+    if (socket_path == NULL || key_path == NULL) {
+        usage (stderr);
+        return 2;
+    }
+
+    // Blocked before the pool starts, so its workers inherit the mask and the signals only
+    // surface through the signalfd
+    sigset_t mask;
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGINT);
+    sigaddset (&mask, SIGTERM);
+    sigprocmask (SIG_BLOCK, &mask, NULL);
+
+    vd_server s;
+    memset (&s, 0, sizeof s);
+    if (store_load (&s.store, key_path) != 0) {
+        return 1;
+    }
+
+    cotp_error_t err = NO_ERROR;
+    if (threads > 1 && (s.pool = cotp_pool_create (threads, NULL, &err)) == NULL) {
+        fprintf (stderr, "cotp-verifyd: %s\n", cotp_strerror (err));
+        store_free (&s.store);
+        return 1;
+    }
+
+    s.signal_fd = signalfd (-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    s.epfd = epoll_create1 (EPOLL_CLOEXEC);
+    s.listen_fd = open_listener (socket_path, mode);
+    if (s.signal_fd < 0 || s.epfd < 0 || s.listen_fd < 0) {
+        if (s.signal_fd < 0 || s.epfd < 0) perror ("cotp-verifyd");
+        return 1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &listen_tag };
+    epoll_ctl (s.epfd, EPOLL_CTL_ADD, s.listen_fd, &ev);
+    ev.data.ptr = &signal_tag;
+    epoll_ctl (s.epfd, EPOLL_CTL_ADD, s.signal_fd, &ev);
+
+    fprintf (stderr, "cotp-verifyd: serving %zu keys on %s\n", s.store.n, socket_path);
+    s.running = 1;
+    struct epoll_event events[VD_MAX_EVENTS];
+    while (s.running) {
+        int n = epoll_wait (s.epfd, events, VD_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror ("cotp-verifyd: epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == &listen_tag) {
+                accept_conns (&s);
+                continue;
+            }
+            if (tag == &signal_tag) {
+                s.running = 0;
+                continue;
+            }
+            vd_conn *c = tag;
+            if (c->dead) {
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                flush_conn (&s, c);
+                // Responses drained: frames held back while the client was behind can go now
+                if (!c->dead) parse_frames (&s, c);
+            }
+            if (!c->dead && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                read_conn (&s, c);
+            }
+        }
+        run_round (&s);
+        reap_dead (&s);
+    }
+
+    while (s.conns != NULL) {
+        conn_kill (&s, s.conns);
+    }
+    reap_dead (&s);
+    close (s.listen_fd);
+    unlink (socket_path);
+    close (s.signal_fd);
+    close (s.epfd);
+    free (s.round.frames);
+    free (s.round.items);
+    free (s.round.jobs);
+    cotp_pool_free (s.pool);
+    store_free (&s.store);
+    return 0;
+}
@@ -0,0 +1,364 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "verifyd_client.h"
+
+#define NO_FRAME ((size_t)-1)
+
+struct verifyd_client {
+    int       fd;
+    uint8_t  *out;          // queued frames not yet written
+    size_t    out_len;
+    size_t    out_cap;
+    size_t    frame_start;  // offset of the frame being built, or NO_FRAME
+    int       frame_op;
+    uint16_t  frame_count;
+    uint32_t  next_id;
+    uint8_t  *in;           // body of the last response
+    size_t    in_cap;
+};
+
+
+static int
+reserve (uint8_t **buf,
+         size_t   *cap,
+         size_t    need)
+{
+    if (need <= *cap) {
+        return 0;
+    }
+    size_t n = *cap ? *cap : 4096;
+    while (n < need) {
+        n *= 2;
+    }
+    uint8_t *p = realloc (*buf, n);
+    if (p == NULL) {
+        return -1;
+    }
+    *buf = p;
+    *cap = n;
+    return 0;
+}
+
+
+verifyd_client *
+verifyd_connect (const char     *socket_path,
+                 verifyd_status *status)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (socket_path == NULL || strlen (socket_path) >= sizeof addr.sun_path) {
+        if (status) *status = VERIFYD_ERR_ARGUMENT;
+        return NULL;
+    }
+    strcpy (addr.sun_path, socket_path);
+
+    verifyd_client *c = calloc (1, sizeof(verifyd_client));
+    if (c == NULL) {
+        if (status) *status = VERIFYD_ERR_MEMORY;
+        return NULL;
+    }
+    c->frame_start = NO_FRAME;
+    c->fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c->fd < 0 || connect (c->fd, (struct sockaddr *)&addr, sizeof addr) != 0) {
+        if (c->fd >= 0) close (c->fd);
+        free (c);
+        if (status) *status = VERIFYD_ERR_IO;
+        return NULL;
+    }
+    if (status) *status = VERIFYD_OK;
+    return c;
+}
+
+
+void
+verifyd_close (verifyd_client *c)
+{
+    if (c == NULL) {
+        return;
+    }
+    close (c->fd);
+    // Queued requests and the last response carry OTP codes
+    if (c->out) cotp_secure_memzero (c->out, c->out_cap);
+    if (c->in) cotp_secure_memzero (c->in, c->in_cap);
+    free (c->out);
+    free (c->in);
+    free (c);
+}
+
+
+verifyd_status
+verifyd_begin (verifyd_client *c,
+               int             op)
+{
+    if (c == NULL || c->frame_start != NO_FRAME ||
+        (op != VERIFYD_OP_GENERATE && op != VERIFYD_OP_VALIDATE)) {
+        return VERIFYD_ERR_ARGUMENT;
+    }
+    if (reserve (&c->out, &c->out_cap, c->out_len + 4 + VERIFYD_HEADER_SIZE) != 0) {
+        return VERIFYD_ERR_MEMORY;
+    }
+    c->frame_start = c->out_len;
+    c->frame_op = op;
+    c->frame_count = 0;
+    c->out_len += 4 + VERIFYD_HEADER_SIZE;
+    return VERIFYD_OK;
+}
+
+
+// Appends the fields shared by both item kinds and returns where the rest goes
+static uint8_t *
+add_item (verifyd_client *c,
+          int             op,
+          const char     *key_id,
+          int64_t         at,
+          size_t          extra)
+{
+    if (c == NULL || key_id == NULL || c->frame_start == NO_FRAME || c->frame_op != op ||
+        c->frame_count >= VERIFYD_MAX_ITEMS) {
+        return NULL;
+    }
+    size_t key_len = strlen (key_id);
+    size_t item = 1 + key_len + 8 + extra;
+    if (key_len > VERIFYD_MAX_KEY_ID ||
+        c->out_len + item - c->frame_start - 4 > VERIFYD_MAX_FRAME ||
+        reserve (&c->out, &c->out_cap, c->out_len + item) != 0) {
+        return NULL;
+    }
+    uint8_t *p = c->out + c->out_len;
+    p[0] = (uint8_t)key_len;
+    memcpy (p + 1, key_id, key_len);
+    verifyd_put_i64 (p + 1 + key_len, at);
+    c->out_len += item;
+    c->frame_count++;
+    return p + 1 + key_len + 8;
+}
+
+
+verifyd_status
+verifyd_add_generate (verifyd_client *c,
+                      const char     *key_id,
+                      int64_t         at)
+{
+    return add_item (c, VERIFYD_OP_GENERATE, key_id, at, 0) ? VERIFYD_OK : VERIFYD_ERR_ARGUMENT;
+}
+
+
+verifyd_status
+verifyd_add_validate (verifyd_client *c,
+                      const char     *key_id,
+                      int64_t         at,
+                      int             window,
+                      const char     *code)
+{
+    if (code == NULL || window < 0 || window > VERIFYD_MAX_WINDOW) {
+        return VERIFYD_ERR_ARGUMENT;
+    }
+    size_t code_len = strlen (code);
+    if (code_len > MAX_DIGITS) {
+        return VERIFYD_ERR_ARGUMENT;
+    }
+    uint8_t *p = add_item (c, VERIFYD_OP_VALIDATE, key_id, at, 2 + code_len);
+    if (p == NULL) {
+        return VERIFYD_ERR_ARGUMENT;
+    }
+    p[0] = (uint8_t)window;
+    p[1] = (uint8_t)code_len;
+    memcpy (p + 2, code, code_len);
+    return VERIFYD_OK;
+}
+
+
+verifyd_status
+verifyd_send (verifyd_client *c,
+              uint32_t       *id)
+{
+    if (c == NULL || c->frame_start == NO_FRAME) {
+        return VERIFYD_ERR_ARGUMENT;
+    }
+    verifyd_header h = {
+        .version = VERIFYD_VERSION,
+        .op = (uint8_t)c->frame_op,
+        .count = c->frame_count,
+        .id = c->next_id++
+    };
+    uint8_t *p = c->out + c->frame_start;
+    verifyd_put_u32 (p, (uint32_t)(c->out_len - c->frame_start - 4));
+    verifyd_put_header (p + 4, &h);
+    c->frame_start = NO_FRAME;
+    if (id) *id = h.id;
+    return VERIFYD_OK;
+}
+
+
+verifyd_status
+verifyd_flush (verifyd_client *c)
+{
+    if (c == NULL) {
+        return VERIFYD_ERR_ARGUMENT;
+    }
+    // Only complete frames go out; one still being built stays queued
+    size_t end = c->frame_start == NO_FRAME ? c->out_len : c->frame_start;
+    size_t off = 0;
+    while (off < end) {
+        ssize_t w = send (c->fd, c->out + off, end - off, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return VERIFYD_ERR_IO;
+        }
+        off += (size_t)w;
+    }
+    memmove (c->out, c->out + end, c->out_len - end);
+    c->out_len -= end;
+    if (c->frame_start != NO_FRAME) {
+        c->frame_start -= end;
+    }
+    return VERIFYD_OK;
+}
+
+
+static int
+read_full (int     fd,
+           void   *buf,
+           size_t  len)
+{
+    size_t off = 0;
+    while (off < len) {
+        ssize_t r = recv (fd, (uint8_t *)buf + off, len - off, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        off += (size_t)r;
+    }
+    return 0;
+}
+
+
+verifyd_status
+verifyd_recv (verifyd_client *c,
+              uint32_t       *id,
+              verifyd_result *out,
+              size_t          max,
+              size_t         *n)
+{
+    if (n) *n = 0;
+    verifyd_status st = verifyd_flush (c);
+    if (st != VERIFYD_OK) {
+        return st;
+    }
+
+    uint8_t len_le[4];
+    if (read_full (c->fd, len_le, 4) != 0) {
+        return VERIFYD_ERR_IO;
+    }
+    uint32_t len = verifyd_get_u32 (len_le);
+    if (len < VERIFYD_HEADER_SIZE || len > VERIFYD_MAX_FRAME) {
+        return VERIFYD_ERR_PROTOCOL;
+    }
+    if (reserve (&c->in, &c->in_cap, len) != 0) {
+        return VERIFYD_ERR_MEMORY;
+    }
+    if (read_full (c->fd, c->in, len) != 0) {
+        return VERIFYD_ERR_IO;
+    }
+
+    verifyd_header h;
+    verifyd_get_header (c->in, &h);
+    if (id) *id = h.id;
+    int op = h.op & ~VERIFYD_OP_RESPONSE;
+    if (h.version != VERIFYD_VERSION || !(h.op & VERIFYD_OP_RESPONSE) || op == VERIFYD_OP_ERROR ||
+        (op != VERIFYD_OP_GENERATE && op != VERIFYD_OP_VALIDATE)) {
+        return VERIFYD_ERR_PROTOCOL;
+    }
+
+    const uint8_t *p = c->in + VERIFYD_HEADER_SIZE;
+    const uint8_t *end = c->in + len;
+    for (size_t i = 0; i < h.count; i++) {
+        verifyd_result r = { .err = 0, .matched_delta = 0, .code = "" };
+        if (op == VERIFYD_OP_GENERATE) {
+            if (end - p < 2 || p[1] > MAX_DIGITS || end - p < 2 + p[1]) {
+                return VERIFYD_ERR_PROTOCOL;
+            }
+            r.err = p[0];
+            memcpy (r.code, p + 2, p[1]);
+            r.code[p[1]] = '\0';
+            p += 2 + p[1];
+        } else {
+            if (end - p < 3) {
+                return VERIFYD_ERR_PROTOCOL;
+            }
+            r.err = p[0];
+            r.matched_delta = (int16_t)verifyd_get_u16 (p + 1);
+            p += 3;
+        }
+        if (i < max && out) {
+            out[i] = r;
+        }
+    }
+    if (p != end) {
+        return VERIFYD_ERR_PROTOCOL;
+    }
+    if (n) *n = h.count;
+    return VERIFYD_OK;
+}
+
+
+static verifyd_status
+round_trip (verifyd_client *c,
+            verifyd_result *out)
+{
+    uint32_t sent, got;
+    size_t n;
+    verifyd_status st = verifyd_send (c, &sent);
+    if (st == VERIFYD_OK) {
+        st = verifyd_recv (c, &got, out, 1, &n);
+    }
+    if (st == VERIFYD_OK && (got != sent || n != 1)) {
+        st = VERIFYD_ERR_PROTOCOL;
+    }
+    return st;
+}
+
+
+verifyd_status
+verifyd_generate (verifyd_client *c,
+                  const char     *key_id,
+                  int64_t         at,
+                  verifyd_result *out)
+{
+    verifyd_status st = verifyd_begin (c, VERIFYD_OP_GENERATE);
+    if (st != VERIFYD_OK) {
+        return st;
+    }
+    st = verifyd_add_generate (c, key_id, at);
+    if (st != VERIFYD_OK) {
+        // Drop the half-built frame
+        c->out_len = c->frame_start;
+        c->frame_start = NO_FRAME;
+        return st;
+    }
+    return round_trip (c, out);
+}
+
+
+verifyd_status
+verifyd_validate (verifyd_client *c,
+                  const char     *key_id,
+                  const char     *code,
+                  int64_t         at,
+                  int             window,
+                  verifyd_result *out)
+{
+    verifyd_status st = verifyd_begin (c, VERIFYD_OP_VALIDATE);
+    if (st != VERIFYD_OK) {
+        return st;
+    }
+    st = verifyd_add_validate (c, key_id, at, window, code);
+    if (st != VERIFYD_OK) {
+        c->out_len = c->frame_start;
+        c->frame_start = NO_FRAME;
+        return st;
+    }
+    return round_trip (c, out);
+}
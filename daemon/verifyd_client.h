@@ -0,0 +1,80 @@
+#pragma once
+// Client for cotp-verifyd. A client is one connection and must not be shared between threads.
+//
+// Requests are built as frames: verifyd_begin(), then up to VERIFYD_MAX_ITEMS verifyd_add_*()
+// calls, then verifyd_send(), which only queues the frame. Several frames may be queued before
+// reading any response (pipelining); verifyd_recv() sends whatever is queued and returns the next
+// response, in request order. verifyd_generate() and verifyd_validate() do one round trip each
+// and expect no pipelined responses to be outstanding.
+#include <stddef.h>
+#include <stdint.h>
+#include "cotp.h"
+#include "verifyd_proto.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct verifyd_client verifyd_client;
+
+typedef enum {
+    VERIFYD_OK = 0,
+    VERIFYD_ERR_IO,           // connect/send/recv failed or the daemon closed the connection
+    VERIFYD_ERR_PROTOCOL,     // malformed response, or the daemon rejected the request
+    VERIFYD_ERR_ARGUMENT,     // bad argument, or the frame would exceed the protocol limits
+    VERIFYD_ERR_MEMORY
+} verifyd_status;
+
+typedef struct {
+    int  err;                      // cotp_error_t, or VERIFYD_UNKNOWN_KEY
+    int  matched_delta;            // validations: offset of the matching step
+    char code[MAX_DIGITS + 1];     // generations: the code, empty on error
+} verifyd_result;
+
+verifyd_client *verifyd_connect       (const char      *socket_path,
+                                       verifyd_status  *status);
+
+void            verifyd_close         (verifyd_client  *c);
+
+verifyd_status  verifyd_begin         (verifyd_client  *c,
+                                       int              op);
+
+verifyd_status  verifyd_add_generate  (verifyd_client  *c,
+                                       const char      *key_id,
+                                       int64_t          at);
+
+verifyd_status  verifyd_add_validate  (verifyd_client  *c,
+                                       const char      *key_id,
+                                       int64_t          at,
+                                       int              window,
+                                       const char      *code);
+
+// Queues the frame begun with verifyd_begin(); *id (optional) receives its request id
+verifyd_status  verifyd_send          (verifyd_client  *c,
+                                       uint32_t        *id);
+
+// Writes out every queued frame
+verifyd_status  verifyd_flush         (verifyd_client  *c);
+
+// Waits for the next response and stores up to `max` results; *n receives the item count
+verifyd_status  verifyd_recv          (verifyd_client  *c,
+                                       uint32_t        *id,
+                                       verifyd_result  *out,
+                                       size_t           max,
+                                       size_t          *n);
+
+verifyd_status  verifyd_generate      (verifyd_client  *c,
+                                       const char      *key_id,
+                                       int64_t          at,
+                                       verifyd_result  *out);
+
+verifyd_status  verifyd_validate      (verifyd_client  *c,
+                                       const char      *key_id,
+                                       const char      *code,
+                                       int64_t          at,
+                                       int              window,
+                                       verifyd_result  *out);
+
+#ifdef __cplusplus
+}
+#endif
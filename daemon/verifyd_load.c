@@ -0,0 +1,219 @@
+// Load generator for cotp-verifyd: each connection runs on its own thread and keeps `depth` frames
+// of `batch` items in flight, measuring the time from a frame's send to its response.
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "verifyd_client.h"
+
+#define LOAD_MAX_DEPTH    256
+#define LOAD_MAX_SAMPLES  (1u << 20)
+
+typedef struct {
+    const char *socket_path;
+    const char *key_id;
+    int         op;
+    int         batch;
+    int         depth;
+    int         window;
+    double      seconds;
+} load_config;
+
+typedef struct {
+    const load_config *cfg;
+    pthread_t          thread;
+    uint64_t           frames;
+    uint64_t           items;
+    uint64_t           errors;
+    double            *samples;   // frame latencies in microseconds
+    size_t             n_samples;
+    verifyd_result    *results;
+} load_worker;
+
+
+static double
+now_sec (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+
+static int
+queue_frame (verifyd_client    *c,
+             const load_config *cfg,
+             int64_t            at)
+{
+    if (verifyd_begin (c, cfg->op) != VERIFYD_OK) {
+        return -1;
+    }
+    for (int i = 0; i < cfg->batch; i++) {
+        verifyd_status st = cfg->op == VERIFYD_OP_GENERATE
+            ? verifyd_add_generate (c, cfg->key_id, at + i)
+            : verifyd_add_validate (c, cfg->key_id, at + i, cfg->window, "000000");
+        if (st != VERIFYD_OK) {
+            return -1;
+        }
+    }
+    return verifyd_send (c, NULL) == VERIFYD_OK ? 0 : -1;
+}
+
+
+static void *
+run_worker (void *arg)
+{
+    load_worker *w = arg;
+    const load_config *cfg = w->cfg;
+    verifyd_status st;
+    verifyd_client *c = verifyd_connect (cfg->socket_path, &st);
+    if (c == NULL) {
+        fprintf (stderr, "verifyd_load: cannot connect to %s\n", cfg->socket_path);
+        w->errors++;
+        return NULL;
+    }
+
+    double sent_at[LOAD_MAX_DEPTH];
+    int64_t at = 1700000000;
+    double deadline = now_sec () + cfg->seconds;
+    while (now_sec () < deadline) {
+        for (int d = 0; d < cfg->depth; d++) {
+            if (queue_frame (c, cfg, at) != 0) {
+                w->errors++;
+                goto out;
+            }
+            at += cfg->batch;
+            sent_at[d] = now_sec ();
+        }
+        for (int d = 0; d < cfg->depth; d++) {
+            size_t n;
+            if (verifyd_recv (c, NULL, w->results, (size_t)cfg->batch, &n) != VERIFYD_OK) {
+                w->errors++;
+                goto out;
+            }
+            double t = now_sec ();
+            if (w->n_samples < LOAD_MAX_SAMPLES) {
+                w->samples[w->n_samples++] = (t - sent_at[d]) * 1e6;
+            }
+            for (size_t i = 0; i < n; i++) {
+                int err = w->results[i].err;
+                if (err != NO_ERROR && err != VALID) {
+                    w->errors++;
+                }
+            }
+            w->frames++;
+            w->items += n;
+        }
+    }
+out:
+    verifyd_close (c);
+    return NULL;
+}
+
+
+static int
+compare_double (const void *a,
+                const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+
+static void
+usage (FILE *out)
+{
+    fprintf (out,
+             "usage: verifyd_load -s SOCKET -k KEY_ID [-c CONNECTIONS] [-b BATCH] [-d DEPTH]\n"
+             "                    [-t SECONDS] [-V WINDOW]\n"
+             "  -c  concurrent connections, one thread each (default 4)\n"
+             "  -b  items per frame (default 16)\n"
+             "  -d  frames in flight per connection (default 4)\n"
+             "  -t  duration in seconds (default 5)\n"
+             "  -V  send validations with this window instead of generations\n");
+}
+
+
+int
+main (int argc, char **argv)
+{
+    load_config cfg = {
+        .op = VERIFYD_OP_GENERATE, .batch = 16, .depth = 4, .window = 0, .seconds = 5
+    };
+    int conns = 4;
+    int opt;
+    while ((opt = getopt (argc, argv, "s:k:c:b:d:t:V:h")) != -1) {
+        switch (opt) {
+        case 's': cfg.socket_path = optarg; break;
+        case 'k': cfg.key_id = optarg; break;
+        case 'c': conns = atoi (optarg); break;
+        case 'b': cfg.batch = atoi (optarg); break;
+        case 'd': cfg.depth = atoi (optarg); break;
+        case 't': cfg.seconds = atof (optarg); break;
+        case 'V': cfg.op = VERIFYD_OP_VALIDATE; cfg.window = atoi (optarg); break;
+        case 'h': usage (stdout); return 0;
+        default: usage (stderr); return 2;
+        }
+    }
+    if (cfg.socket_path == NULL || cfg.key_id == NULL || conns < 1 || cfg.batch < 1 ||
+        cfg.batch > VERIFYD_MAX_ITEMS || cfg.depth < 1 || cfg.depth > LOAD_MAX_DEPTH ||
+        cfg.window < 0 || cfg.window > VERIFYD_MAX_WINDOW) {
+        usage (stderr);
+        return 2;
+    }
+
+    load_worker *workers = calloc ((size_t)conns, sizeof(load_worker));
+    if (workers == NULL) {
+        return 1;
+    }
+    for (int i = 0; i < conns; i++) {
+        workers[i].cfg = &cfg;
+        workers[i].samples = malloc (LOAD_MAX_SAMPLES * sizeof(double));
+        workers[i].results = malloc ((size_t)cfg.batch * sizeof(verifyd_result));
+        if (workers[i].samples == NULL || workers[i].results == NULL) {
+            return 1;
+        }
+    }
+    double start = now_sec ();
+    for (int i = 0; i < conns; i++) {
+        pthread_create (&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+    uint64_t frames = 0, items = 0, errors = 0;
+    size_t n_samples = 0;
+    for (int i = 0; i < conns; i++) {
+        pthread_join (workers[i].thread, NULL);
+        frames += workers[i].frames;
+        items += workers[i].items;
+        errors += workers[i].errors;
+        n_samples += workers[i].n_samples;
+    }
+    double elapsed = now_sec () - start;
+
+    double *all = malloc ((n_samples ? n_samples : 1) * sizeof(double));
+    if (all == NULL) {
+        return 1;
+    }
+    size_t k = 0;
+    for (int i = 0; i < conns; i++) {
+        memcpy (all + k, workers[i].samples, workers[i].n_samples * sizeof(double));
+        k += workers[i].n_samples;
+        free (workers[i].samples);
+        free (workers[i].results);
+    }
+    qsort (all, n_samples, sizeof(double), compare_double);
+
+    printf ("%s: %d connections, batch %d, depth %d, %.1f s\n",
+            cfg.op == VERIFYD_OP_GENERATE ? "generate" : "validate", conns, cfg.batch, cfg.depth, elapsed);
+    printf ("  %.0f items/s, %.0f frames/s, %llu errors\n",
+            (double)items / elapsed, (double)frames / elapsed, (unsigned long long)errors);
+    if (n_samples > 0) {
+        printf ("  frame latency us: p50 %.1f  p99 %.1f  max %.1f\n",
+                all[n_samples / 2], all[n_samples * 99 / 100], all[n_samples - 1]);
+    }
+    free (all);
+    free (workers);
+    return errors ? 1 : 0;
+}
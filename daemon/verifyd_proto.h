@@ -0,0 +1,118 @@
+#pragma once
+// Wire format shared by cotp-verifyd and its client library.
+//
+// Every message is a frame: a little-endian u32 holding the number of bytes that follow, then a
+// fixed header and `count` items of the frame's operation:
+//
+//   u8  version      VERIFYD_VERSION
+//   u8  op           VERIFYD_OP_*; responses set VERIFYD_OP_RESPONSE
+//   u16 count        items in this frame
+//   u32 id           chosen by the client, echoed in the response
+//
+// Request items (key ids are at most 255 bytes, `at` is a little-endian i64):
+//   GENERATE   u8 key_len, key_id, i64 at
+//   VALIDATE   u8 key_len, key_id, i64 at, u8 window, u8 code_len, code
+//
+// `at` is the timestamp for TOTP keys or the counter for HOTP keys; VERIFYD_AT_NOW asks for the
+// daemon's clock. VALIDATE checks steps [-window, +window] around `at` for TOTP keys and counters
+// [at, at + window] for HOTP keys.
+//
+// Response items, one per request item and in the same order:
+//   GENERATE   u8 err, u8 code_len, code
+//   VALIDATE   u8 err, i16 matched_delta
+//
+// `err` is a cotp_error_t (VALID on a successful validation, NO_ERROR on a miss) or
+// VERIFYD_UNKNOWN_KEY. A request the daemon cannot parse is answered with a VERIFYD_OP_ERROR frame
+// carrying its id and no items. Clients may pipeline frames; responses come back in order.
+#include <stdint.h>
+#include <string.h>
+
+#define VERIFYD_VERSION        1
+#define VERIFYD_HEADER_SIZE    8
+#define VERIFYD_MAX_FRAME      (256 * 1024)
+#define VERIFYD_MAX_ITEMS      4096
+#define VERIFYD_MAX_KEY_ID     255
+#define VERIFYD_MAX_WINDOW     16
+#define VERIFYD_AT_NOW         INT64_MIN
+
+#define VERIFYD_OP_GENERATE    1
+#define VERIFYD_OP_VALIDATE    2
+#define VERIFYD_OP_ERROR       0x7f
+#define VERIFYD_OP_RESPONSE    0x80
+
+#define VERIFYD_UNKNOWN_KEY    0xff
+
+typedef struct {
+    uint8_t  version;
+    uint8_t  op;
+    uint16_t count;
+    uint32_t id;
+} verifyd_header;
+
+static inline void
+verifyd_put_u16 (uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void
+verifyd_put_u32 (uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static inline void
+verifyd_put_i64 (uint8_t *p, int64_t v)
+{
+    uint64_t u = (uint64_t)v;
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(u >> (8 * i));
+    }
+}
+
+static inline uint16_t
+verifyd_get_u16 (const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t
+verifyd_get_u32 (const uint8_t *p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        v |= (uint32_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+static inline int64_t
+verifyd_get_i64 (const uint8_t *p)
+{
+    uint64_t u = 0;
+    for (int i = 0; i < 8; i++) {
+        u |= (uint64_t)p[i] << (8 * i);
+    }
+    return (int64_t)u;
+}
+
+static inline void
+verifyd_put_header (uint8_t *p, const verifyd_header *h)
+{
+    p[0] = h->version;
+    p[1] = h->op;
+    verifyd_put_u16 (p + 2, h->count);
+    verifyd_put_u32 (p + 4, h->id);
+}
+
+static inline void
+verifyd_get_header (const uint8_t *p, verifyd_header *h)
+{
+    h->version = p[0];
+    h->op = p[1];
+    h->count = verifyd_get_u16 (p + 2);
+    h->id = verifyd_get_u32 (p + 4);
+}
@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <string.h>
+#include "otp_internal.h"
+#include "utils/pool.h"
+#include "utils/profile.h"
+#include "utils/metrics.h"
+#include "utils/secure_zero.h"
+#include "utils/digits.h"
+
+// Jobs handed to a worker at a time: large enough to amortize a steal, small enough to balance
+#define BATCH_CHUNK 256
+
+// Sort record for one job: jobs are run grouped by algorithm, then key, so each chunk feeds
+// one kind of handle; the original index breaks ties to keep the permutation deterministic.
+typedef struct {
+    int       algo;
+    uintptr_t key;
+    size_t    index;
+} batch_slot;
+
+typedef struct {
+    cotp_otp_job     *jobs;
+    const batch_slot *order;
+    otp_scratch      *scratch;
+} batch_run;
+
+static int
+job_algo (const cotp_otp_job *job)
+{
+    if (job->key != NULL) {
+        return job->key->algo;
+    }
+    return job->type == COTP_JOB_STEAM ? COTP_SHA1 : job->sha_algo;
+}
+
+
+static int
+compare_slots (const void *a,
+               const void *b)
+{
+    const batch_slot *x = a;
+    const batch_slot *y = b;
+    if (x->algo != y->algo) {
+        return x->algo < y->algo ? -1 : 1;
+    }
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+
+cotp_error_t
+otp_scratch_key (otp_scratch     *ws,
+                 const cotp_key  *key,
+                 const char      *base32_encoded_secret,
+                 int              algo,
+                 whmac_handle_t **hd)
+{
+    if (ws->hd[algo] == NULL) {
+        COTP_PROF_START (t_handle);
+        ws->hd[algo] = whmac_gethandle (algo);
+        COTP_PROF_STOP (COTP_STAGE_HMAC_GETHANDLE, t_handle);
+        if (ws->hd[algo] == NULL) {
+            return WHMAC_ERROR;
+        }
+    }
+
+    if (key != NULL) {
+        if (ws->keyed[algo] != key) {
+            COTP_PROF_START (t_setkey);
+            int rc = whmac_setkey (ws->hd[algo], key->secret, key->secret_len);
+            COTP_PROF_STOP (COTP_STAGE_HMAC_SETKEY, t_setkey);
+            if (rc != NO_ERROR) {
+                ws->keyed[algo] = NULL;
+                return WHMAC_ERROR;
+            }
+            ws->keyed[algo] = key;
+        }
+    } else {
+        cotp_error_t err;
+        size_t secret_len = 0;
+        uint8_t *secret = otp_decode_secret (base32_encoded_secret, &secret_len, &err);
+        if (secret == NULL) {
+            return err;
+        }
+        COTP_PROF_START (t_setkey);
+        int rc = whmac_setkey (ws->hd[algo], secret, secret_len);
+        COTP_PROF_STOP (COTP_STAGE_HMAC_SETKEY, t_setkey);
+        cotp_secure_memzero (secret, secret_len);
+        free (secret);
+        ws->keyed[algo] = NULL;
+        if (rc != NO_ERROR) {
+            return WHMAC_ERROR;
+        }
+    }
+
+    *hd = ws->hd[algo];
+    return NO_ERROR;
+}
+
+
+void
+otp_scratch_release (otp_scratch *ws)
+{
+    for (int a = 0; a < 3; a++) {
+        whmac_freehandle (ws->hd[a]);
+        ws->hd[a] = NULL;
+        ws->keyed[a] = NULL;
+    }
+}
+
+
+cotp_error_t
+otp_scratch_job (otp_scratch  *ws,
+                 cotp_otp_job *job)
+{
+    if (job->type != COTP_JOB_HOTP && job->type != COTP_JOB_TOTP && job->type != COTP_JOB_STEAM) {
+        return INVALID_USER_INPUT;
+    }
+    if (job->key == NULL && job->base32_encoded_secret == NULL) {
+        return INVALID_USER_INPUT;
+    }
+    int steam = job->type == COTP_JOB_STEAM;
+    int algo = job_algo (job);
+    if (algo != COTP_SHA1 && algo != COTP_SHA256 && algo != COTP_SHA512) {
+        return INVALID_ALGO;
+    }
+    if (steam && algo != COTP_SHA1) {
+        return INVALID_ALGO;
+    }
+    if (!steam && (job->digits < MIN_DIGITS || job->digits > MAX_DIGITS)) {
+        return INVALID_DIGITS;
+    }
+    long counter = job->counter;
+    if (job->type != COTP_JOB_HOTP) {
+        if (job->period <= 0 || job->period > 120) {
+            return INVALID_PERIOD;
+        }
+        counter /= job->period;
+    }
+    if (counter < 0) {
+        return INVALID_COUNTER;
+    }
+
+    whmac_handle_t *hd;
+    cotp_error_t err = otp_scratch_key (ws, job->key, job->base32_encoded_secret, algo, &hd);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    uint32_t bin_code;
+    err = otp_hmac_token (hd, counter, &bin_code);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    COTP_PROF_START (t_format);
+    if (steam) {
+        otp_steam_format (bin_code, job->code);
+    } else {
+        otp_code_format (bin_code, job->digits, job->code);
+    }
+    COTP_PROF_STOP (COTP_STAGE_FORMAT, t_format);
+
+    return NO_ERROR;
+}
+
+
+static void
+run_chunk (void   *arg,
+           size_t  begin,
+           size_t  end,
+           int     worker)
+{
+    batch_run *run = arg;
+    otp_scratch *ws = &run->scratch[worker];
+    for (size_t i = begin; i < end; i++) {
+        cotp_otp_job *job = &run->jobs[run->order[i].index];
+        job->code[0] = '\0';
+        job->err = otp_scratch_job (ws, job);
+        COTP_METRIC_GENERATED (job_algo (job), job->err);
+    }
+}
+
+
+cotp_error_t
+cotp_otp_batch (cotp_otp_job *jobs,
+                size_t        n,
+                cotp_pool    *pool)
+{
+    if (n == 0) {
+        return NO_ERROR;
+    }
+    if (jobs == NULL || n > SIZE_MAX / sizeof(batch_slot)) {
+        return INVALID_USER_INPUT;
+    }
+
+    // One-shot backend initialization must happen before any worker touches a handle
+    if (whmac_check () == -1) {
+        return WCRYPT_VERSION_MISMATCH;
+    }
+
+    batch_slot *order = malloc (n * sizeof(batch_slot));
+    otp_scratch *scratch = calloc ((size_t)pool_size (pool), sizeof(otp_scratch));
+    if (order == NULL || scratch == NULL) {
+        free (order);
+        free (scratch);
+        return MEMORY_ALLOCATION_ERROR;
+    }
+    for (size_t i = 0; i < n; i++) {
+        order[i].algo = job_algo (&jobs[i]);
+        order[i].key = (uintptr_t)jobs[i].key;
+        order[i].index = i;
+    }
+    qsort (order, n, sizeof(batch_slot), compare_slots);
+
+    batch_run run = { .jobs = jobs, .order = order, .scratch = scratch };
+    pool_run (pool, run_chunk, &run, n, BATCH_CHUNK);
+
+    for (int w = 0; w < pool_size (pool); w++) {
+        otp_scratch_release (&scratch[w]);
+    }
+    free (scratch);
+    free (order);
+
+    return NO_ERROR;
+}
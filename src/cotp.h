@@ -24,6 +24,9 @@
 #define MIN_DIGITS 4
 #define MAX_DIGITS 10
 
+// Length of a Steam Guard code (always SHA-1, base-26 alphabet)
+#define COTP_STEAM_DIGITS 5
+
 typedef enum cotp_error {
     NO_ERROR = 0,
     VALID,
@@ -37,12 +40,97 @@ typedef enum cotp_error {
     EMPTY_STRING,
     MISSING_LEADING_ZERO,
     INVALID_COUNTER,
-    WHMAC_ERROR
+    WHMAC_ERROR,
+    REPLAY_DETECTED
 } cotp_error_t;
 
 // Opaque context for repeated OTP computations (optional ergonomic API)
 typedef struct cotp_ctx cotp_ctx;
 
+// Opaque pre-keyed secret: Base32 decoding and HMAC key setup are done once at creation
+typedef struct cotp_key cotp_key;
+
+// Opaque table of precomputed TOTP tokens keyed by (key id, time step)
+typedef struct cotp_totp_cache cotp_totp_cache;
+
+// Opaque record of accepted (key id, time step) pairs used to reject replayed TOTP codes
+typedef struct cotp_replay_cache cotp_replay_cache;
+
+// Opaque per-account estimate of clock drift, used to center TOTP validation windows
+typedef struct cotp_drift_tracker cotp_drift_tracker;
+
+// Opaque key store in a shared memory segment: one writer process, lock-free readers in any process
+typedef struct cotp_keystore cotp_keystore;
+
+// Longest decoded secret a cotp_keystore slot holds
+#define COTP_KEYSTORE_MAX_SECRET_LEN 128
+
+// Opaque worker pool backing the batch API
+typedef struct cotp_pool cotp_pool;
+
+#define COTP_POOL_MAX_THREADS 1024
+
+typedef enum {
+    COTP_JOB_HOTP  = 0,
+    COTP_JOB_TOTP  = 1,
+    COTP_JOB_STEAM = 2     // Steam Guard TOTP: SHA-1 and COTP_STEAM_DIGITS characters, `digits` is ignored
+} cotp_job_type;
+
+// One code to generate with cotp_otp_batch(). Inputs are read-only; `code` and `err` are written.
+typedef struct {
+    cotp_job_type type;
+    const char   *base32_encoded_secret;  // used when `key` is NULL
+    cotp_key     *key;                    // optional pre-keyed secret; its algorithm overrides sha_algo
+    long          counter;                // HOTP counter, or TOTP / Steam timestamp
+    int           digits;
+    int           period;                 // TOTP and Steam only
+    int           sha_algo;               // ignored by Steam jobs, which always use SHA-1
+    char          code[MAX_DIGITS + 1];   // out: zero-padded code, empty on error
+    cotp_error_t  err;                    // out: NO_ERROR or the same errors as get_hotp / get_totp_at
+} cotp_otp_job;
+
+// One code to check with cotp_validate_batch(). Inputs are read-only; `matched_delta` and `err` are written.
+typedef struct {
+    const char   *base32_encoded_secret;  // used when `key` is NULL
+    cotp_key     *key;                    // optional pre-keyed secret; its algorithm overrides sha_algo
+    const char   *user_code;
+    long          timestamp;
+    int           digits;
+    int           period;
+    int           sha_algo;
+    int           window;                 // as for validate_totp_in_window
+    int           matched_delta;          // out: offset of the matching step, 0 otherwise
+    cotp_error_t  err;                    // out: VALID on a match, NO_ERROR on a miss, otherwise the error
+} cotp_validate_job;
+
+// Opaque submission/completion queue served by its own worker threads
+typedef struct cotp_queue cotp_queue;
+
+typedef enum {
+    COTP_ASYNC_GENERATE      = 0,   // generate job.code, as cotp_otp_batch does
+    COTP_ASYNC_VALIDATE_TOTP = 1    // match user_code around job.counter (requires COTP_ENABLE_VALIDATION)
+} cotp_async_op;
+
+// One request for cotp_queue_submit(). The struct is copied, but a secret string or cotp_key it
+// points to must stay valid until the matching completion has been polled.
+typedef struct {
+    cotp_async_op op;
+    uint64_t      user_data;                  // handed back unchanged in the completion
+    cotp_otp_job  job;                        // inputs as for cotp_otp_batch; for VALIDATE_TOTP, `counter` is
+                                              // the timestamp and `type` is ignored
+    int           window;                     // VALIDATE_TOTP only
+    char          user_code[MAX_DIGITS + 1];  // VALIDATE_TOTP only
+} cotp_async_request;
+
+typedef struct {
+    uint64_t      user_data;
+    cotp_async_op op;
+    cotp_error_t  err;                        // GENERATE: as cotp_otp_job.err. VALIDATE_TOTP: VALID on a match,
+                                              // NO_ERROR on a miss, otherwise the error
+    int           matched_delta;              // VALIDATE_TOTP: offset of the matching step
+    char          code[MAX_DIGITS + 1];       // GENERATE: the code, empty on error
+} cotp_async_completion;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -66,6 +154,81 @@ COTP_API COTP_WUR int validate_totp_in_window(const char* user_code,
                             int*        matched_delta,
                             cotp_error_t* err_code);
 
+/**
+ * validate_totp_in_window_ct
+ *
+ * Same contract as validate_totp_in_window, but the run time does not depend on which offset matched.
+ * All 2*window+1 codes are generated from one keyed HMAC handle. The parsed user code is then compared
+ * against every one of them with branchless masks (no early exit). On several matches the most
+ * negative offset wins, as in validate_totp_in_window.
+ */
+COTP_API COTP_WUR int validate_totp_in_window_ct(const char* user_code,
+                            const char* base32_encoded_secret,
+                            long        timestamp,
+                            int         digits,
+                            int         period,
+                            int         sha_algo,
+                            int         window,
+                            int*        matched_delta,
+                            cotp_error_t* err_code);
+
+/**
+ * validate_totp_in_window_nearest
+ *
+ * validate_totp_in_window that tries the offsets by distance from now: 0, -1, +1, -2, +2, ... up to
+ * ±window. Most codes match at 0 or -1, so a valid code usually costs one or two HMACs instead of
+ * window + 1. When two offsets produce the same code the nearer one is reported.
+ */
+COTP_API COTP_WUR int validate_totp_in_window_nearest(const char*   user_code,
+                            const char*   base32_encoded_secret,
+                            long          timestamp,
+                            int           digits,
+                            int           period,
+                            int           sha_algo,
+                            int           window,
+                            int*          matched_delta,
+                            cotp_error_t* err_code);
+
+/**
+ * validate_totp_in_order
+ *
+ * Validates against exactly the offsets in `deltas` (in periods, each in [-1024, 1024]), tried in the
+ * given order, e.g. sorted by how often each offset matched in the past. Returns 1 and the first
+ * offset that matches. `n_deltas` must be in [1, 2049]; NULL deltas => INVALID_USER_INPUT.
+ */
+COTP_API COTP_WUR int validate_totp_in_order(const char*   user_code,
+                            const char*   base32_encoded_secret,
+                            long          timestamp,
+                            int           digits,
+                            int           period,
+                            int           sha_algo,
+                            const int*    deltas,
+                            size_t        n_deltas,
+                            int*          matched_delta,
+                            cotp_error_t* err_code);
+
+/**
+ * validate_totp_in_window_pool
+ *
+ * validate_totp_in_window with the window split over the workers of `pool`. Each worker keys its own
+ * HMAC handle, and workers stop once a match is found for a lower offset than anything they have left.
+ * Results are identical to the sequential scan, including the reported offset.
+ * Windows smaller than COTP_POOL_VALIDATION_MIN_WINDOW, a NULL pool or a one-thread pool run on the
+ * calling thread. Do not call from a job running on the same pool.
+ */
+#define COTP_POOL_VALIDATION_MIN_WINDOW 64
+
+COTP_API COTP_WUR int validate_totp_in_window_pool(const char*   user_code,
+                            const char*   base32_encoded_secret,
+                            long          timestamp,
+                            int           digits,
+                            int           period,
+                            int           sha_algo,
+                            int           window,
+                            cotp_pool*    pool,
+                            int*          matched_delta,
+                            cotp_error_t* err_code);
+
 /**
  * cotp_ctx_validate_totp
  *
@@ -79,6 +242,431 @@ COTP_API COTP_WUR int cotp_ctx_validate_totp(cotp_ctx* ctx,
                             int           window,
                             int*          matched_delta,
                             cotp_error_t* err);
+
+/**
+ * cotp_replay_cache_create
+ *
+ * Creates a sharded, thread-safe record of accepted codes sized for about `capacity` simultaneously
+ * live (key id, time step) pairs. Memory is allocated up front. Release with cotp_replay_cache_free().
+ */
+COTP_API COTP_WUR cotp_replay_cache *cotp_replay_cache_create (size_t        capacity,
+                                                               cotp_error_t *err);
+
+/**
+ * cotp_replay_cache_free
+ *
+ * Releases the cache. NULL-safe.
+ */
+COTP_API void cotp_replay_cache_free (cotp_replay_cache *rc);
+
+/**
+ * cotp_replay_cache_check_and_mark
+ *
+ * Atomically checks whether (key_id, step) was already accepted and, if not, records it. The record
+ * expires at (step + window + 1) * period, the first moment no validation with that period and window
+ * can match `step` any more; `now` is the current timestamp and drives expiry.
+ * Returns 1 if the pair is fresh (and is now marked), 0 with REPLAY_DETECTED if it was already accepted,
+ * 0 with MEMORY_ALLOCATION_ERROR if the shard is full of live entries (fails closed).
+ */
+COTP_API COTP_WUR int cotp_replay_cache_check_and_mark (cotp_replay_cache *rc,
+                                                        uint64_t           key_id,
+                                                        long               step,
+                                                        int                period,
+                                                        int                window,
+                                                        long               now,
+                                                        cotp_error_t      *err);
+
+/**
+ * validate_totp_in_window_once
+ *
+ * validate_totp_in_window followed by cotp_replay_cache_check_and_mark on the matched step, using
+ * `timestamp` as the current time. Returns 1 with VALID only the first time a code is accepted for
+ * `key_id` and step; a reuse within the window returns 0 with REPLAY_DETECTED.
+ */
+COTP_API COTP_WUR int validate_totp_in_window_once(cotp_replay_cache* rc,
+                            uint64_t      key_id,
+                            const char*   user_code,
+                            const char*   base32_encoded_secret,
+                            long          timestamp,
+                            int           digits,
+                            int           period,
+                            int           sha_algo,
+                            int           window,
+                            int*          matched_delta,
+                            cotp_error_t* err_code);
+
+/**
+ * cotp_drift_tracker_create
+ *
+ * Creates a sharded, thread-safe table of per-account drift estimates sized for about `capacity`
+ * key ids. Memory is allocated up front. Release with cotp_drift_tracker_free().
+ */
+COTP_API COTP_WUR cotp_drift_tracker *cotp_drift_tracker_create (size_t        capacity,
+                                                                 cotp_error_t *err);
+
+/**
+ * cotp_drift_tracker_free
+ *
+ * Releases the tracker. NULL-safe.
+ */
+COTP_API void cotp_drift_tracker_free (cotp_drift_tracker *dt);
+
+/**
+ * cotp_drift_tracker_record
+ *
+ * Folds a matched offset (in periods, as reported by matched_delta) into the estimate for `key_id`:
+ * the first offset is taken as is, later ones move the estimate a quarter of the way towards them.
+ * Returns INVALID_USER_INPUT for |delta| > 1024 and MEMORY_ALLOCATION_ERROR if the key id is new
+ * and its shard is full.
+ */
+COTP_API cotp_error_t cotp_drift_tracker_record (cotp_drift_tracker *dt,
+                                                 uint64_t            key_id,
+                                                 int                 delta);
+
+/**
+ * cotp_drift_tracker_expected
+ *
+ * Returns the estimate for `key_id` rounded to whole periods, or 0 for an unknown key id.
+ */
+COTP_API COTP_WUR int cotp_drift_tracker_expected (cotp_drift_tracker *dt,
+                                                   uint64_t            key_id);
+
+/**
+ * cotp_drift_tracker_forget
+ *
+ * Drops the estimate for `key_id`, e.g. when its secret is replaced. No-op for an unknown key id.
+ */
+COTP_API void cotp_drift_tracker_forget (cotp_drift_tracker *dt,
+                                         uint64_t            key_id);
+
+/**
+ * validate_totp_with_drift
+ *
+ * validate_totp_in_window that searches [e - narrow_window, e + narrow_window] first, where e is the
+ * expected offset of `key_id`, and the rest of [-wide_window, wide_window] only on a miss. Offsets
+ * outside the wide window are never accepted. A match is recorded in the tracker, so accounts with a
+ * steady drift cost about 2 * narrow_window + 1 HMACs per valid code. Offsets are tried in ascending
+ * order within each part, so when two offsets produce the same code the reported one may differ from
+ * validate_totp_in_window. Both windows must be in [0, 1024].
+ */
+COTP_API COTP_WUR int validate_totp_with_drift(cotp_drift_tracker* dt,
+                            uint64_t      key_id,
+                            const char*   user_code,
+                            const char*   base32_encoded_secret,
+                            long          timestamp,
+                            int           digits,
+                            int           period,
+                            int           sha_algo,
+                            int           narrow_window,
+                            int           wide_window,
+                            int*          matched_delta,
+                            cotp_error_t* err_code);
+
+/**
+ * validate_hotp_in_window
+ *
+ * Validates a user-provided HOTP code against counters [counter, counter + look_ahead] (RFC 4226 §7.2).
+ * Returns 1 on match and stores the counter that matched in *matched_counter; the caller should persist
+ * matched_counter + 1 as the next expected counter. Returns 0 otherwise (*matched_counter = -1).
+ * The secret is decoded and keyed once for the whole scan. `look_ahead` must be in [0, 1024].
+ */
+COTP_API COTP_WUR int validate_hotp_in_window(const char*   user_code,
+                            const char*   base32_encoded_secret,
+                            long          counter,
+                            int           digits,
+                            int           sha_algo,
+                            int           look_ahead,
+                            long*         matched_counter,
+                            cotp_error_t* err_code);
+
+/**
+ * cotp_hotp_resync
+ *
+ * RFC 4226 §7.4 resynchronization: looks for a counter c in [counter, counter + look_ahead] such that
+ * first_code is the code for c and second_code the code for c + 1. Returns 1 on success with
+ * *matched_counter = c + 1 (persist matched_counter + 1), 0 otherwise. Same arguments and error
+ * reporting as validate_hotp_in_window.
+ */
+COTP_API COTP_WUR int cotp_hotp_resync(const char*   first_code,
+                            const char*   second_code,
+                            const char*   base32_encoded_secret,
+                            long          counter,
+                            int           digits,
+                            int           sha_algo,
+                            int           look_ahead,
+                            long*         matched_counter,
+                            cotp_error_t* err_code);
+
+/**
+ * cotp_ctx_validate_hotp
+ *
+ * Context-API wrapper around validate_hotp_in_window. Uses ctx->digits and ctx->algo.
+ */
+COTP_API COTP_WUR int cotp_ctx_validate_hotp(cotp_ctx* ctx,
+                            const char*   user_code,
+                            const char*   base32_encoded_secret,
+                            long          counter,
+                            int           look_ahead,
+                            long*         matched_counter,
+                            cotp_error_t* err);
+
+/**
+ * cotp_totp_cache_create
+ *
+ * Creates a cache holding up to `max_keys` secrets that all share digits/period/sha_algo.
+ * For every key, cotp_totp_cache_refresh() precomputes the tokens of the steps around the given
+ * timestamp (previous, current and the two following ones) so that cotp_totp_cache_validate()
+ * is a table lookup in the common case. Memory is fixed at creation; tokens of older steps are
+ * overwritten by newer ones. Release with cotp_totp_cache_free(). Returns NULL and sets *err on error.
+ * All cache functions are thread-safe.
+ */
+COTP_API COTP_WUR cotp_totp_cache *cotp_totp_cache_create (size_t        max_keys,
+                                                           int           digits,
+                                                           int           period,
+                                                           int           sha_algo,
+                                                           cotp_error_t *err);
+
+/**
+ * cotp_totp_cache_free
+ *
+ * Releases the cache and securely wipes every stored secret. NULL-safe.
+ */
+COTP_API void cotp_totp_cache_free (cotp_totp_cache *cache);
+
+/**
+ * cotp_totp_cache_enable_index
+ *
+ * Enables the reverse index used by cotp_totp_cache_find(). The index holds one sorted
+ * (token, key id) array per cached step, preallocated for max_keys entries; each refresh only
+ * rebuilds the arrays of the steps it computed. Calling it twice is a no-op.
+ */
+COTP_API COTP_WUR cotp_error_t cotp_totp_cache_enable_index (cotp_totp_cache *cache);
+
+/**
+ * cotp_totp_cache_add_key
+ *
+ * Registers (or replaces) the secret for `key_id`. Returns NO_ERROR on success, the decoding error
+ * for an invalid secret, or MEMORY_ALLOCATION_ERROR when the cache already holds max_keys keys.
+ */
+COTP_API COTP_WUR cotp_error_t cotp_totp_cache_add_key (cotp_totp_cache *cache,
+                                                        uint64_t         key_id,
+                                                        const char      *base32_encoded_secret);
+
+/**
+ * cotp_totp_cache_remove_key
+ *
+ * Forgets `key_id` and wipes its secret. Returns INVALID_USER_INPUT if the id is unknown.
+ */
+COTP_API COTP_WUR cotp_error_t cotp_totp_cache_remove_key (cotp_totp_cache *cache,
+                                                           uint64_t         key_id);
+
+/**
+ * cotp_totp_cache_refresh
+ *
+ * Precomputes the tokens for steps [s-1, s+2] of every key, where s = timestamp / period. Steps that
+ * are already present are skipped, so calling it once per period (see cotp_totp_cache_next_refresh)
+ * only computes one new HMAC per key. Meant to be driven from a background thread.
+ */
+COTP_API COTP_WUR cotp_error_t cotp_totp_cache_refresh (cotp_totp_cache *cache,
+                                                        long             timestamp);
+
+/**
+ * cotp_totp_cache_next_refresh
+ *
+ * Returns the timestamp at which the next refresh should run: the last second of the current period.
+ * Returns -1 for a NULL cache or a negative timestamp.
+ */
+COTP_API COTP_WUR long cotp_totp_cache_next_refresh (const cotp_totp_cache *cache,
+                                                     long                   timestamp);
+
+/**
+ * cotp_totp_cache_validate
+ *
+ * Same contract as validate_totp_in_window for the secret registered under `key_id`. Steps held by
+ * the cache are compared without computing an HMAC; other steps are computed on the fly.
+ * An unknown key_id returns 0 with INVALID_USER_INPUT.
+ */
+COTP_API COTP_WUR int cotp_totp_cache_validate (cotp_totp_cache *cache,
+                                                uint64_t         key_id,
+                                                const char      *user_code,
+                                                long             timestamp,
+                                                int              window,
+                                                int             *matched_delta,
+                                                cotp_error_t    *err);
+
+/**
+ * cotp_totp_cache_find
+ *
+ * Resolves a code received without an account to the keys that produced it. Searches the indexed steps
+ * within [-window, +window] of `timestamp` (steps not yet refreshed are skipped, no HMAC is computed) and
+ * confirms each candidate against the live cache entry with a timing-safe compare.
+ * Writes up to `max_ids` key ids (and, if non-NULL, the matching deltas) and returns the total number of
+ * matching keys, which may exceed max_ids. err is VALID if at least one key matched, NO_ERROR if none did,
+ * INVALID_USER_INPUT if the index is not enabled.
+ */
+COTP_API COTP_WUR size_t cotp_totp_cache_find (cotp_totp_cache *cache,
+                                               const char      *user_code,
+                                               long             timestamp,
+                                               int              window,
+                                               uint64_t        *key_ids,
+                                               int             *matched_deltas,
+                                               size_t           max_ids,
+                                               cotp_error_t    *err);
+#endif
+
+// Operations reported to tracing hooks
+typedef enum {
+    COTP_TRACE_HOTP = 0,       // get_hotp
+    COTP_TRACE_TOTP,           // get_totp / get_totp_at
+    COTP_TRACE_STEAM_TOTP,     // get_steam_totp / get_steam_totp_at
+    COTP_TRACE_VALIDATE_TOTP,  // validate_totp_in_window
+    COTP_TRACE_VALIDATE_HOTP,  // validate_hotp_in_window
+    COTP_TRACE_URI_PARSE,      // cotp_otpauth_uri_parse
+    COTP_TRACE_URI_BUILD       // cotp_otpauth_uri_build
+} cotp_trace_op;
+
+// Describes one traced call. Never carries secrets, codes or URIs.
+typedef struct {
+    cotp_trace_op op;
+    int           algo;         // COTP_SHA1/256/512 as passed by the caller, -1 for URI parsing
+    int           window;       // validation window or look-ahead, 0 for generation
+    uint64_t      duration_ns;  // end events only
+    cotp_error_t  err;          // end events only: the error the call reported
+} cotp_trace_event;
+
+typedef struct {
+    void (*begin) (const cotp_trace_event *ev, void *user_data);  // optional
+    void (*end)   (const cotp_trace_event *ev, void *user_data);  // optional
+    void  *user_data;
+} cotp_trace_hooks;
+
+/**
+ * cotp_trace_set_hooks
+ *
+ * Installs process-wide tracing hooks, or removes them when `hooks` is NULL. Callbacks run on the
+ * calling thread, before and after the traced operation, and must be thread-safe. The struct is used
+ * in place: keep it alive and unchanged while installed, and after removing it until calls that
+ * started earlier have returned. A call that began with hooks installed always gets its end event.
+ */
+COTP_API void cotp_trace_set_hooks (const cotp_trace_hooks *hooks);
+
+// Source of the current time for get_totp, get_steam_totp, cotp_ctx_totp, cotp_ctx_steam_totp and cotp_key_totp
+typedef struct {
+    long (*now) (void *user_data);   // seconds since the Unix epoch
+    void  *user_data;
+} cotp_clock;
+
+/**
+ * cotp_set_clock
+ *
+ * Replaces the process-wide clock, e.g. with a fixed or fake time in tests. NULL restores the
+ * system clock (CLOCK_REALTIME_COARSE where available). The struct is used in place: keep it alive
+ * and unchanged while installed. `now` may be called from any thread.
+ */
+COTP_API void cotp_set_clock (const cotp_clock *clock);
+
+/**
+ * cotp_time_step
+ *
+ * Returns the TOTP counter (current time / period) for `period`. The counter of each period is cached
+ * and recomputed only when the clock crosses into another step, so this is a clock read and a compare.
+ * Returns -1 and sets *err_code to INVALID_PERIOD if period is not in 1..120.
+ */
+COTP_API COTP_WUR long cotp_time_step (int           period,
+                                       cotp_error_t *err_code);
+
+#ifdef COTP_ENABLE_PROFILING
+// Stages of the OTP pipeline timed by COTP_ENABLE_PROFILING builds
+typedef enum {
+    COTP_STAGE_NORMALIZE_SECRET = 0,  // dropping spaces and upper-casing the Base32 secret
+    COTP_STAGE_BASE32_DECODE,
+    COTP_STAGE_HMAC_GETHANDLE,
+    COTP_STAGE_HMAC_SETKEY,
+    COTP_STAGE_HMAC_FINALIZE,         // counter update, finalize and (pre-keyed paths) re-arm
+    COTP_STAGE_TRUNCATE,              // dynamic truncation and reduction to `digits`
+    COTP_STAGE_FORMAT,                // zero-padded decimal or Steam output
+    COTP_STAGE_COUNT
+} cotp_stage;
+
+typedef struct {
+    uint64_t calls[COTP_STAGE_COUNT];
+    uint64_t ticks[COTP_STAGE_COUNT];  // see cotp_stage_tick_rate()
+} cotp_stage_stats;
+
+/**
+ * cotp_stage_stats_snapshot
+ *
+ * Sums the per-thread stage counters of every thread, including threads that have exited, since the
+ * last cotp_stage_stats_reset(). Counters are recorded without locks; a snapshot taken under load may
+ * miss the samples being recorded at that instant.
+ */
+COTP_API void cotp_stage_stats_snapshot (cotp_stage_stats *out);
+
+/**
+ * cotp_stage_stats_reset
+ *
+ * Starts a new measurement interval for all threads.
+ */
+COTP_API void cotp_stage_stats_reset (void);
+
+/**
+ * cotp_stage_name
+ *
+ * Returns a static name for the stage (e.g. "base32_decode"), or NULL for an out-of-range value.
+ */
+COTP_API COTP_WUR const char *cotp_stage_name (cotp_stage stage);
+
+/**
+ * cotp_stage_tick_rate
+ *
+ * Ticks per second of the counter used for `ticks` (TSC on x86, the virtual counter on AArch64,
+ * nanoseconds elsewhere). Calibrated once against CLOCK_MONOTONIC on first call, which takes ~20 ms.
+ */
+COTP_API COTP_WUR uint64_t cotp_stage_tick_rate (void);
+#endif
+
+#ifdef COTP_ENABLE_METRICS
+#define COTP_METRICS_ALGOS           3
+#define COTP_METRICS_ERRORS          (REPLAY_DETECTED + 1)
+#define COTP_METRICS_DELTA_RANGE     8                                  // offsets beyond ±8 are folded into ±8
+#define COTP_METRICS_DELTA_BUCKETS   (2 * COTP_METRICS_DELTA_RANGE + 1)
+#define COTP_METRICS_LATENCY_BUCKETS 17                                 // 64 ns · 2^i for i < 16, then +Inf
+
+// Library-wide counters since process start, as returned by cotp_metrics_snapshot()
+typedef struct {
+    uint64_t codes_generated[COTP_METRICS_ALGOS];       // indexed by COTP_SHA1/256/512
+    uint64_t validations;                               // validate_* and cotp_totp_cache_validate calls
+    uint64_t validations_matched;
+    uint64_t matched_delta[COTP_METRICS_DELTA_BUCKETS]; // index delta + COTP_METRICS_DELTA_RANGE (HOTP: look-ahead offset)
+    uint64_t errors[COTP_METRICS_ERRORS];               // indexed by cotp_error_t; NO_ERROR and VALID stay 0
+    uint64_t hmac_latency[COTP_METRICS_ALGOS][COTP_METRICS_LATENCY_BUCKETS];  // per-bucket (not cumulative) counts
+    uint64_t hmac_latency_sum_ns[COTP_METRICS_ALGOS];
+} cotp_metrics;
+
+/**
+ * cotp_metrics_snapshot
+ *
+ * Sums the per-thread shards of every counter into `out`. Counters only grow; compute rates
+ * from the difference of two snapshots. Cheap enough to call on every scrape.
+ */
+COTP_API void cotp_metrics_snapshot (cotp_metrics *out);
+
+/**
+ * cotp_metrics_latency_bound_ns
+ *
+ * Upper bound, in nanoseconds, of latency bucket `bucket`; UINT64_MAX for the last (+Inf) bucket.
+ */
+COTP_API COTP_WUR uint64_t cotp_metrics_latency_bound_ns (int bucket);
+
+/**
+ * cotp_metrics_format_prometheus
+ *
+ * Renders a snapshot in the Prometheus text exposition format (counters prefixed `cotp_` and a
+ * `cotp_hmac_duration_seconds` histogram per algorithm). Returns a newly allocated string the
+ * caller must free(); NULL with *err set on error.
+ */
+COTP_API COTP_WUR char *cotp_metrics_format_prometheus (const cotp_metrics *m,
+                                                        cotp_error_t       *err);
 #endif
 
 /**
@@ -120,6 +708,301 @@ COTP_API COTP_WUR char*     cotp_ctx_hotp(cotp_ctx* ctx, const char* base32_enco
 COTP_API COTP_WUR char*     cotp_ctx_steam_totp(cotp_ctx* ctx, const char* base32_encoded_secret, cotp_error_t* err);
 COTP_API COTP_WUR char*     cotp_ctx_steam_totp_at(cotp_ctx* ctx, const char* base32_encoded_secret, long timestamp, cotp_error_t* err);
 
+/**
+ * cotp_key_create
+ *
+ * Decodes `base32_encoded_secret` once and keys an HMAC handle for `sha_algo`, so that repeated
+ * codes for the same secret skip the Base32 decoding and key setup. Release with cotp_key_free().
+ * Returns NULL and sets *err_code on error.
+ * A key carries HMAC state: do not use the same key from two threads at once.
+ */
+COTP_API COTP_WUR cotp_key *cotp_key_create (const char   *base32_encoded_secret,
+                                             int           sha_algo,
+                                             cotp_error_t *err_code);
+
+/**
+ * cotp_key_free
+ *
+ * Securely wipes the decoded secret and releases the key. NULL-safe.
+ */
+COTP_API void cotp_key_free (cotp_key *key);
+
+/**
+ * cotp_key_hotp / cotp_key_totp_at
+ *
+ * Write the zero-padded code into `out`, which must hold at least digits + 1 bytes. Nothing is allocated.
+ * Return NO_ERROR on success or the same error codes as get_hotp / get_totp_at.
+ */
+COTP_API COTP_WUR cotp_error_t cotp_key_hotp    (cotp_key *key,
+                                                 long      counter,
+                                                 int       digits,
+                                                 char     *out,
+                                                 size_t    out_len);
+
+COTP_API COTP_WUR cotp_error_t cotp_key_totp_at (cotp_key *key,
+                                                 long      timestamp,
+                                                 int       digits,
+                                                 int       period,
+                                                 char     *out,
+                                                 size_t    out_len);
+
+/**
+ * cotp_key_totp
+ *
+ * cotp_key_totp_at for the current time, taken from the cached time step (see cotp_time_step).
+ */
+COTP_API COTP_WUR cotp_error_t cotp_key_totp    (cotp_key *key,
+                                                 int       digits,
+                                                 int       period,
+                                                 char     *out,
+                                                 size_t    out_len);
+
+/**
+ * cotp_key_steam_totp_at / cotp_key_steam_totp
+ *
+ * Write the Steam Guard code into `out`, which must hold at least COTP_STEAM_DIGITS + 1 bytes.
+ * Nothing is allocated. The key must have been created with COTP_SHA1 (INVALID_ALGO otherwise).
+ * cotp_key_steam_totp uses the current time, like cotp_key_totp.
+ */
+COTP_API COTP_WUR cotp_error_t cotp_key_steam_totp_at (cotp_key *key,
+                                                       long      timestamp,
+                                                       int       period,
+                                                       char     *out,
+                                                       size_t    out_len);
+
+COTP_API COTP_WUR cotp_error_t cotp_key_steam_totp    (cotp_key *key,
+                                                       int       period,
+                                                       char     *out,
+                                                       size_t    out_len);
+
+#ifdef COTP_ENABLE_KEYSTORE
+/**
+ * cotp_keystore_create
+ *
+ * Creates a key store for about `capacity` keys in a new shared memory segment and returns the
+ * writer's handle. `name` is a POSIX shared memory name ("/cotp-keys"), created with mode 0600 and
+ * failing if it exists; NULL creates an anonymous memfd (Linux) that children inherit over fork()
+ * or that can be passed on with cotp_keystore_fd(). Only the creating process may write.
+ */
+COTP_API COTP_WUR cotp_keystore *cotp_keystore_create (const char   *name,
+                                                       size_t        capacity,
+                                                       cotp_error_t *err);
+
+/**
+ * cotp_keystore_open / cotp_keystore_open_fd
+ *
+ * Map an existing store read-only, by name or from a descriptor received from the writer (which
+ * stays owned by the caller). INVALID_USER_INPUT if there is no such segment or it is not a store.
+ */
+COTP_API COTP_WUR cotp_keystore *cotp_keystore_open    (const char   *name,
+                                                        cotp_error_t *err);
+
+COTP_API COTP_WUR cotp_keystore *cotp_keystore_open_fd (int           fd,
+                                                        cotp_error_t *err);
+
+/**
+ * cotp_keystore_fd
+ *
+ * Returns the descriptor of the segment in the writer process, -1 elsewhere.
+ */
+COTP_API COTP_WUR int cotp_keystore_fd (const cotp_keystore *ks);
+
+/**
+ * cotp_keystore_close
+ *
+ * Unmaps the store. When the writer closes a named store, the name is unlinked; processes that
+ * still have it mapped keep reading it. NULL-safe.
+ */
+COTP_API void cotp_keystore_close (cotp_keystore *ks);
+
+/**
+ * cotp_keystore_put
+ *
+ * Writer only: adds `key_id` or replaces its secret and algorithm. Readers see either the old or
+ * the new entry, never a mix. The decoded secret must fit COTP_KEYSTORE_MAX_SECRET_LEN bytes.
+ * MEMORY_ALLOCATION_ERROR if the store is full; INVALID_USER_INPUT when called from a reader.
+ */
+COTP_API COTP_WUR cotp_error_t cotp_keystore_put (cotp_keystore *ks,
+                                                  uint64_t       key_id,
+                                                  const char    *base32_encoded_secret,
+                                                  int            sha_algo);
+
+/**
+ * cotp_keystore_remove
+ *
+ * Writer only: removes `key_id` and wipes its secret. INVALID_USER_INPUT for an unknown id. The slot
+ * is reused by a later put that probes through it, or freed outright when it ends its probe chain.
+ */
+COTP_API COTP_WUR cotp_error_t cotp_keystore_remove (cotp_keystore *ks,
+                                                     uint64_t       key_id);
+
+/**
+ * cotp_keystore_generation / cotp_keystore_count
+ *
+ * The number of puts and removes applied so far, and the number of keys stored. A reader that
+ * caches keys from cotp_keystore_get_key() can drop its cache when the generation changes.
+ */
+COTP_API COTP_WUR uint64_t cotp_keystore_generation (const cotp_keystore *ks);
+
+COTP_API COTP_WUR size_t   cotp_keystore_count      (const cotp_keystore *ks);
+
+/**
+ * cotp_keystore_get_key
+ *
+ * Copies the secret of `key_id` out of the store, without locking, into a new process-local
+ * cotp_key. Release with cotp_key_free(). INVALID_USER_INPUT for an unknown id. WHMAC_ERROR if a slot
+ * stays mid-update for about a second: the writer died inside a put, and readers should re-attach to a
+ * store from a new writer. cotp_keystore_totp_at and cotp_keystore_validate_totp report it too.
+ */
+COTP_API COTP_WUR cotp_key *cotp_keystore_get_key (const cotp_keystore *ks,
+                                                   uint64_t             key_id,
+                                                   cotp_error_t        *err);
+
+/**
+ * cotp_keystore_totp_at
+ *
+ * cotp_key_totp_at on the current secret of `key_id`.
+ */
+COTP_API COTP_WUR cotp_error_t cotp_keystore_totp_at (const cotp_keystore *ks,
+                                                      uint64_t             key_id,
+                                                      long                 timestamp,
+                                                      int                  digits,
+                                                      int                  period,
+                                                      char                *out,
+                                                      size_t               out_len);
+
+#ifdef COTP_ENABLE_VALIDATION
+/**
+ * cotp_keystore_validate_totp
+ *
+ * validate_totp_in_window on the current secret and algorithm of `key_id`.
+ */
+COTP_API COTP_WUR int cotp_keystore_validate_totp (const cotp_keystore *ks,
+                                                   uint64_t             key_id,
+                                                   const char          *user_code,
+                                                   long                 timestamp,
+                                                   int                  digits,
+                                                   int                  period,
+                                                   int                  window,
+                                                   int                 *matched_delta,
+                                                   cotp_error_t        *err);
+#endif
+#endif
+
+/**
+ * cotp_pool_create
+ *
+ * Starts `threads` workers (<= 0 means one per online CPU, at most COTP_POOL_MAX_THREADS) for
+ * cotp_otp_batch(). If `cpus` is non-NULL it must hold `threads` entries; worker i is pinned to
+ * cpus[i] (Linux only, negative entries leave the worker unpinned). Release with cotp_pool_free().
+ * A pool may be shared by several threads; their batches run one after another.
+ */
+COTP_API COTP_WUR cotp_pool *cotp_pool_create (int           threads,
+                                               const int    *cpus,
+                                               cotp_error_t *err_code);
+
+/**
+ * cotp_pool_free
+ *
+ * Stops and joins the workers. Must not be called while a batch is running on the pool. NULL-safe.
+ */
+COTP_API void cotp_pool_free (cotp_pool *pool);
+
+/**
+ * cotp_otp_batch
+ *
+ * Generates the code of every job. Jobs are grouped by algorithm and key, split into chunks and,
+ * when `pool` is non-NULL, spread over its workers with work stealing; a NULL pool runs everything
+ * on the calling thread. Results are written into each job, so the output order is the input order
+ * whatever the schedule. The same cotp_key may appear in several jobs: workers key their own HMAC
+ * handles from it and never touch the key's handle.
+ * Returns NO_ERROR once every job has been processed (check each job's `err`), or an error if the
+ * batch could not be started.
+ */
+COTP_API COTP_WUR cotp_error_t cotp_otp_batch (cotp_otp_job *jobs,
+                                               size_t        n,
+                                               cotp_pool    *pool);
+
+#ifdef COTP_ENABLE_VALIDATION
+/**
+ * cotp_validate_batch
+ *
+ * Runs validate_totp_in_window for every job and writes each verdict into the job. Jobs are grouped
+ * by algorithm, secret and time step and spread over `pool` as in cotp_otp_batch (NULL runs on the
+ * calling thread). Each worker keys an HMAC handle once per run of jobs that share a cotp_key or the
+ * same secret string pointer, and reuses tokens computed for the steps their windows have in common.
+ * Results, including matched_delta, are those of validate_totp_in_window.
+ * Returns NO_ERROR once every job has been processed (check each job's `err`), or an error if the
+ * batch could not be started.
+ */
+COTP_API COTP_WUR cotp_error_t cotp_validate_batch (cotp_validate_job *jobs,
+                                                    size_t             n,
+                                                    cotp_pool         *pool);
+#endif
+
+/**
+ * cotp_queue_create
+ *
+ * Starts `threads` workers (<= 0 means one per online CPU, at most COTP_POOL_MAX_THREADS) serving a
+ * queue that holds up to `capacity` requests in flight, i.e. submitted and not yet polled.
+ * Workers take submissions in groups and order each group by algorithm and key, so consecutive
+ * requests for the same cotp_key share one keyed HMAC handle. Release with cotp_queue_free().
+ */
+COTP_API COTP_WUR cotp_queue *cotp_queue_create (int           threads,
+                                                 size_t        capacity,
+                                                 cotp_error_t *err_code);
+
+/**
+ * cotp_queue_free
+ *
+ * Stops and joins the workers. Requests still queued and completions not yet polled are discarded
+ * and wiped. NULL-safe.
+ */
+COTP_API void cotp_queue_free (cotp_queue *q);
+
+/**
+ * cotp_queue_submit
+ *
+ * Queues up to `n` requests without blocking and returns how many were accepted, in order; fewer
+ * than `n` means the queue is at capacity, so poll completions and submit the rest again.
+ * Thread-safe. Returns 0 and sets *err_code to INVALID_USER_INPUT for a NULL queue or requests.
+ */
+COTP_API COTP_WUR size_t cotp_queue_submit (cotp_queue               *q,
+                                            const cotp_async_request *reqs,
+                                            size_t                    n,
+                                            cotp_error_t             *err_code);
+
+/**
+ * cotp_queue_poll
+ *
+ * Moves up to `max` finished completions into `out` without blocking and returns their number.
+ * Completions come in the order the workers finish them, not the submission order.
+ */
+COTP_API COTP_WUR size_t cotp_queue_poll (cotp_queue            *q,
+                                          cotp_async_completion *out,
+                                          size_t                 max);
+
+/**
+ * cotp_queue_wait
+ *
+ * Like cotp_queue_poll, but first waits up to `timeout_ms` milliseconds (< 0 waits forever) for
+ * at least one completion. Returns 0 on timeout.
+ */
+COTP_API COTP_WUR size_t cotp_queue_wait (cotp_queue            *q,
+                                          cotp_async_completion *out,
+                                          size_t                 max,
+                                          int                    timeout_ms);
+
+/**
+ * cotp_queue_eventfd
+ *
+ * Returns a non-blocking eventfd that becomes readable when completions arrive in an empty
+ * completion queue, for use with epoll or io_uring. When it fires, read() it to reset it, then call
+ * cotp_queue_poll until it returns 0. Returns -1 where eventfd is unavailable (non-Linux).
+ * The descriptor belongs to the queue; do not close it.
+ */
+COTP_API COTP_WUR int cotp_queue_eventfd (const cotp_queue *q);
+
 /**
  * base32_encode
  *
@@ -0,0 +1,1196 @@
+#pragma once
+// Header-only C++17 wrapper over cotp.h. Every call forwards to the C API; errors are reported by
+// throwing cotp::error, or through the noexcept try_* overloads where the caller must not throw.
+#include "cotp.h"
+
+#if !defined(__cplusplus) || ((defined(_MSVC_LANG) ? _MSVC_LANG : __cplusplus) < 201703L)
+    #error "cotp.hpp requires C++17 or later"
+#endif
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#if __has_include(<version>)
+    #include <version>
+#endif
+#if defined(__cpp_lib_span)
+    #include <span>
+#endif
+#if defined(__cpp_impl_coroutine) && defined(__cpp_lib_coroutine)
+    #define COTP_HPP_COROUTINES 1
+    #include <coroutine>
+    #include <exception>
+    #include <new>
+    #if defined(__linux__)
+        #include <unistd.h>
+    #endif
+#endif
+
+namespace cotp {
+
+enum class algo : int {
+    sha1   = COTP_SHA1,
+    sha256 = COTP_SHA256,
+    sha512 = COTP_SHA512
+};
+
+
+/**
+ * cotp::error
+ *
+ * Thrown by the throwing overloads. code() is the cotp_error_t reported by the C API and what()
+ * its cotp_strerror() description.
+ */
+class error : public std::runtime_error {
+public:
+    explicit error (cotp_error_t err) : std::runtime_error (cotp_strerror (err)), err_ (err) {}
+
+    cotp_error_t code () const noexcept { return err_; }
+
+private:
+    cotp_error_t err_;
+};
+
+
+#if defined(__cpp_lib_span)
+using byte_span       = std::span<std::uint8_t>;
+using const_byte_span = std::span<const std::uint8_t>;
+#else
+// Minimal stand-in for std::span before C++20: a non-owning pointer and length
+template <typename T>
+class basic_span {
+public:
+    constexpr basic_span () noexcept = default;
+    constexpr basic_span (T *data, std::size_t size) noexcept : data_ (data), size_ (size) {}
+    template <std::size_t N>
+    constexpr basic_span (T (&arr)[N]) noexcept : data_ (arr), size_ (N) {}
+    template <typename U, std::size_t N>
+    constexpr basic_span (std::array<U, N> &arr) noexcept : data_ (arr.data ()), size_ (N) {}
+    template <typename U, std::size_t N>
+    constexpr basic_span (const std::array<U, N> &arr) noexcept : data_ (arr.data ()), size_ (N) {}
+
+    constexpr T          *data  () const noexcept { return data_; }
+    constexpr std::size_t size  () const noexcept { return size_; }
+    constexpr bool        empty () const noexcept { return size_ == 0; }
+
+private:
+    T          *data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+using byte_span       = basic_span<std::uint8_t>;
+using const_byte_span = basic_span<const std::uint8_t>;
+#endif
+
+
+namespace detail {
+
+template <typename T>
+class secure_storage {
+public:
+    secure_storage () noexcept = default;
+    secure_storage (T *data, std::size_t size) noexcept : data_ (data), size_ (size) {}
+    secure_storage (const secure_storage &) = delete;
+    secure_storage &operator= (const secure_storage &) = delete;
+    secure_storage (secure_storage &&other) noexcept
+        : data_ (std::exchange (other.data_, nullptr)), size_ (std::exchange (other.size_, 0)) {}
+    secure_storage &operator= (secure_storage &&other) noexcept
+    {
+        if (this != &other) {
+            reset ();
+            data_ = std::exchange (other.data_, nullptr);
+            size_ = std::exchange (other.size_, 0);
+        }
+        return *this;
+    }
+    ~secure_storage () { reset (); }
+
+    T          *data  () noexcept       { return data_; }
+    const T    *data  () const noexcept { return data_; }
+    std::size_t size  () const noexcept { return size_; }
+    bool        empty () const noexcept { return size_ == 0; }
+
+    // Wipes and frees the contents now instead of at destruction
+    void reset () noexcept
+    {
+        if (data_ != nullptr) {
+            cotp_secure_memzero (data_, size_ * sizeof(T));
+            std::free (data_);
+        }
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+private:
+    T          *data_ = nullptr;   // malloc()ed by the C API
+    std::size_t size_ = 0;
+};
+
+
+// NUL-terminated copy of a string_view for the C API. Short inputs stay on the stack; both copies
+// are wiped on destruction since they usually hold a secret.
+class c_string {
+public:
+    explicit c_string (std::string_view sv)
+    {
+        char *dst = inline_.data ();
+        if (sv.size () >= inline_.size ()) {
+            heap_.reset (new char[sv.size () + 1]);
+            dst = heap_.get ();
+        }
+        if (!sv.empty ()) {
+            std::memcpy (dst, sv.data (), sv.size ());
+        }
+        dst[sv.size ()] = '\0';
+        ptr_ = dst;
+        len_ = sv.size ();
+    }
+    c_string (const c_string &) = delete;
+    c_string &operator= (const c_string &) = delete;
+    ~c_string () { cotp_secure_memzero (ptr_, len_ + 1); }
+
+    const char *get () const noexcept { return ptr_; }
+
+private:
+    std::array<char, 128>   inline_;
+    std::unique_ptr<char[]> heap_;
+    char                   *ptr_ = nullptr;
+    std::size_t             len_ = 0;
+};
+
+
+inline void
+check (cotp_error_t err)
+{
+    if (err != NO_ERROR && err != VALID) {
+        throw error (err);
+    }
+}
+
+} // namespace detail
+
+
+/**
+ * cotp::secure_buffer / cotp::secure_string
+ *
+ * Move-only owners of bytes returned by the C API. The contents are wiped with
+ * cotp_secure_memzero() before being freed, on destruction or reset().
+ */
+class secure_buffer : public detail::secure_storage<std::uint8_t> {
+public:
+    using detail::secure_storage<std::uint8_t>::secure_storage;
+
+    const_byte_span span () const noexcept { return const_byte_span (data (), size ()); }
+};
+
+class secure_string : public detail::secure_storage<char> {
+public:
+    using detail::secure_storage<char>::secure_storage;
+
+    std::string_view view  () const noexcept { return std::string_view (data () ? data () : "", size ()); }
+    const char      *c_str () const noexcept { return data () ? data () : ""; }
+};
+
+
+/**
+ * cotp::truncate / cotp::format
+ *
+ * Compile-time specializations of the last two steps of RFC 4226: reducing the 31-bit dynamic
+ * truncation to Digits decimal digits (a constant modulus) and writing it zero-padded, two digits
+ * at a time. Both are constexpr.
+ */
+template <int Digits>
+inline constexpr std::uint64_t modulus = 10 * modulus<Digits - 1>;
+
+template <>
+inline constexpr std::uint64_t modulus<0> = 1;
+
+template <int Digits>
+constexpr std::uint32_t
+truncate (std::uint32_t bin_code) noexcept
+{
+    static_assert (Digits >= MIN_DIGITS && Digits <= MAX_DIGITS, "unsupported number of digits");
+    return static_cast<std::uint32_t>(bin_code % modulus<Digits>);
+}
+
+template <int Digits>
+constexpr std::array<char, Digits + 1>
+format (std::uint32_t token) noexcept
+{
+    static_assert (Digits >= MIN_DIGITS && Digits <= MAX_DIGITS, "unsupported number of digits");
+    constexpr char pairs[] = "00010203040506070809" "10111213141516171819" "20212223242526272829"
+                             "30313233343536373839" "40414243444546474849" "50515253545556575859"
+                             "60616263646566676869" "70717273747576777879" "80818283848586878889"
+                             "90919293949596979899";
+    std::array<char, Digits + 1> out {};
+    int i = Digits;
+    for (; i >= 2; i -= 2) {
+        out[i - 1] = pairs[(token % 100) * 2 + 1];
+        out[i - 2] = pairs[(token % 100) * 2];
+        token /= 100;
+    }
+    if (i == 1) {
+        out[0] = static_cast<char>('0' + token);
+    }
+    return out;
+}
+
+
+/**
+ * cotp::code
+ *
+ * A generated OTP stored inline (no heap). Compare with matches(), which is constant-time.
+ * The digits are wiped when the object goes away.
+ */
+class code {
+public:
+    code () noexcept = default;
+    code (const code &) noexcept = default;
+    code &operator= (const code &) noexcept = default;
+    ~code () { cotp_secure_memzero (buf_.data (), buf_.size ()); }
+
+    std::string_view view  () const noexcept { return std::string_view (buf_.data (), len_); }
+    const char      *c_str () const noexcept { return buf_.data (); }
+    std::size_t      size  () const noexcept { return len_; }
+    bool             empty () const noexcept { return len_ == 0; }
+
+    bool matches (std::string_view user_code) const noexcept
+    {
+        return user_code.size () == len_ &&
+               cotp_timing_safe_memcmp (buf_.data (), user_code.data (), len_) == 0;
+    }
+
+    // Buffer the C API writes into; finish() records the result afterwards
+    char *out () noexcept { return buf_.data (); }
+    static constexpr std::size_t capacity () noexcept { return MAX_DIGITS + 1; }
+    void finish (cotp_error_t err) noexcept
+    {
+        if (err != NO_ERROR) buf_[0] = '\0';
+        len_ = std::strlen (buf_.data ());
+    }
+
+    // Takes over a malloc()ed code returned by the C API, wiping and freeing it
+    static code adopt (char *c_code) noexcept
+    {
+        code c;
+        std::size_t n = std::strlen (c_code);
+        std::size_t copy = n < MAX_DIGITS ? n : MAX_DIGITS;
+        std::memcpy (c.buf_.data (), c_code, copy);
+        c.buf_[copy] = '\0';
+        c.len_ = copy;
+        cotp_secure_memzero (c_code, n);
+        std::free (c_code);
+        return c;
+    }
+
+private:
+    std::array<char, MAX_DIGITS + 1> buf_ {};
+    std::size_t                      len_ = 0;
+};
+
+
+/**
+ * cotp::key
+ *
+ * RAII owner of a cotp_key: the secret is decoded and the HMAC keyed once. Codes are written
+ * inline, so hotp()/totp_at() do not allocate. Like cotp_key, one key must not be used by two
+ * threads at once.
+ */
+class key {
+public:
+    key (std::string_view base32_secret, cotp::algo a = algo::sha1)
+    {
+        detail::c_string secret (base32_secret);
+        cotp_error_t err = NO_ERROR;
+        k_.reset (cotp_key_create (secret.get (), static_cast<int>(a), &err));
+        if (!k_) {
+            throw error (err != NO_ERROR ? err : MEMORY_ALLOCATION_ERROR);
+        }
+    }
+
+    code hotp (long counter, int digits = 6)
+    {
+        code c;
+        detail::check (try_hotp (counter, digits, c));
+        return c;
+    }
+
+    code totp_at (long timestamp, int digits = 6, int period = 30)
+    {
+        code c;
+        detail::check (try_totp_at (timestamp, digits, period, c));
+        return c;
+    }
+
+    // Requires a key created with algo::sha1
+    code steam_totp_at (long timestamp, int period = 30)
+    {
+        code c;
+        detail::check (try_steam_totp_at (timestamp, period, c));
+        return c;
+    }
+
+    // Fixed-length variants: the digit count is checked at compile time
+    template <int Digits>
+    code hotp (long counter)
+    {
+        static_assert (Digits >= MIN_DIGITS && Digits <= MAX_DIGITS, "unsupported number of digits");
+        return hotp (counter, Digits);
+    }
+
+    template <int Digits>
+    code totp_at (long timestamp, int period = 30)
+    {
+        static_assert (Digits >= MIN_DIGITS && Digits <= MAX_DIGITS, "unsupported number of digits");
+        return totp_at (timestamp, Digits, period);
+    }
+
+    cotp_error_t try_hotp (long counter, int digits, code &out) noexcept
+    {
+        cotp_error_t err = cotp_key_hotp (k_.get (), counter, digits, out.out (), code::capacity ());
+        out.finish (err);
+        return err;
+    }
+
+    cotp_error_t try_totp_at (long timestamp, int digits, int period, code &out) noexcept
+    {
+        cotp_error_t err = cotp_key_totp_at (k_.get (), timestamp, digits, period, out.out (), code::capacity ());
+        out.finish (err);
+        return err;
+    }
+
+    cotp_error_t try_steam_totp_at (long timestamp, int period, code &out) noexcept
+    {
+        cotp_error_t err = cotp_key_steam_totp_at (k_.get (), timestamp, period, out.out (), code::capacity ());
+        out.finish (err);
+        return err;
+    }
+
+    cotp_key *get () const noexcept { return k_.get (); }
+
+private:
+    struct deleter {
+        void operator() (cotp_key *k) const noexcept { cotp_key_free (k); }
+    };
+    std::unique_ptr<cotp_key, deleter> k_;
+};
+
+
+/**
+ * cotp::context
+ *
+ * RAII owner of a cotp_ctx holding digits, period and algorithm. Throws INVALID_DIGITS,
+ * INVALID_PERIOD or INVALID_ALGO for out-of-range parameters.
+ */
+class context {
+public:
+    explicit context (int digits = 6, int period = 30, cotp::algo a = algo::sha1)
+    {
+        if (digits < MIN_DIGITS || digits > MAX_DIGITS) throw error (INVALID_DIGITS);
+        if (period <= 0 || period > 120) throw error (INVALID_PERIOD);
+        if (a != algo::sha1 && a != algo::sha256 && a != algo::sha512) throw error (INVALID_ALGO);
+        ctx_.reset (cotp_ctx_create (digits, period, static_cast<int>(a)));
+        if (!ctx_) {
+            throw error (MEMORY_ALLOCATION_ERROR);
+        }
+    }
+
+    code totp_at (std::string_view base32_secret, long timestamp)
+    {
+        detail::c_string secret (base32_secret);
+        cotp_error_t err = NO_ERROR;
+        return take (cotp_ctx_totp_at (ctx_.get (), secret.get (), timestamp, &err), err);
+    }
+
+    code hotp (std::string_view base32_secret, long counter)
+    {
+        detail::c_string secret (base32_secret);
+        cotp_error_t err = NO_ERROR;
+        return take (cotp_ctx_hotp (ctx_.get (), secret.get (), counter, &err), err);
+    }
+
+    code steam_totp_at (std::string_view base32_secret, long timestamp)
+    {
+        detail::c_string secret (base32_secret);
+        cotp_error_t err = NO_ERROR;
+        return take (cotp_ctx_steam_totp_at (ctx_.get (), secret.get (), timestamp, &err), err);
+    }
+
+#ifdef COTP_ENABLE_VALIDATION
+    // Returns the matched offset, or std::nullopt if no step in [-window, +window] matches
+    std::optional<int> validate_totp (std::string_view user_code, std::string_view base32_secret,
+                                      long timestamp, int window)
+    {
+        detail::c_string c (user_code);
+        detail::c_string secret (base32_secret);
+        int delta = 0;
+        cotp_error_t err = NO_ERROR;
+        if (cotp_ctx_validate_totp (ctx_.get (), c.get (), secret.get (), timestamp, window, &delta, &err)) {
+            return delta;
+        }
+        detail::check (err);
+        return std::nullopt;
+    }
+#endif
+
+    cotp_ctx *get () const noexcept { return ctx_.get (); }
+
+private:
+    static code take (char *c_code, cotp_error_t err)
+    {
+        if (c_code == nullptr) {
+            throw error (err != NO_ERROR ? err : MEMORY_ALLOCATION_ERROR);
+        }
+        return code::adopt (c_code);
+    }
+
+    struct deleter {
+        void operator() (cotp_ctx *ctx) const noexcept { cotp_ctx_free (ctx); }
+    };
+    std::unique_ptr<cotp_ctx, deleter> ctx_;
+};
+
+
+// One-shot generators; prefer cotp::key when the same secret produces several codes
+inline code
+hotp (std::string_view base32_secret, long counter, int digits = 6, algo a = algo::sha1)
+{
+    detail::c_string secret (base32_secret);
+    cotp_error_t err = NO_ERROR;
+    char *c = get_hotp (secret.get (), counter, digits, static_cast<int>(a), &err);
+    if (c == nullptr) throw error (err != NO_ERROR ? err : MEMORY_ALLOCATION_ERROR);
+    return code::adopt (c);
+}
+
+
+inline code
+totp_at (std::string_view base32_secret, long timestamp, int digits = 6, int period = 30, algo a = algo::sha1)
+{
+    detail::c_string secret (base32_secret);
+    cotp_error_t err = NO_ERROR;
+    char *c = get_totp_at (secret.get (), timestamp, digits, period, static_cast<int>(a), &err);
+    if (c == nullptr) throw error (err != NO_ERROR ? err : MEMORY_ALLOCATION_ERROR);
+    return code::adopt (c);
+}
+
+
+inline code
+steam_totp_at (std::string_view base32_secret, long timestamp, int period = 30)
+{
+    detail::c_string secret (base32_secret);
+    cotp_error_t err = NO_ERROR;
+    char *c = get_steam_totp_at (secret.get (), timestamp, period, &err);
+    if (c == nullptr) throw error (err != NO_ERROR ? err : MEMORY_ALLOCATION_ERROR);
+    return code::adopt (c);
+}
+
+
+inline secure_string
+base32_encode (const_byte_span data)
+{
+    cotp_error_t err = NO_ERROR;
+    char *enc = ::base32_encode (data.data (), data.size (), &err);
+    if (enc == nullptr) throw error (err != NO_ERROR ? err : MEMORY_ALLOCATION_ERROR);
+    return secure_string (enc, std::strlen (enc));
+}
+
+
+// Number of bytes base32_decode() produces for `encoded`: spaces and padding are not counted
+inline std::size_t
+base32_decoded_size (std::string_view encoded) noexcept
+{
+    std::size_t chars = 0;
+    for (char ch : encoded) {
+        if (ch != ' ' && ch != '=') chars++;
+    }
+    return chars * 5 / 8;
+}
+
+
+inline secure_buffer
+base32_decode (std::string_view encoded)
+{
+    detail::c_string in (encoded);
+    cotp_error_t err = NO_ERROR;
+    std::uint8_t *dec = ::base32_decode (in.get (), encoded.size (), &err);
+    if (dec == nullptr) throw error (err != NO_ERROR ? err : MEMORY_ALLOCATION_ERROR);
+    if (err == EMPTY_STRING) {
+        std::free (dec);
+        return secure_buffer ();
+    }
+    // The C API stops at an embedded NUL, so size the result from what it actually read
+    return secure_buffer (dec, base32_decoded_size (std::string_view (in.get ())));
+}
+
+
+/**
+ * base32_decode_into
+ *
+ * Decodes into a caller-provided buffer and returns the number of bytes written. Throws
+ * INVALID_USER_INPUT if `out` is smaller than base32_decoded_size(encoded).
+ */
+inline std::size_t
+base32_decode_into (std::string_view encoded, byte_span out)
+{
+    std::size_t n = base32_decoded_size (encoded);
+    if (n > out.size ()) throw error (INVALID_USER_INPUT);
+    secure_buffer dec = base32_decode (encoded);
+    if (!dec.empty ()) {
+        std::memcpy (out.data (), dec.data (), dec.size ());
+    }
+    return dec.size ();
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+// Returns the matched offset, or std::nullopt if no step in [-window, +window] matches
+inline std::optional<int>
+validate_totp (std::string_view user_code, std::string_view base32_secret, long timestamp, int window,
+               int digits = 6, int period = 30, algo a = algo::sha1)
+{
+    detail::c_string c (user_code);
+    detail::c_string secret (base32_secret);
+    int delta = 0;
+    cotp_error_t err = NO_ERROR;
+    if (validate_totp_in_window (c.get (), secret.get (), timestamp, digits, period,
+                                 static_cast<int>(a), window, &delta, &err)) {
+        return delta;
+    }
+    detail::check (err);
+    return std::nullopt;
+}
+#endif
+
+
+// otpauth:// URIs, released with cotp_otpauth_uri_free() (which wipes the secret)
+struct uri_deleter {
+    void operator() (cotp_otpauth_uri *u) const noexcept { cotp_otpauth_uri_free (u); }
+};
+using uri_ptr = std::unique_ptr<cotp_otpauth_uri, uri_deleter>;
+
+
+inline uri_ptr
+parse_uri (std::string_view uri)
+{
+    detail::c_string in (uri);
+    cotp_error_t err = NO_ERROR;
+    uri_ptr u (cotp_otpauth_uri_parse (in.get (), &err));
+    if (!u) throw error (err != NO_ERROR ? err : MEMORY_ALLOCATION_ERROR);
+    return u;
+}
+
+
+inline secure_string
+build_uri (const cotp_otpauth_uri &u)
+{
+    cotp_error_t err = NO_ERROR;
+    char *s = cotp_otpauth_uri_build (&u, &err);
+    if (s == nullptr) throw error (err != NO_ERROR ? err : MEMORY_ALLOCATION_ERROR);
+    return secure_string (s, std::strlen (s));
+}
+
+
+#if defined(COTP_HPP_COROUTINES)
+namespace detail {
+
+// Per-thread free lists of coroutine frames in 64-byte size classes up to 4 KiB: once a thread has
+// run a task of some size, later tasks of that size reuse its frame instead of the heap.
+class frame_pool {
+public:
+    static void *allocate (std::size_t n)
+    {
+        std::size_t cls = size_class (n);
+        if (cls >= classes) {
+            return ::operator new (n);
+        }
+        node *&head = lists ().head[cls];
+        if (head != nullptr) {
+            return std::exchange (head, head->next);
+        }
+        return ::operator new ((cls + 1) * granule);
+    }
+
+    static void deallocate (void *p, std::size_t n) noexcept
+    {
+        std::size_t cls = size_class (n);
+        if (cls >= classes) {
+            ::operator delete (p);
+            return;
+        }
+        node *&head = lists ().head[cls];
+        head = ::new (p) node {head};
+    }
+
+private:
+    static constexpr std::size_t granule = 64;
+    static constexpr std::size_t classes = 64;
+
+    struct node {
+        node *next;
+    };
+
+    struct free_lists {
+        node *head[classes] = {};
+        ~free_lists ()
+        {
+            for (node *&h : head) {
+                while (h != nullptr) {
+                    ::operator delete (std::exchange (h, h->next));
+                }
+            }
+        }
+    };
+
+    static std::size_t  size_class (std::size_t n) noexcept { return n == 0 ? 0 : (n - 1) / granule; }
+    static free_lists  &lists () noexcept { thread_local free_lists l; return l; }
+};
+
+
+// Frame allocation for task promises. Frames come from frame_pool, unless the coroutine's
+// parameters start with (std::allocator_arg_t, const Alloc &), after the object for member
+// functions: then the frame is allocated from a copy of that allocator, kept behind the frame.
+// Either way the matching deallocation routine is stored behind the frame too.
+class frame_allocation {
+public:
+    static void *operator new (std::size_t n)
+    {
+        void *p = frame_pool::allocate (trailer (n) + sizeof(dealloc_fn));
+        store (p, n, &pool_deallocate);
+        return p;
+    }
+
+    template <typename Alloc, typename... Args>
+    static void *operator new (std::size_t n, std::allocator_arg_t, const Alloc &alloc, const Args &...)
+    {
+        return allocate_with (n, alloc);
+    }
+
+    template <typename Self, typename Alloc, typename... Args>
+    static void *operator new (std::size_t n, const Self &, std::allocator_arg_t, const Alloc &alloc, const Args &...)
+    {
+        return allocate_with (n, alloc);
+    }
+
+    static void operator delete (void *p, std::size_t n) noexcept
+    {
+        dealloc_fn fn;
+        std::memcpy (&fn, static_cast<char *>(p) + trailer (n), sizeof fn);
+        fn (p, n);
+    }
+
+private:
+    using dealloc_fn = void (*)(void *, std::size_t);
+
+    struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) block {
+        unsigned char bytes[__STDCPP_DEFAULT_NEW_ALIGNMENT__];
+    };
+
+    template <typename Alloc>
+    using block_alloc = typename std::allocator_traits<Alloc>::template rebind_alloc<block>;
+
+    static constexpr std::size_t align_up (std::size_t n, std::size_t a) noexcept { return (n + a - 1) / a * a; }
+    static constexpr std::size_t trailer  (std::size_t n) noexcept { return align_up (n, alignof(dealloc_fn)); }
+
+    template <typename Alloc>
+    static constexpr std::size_t alloc_offset (std::size_t n) noexcept
+    {
+        return align_up (trailer (n) + sizeof(dealloc_fn), alignof(block_alloc<Alloc>));
+    }
+
+    template <typename Alloc>
+    static constexpr std::size_t blocks (std::size_t n) noexcept
+    {
+        return (alloc_offset<Alloc> (n) + sizeof(block_alloc<Alloc>) + sizeof(block) - 1) / sizeof(block);
+    }
+
+    static void store (void *p, std::size_t n, dealloc_fn fn) noexcept
+    {
+        std::memcpy (static_cast<char *>(p) + trailer (n), &fn, sizeof fn);
+    }
+
+    static void pool_deallocate (void *p, std::size_t n)
+    {
+        frame_pool::deallocate (p, trailer (n) + sizeof(dealloc_fn));
+    }
+
+    template <typename Alloc>
+    static void *allocate_with (std::size_t n, const Alloc &alloc)
+    {
+        using A = block_alloc<Alloc>;
+        static_assert (alignof(A) <= alignof(block), "over-aligned allocators are not supported");
+        A a (alloc);
+        void *p = std::allocator_traits<A>::allocate (a, blocks<Alloc> (n));
+        ::new (static_cast<char *>(p) + alloc_offset<Alloc> (n)) A (std::move (a));
+        store (p, n, &alloc_deallocate<Alloc>);
+        return p;
+    }
+
+    template <typename Alloc>
+    static void alloc_deallocate (void *p, std::size_t n)
+    {
+        using A = block_alloc<Alloc>;
+        A *stored = std::launder (reinterpret_cast<A *>(static_cast<char *>(p) + alloc_offset<Alloc> (n)));
+        A a (std::move (*stored));
+        stored->~A ();
+        std::allocator_traits<A>::deallocate (a, static_cast<block *>(p), blocks<Alloc> (n));
+    }
+};
+
+
+template <typename T>
+struct task_value {
+    void return_value (T v) { value.emplace (std::move (v)); }
+    T    take () { return std::move (*value); }
+
+    std::optional<T> value;
+};
+
+template <>
+struct task_value<void> {
+    void return_void () noexcept {}
+    void take () noexcept {}
+};
+
+} // namespace detail
+
+
+/**
+ * cotp::task
+ *
+ * Lazily started coroutine returning T, for use with async_queue. Awaiting a task runs it and
+ * resumes the awaiting coroutine when it finishes. A top-level task is started once with start()
+ * and then advances as async_queue::dispatch() completes what it awaits; once done(), result()
+ * returns its value or rethrows its exception. Frames are recycled per thread, or allocated from
+ * the allocator passed as (std::allocator_arg, alloc) leading parameters.
+ */
+template <typename T = void>
+class task {
+public:
+    struct promise_type : detail::frame_allocation, detail::task_value<T> {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr      exception;
+
+        task get_return_object () noexcept
+        {
+            return task (std::coroutine_handle<promise_type>::from_promise (*this));
+        }
+
+        std::suspend_always initial_suspend () noexcept { return {}; }
+
+        auto final_suspend () noexcept
+        {
+            struct resume_continuation {
+                bool await_ready () const noexcept { return false; }
+                std::coroutine_handle<> await_suspend (std::coroutine_handle<promise_type> h) noexcept
+                {
+                    std::coroutine_handle<> next = h.promise ().continuation;
+                    return next ? next : std::noop_coroutine ();
+                }
+                void await_resume () const noexcept {}
+            };
+            return resume_continuation {};
+        }
+
+        void unhandled_exception () noexcept { exception = std::current_exception (); }
+    };
+
+    task (task &&other) noexcept : h_ (std::exchange (other.h_, nullptr)) {}
+    task &operator= (task &&other) noexcept
+    {
+        if (this != &other) {
+            if (h_) h_.destroy ();
+            h_ = std::exchange (other.h_, nullptr);
+        }
+        return *this;
+    }
+    ~task () { if (h_) h_.destroy (); }
+
+    bool await_ready () const noexcept { return h_.done (); }
+    std::coroutine_handle<> await_suspend (std::coroutine_handle<> awaiting) noexcept
+    {
+        h_.promise ().continuation = awaiting;
+        return h_;
+    }
+    T await_resume () { return result (); }
+
+    void start () { h_.resume (); }
+    bool done () const noexcept { return h_.done (); }
+    T result ()
+    {
+        promise_type &p = h_.promise ();
+        if (p.exception) {
+            std::rethrow_exception (p.exception);
+        }
+        return p.take ();
+    }
+
+private:
+    explicit task (std::coroutine_handle<promise_type> h) noexcept : h_ (h) {}
+
+    std::coroutine_handle<promise_type> h_;
+};
+
+
+class async_queue;
+
+namespace detail {
+
+class async_op;
+
+// What a submitted request's user_data points to: its operation and, for batches, the job index
+struct op_tag {
+    async_op   *op;
+    std::size_t index;
+};
+
+// Base of the awaitables returned by async_queue. They live in the awaiting coroutine's frame,
+// so a request costs no allocation; async_queue::dispatch() routes completions back to them.
+class async_op {
+public:
+    async_op (const async_op &) = delete;
+    async_op &operator= (const async_op &) = delete;
+
+protected:
+    explicit async_op (async_queue &q) noexcept : queue_ (q) {}
+    ~async_op () = default;
+
+    // Submits what can be submitted now; false if the queue was full and a retry is needed
+    virtual bool pump () = 0;
+    // Records one completion. Resuming the waiter must be the last thing it does.
+    virtual void complete (op_tag &tag, const cotp_async_completion &c) = 0;
+
+    void start (std::coroutine_handle<> waiter)
+    {
+        waiter_ = waiter;
+        submit_more ();
+    }
+    void        submit_more ();
+    std::size_t submit (const cotp_async_request *reqs, std::size_t n) noexcept;
+
+    async_queue            &queue_;
+    std::coroutine_handle<> waiter_;
+
+private:
+    friend class cotp::async_queue;
+    async_op *next_blocked_ = nullptr;
+    bool      blocked_      = false;
+};
+
+} // namespace detail
+
+
+// Awaitable for one generated code: resumes with the code, or throws cotp::error
+class generate_op : public detail::async_op {
+public:
+    bool await_ready () const noexcept { return false; }
+    void await_suspend (std::coroutine_handle<> h) { start (h); }
+    code await_resume ()
+    {
+        detail::check (err_);
+        return code_;
+    }
+
+private:
+    friend class async_queue;
+    generate_op (async_queue &q, const cotp_otp_job &job) noexcept : async_op (q)
+    {
+        req_.op = COTP_ASYNC_GENERATE;
+        req_.job = job;
+    }
+
+    bool pump () override
+    {
+        req_.user_data = reinterpret_cast<std::uintptr_t>(&tag_);
+        return submit (&req_, 1) == 1;
+    }
+
+    void complete (detail::op_tag &, const cotp_async_completion &c) override
+    {
+        err_ = c.err;
+        std::memcpy (code_.out (), c.code, code::capacity ());
+        code_.finish (c.err);
+        waiter_.resume ();
+    }
+
+    cotp_async_request req_ {};
+    detail::op_tag     tag_ {this, 0};
+    cotp_error_t       err_ = NO_ERROR;
+    code               code_;
+};
+
+
+// Awaitable for a batch of jobs: submits at most `window` of them at a time and resumes once every
+// job has completed, with each job's code and err filled in as cotp_otp_batch() would
+class batch_op : public detail::async_op {
+public:
+    bool await_ready () const noexcept { return remaining_ == 0; }
+    void await_suspend (std::coroutine_handle<> h) { start (h); }
+    void await_resume () const noexcept {}
+
+private:
+    friend class async_queue;
+    static constexpr std::size_t window = 64;
+
+    batch_op (async_queue &q, cotp_otp_job *jobs, std::size_t n) noexcept
+        : async_op (q), jobs_ (jobs), n_ (n), remaining_ (n)
+    {
+        for (std::size_t i = 0; i < window; i++) {
+            tags_[i].op = this;
+            free_[i] = &tags_[window - 1 - i];
+        }
+    }
+
+    bool pump () override
+    {
+        cotp_async_request reqs[window];
+        std::size_t k = 0;
+        for (; k < free_count_ && next_ + k < n_; k++) {
+            detail::op_tag *tag = free_[free_count_ - 1 - k];
+            tag->index = next_ + k;
+            reqs[k] = cotp_async_request {};
+            reqs[k].op = COTP_ASYNC_GENERATE;
+            reqs[k].user_data = reinterpret_cast<std::uintptr_t>(tag);
+            reqs[k].job = jobs_[next_ + k];
+        }
+        std::size_t accepted = k > 0 ? submit (reqs, k) : 0;
+        free_count_ -= accepted;
+        next_ += accepted;
+        return accepted == k;
+    }
+
+    void complete (detail::op_tag &tag, const cotp_async_completion &c) override
+    {
+        cotp_otp_job &job = jobs_[tag.index];
+        job.err = c.err;
+        std::memcpy (job.code, c.code, sizeof job.code);
+        free_[free_count_++] = &tag;
+        if (--remaining_ == 0) {
+            waiter_.resume ();
+            return;
+        }
+        submit_more ();
+    }
+
+    cotp_otp_job   *jobs_;
+    std::size_t     n_;
+    std::size_t     next_ = 0;
+    std::size_t     remaining_;
+    detail::op_tag  tags_[window];
+    detail::op_tag *free_[window];
+    std::size_t     free_count_ = window;
+};
+
+
+#ifdef COTP_ENABLE_VALIDATION
+// Awaitable for one TOTP validation: resumes with the matched offset or std::nullopt on a miss,
+// or throws cotp::error
+class validate_op : public detail::async_op {
+public:
+    ~validate_op () { cotp_secure_memzero (req_.user_code, sizeof req_.user_code); }
+
+    bool await_ready () const noexcept { return false; }
+    void await_suspend (std::coroutine_handle<> h) { start (h); }
+    std::optional<int> await_resume ()
+    {
+        if (err_ == VALID) {
+            return delta_;
+        }
+        detail::check (err_);
+        return std::nullopt;
+    }
+
+private:
+    friend class async_queue;
+    validate_op (async_queue &q, const cotp_otp_job &job, std::string_view user_code, int window) noexcept
+        : async_op (q)
+    {
+        req_.op = COTP_ASYNC_VALIDATE_TOTP;
+        req_.job = job;
+        req_.window = window;
+        // A code too long for the request can't match anyway; leaving it empty makes it a miss
+        if (user_code.size () < sizeof req_.user_code) {
+            std::memcpy (req_.user_code, user_code.data (), user_code.size ());
+        }
+    }
+
+    bool pump () override
+    {
+        req_.user_data = reinterpret_cast<std::uintptr_t>(&tag_);
+        return submit (&req_, 1) == 1;
+    }
+
+    void complete (detail::op_tag &, const cotp_async_completion &c) override
+    {
+        err_ = c.err;
+        delta_ = c.matched_delta;
+        waiter_.resume ();
+    }
+
+    cotp_async_request req_ {};
+    detail::op_tag     tag_ {this, 0};
+    cotp_error_t       err_ = NO_ERROR;
+    int                delta_ = 0;
+};
+#endif
+
+
+/**
+ * cotp::async_queue
+ *
+ * Coroutine front end for cotp_queue. generate(), generate_batch() and validate_totp() return
+ * awaitables that submit on co_await and resume the coroutine once the result is in; secrets,
+ * keys and batch jobs they refer to must outlive the co_await. Completions are delivered by
+ * dispatch(), which must be called from one thread, the one driving the coroutines: typically
+ * when eventfd() becomes readable, or as dispatch(-1) in a loop until the top-level task is done.
+ * Submissions that find the queue full are retried by dispatch().
+ */
+class async_queue {
+public:
+    explicit async_queue (int threads = 0, std::size_t capacity = 1024)
+    {
+        cotp_error_t err = NO_ERROR;
+        q_.reset (cotp_queue_create (threads, capacity, &err));
+        if (!q_) {
+            throw error (err != NO_ERROR ? err : MEMORY_ALLOCATION_ERROR);
+        }
+    }
+
+    generate_op generate (const cotp_otp_job &job) noexcept { return generate_op (*this, job); }
+
+    generate_op totp_at (const key &k, long timestamp, int digits = 6, int period = 30) noexcept
+    {
+        return generate_op (*this, make_job (k, COTP_JOB_TOTP, timestamp, digits, period));
+    }
+
+    generate_op hotp (const key &k, long counter, int digits = 6) noexcept
+    {
+        return generate_op (*this, make_job (k, COTP_JOB_HOTP, counter, digits, 0));
+    }
+
+    batch_op generate_batch (cotp_otp_job *jobs, std::size_t n) noexcept { return batch_op (*this, jobs, n); }
+
+#ifdef COTP_ENABLE_VALIDATION
+    // For `job`, counter is the timestamp, as in cotp_async_request
+    validate_op validate_totp (const cotp_otp_job &job, std::string_view user_code, int window) noexcept
+    {
+        return validate_op (*this, job, user_code, window);
+    }
+
+    validate_op validate_totp (const key &k, std::string_view user_code, long timestamp, int window,
+                               int digits = 6, int period = 30) noexcept
+    {
+        return validate_op (*this, make_job (k, COTP_JOB_TOTP, timestamp, digits, period), user_code, window);
+    }
+#endif
+
+    // Resumes the coroutines whose results arrived, then retries blocked submissions. With a
+    // non-zero timeout_ms, first waits for a completion as cotp_queue_wait() does. Returns the
+    // number of completions handled. Must not be called from inside a resumed coroutine.
+    std::size_t dispatch (int timeout_ms = 0)
+    {
+        constexpr std::size_t burst = 32;
+        cotp_async_completion buf[burst];
+#if defined(__linux__)
+        int fd = eventfd ();
+        if (fd >= 0) {
+            std::uint64_t count;
+            (void)::read (fd, &count, sizeof count);
+        }
+#endif
+        std::size_t total = 0;
+        std::size_t n = timeout_ms != 0 ? cotp_queue_wait (q_.get (), buf, burst, timeout_ms)
+                                        : cotp_queue_poll (q_.get (), buf, burst);
+        while (n > 0) {
+            for (std::size_t i = 0; i < n; i++) {
+                auto *tag = reinterpret_cast<detail::op_tag *>(static_cast<std::uintptr_t>(buf[i].user_data));
+                tag->op->complete (*tag, buf[i]);
+            }
+            total += n;
+            n = cotp_queue_poll (q_.get (), buf, burst);
+        }
+        cotp_secure_memzero (buf, sizeof buf);
+        retry_blocked ();
+        return total;
+    }
+
+    int         eventfd () const noexcept { return cotp_queue_eventfd (q_.get ()); }
+    cotp_queue *get () const noexcept { return q_.get (); }
+
+private:
+    friend class detail::async_op;
+
+    static cotp_otp_job make_job (const key &k, cotp_job_type type, long counter, int digits, int period) noexcept
+    {
+        cotp_otp_job job {};
+        job.type = type;
+        job.key = k.get ();
+        job.counter = counter;
+        job.digits = digits;
+        job.period = period;
+        return job;
+    }
+
+    void block (detail::async_op *op) noexcept
+    {
+        if (op->blocked_) {
+            return;
+        }
+        op->blocked_ = true;
+        op->next_blocked_ = nullptr;
+        if (blocked_tail_ != nullptr) {
+            blocked_tail_->next_blocked_ = op;
+        } else {
+            blocked_head_ = op;
+        }
+        blocked_tail_ = op;
+    }
+
+    void retry_blocked ()
+    {
+        detail::async_op *op = std::exchange (blocked_head_, nullptr);
+        blocked_tail_ = nullptr;
+        while (op != nullptr) {
+            detail::async_op *next = op->next_blocked_;
+            op->blocked_ = false;
+            if (!op->pump ()) {
+                block (op);
+            }
+            op = next;
+        }
+    }
+
+    struct deleter {
+        void operator() (cotp_queue *q) const noexcept { cotp_queue_free (q); }
+    };
+    std::unique_ptr<cotp_queue, deleter> q_;
+    detail::async_op                    *blocked_head_ = nullptr;
+    detail::async_op                    *blocked_tail_ = nullptr;
+};
+
+
+// A blocked operation is left to retry_blocked(), which owns its place in the list
+inline void
+detail::async_op::submit_more ()
+{
+    if (!blocked_ && !pump ()) {
+        queue_.block (this);
+    }
+}
+
+
+inline std::size_t
+detail::async_op::submit (const cotp_async_request *reqs, std::size_t n) noexcept
+{
+    cotp_error_t err = NO_ERROR;
+    return cotp_queue_submit (queue_.get (), reqs, n, &err);
+}
+#endif // COTP_HPP_COROUTINES
+
+} // namespace cotp
@@ -96,4 +96,22 @@ int cotp_ctx_validate_totp(cotp_ctx* ctx,
                                    ctx->digits, ctx->period, ctx->algo,
                                    window, matched_delta, err);
 }
+
+int cotp_ctx_validate_hotp(cotp_ctx* ctx,
+                           const char*   user_code,
+                           const char*   base32_encoded_secret,
+                           long          counter,
+                           int           look_ahead,
+                           long*         matched_counter,
+                           cotp_error_t* err)
+{
+    if (!ctx) {
+        if (err) *err = INVALID_USER_INPUT;
+        if (matched_counter) *matched_counter = -1;
+        return 0;
+    }
+    return validate_hotp_in_window(user_code, base32_encoded_secret, counter,
+                                   ctx->digits, ctx->algo,
+                                   look_ahead, matched_counter, err);
+}
 #endif
@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <string.h>
+#include "otp_internal.h"
+#include "utils/secure_zero.h"
+#include "utils/profile.h"
+#include "utils/metrics.h"
+#include "utils/digits.h"
+#include "utils/timestep.h"
+
+cotp_key *
+otp_key_adopt (uint8_t      *secret,
+               size_t        secret_len,
+               int           sha_algo,
+               cotp_error_t *err_code)
+{
+    cotp_key *key = calloc (1, sizeof(*key));
+    if (key == NULL) {
+        cotp_secure_memzero (secret, secret_len);
+        free (secret);
+        *err_code = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    key->algo = sha_algo;
+    key->secret = secret;
+    key->secret_len = secret_len;
+
+    COTP_PROF_START (t_handle);
+    key->hd = whmac_gethandle (sha_algo);
+    COTP_PROF_STOP (COTP_STAGE_HMAC_GETHANDLE, t_handle);
+    if (key->hd == NULL) {
+        cotp_key_free (key);
+        *err_code = WHMAC_ERROR;
+        return NULL;
+    }
+    COTP_PROF_START (t_setkey);
+    int setkey_err = whmac_setkey (key->hd, key->secret, key->secret_len);
+    COTP_PROF_STOP (COTP_STAGE_HMAC_SETKEY, t_setkey);
+    if (setkey_err != NO_ERROR) {
+        cotp_key_free (key);
+        *err_code = WHMAC_ERROR;
+        return NULL;
+    }
+
+    *err_code = NO_ERROR;
+    return key;
+}
+
+
+cotp_key *
+cotp_key_create (const char   *base32_encoded_secret,
+                 int           sha_algo,
+                 cotp_error_t *err_code)
+{
+    cotp_error_t local_err = NO_ERROR;
+    cotp_error_t *errp = err_code ? err_code : &local_err;
+
+    if (base32_encoded_secret == NULL) {
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+    }
+
+    if (whmac_check () == -1) {
+        *errp = WCRYPT_VERSION_MISMATCH;
+        return NULL;
+    }
+
+    if (sha_algo != COTP_SHA1 && sha_algo != COTP_SHA256 && sha_algo != COTP_SHA512) {
+        *errp = INVALID_ALGO;
+        return NULL;
+    }
+
+    size_t secret_len = 0;
+    uint8_t *secret = otp_decode_secret (base32_encoded_secret, &secret_len, errp);
+    if (secret == NULL) {
+        return NULL;
+    }
+    return otp_key_adopt (secret, secret_len, sha_algo, errp);
+}
+
+
+void
+cotp_key_free (cotp_key *key)
+{
+    if (!key) return;
+    whmac_freehandle (key->hd);
+    if (key->secret) {
+        cotp_secure_memzero (key->secret, key->secret_len);
+        free (key->secret);
+    }
+    free (key);
+}
+
+
+cotp_error_t
+key_token (cotp_key *key,
+           long      counter,
+           uint32_t *bin_code)
+{
+    return otp_hmac_token (key->hd, counter, bin_code);
+}
+
+
+static cotp_error_t
+key_hotp_code (cotp_key *key,
+               long      counter,
+               int       digits,
+               char     *out,
+               size_t    out_len)
+{
+    if (key == NULL || out == NULL) {
+        return INVALID_USER_INPUT;
+    }
+    if (digits < MIN_DIGITS || digits > MAX_DIGITS) {
+        return INVALID_DIGITS;
+    }
+    if (out_len < (size_t)digits + 1) {
+        return INVALID_USER_INPUT;
+    }
+    if (counter < 0) {
+        return INVALID_COUNTER;
+    }
+
+    uint32_t bin_code;
+    cotp_error_t err = key_token (key, counter, &bin_code);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    COTP_PROF_START (t_format);
+    otp_code_format (bin_code, digits, out);
+    COTP_PROF_STOP (COTP_STAGE_FORMAT, t_format);
+
+    return NO_ERROR;
+}
+
+
+cotp_error_t
+cotp_key_hotp (cotp_key *key,
+               long      counter,
+               int       digits,
+               char     *out,
+               size_t    out_len)
+{
+    cotp_error_t err = key_hotp_code (key, counter, digits, out, out_len);
+    COTP_METRIC_GENERATED (key ? key->algo : -1, err);
+    return err;
+}
+
+
+cotp_error_t
+cotp_key_totp_at (cotp_key *key,
+                  long      timestamp,
+                  int       digits,
+                  int       period,
+                  char     *out,
+                  size_t    out_len)
+{
+    cotp_error_t err = INVALID_PERIOD;
+    if (period > 0 && period <= 120) {
+        err = key_hotp_code (key, timestamp / period, digits, out, out_len);
+    }
+    COTP_METRIC_GENERATED (key ? key->algo : -1, err);
+    return err;
+}
+
+
+cotp_error_t
+cotp_key_totp (cotp_key *key,
+               int       digits,
+               int       period,
+               char     *out,
+               size_t    out_len)
+{
+    cotp_error_t err = INVALID_PERIOD;
+    if (period > 0 && period <= 120) {
+        err = key_hotp_code (key, timestep_current (period), digits, out, out_len);
+    }
+    COTP_METRIC_GENERATED (key ? key->algo : -1, err);
+    return err;
+}
+
+
+// Steam Guard code for time step `counter`; Steam is only defined over HMAC-SHA1
+static cotp_error_t
+key_steam_code (cotp_key *key,
+                long      counter,
+                char     *out,
+                size_t    out_len)
+{
+    if (key == NULL || out == NULL || out_len < COTP_STEAM_DIGITS + 1) {
+        return INVALID_USER_INPUT;
+    }
+    if (key->algo != COTP_SHA1) {
+        return INVALID_ALGO;
+    }
+    if (counter < 0) {
+        return INVALID_COUNTER;
+    }
+
+    uint32_t bin_code;
+    cotp_error_t err = key_token (key, counter, &bin_code);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    COTP_PROF_START (t_format);
+    otp_steam_format (bin_code, out);
+    COTP_PROF_STOP (COTP_STAGE_FORMAT, t_format);
+
+    return NO_ERROR;
+}
+
+
+cotp_error_t
+cotp_key_steam_totp_at (cotp_key *key,
+                        long      timestamp,
+                        int       period,
+                        char     *out,
+                        size_t    out_len)
+{
+    cotp_error_t err = INVALID_PERIOD;
+    if (period > 0 && period <= 120) {
+        err = key_steam_code (key, timestamp / period, out, out_len);
+    }
+    COTP_METRIC_GENERATED (COTP_SHA1, err);
+    return err;
+}
+
+
+cotp_error_t
+cotp_key_steam_totp (cotp_key *key,
+                     int       period,
+                     char     *out,
+                     size_t    out_len)
+{
+    cotp_error_t err = INVALID_PERIOD;
+    if (period > 0 && period <= 120) {
+        err = key_steam_code (key, timestep_current (period), out, out_len);
+    }
+    COTP_METRIC_GENERATED (COTP_SHA1, err);
+    return err;
+}
@@ -1,12 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
-#include "whmac.h"
-#include "cotp.h"
+#include "otp_internal.h"
 #include "utils/secure_zero.h"
+#include "utils/profile.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
+#include "utils/digits.h"
+#include "utils/timestep.h"
 
 static size_t b32_decoded_len_from_str(const char *s) {
     if (!s) return 0;
@@ -43,8 +46,8 @@ static char  *get_steam_code   (const unsigned char *hmac,
                                 whmac_handle_t *hd);
 
 static int    truncate_otp     (const unsigned char *hmac,
-                                int          digits_length,
-                                whmac_handle_t *hd);
+                                whmac_handle_t *hd,
+                                uint32_t    *bin_code);
 
 static unsigned char *compute_hmac (const char  *K,
                                 long         C,
@@ -52,7 +55,7 @@ static unsigned char *compute_hmac (const char  *K,
                                 cotp_error_t *err_code);
 
 static char  *finalize         (int          digits_length,
-                                int          tk);
+                                uint32_t     bin_code);
 
 static int    check_period     (int          period);
 
@@ -60,13 +63,83 @@ static int    check_otp_len    (int          digits_length);
 
 static int    check_algo       (int          algo);
 
+static char  *totp_code        (const char  *secret,
+                                int          use_clock,
+                                long         current_timestamp,
+                                int          digits,
+                                int          period,
+                                int          algo,
+                                cotp_error_t *err_code);
+
+static char  *steam_totp_code  (const char  *secret,
+                                int          use_clock,
+                                long         current_timestamp,
+                                int          period,
+                                cotp_error_t *err_code);
+
 
+// The public generators wrap the otp_*_code workers so that metrics count each call once,
+// while validation reuses the workers without counting every window step as a generated code.
 char *
 get_hotp (const char   *secret,
           long          counter,
           int           digits,
           int           algo,
           cotp_error_t *err_code)
+{
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_HOTP, algo, 0);
+    cotp_error_t err;
+    char *hotp = otp_hotp_code (secret, counter, digits, algo, &err);
+    trace_end (&span, err);
+    COTP_METRIC_GENERATED (algo, err);
+    if (err_code) *err_code = err;
+    return hotp;
+}
+
+
+char *
+get_totp_at (const char   *secret,
+             long          current_timestamp,
+             int           digits,
+             int           period,
+             int           algo,
+             cotp_error_t *err_code)
+{
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_TOTP, algo, 0);
+    cotp_error_t err;
+    char *totp = otp_totp_code (secret, current_timestamp, digits, period, algo, &err);
+    trace_end (&span, err);
+    COTP_METRIC_GENERATED (algo, err);
+    if (err_code) *err_code = err;
+    return totp;
+}
+
+
+char *
+get_steam_totp_at (const char   *secret,
+                   long          current_timestamp,
+                   int           period,
+                   cotp_error_t *err_code)
+{
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_STEAM_TOTP, COTP_SHA1, 0);
+    cotp_error_t err;
+    char *totp = steam_totp_code (secret, 0, current_timestamp, period, &err);
+    trace_end (&span, err);
+    COTP_METRIC_GENERATED (COTP_SHA1, err);
+    if (err_code) *err_code = err;
+    return totp;
+}
+
+
+char *
+otp_hotp_code (const char   *secret,
+               long          counter,
+               int           digits,
+               int           algo,
+               cotp_error_t *err_code)
 {
     cotp_error_t local_err = NO_ERROR;
     cotp_error_t *errp = err_code ? err_code : &local_err;
@@ -96,7 +169,9 @@ get_hotp (const char   *secret,
         return NULL;
     }
 
+    COTP_PROF_START (t_handle);
     whmac_handle_t *hd = whmac_gethandle (algo);
+    COTP_PROF_STOP (COTP_STAGE_HMAC_GETHANDLE, t_handle);
     if (hd == NULL) {
         *errp = WHMAC_ERROR;
         return NULL;
@@ -109,30 +184,51 @@ get_hotp (const char   *secret,
     }
 
     size_t dlen = whmac_getlen(hd);
-    int tk = truncate_otp (hmac, digits, hd);
+    COTP_PROF_START (t_truncate);
+    uint32_t bin_code = 0;
+    int tk = truncate_otp (hmac, hd, &bin_code);
+    COTP_PROF_STOP (COTP_STAGE_TRUNCATE, t_truncate);
     whmac_freehandle (hd);
 
     cotp_secure_memzero(hmac, dlen);
     free (hmac);
 
-    if (tk == INT_MIN) {
+    if (tk != 0) {
         *errp = WHMAC_ERROR;
         return NULL;
     }
 
     *errp = NO_ERROR;
 
-    return finalize (digits, tk);
+    COTP_PROF_START (t_format);
+    char *token = finalize (digits, bin_code);
+    COTP_PROF_STOP (COTP_STAGE_FORMAT, t_format);
+    return token;
 }
 
 
 char *
-get_totp_at (const char   *secret,
-             long          current_timestamp,
-             int           digits,
-             int           period,
-             int           algo,
-             cotp_error_t *err_code)
+otp_totp_code (const char   *secret,
+               long          current_timestamp,
+               int           digits,
+               int           period,
+               int           algo,
+               cotp_error_t *err_code)
+{
+    return totp_code (secret, 0, current_timestamp, digits, period, algo, err_code);
+}
+
+
+// With use_clock set, current_timestamp is ignored and the cached step of the current time is used,
+// so get_totp only divides when the clock crosses a step boundary
+static char *
+totp_code (const char   *secret,
+           int           use_clock,
+           long          current_timestamp,
+           int           digits,
+           int           period,
+           int           algo,
+           cotp_error_t *err_code)
 {
     cotp_error_t local_err = NO_ERROR;
     cotp_error_t *errp = err_code ? err_code : &local_err;
@@ -158,7 +254,8 @@ get_totp_at (const char   *secret,
     }
 
     cotp_error_t err;
-    char *totp = get_hotp (secret, current_timestamp / period, digits, algo, &err);
+    long step = use_clock ? timestep_current (period) : current_timestamp / period;
+    char *totp = otp_hotp_code (secret, step, digits, algo, &err);
     if (err != NO_ERROR) {
         *errp = err;
         return NULL;
@@ -177,7 +274,14 @@ get_totp (const char   *secret,
           int           algo,
           cotp_error_t *err_code)
 {
-    return get_totp_at (secret, (long)time(NULL), digits, period, algo, err_code);
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_TOTP, algo, 0);
+    cotp_error_t err;
+    char *totp = totp_code (secret, 1, 0, digits, period, algo, &err);
+    trace_end (&span, err);
+    COTP_METRIC_GENERATED (algo, err);
+    if (err_code) *err_code = err;
+    return totp;
 }
 
 
@@ -189,15 +293,23 @@ get_steam_totp (const char   *secret,
     // AFAIK, the secret is stored base64 encoded on the device. As I don't have time to waste on reverse engineering
     // this non-standard solution, the user is responsible for decoding the secret in whatever format this is and then
     // providing the library with the secret base32 encoded.
-    return get_steam_totp_at (secret, (long)time(NULL), period, err_code);
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_STEAM_TOTP, COTP_SHA1, 0);
+    cotp_error_t err;
+    char *totp = steam_totp_code (secret, 1, 0, period, &err);
+    trace_end (&span, err);
+    COTP_METRIC_GENERATED (COTP_SHA1, err);
+    if (err_code) *err_code = err;
+    return totp;
 }
 
 
-char *
-get_steam_totp_at (const char   *secret,
-                   long          current_timestamp,
-                   int           period,
-                   cotp_error_t *err_code)
+static char *
+steam_totp_code (const char   *secret,
+                 int           use_clock,
+                 long          current_timestamp,
+                 int           period,
+                 cotp_error_t *err_code)
 {
     cotp_error_t local_err = NO_ERROR;
     cotp_error_t *errp = err_code ? err_code : &local_err;
@@ -217,18 +329,24 @@ get_steam_totp_at (const char   *secret,
         return NULL;
     }
 
+    COTP_PROF_START (t_handle);
     whmac_handle_t *hd = whmac_gethandle (COTP_SHA1);
+    COTP_PROF_STOP (COTP_STAGE_HMAC_GETHANDLE, t_handle);
     if (hd == NULL) {
         *errp = WHMAC_ERROR;
         return NULL;
     }
-    unsigned char *hmac = compute_hmac (secret, current_timestamp / period, hd, errp);
+    long step = use_clock ? timestep_current (period) : current_timestamp / period;
+    unsigned char *hmac = compute_hmac (secret, step, hd, errp);
     if (hmac == NULL) {
         whmac_freehandle (hd);
         return NULL;
     }
 
+    // Truncation and base-26 output are one loop here, so both count as the format stage
+    COTP_PROF_START (t_format);
     char *totp = get_steam_code (hmac, hd);
+    COTP_PROF_STOP (COTP_STAGE_FORMAT, t_format);
 
     size_t dlen = whmac_getlen(hd);
     whmac_freehandle (hd);
@@ -281,6 +399,147 @@ otp_to_int (const char   *otp,
 }
 
 
+uint8_t *
+otp_decode_secret (const char   *K,
+                   size_t       *secret_len,
+                   cotp_error_t *err_code)
+{
+    if (K == NULL) {
+        *err_code = INVALID_USER_INPUT;
+        return NULL;
+    }
+
+    COTP_PROF_START (t_normalize);
+    char *normalized_K = normalize_secret (K);
+    COTP_PROF_STOP (COTP_STAGE_NORMALIZE_SECRET, t_normalize);
+    if (normalized_K == NULL) {
+        *err_code = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+
+    if (normalized_K[0] == '\0') {
+        cotp_secure_memzero(normalized_K, 1);
+        free(normalized_K);
+        *err_code = EMPTY_STRING;
+        return NULL;
+    }
+
+    *secret_len = b32_decoded_len_from_str(normalized_K);
+
+    size_t normalized_K_len = strlen(normalized_K);
+    COTP_PROF_START (t_decode);
+    uint8_t *secret = base32_decode (normalized_K, normalized_K_len, err_code);
+    COTP_PROF_STOP (COTP_STAGE_BASE32_DECODE, t_decode);
+    cotp_secure_memzero(normalized_K, normalized_K_len);
+    free (normalized_K);
+    if (secret == NULL) {
+        return NULL;
+    }
+    if (*err_code != NO_ERROR) {
+        cotp_secure_memzero(secret, *secret_len);
+        free(secret);
+        return NULL;
+    }
+
+    return secret;
+}
+
+
+int
+otp_dynamic_truncate (const unsigned char *hmac,
+                      size_t               hlen,
+                      uint32_t            *bin_code)
+{
+    // take the lower four bits of the last byte
+    if (hlen < 4) {
+        return -1;
+    }
+    int offset = hmac[hlen - 1] & 0x0f;
+    if ((size_t)offset + 3 >= hlen) {
+        return -1;
+    }
+
+    // Starting from the offset, take the successive 4 bytes while stripping the topmost bit to prevent it being handled as a signed integer
+    *bin_code = ((uint32_t)(hmac[offset] & 0x7f) << 24) | ((uint32_t)(hmac[offset + 1] & 0xff) << 16) | ((uint32_t)(hmac[offset + 2] & 0xff) << 8) | ((uint32_t)(hmac[offset + 3] & 0xff));
+
+    return 0;
+}
+
+
+cotp_error_t
+otp_hmac_token (whmac_handle_t *hd,
+                long            counter,
+                uint32_t       *bin_code)
+{
+    unsigned char C_reverse_byte_order[8];
+    REVERSE_BYTES(counter, C_reverse_byte_order);
+    return otp_hmac_token_be (hd, C_reverse_byte_order, bin_code);
+}
+
+
+cotp_error_t
+otp_hmac_token_be (whmac_handle_t      *hd,
+                   const unsigned char  counter_be[8],
+                   uint32_t            *bin_code)
+{
+    unsigned char hmac[COTP_MAX_HMAC_LEN];
+    size_t dlen = whmac_getlen (hd);
+    COTP_PROF_START (t_hmac);
+    COTP_METRIC_HMAC_START (t_metric);
+    if (whmac_update (hd, counter_be, 8) != NO_ERROR) {
+        whmac_reset (hd);
+        return WHMAC_ERROR;
+    }
+    ssize_t flen = whmac_finalize (hd, hmac, sizeof(hmac));
+    int reset_err = whmac_reset (hd);
+    COTP_METRIC_HMAC_STOP (dlen, t_metric);
+    COTP_PROF_STOP (COTP_STAGE_HMAC_FINALIZE, t_hmac);
+
+    cotp_error_t err = NO_ERROR;
+    COTP_PROF_START (t_truncate);
+    if (flen < 0 || reset_err != NO_ERROR || otp_dynamic_truncate (hmac, dlen, bin_code) != 0) {
+        err = WHMAC_ERROR;
+    }
+    COTP_PROF_STOP (COTP_STAGE_TRUNCATE, t_truncate);
+    cotp_secure_memzero(hmac, sizeof(hmac));
+
+    return err;
+}
+
+
+const char otp_digit_pairs[200] =
+    "00010203040506070809" "10111213141516171819" "20212223242526272829" "30313233343536373839"
+    "40414243444546474849" "50515253545556575859" "60616263646566676869" "70717273747576777879"
+    "80818283848586878889" "90919293949596979899";
+
+const char otp_steam_alphabet[26] = {
+    '2', '3', '4', '5', '6', '7', '8', '9', 'B', 'C', 'D', 'F', 'G',
+    'H', 'J', 'K', 'M', 'N', 'P', 'Q', 'R', 'T', 'V', 'W', 'X', 'Y'
+};
+
+
+int
+otp_parse_code (const char *user_code,
+                int         digits,
+                uint32_t   *token)
+{
+    uint64_t value = 0;
+    int i = 0;
+    for (; i < digits; ++i) {
+        if (!isdigit((unsigned char)user_code[i])) {
+            return -1;
+        }
+        value = value * 10 + (uint64_t)(user_code[i] - '0');
+    }
+    // 10-digit codes can exceed the 31-bit range of a truncated HMAC, which can never match anyway
+    if (user_code[i] != '\0' || value > UINT32_MAX) {
+        return -1;
+    }
+    *token = (uint32_t)value;
+    return 0;
+}
+
+
 static char *
 normalize_secret (const char *K)
 {
@@ -301,28 +560,13 @@ static char *
 get_steam_code (const unsigned char *hmac,
                 whmac_handle_t *hd)
 {
-    size_t hlen = whmac_getlen(hd);
-    if (hlen < 4) {
-        return NULL;
-    }
-    int offset = (hmac[hlen-1] & 0x0f);
-    if ((size_t)offset + 3 >= hlen) {
+    uint32_t bin_code;
+    if (otp_dynamic_truncate (hmac, whmac_getlen(hd), &bin_code) != 0) {
         return NULL;
     }
 
-    // Starting from the offset, take the successive 4 bytes while stripping the topmost bit to prevent it being handled as a signed integer
-    uint32_t bin_code = ((uint32_t)(hmac[offset] & 0x7f) << 24) | ((uint32_t)(hmac[offset + 1] & 0xff) << 16) | ((uint32_t)(hmac[offset + 2] & 0xff) << 8) | ((uint32_t)(hmac[offset + 3] & 0xff));
-
-    const char steam_alphabet[] = "23456789BCDFGHJKMNPQRTVWXY";
-
-    char code[6];
-    size_t steam_alphabet_len = strlen (steam_alphabet);
-    for (int i = 0; i < 5; i++) {
-        uint32_t mod = bin_code % (uint32_t)steam_alphabet_len;
-        bin_code = bin_code / (uint32_t)steam_alphabet_len;
-        code[i] = steam_alphabet[mod];
-    }
-    code[5] = '\0';
+    char code[COTP_STEAM_DIGITS + 1];
+    otp_steam_format (bin_code, code);
 
     return strdup (code);
 }
@@ -330,29 +574,10 @@ get_steam_code (const unsigned char *hmac,
 
 static int
 truncate_otp (const unsigned char *hmac,
-              int            digits_length,
-              whmac_handle_t *hd)
+              whmac_handle_t *hd,
+              uint32_t       *bin_code)
 {
-    // take the lower four bits of the last byte
-    size_t hlen = whmac_getlen(hd);
-    if (hlen < 4) {
-        return INT_MIN;
-    }
-    int offset = hmac[hlen - 1] & 0x0f;
-    if ((size_t)offset + 3 >= hlen) {
-        return INT_MIN;
-    }
-
-    // Starting from the offset, take the successive 4 bytes while stripping the topmost bit to prevent it being handled as a signed integer
-    uint32_t bin_code = ((uint32_t)(hmac[offset] & 0x7f) << 24) | ((uint32_t)(hmac[offset + 1] & 0xff) << 16) | ((uint32_t)(hmac[offset + 2] & 0xff) << 8) | ((uint32_t)(hmac[offset + 3] & 0xff));
-
-    uint64_t mod = 1;
-    for (int i = 0; i < digits_length; ++i) {
-        mod *= 10ULL;
-    }
-    int token = (int)(((uint64_t)bin_code) % mod);
-
-    return token;
+    return otp_dynamic_truncate (hmac, whmac_getlen(hd), bin_code);
 }
 
 
@@ -366,49 +591,26 @@ compute_hmac (const char *K,
         return NULL;
     }
 
-    if (K == NULL) {
-        *err_code = INVALID_USER_INPUT;
-        return NULL;
-    }
-
-    char *normalized_K = normalize_secret (K);
-    if (normalized_K == NULL) {
-        *err_code = MEMORY_ALLOCATION_ERROR;
-        return NULL;
-    }
-
-    if (normalized_K[0] == '\0') {
-        cotp_secure_memzero(normalized_K, 1);
-        free(normalized_K);
-        *err_code = EMPTY_STRING;
-        return NULL;
-    }
-
-    size_t secret_len = b32_decoded_len_from_str(normalized_K);
-
-    size_t normalized_K_len = strlen(normalized_K);
-    unsigned char *secret = base32_decode (normalized_K, normalized_K_len, err_code);
-    cotp_secure_memzero(normalized_K, normalized_K_len);
-    free (normalized_K);
+    size_t secret_len = 0;
+    unsigned char *secret = otp_decode_secret (K, &secret_len, err_code);
     if (secret == NULL) {
         return NULL;
     }
-    if (*err_code != NO_ERROR) {
-        cotp_secure_memzero(secret, secret_len);
-        free(secret);
-        return NULL;
-    }
 
     unsigned char C_reverse_byte_order[8];
     REVERSE_BYTES(C, C_reverse_byte_order);
 
+    COTP_METRIC_HMAC_START (t_metric);
+    COTP_PROF_START (t_setkey);
     cotp_error_t err = whmac_setkey (hd, secret, secret_len);
+    COTP_PROF_STOP (COTP_STAGE_HMAC_SETKEY, t_setkey);
     if (err) {
         cotp_secure_memzero(secret, secret_len);
         free (secret);
         *err_code = WHMAC_ERROR;
         return NULL;
     }
+    COTP_PROF_START (t_hmac);
     if (whmac_update (hd, C_reverse_byte_order, sizeof(C_reverse_byte_order)) != NO_ERROR) {
         cotp_secure_memzero(secret, secret_len);
         free (secret);
@@ -426,6 +628,8 @@ compute_hmac (const char *K,
     }
 
     ssize_t flen = whmac_finalize (hd, hmac, dlen);
+    COTP_PROF_STOP (COTP_STAGE_HMAC_FINALIZE, t_hmac);
+    COTP_METRIC_HMAC_STOP (dlen, t_metric);
     if (flen < 0) {
         cotp_secure_memzero(hmac, dlen);
         free (hmac);
@@ -442,15 +646,14 @@ compute_hmac (const char *K,
 
 
 static char *
-finalize (int digits_length,
-          int tk)
+finalize (int      digits_length,
+          uint32_t bin_code)
 {
-    char *token = calloc (digits_length + 1, 1);
+    char *token = malloc (digits_length + 1);
     if (token == NULL) {
         return NULL;
     }
-    // Print with leading zeros without building an intermediate format string
-    snprintf (token, digits_length + 1, "%0*d", digits_length, tk);
+    otp_code_format (bin_code, digits_length, token);
     return token;
 }
 
@@ -0,0 +1,165 @@
+#pragma once
+// Helpers shared by otp.c, key.c and the optional modules under utils/.
+// Nothing declared here is exported from the library.
+#include <limits.h>
+#include <sys/types.h>
+#include "cotp.h"
+#include "whmac.h"
+
+// Largest HMAC output produced by any supported algorithm (SHA-512)
+#define COTP_MAX_HMAC_LEN          64
+
+#define COTP_MAX_VALIDATION_WINDOW 1024
+
+// splitmix64 finalizer: spreads sequential ids evenly over hash table buckets
+static inline uint64_t
+otp_mix64 (uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+struct cotp_key {
+    whmac_handle_t *hd;
+    uint8_t        *secret;
+    size_t          secret_len;
+    int             algo;
+};
+
+/*
+ * Normalizes (drops spaces, upper-cases) and decodes a Base32 secret.
+ * Returns a newly allocated buffer of *secret_len bytes that the caller must wipe and free().
+ */
+uint8_t      *otp_decode_secret    (const char          *base32_encoded_secret,
+                                    size_t              *secret_len,
+                                    cotp_error_t        *err_code);
+
+/*
+ * Builds a key around an already decoded secret, taking ownership of the malloc'ed buffer (it is
+ * wiped and freed with the key, or right away on failure). The algorithm must already be checked.
+ */
+cotp_key     *otp_key_adopt        (uint8_t             *secret,
+                                    size_t               secret_len,
+                                    int                  sha_algo,
+                                    cotp_error_t        *err_code);
+
+// get_hotp / get_totp_at without metrics accounting, for callers that generate codes internally
+char         *otp_hotp_code        (const char          *base32_encoded_secret,
+                                    long                 counter,
+                                    int                  digits,
+                                    int                  sha_algo,
+                                    cotp_error_t        *err_code);
+
+char         *otp_totp_code        (const char          *base32_encoded_secret,
+                                    long                 timestamp,
+                                    int                  digits,
+                                    int                  period,
+                                    int                  sha_algo,
+                                    cotp_error_t        *err_code);
+
+/*
+ * RFC 4226 §5.3 dynamic truncation. Returns 0 and stores the 31-bit value in *bin_code,
+ * or -1 if hlen is too short for the offset encoded in the last byte.
+ */
+int           otp_dynamic_truncate (const unsigned char *hmac,
+                                    size_t               hlen,
+                                    uint32_t            *bin_code);
+
+/*
+ * Parses a user-supplied code of exactly `digits` ASCII digits into *token.
+ * Returns 0 on success, -1 if the length or any character is wrong.
+ */
+int           otp_parse_code       (const char          *user_code,
+                                    int                  digits,
+                                    uint32_t            *token);
+
+/*
+ * Computes HMAC(counter) on a handle already keyed with whmac_setkey and returns the truncated
+ * 31-bit value in *bin_code. The handle is re-armed with whmac_reset for the next counter.
+ */
+cotp_error_t  otp_hmac_token       (whmac_handle_t      *hd,
+                                    long                 counter,
+                                    uint32_t            *bin_code);
+
+// Same as otp_hmac_token for a counter already encoded as 8 big-endian bytes
+cotp_error_t  otp_hmac_token_be    (whmac_handle_t      *hd,
+                                    const unsigned char  counter_be[8],
+                                    uint32_t            *bin_code);
+
+/*
+ * Computes HMAC(key, counter) on the key's pre-keyed handle and returns the truncated
+ * 31-bit value in *bin_code. The handle is re-armed before returning, so a key must not
+ * be used by two threads at once.
+ */
+cotp_error_t  key_token            (cotp_key            *key,
+                                    long                 counter,
+                                    uint32_t            *bin_code);
+
+// Per-thread HMAC handles, one per algorithm, reused across jobs. `keyed` remembers which cotp_key a
+// handle currently holds so runs of jobs on the same key skip setkey. Zero-initialize before use.
+typedef struct {
+    whmac_handle_t *hd[3];
+    const cotp_key *keyed[3];
+} otp_scratch;
+
+/*
+ * Stores in *hd the scratch handle for `algo` keyed with `key`, or with the decoded
+ * base32_encoded_secret when key is NULL. The key's own handle is never touched.
+ */
+cotp_error_t  otp_scratch_key      (otp_scratch         *ws,
+                                    const cotp_key      *key,
+                                    const char          *base32_encoded_secret,
+                                    int                  algo,
+                                    whmac_handle_t     **hd);
+
+// Validates and generates one batch job on the scratch handles; returns the job's error
+cotp_error_t  otp_scratch_job      (otp_scratch         *ws,
+                                    cotp_otp_job        *job);
+
+void          otp_scratch_release  (otp_scratch         *ws);
+
+#ifdef COTP_ENABLE_VALIDATION
+// Windows are symmetric, so the sign is dropped (INT_MIN, whose negation would overflow, maps to the
+// maximum). Returns the normalized window, or -1 if it exceeds COTP_MAX_VALIDATION_WINDOW.
+static inline int
+otp_normalize_window (int window)
+{
+    if (window == INT_MIN) {
+        return COTP_MAX_VALIDATION_WINDOW;
+    }
+    if (window < 0) {
+        window = -window;
+    }
+    return window > COTP_MAX_VALIDATION_WINDOW ? -1 : window;
+}
+
+/*
+ * validate_totp_in_window on a handle already keyed with whmac_setkey. Returns 1 and sets
+ * *matched_delta on a match; returns 0 with *err_code NO_ERROR on a miss or set to the error.
+ */
+int           otp_scan_totp_keyed  (whmac_handle_t      *hd,
+                                    const char          *user_code,
+                                    long                 timestamp,
+                                    int                  digits,
+                                    int                  period,
+                                    int                  window,
+                                    int                 *matched_delta,
+                                    cotp_error_t        *err_code);
+
+/*
+ * Constant-time variant of otp_scan_totp_keyed. It generates all 2 * window + 1 steps, then
+ * compares the user's token against all of them without branching on the result.
+ */
+int           otp_scan_totp_ct     (whmac_handle_t      *hd,
+                                    const char          *user_code,
+                                    long                 timestamp,
+                                    int                  digits,
+                                    int                  period,
+                                    int                  window,
+                                    int                 *matched_delta,
+                                    cotp_error_t        *err_code);
+#endif
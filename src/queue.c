@@ -0,0 +1,406 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#include "otp_internal.h"
+#include "utils/metrics.h"
+#include "utils/secure_zero.h"
+
+// Requests a worker takes per trip to the lock. They are then ordered by algorithm and key so
+// runs on the same cotp_key reuse one keyed handle.
+#define QUEUE_COALESCE 64
+
+struct cotp_queue {
+    pthread_mutex_t        lock;
+    pthread_cond_t         sub_cv;     // workers: submissions or shutdown
+    pthread_cond_t         done_cv;    // cotp_queue_wait: completions
+
+    cotp_async_request    *sq;
+    size_t                 sq_head;
+    size_t                 sq_count;
+    cotp_async_completion *cq;
+    size_t                 cq_head;
+    size_t                 cq_count;
+    size_t                 capacity;
+    size_t                 inflight;   // submitted and not yet polled, so neither ring can overflow
+
+    int                    shutdown;
+    int                    nthreads;
+    pthread_t             *threads;
+    int                    efd;
+};
+
+static int
+request_algo (const cotp_async_request *r)
+{
+    if (r->job.key != NULL) {
+        return r->job.key->algo;
+    }
+    // Steam jobs ignore sha_algo; validation requests ignore the job type
+    return r->op == COTP_ASYNC_GENERATE && r->job.type == COTP_JOB_STEAM ? COTP_SHA1 : r->job.sha_algo;
+}
+
+
+static void
+order_requests (const cotp_async_request *reqs,
+                size_t                    n,
+                size_t                   *order)
+{
+    // Insertion sort: groups are small and often already sorted
+    for (size_t i = 0; i < n; i++) {
+        size_t cur = order[i] = i;
+        int algo = request_algo (&reqs[cur]);
+        uintptr_t key = (uintptr_t)reqs[cur].job.key;
+        size_t j = i;
+        for (; j > 0; j--) {
+            const cotp_async_request *prev = &reqs[order[j - 1]];
+            int palgo = request_algo (prev);
+            if (palgo < algo || (palgo == algo && (uintptr_t)prev->job.key <= key)) {
+                break;
+            }
+            order[j] = order[j - 1];
+        }
+        order[j] = cur;
+    }
+}
+
+
+static cotp_error_t
+validate_request (otp_scratch        *ws,
+                  cotp_async_request *r,
+                  int                *matched_delta)
+{
+#ifdef COTP_ENABLE_VALIDATION
+    if (r->job.key == NULL && r->job.base32_encoded_secret == NULL) {
+        return INVALID_USER_INPUT;
+    }
+    int algo = request_algo (r);
+    if (algo != COTP_SHA1 && algo != COTP_SHA256 && algo != COTP_SHA512) {
+        return INVALID_ALGO;
+    }
+    whmac_handle_t *hd;
+    cotp_error_t err = otp_scratch_key (ws, r->job.key, r->job.base32_encoded_secret, algo, &hd);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    r->user_code[MAX_DIGITS] = '\0';
+    (void)otp_scan_totp_keyed (hd, r->user_code, r->job.counter, r->job.digits, r->job.period,
+                               r->window, matched_delta, &err);
+    COTP_METRIC_VALIDATED (err == VALID, *matched_delta, err);
+    return err;
+#else
+    (void)ws;
+    (void)r;
+    (void)matched_delta;
+    return INVALID_USER_INPUT;
+#endif
+}
+
+
+static void
+run_request (otp_scratch           *ws,
+             cotp_async_request    *r,
+             cotp_async_completion *c)
+{
+    c->user_data = r->user_data;
+    c->op = r->op;
+    c->matched_delta = 0;
+    c->code[0] = '\0';
+
+    switch (r->op) {
+        case COTP_ASYNC_GENERATE:
+            r->job.code[0] = '\0';
+            c->err = otp_scratch_job (ws, &r->job);
+            COTP_METRIC_GENERATED (request_algo (r), c->err);
+            if (c->err == NO_ERROR) {
+                memcpy (c->code, r->job.code, sizeof(c->code));
+            }
+            cotp_secure_memzero (r->job.code, sizeof(r->job.code));
+            break;
+        case COTP_ASYNC_VALIDATE_TOTP:
+            c->err = validate_request (ws, r, &c->matched_delta);
+            break;
+        default:
+            c->err = INVALID_USER_INPUT;
+            break;
+    }
+    cotp_secure_memzero (r->user_code, sizeof(r->user_code));
+}
+
+
+static void
+notify (cotp_queue *q)
+{
+#ifdef __linux__
+    uint64_t one = 1;
+    // EAGAIN means the counter is already non-zero, which is all a waiter needs
+    while (write (q->efd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+#else
+    (void)q;
+#endif
+}
+
+
+static void *
+queue_worker (void *p)
+{
+    cotp_queue *q = p;
+    otp_scratch ws = { 0 };
+    cotp_async_request    reqs[QUEUE_COALESCE];
+    cotp_async_completion done[QUEUE_COALESCE];
+    size_t                order[QUEUE_COALESCE];
+
+    pthread_mutex_lock (&q->lock);
+    for (;;) {
+        while (!q->shutdown && q->sq_count == 0) {
+            pthread_cond_wait (&q->sub_cv, &q->lock);
+        }
+        if (q->shutdown) {
+            break;
+        }
+        size_t n = q->sq_count < QUEUE_COALESCE ? q->sq_count : QUEUE_COALESCE;
+        for (size_t i = 0; i < n; i++) {
+            cotp_async_request *slot = &q->sq[(q->sq_head + i) % q->capacity];
+            reqs[i] = *slot;
+            cotp_secure_memzero (slot->user_code, sizeof(slot->user_code));
+        }
+        q->sq_head = (q->sq_head + n) % q->capacity;
+        q->sq_count -= n;
+        pthread_mutex_unlock (&q->lock);
+
+        order_requests (reqs, n, order);
+        for (size_t i = 0; i < n; i++) {
+            run_request (&ws, &reqs[order[i]], &done[i]);
+        }
+        // Callers may free a key once its completion is polled, and a new key can get the same
+        // address: no keyed handle, nor the secret inside it, may outlive the group it was keyed for
+        otp_scratch_release (&ws);
+
+        pthread_mutex_lock (&q->lock);
+        int was_empty = (q->cq_count == 0);
+        for (size_t i = 0; i < n; i++) {
+            q->cq[(q->cq_head + q->cq_count) % q->capacity] = done[i];
+            q->cq_count++;
+        }
+        pthread_cond_broadcast (&q->done_cv);
+        if (was_empty && q->efd >= 0) {
+            notify (q);
+        }
+        cotp_secure_memzero (done, n * sizeof(done[0]));
+    }
+    pthread_mutex_unlock (&q->lock);
+
+    return NULL;
+}
+
+
+static void
+stop_workers (cotp_queue *q,
+              int         started)
+{
+    pthread_mutex_lock (&q->lock);
+    q->shutdown = 1;
+    pthread_cond_broadcast (&q->sub_cv);
+    pthread_mutex_unlock (&q->lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join (q->threads[i], NULL);
+    }
+}
+
+
+cotp_queue *
+cotp_queue_create (int           threads,
+                   size_t        capacity,
+                   cotp_error_t *err_code)
+{
+    cotp_error_t local_err = NO_ERROR;
+    cotp_error_t *errp = err_code ? err_code : &local_err;
+
+    if (threads <= 0) {
+        long online = sysconf (_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (int)online : 1;
+    }
+    if (threads > COTP_POOL_MAX_THREADS || capacity == 0 ||
+        capacity > SIZE_MAX / sizeof(cotp_async_request)) {
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+    }
+
+    // One-shot backend initialization must happen before any worker touches a handle
+    if (whmac_check () == -1) {
+        *errp = WCRYPT_VERSION_MISMATCH;
+        return NULL;
+    }
+
+    cotp_queue *q = calloc (1, sizeof(*q));
+    if (q == NULL) {
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    pthread_mutex_init (&q->lock, NULL);
+    pthread_cond_init (&q->sub_cv, NULL);
+    pthread_cond_init (&q->done_cv, NULL);
+    q->capacity = capacity;
+    q->efd = -1;
+    q->sq = calloc (capacity, sizeof(cotp_async_request));
+    q->cq = calloc (capacity, sizeof(cotp_async_completion));
+    q->threads = calloc ((size_t)threads, sizeof(pthread_t));
+#ifdef __linux__
+    q->efd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+    if (q->sq == NULL || q->cq == NULL || q->threads == NULL) {
+        cotp_queue_free (q);
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create (&q->threads[i], NULL, queue_worker, q) != 0) {
+            q->nthreads = i;
+            cotp_queue_free (q);
+            *errp = MEMORY_ALLOCATION_ERROR;
+            return NULL;
+        }
+    }
+    q->nthreads = threads;
+
+    *errp = NO_ERROR;
+    return q;
+}
+
+
+void
+cotp_queue_free (cotp_queue *q)
+{
+    if (!q) return;
+    stop_workers (q, q->nthreads);
+    pthread_cond_destroy (&q->sub_cv);
+    pthread_cond_destroy (&q->done_cv);
+    pthread_mutex_destroy (&q->lock);
+    if (q->sq) {
+        cotp_secure_memzero (q->sq, q->capacity * sizeof(cotp_async_request));
+        free (q->sq);
+    }
+    if (q->cq) {
+        cotp_secure_memzero (q->cq, q->capacity * sizeof(cotp_async_completion));
+        free (q->cq);
+    }
+    if (q->efd >= 0) {
+        close (q->efd);
+    }
+    free (q->threads);
+    free (q);
+}
+
+
+size_t
+cotp_queue_submit (cotp_queue               *q,
+                   const cotp_async_request *reqs,
+                   size_t                    n,
+                   cotp_error_t             *err_code)
+{
+    if (!q || (!reqs && n > 0)) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+
+    pthread_mutex_lock (&q->lock);
+    size_t room = q->capacity - q->inflight;
+    size_t k = n < room ? n : room;
+    for (size_t i = 0; i < k; i++) {
+        q->sq[(q->sq_head + q->sq_count + i) % q->capacity] = reqs[i];
+    }
+    q->sq_count += k;
+    q->inflight += k;
+    if (k > QUEUE_COALESCE) {
+        pthread_cond_broadcast (&q->sub_cv);
+    } else if (k > 0) {
+        pthread_cond_signal (&q->sub_cv);
+    }
+    pthread_mutex_unlock (&q->lock);
+
+    if (err_code) *err_code = NO_ERROR;
+    return k;
+}
+
+
+// Caller holds q->lock
+static size_t
+take_completions (cotp_queue            *q,
+                  cotp_async_completion *out,
+                  size_t                 max)
+{
+    size_t k = q->cq_count < max ? q->cq_count : max;
+    for (size_t i = 0; i < k; i++) {
+        cotp_async_completion *slot = &q->cq[(q->cq_head + i) % q->capacity];
+        out[i] = *slot;
+        cotp_secure_memzero (slot, sizeof(*slot));
+    }
+    q->cq_head = (q->cq_head + k) % q->capacity;
+    q->cq_count -= k;
+    q->inflight -= k;
+    return k;
+}
+
+
+size_t
+cotp_queue_poll (cotp_queue            *q,
+                 cotp_async_completion *out,
+                 size_t                 max)
+{
+    if (!q || !out || max == 0) {
+        return 0;
+    }
+    pthread_mutex_lock (&q->lock);
+    size_t k = take_completions (q, out, max);
+    pthread_mutex_unlock (&q->lock);
+    return k;
+}
+
+
+size_t
+cotp_queue_wait (cotp_queue            *q,
+                 cotp_async_completion *out,
+                 size_t                 max,
+                 int                    timeout_ms)
+{
+    if (!q || !out || max == 0) {
+        return 0;
+    }
+
+    struct timespec deadline;
+    if (timeout_ms >= 0) {
+        clock_gettime (CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock (&q->lock);
+    while (q->cq_count == 0) {
+        if (timeout_ms < 0) {
+            pthread_cond_wait (&q->done_cv, &q->lock);
+        } else if (pthread_cond_timedwait (&q->done_cv, &q->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    size_t k = take_completions (q, out, max);
+    pthread_mutex_unlock (&q->lock);
+    return k;
+}
+
+
+int
+cotp_queue_eventfd (const cotp_queue *q)
+{
+    return q ? q->efd : -1;
+}
@@ -17,6 +17,7 @@ cotp_strerror (cotp_error_t err)
         case MISSING_LEADING_ZERO:     return "leading zero dropped during conversion";
         case INVALID_COUNTER:          return "invalid counter (must be >= 0)";
         case WHMAC_ERROR:              return "HMAC computation error";
+        case REPLAY_DETECTED:          return "OTP already used";
     }
     return "unknown error";
 }
@@ -0,0 +1,94 @@
+#pragma once
+// Digit reduction and formatting specialized per code length. Each otp_reduce_N divides by a
+// constant, which compilers turn into a multiply and shift, and each otp_format_N writes two
+// digits at a time from a lookup table with a fully unrolled loop. otp_code_reduce and
+// otp_code_format pick the specialization from a runtime digits value. otp_steam_format does
+// the same for Steam's base-26 alphabet.
+#include <stdint.h>
+#include <string.h>
+#include "../cotp.h"
+
+_Static_assert (MIN_DIGITS == 4 && MAX_DIGITS == 10, "one specialization per supported code length");
+
+// "00" "01" … "99"
+extern const char otp_digit_pairs[200];
+
+// Steam Guard alphabet: digits and consonants that cannot be mistaken for each other
+extern const char otp_steam_alphabet[26];
+
+#define OTP_DEFINE_DIGITS(N, MOD)                                                   \
+    static inline uint32_t                                                          \
+    otp_reduce_##N (uint32_t bin_code)                                              \
+    {                                                                               \
+        return (uint32_t)((uint64_t)bin_code % (MOD));                              \
+    }                                                                               \
+                                                                                    \
+    static inline void                                                              \
+    otp_format_##N (uint32_t token,                                                 \
+                    char    *out)                                                   \
+    {                                                                               \
+        out[N] = '\0';                                                              \
+        int i = N;                                                                  \
+        for (; i >= 2; i -= 2) {                                                    \
+            memcpy (out + i - 2, otp_digit_pairs + (token % 100) * 2, 2);           \
+            token /= 100;                                                           \
+        }                                                                           \
+        if (i == 1) {                                                               \
+            out[0] = (char)('0' + token);                                           \
+        }                                                                           \
+    }
+
+OTP_DEFINE_DIGITS (4,  10000ULL)
+OTP_DEFINE_DIGITS (5,  100000ULL)
+OTP_DEFINE_DIGITS (6,  1000000ULL)
+OTP_DEFINE_DIGITS (7,  10000000ULL)
+OTP_DEFINE_DIGITS (8,  100000000ULL)
+OTP_DEFINE_DIGITS (9,  1000000000ULL)
+OTP_DEFINE_DIGITS (10, 10000000000ULL)
+
+// Truncated 31-bit value reduced to `digits` decimal digits; digits must be in [MIN_DIGITS, MAX_DIGITS]
+static inline uint32_t
+otp_code_reduce (uint32_t bin_code,
+                 int      digits)
+{
+    switch (digits) {
+        case 4:  return otp_reduce_4 (bin_code);
+        case 5:  return otp_reduce_5 (bin_code);
+        case 6:  return otp_reduce_6 (bin_code);
+        case 7:  return otp_reduce_7 (bin_code);
+        case 8:  return otp_reduce_8 (bin_code);
+        case 9:  return otp_reduce_9 (bin_code);
+        default: return otp_reduce_10 (bin_code);
+    }
+}
+
+
+// Reduces and writes the zero-padded code followed by a NUL; out must hold digits + 1 bytes
+static inline void
+otp_code_format (uint32_t bin_code,
+                 int      digits,
+                 char    *out)
+{
+    switch (digits) {
+        case 4:  otp_format_4 (otp_reduce_4 (bin_code), out); break;
+        case 5:  otp_format_5 (otp_reduce_5 (bin_code), out); break;
+        case 6:  otp_format_6 (otp_reduce_6 (bin_code), out); break;
+        case 7:  otp_format_7 (otp_reduce_7 (bin_code), out); break;
+        case 8:  otp_format_8 (otp_reduce_8 (bin_code), out); break;
+        case 9:  otp_format_9 (otp_reduce_9 (bin_code), out); break;
+        default: otp_format_10 (otp_reduce_10 (bin_code), out); break;
+    }
+}
+
+
+// Writes the COTP_STEAM_DIGITS-character Steam code for a truncated value, followed by a NUL
+static inline void
+otp_steam_format (uint32_t bin_code,
+                  char    *out)
+{
+    for (int i = 0; i < COTP_STEAM_DIGITS; i++) {
+        out[i] = otp_steam_alphabet[bin_code % 26u];
+        bin_code /= 26u;
+    }
+    out[COTP_STEAM_DIGITS] = '\0';
+}
@@ -0,0 +1,351 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "../otp_internal.h"
+#include "metrics.h"
+#include "trace.h"
+#include "digits.h"
+
+#ifdef COTP_ENABLE_VALIDATION
+
+// Same layout as the replay cache: independent shards behind their own mutex, each an
+// open-addressing table. Estimates are kept in 1/256 of a step so small drifts accumulate.
+#define DRIFT_SHARDS 64
+#define DRIFT_SCALE  256
+// Weight of a new observation in the moving average is 1 / DRIFT_SMOOTHING
+#define DRIFT_SMOOTHING 4
+
+typedef struct {
+    uint64_t key_id;
+    int32_t  estimate;     // smoothed offset in steps * DRIFT_SCALE
+    uint32_t samples;      // 0 marks a free bucket
+} drift_entry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    drift_entry    *entries;
+    size_t          mask;
+    size_t          used;
+} drift_shard;
+
+struct cotp_drift_tracker {
+    drift_shard shards[DRIFT_SHARDS];
+    size_t      max_load;      // per shard
+};
+
+static drift_shard *
+shard_of (cotp_drift_tracker *dt,
+          uint64_t            key_id)
+{
+    return &dt->shards[otp_mix64 (key_id) % DRIFT_SHARDS];
+}
+
+
+// Low bits pick the shard, the remaining ones the bucket inside it
+static size_t
+home_bucket (const drift_shard *shard,
+             uint64_t           key_id)
+{
+    return (size_t)(otp_mix64 (key_id) / DRIFT_SHARDS) & shard->mask;
+}
+
+
+// Returns the bucket holding key_id, or the free bucket where it would go
+static size_t
+find_bucket (const drift_shard *shard,
+             uint64_t           key_id)
+{
+    size_t i = home_bucket (shard, key_id);
+    while (shard->entries[i].samples != 0 && shard->entries[i].key_id != key_id) {
+        i = (i + 1) & shard->mask;
+    }
+    return i;
+}
+
+
+static int
+round_estimate (int32_t estimate)
+{
+    return (int)((estimate + (estimate < 0 ? -DRIFT_SCALE / 2 : DRIFT_SCALE / 2)) / DRIFT_SCALE);
+}
+
+
+cotp_drift_tracker *
+cotp_drift_tracker_create (size_t        capacity,
+                           cotp_error_t *err_code)
+{
+    cotp_error_t local_err = NO_ERROR;
+    cotp_error_t *errp = err_code ? err_code : &local_err;
+
+    if (capacity == 0 || capacity > SIZE_MAX / 4 / sizeof(drift_entry)) {
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+    }
+
+    // Size every shard for its share of `capacity` at a 3/4 maximum load factor, plus headroom
+    // for keys that hash unevenly
+    size_t per_shard = (capacity + DRIFT_SHARDS - 1) / DRIFT_SHARDS;
+    size_t buckets = 16;
+    while (buckets * 3 / 4 < per_shard + per_shard / 4 + 1) {
+        buckets <<= 1;
+    }
+
+    cotp_drift_tracker *dt = calloc (1, sizeof(*dt));
+    if (dt == NULL) {
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    dt->max_load = buckets * 3 / 4;
+    for (int i = 0; i < DRIFT_SHARDS; i++) {
+        dt->shards[i].entries = calloc (buckets, sizeof(drift_entry));
+        if (dt->shards[i].entries == NULL) {
+            for (int j = 0; j < i; j++) {
+                pthread_mutex_destroy (&dt->shards[j].lock);
+                free (dt->shards[j].entries);
+            }
+            free (dt);
+            *errp = MEMORY_ALLOCATION_ERROR;
+            return NULL;
+        }
+        dt->shards[i].mask = buckets - 1;
+        pthread_mutex_init (&dt->shards[i].lock, NULL);
+    }
+
+    *errp = NO_ERROR;
+    return dt;
+}
+
+
+void
+cotp_drift_tracker_free (cotp_drift_tracker *dt)
+{
+    if (!dt) return;
+    for (int i = 0; i < DRIFT_SHARDS; i++) {
+        pthread_mutex_destroy (&dt->shards[i].lock);
+        free (dt->shards[i].entries);
+    }
+    free (dt);
+}
+
+
+cotp_error_t
+cotp_drift_tracker_record (cotp_drift_tracker *dt,
+                           uint64_t            key_id,
+                           int                 delta)
+{
+    if (!dt || delta < -COTP_MAX_VALIDATION_WINDOW || delta > COTP_MAX_VALIDATION_WINDOW) {
+        return INVALID_USER_INPUT;
+    }
+
+    drift_shard *shard = shard_of (dt, key_id);
+    pthread_mutex_lock (&shard->lock);
+    size_t i = find_bucket (shard, key_id);
+    drift_entry *e = &shard->entries[i];
+    int32_t observed = (int32_t)delta * DRIFT_SCALE;
+    if (e->samples == 0) {
+        if (shard->used >= dt->max_load) {
+            pthread_mutex_unlock (&shard->lock);
+            return MEMORY_ALLOCATION_ERROR;
+        }
+        // The first match is the best estimate there is
+        e->key_id = key_id;
+        e->estimate = observed;
+        e->samples = 1;
+        shard->used++;
+    } else {
+        e->estimate += (observed - e->estimate) / DRIFT_SMOOTHING;
+        if (e->samples < UINT32_MAX) {
+            e->samples++;
+        }
+    }
+    pthread_mutex_unlock (&shard->lock);
+    return NO_ERROR;
+}
+
+
+int
+cotp_drift_tracker_expected (cotp_drift_tracker *dt,
+                             uint64_t            key_id)
+{
+    if (!dt) return 0;
+
+    drift_shard *shard = shard_of (dt, key_id);
+    pthread_mutex_lock (&shard->lock);
+    const drift_entry *e = &shard->entries[find_bucket (shard, key_id)];
+    int expected = e->samples != 0 ? round_estimate (e->estimate) : 0;
+    pthread_mutex_unlock (&shard->lock);
+    return expected;
+}
+
+
+void
+cotp_drift_tracker_forget (cotp_drift_tracker *dt,
+                           uint64_t            key_id)
+{
+    if (!dt) return;
+
+    drift_shard *shard = shard_of (dt, key_id);
+    pthread_mutex_lock (&shard->lock);
+    size_t i = find_bucket (shard, key_id);
+    if (shard->entries[i].samples != 0) {
+        // Backward-shift deletion: pull later members of the probe chain into the hole
+        for (size_t j = (i + 1) & shard->mask; shard->entries[j].samples != 0; j = (j + 1) & shard->mask) {
+            size_t home = home_bucket (shard, shard->entries[j].key_id);
+            int movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+            if (movable) {
+                shard->entries[i] = shard->entries[j];
+                i = j;
+            }
+        }
+        memset (&shard->entries[i], 0, sizeof(shard->entries[i]));
+        shard->used--;
+    }
+    pthread_mutex_unlock (&shard->lock);
+}
+
+
+// Tries the offsets [lo, hi] in ascending order; offsets whose timestamp would overflow are skipped
+static int
+scan_range (whmac_handle_t *hd,
+            uint32_t        user_token,
+            long            timestamp,
+            int             digits,
+            int             period,
+            int             lo,
+            int             hi,
+            int            *matched_delta,
+            cotp_error_t   *err_code)
+{
+    for (int delta = lo; delta <= hi; ++delta) {
+        long step;
+        long t;
+        if (__builtin_mul_overflow ((long)delta, (long)period, &step) ||
+            __builtin_add_overflow (timestamp, step, &t)) {
+            continue;
+        }
+        uint32_t bin_code;
+        cotp_error_t err = otp_hmac_token (hd, t / period, &bin_code);
+        if (err != NO_ERROR) {
+            *err_code = err;
+            return 0;
+        }
+        uint32_t token = otp_code_reduce (bin_code, digits);
+        if (cotp_timing_safe_memcmp (&token, &user_token, sizeof(token)) == 0) {
+            *matched_delta = delta;
+            *err_code = VALID;
+            return 1;
+        }
+    }
+    *err_code = NO_ERROR;
+    return 0;
+}
+
+
+static int
+scan_with_drift (cotp_drift_tracker *dt,
+                 uint64_t            key_id,
+                 const char         *user_code,
+                 const char         *base32_encoded_secret,
+                 long                timestamp,
+                 int                 digits,
+                 int                 period,
+                 int                 sha_algo,
+                 int                 narrow_window,
+                 int                 wide_window,
+                 int                *matched_delta,
+                 cotp_error_t       *err_code)
+{
+    *matched_delta = 0;
+    if (!dt || !user_code || !base32_encoded_secret) {
+        *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+    if (digits < MIN_DIGITS || digits > MAX_DIGITS) {
+        *err_code = INVALID_DIGITS;
+        return 0;
+    }
+    if (period <= 0 || period > 120) {
+        *err_code = INVALID_PERIOD;
+        return 0;
+    }
+    if (narrow_window < 0 || narrow_window > COTP_MAX_VALIDATION_WINDOW ||
+        wide_window < 0 || wide_window > COTP_MAX_VALIDATION_WINDOW) {
+        *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+    // Same rule as the plain scan: the lowest step of the wide window must have a valid counter
+    long lowest;
+    if (__builtin_sub_overflow (timestamp, (long)wide_window * period, &lowest) || lowest / period < 0) {
+        *err_code = INVALID_COUNTER;
+        return 0;
+    }
+    // Codes of the wrong shape can't match
+    uint32_t user_token;
+    if (otp_parse_code (user_code, digits, &user_token) != 0) {
+        *err_code = NO_ERROR;
+        return 0;
+    }
+
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (base32_encoded_secret, sha_algo, &err);
+    if (key == NULL) {
+        *err_code = err;
+        return 0;
+    }
+
+    // The narrow window is centered on the expected offset but never reaches outside the wide one,
+    // which stays the acceptance policy
+    if (narrow_window > wide_window) narrow_window = wide_window;
+    int center = cotp_drift_tracker_expected (dt, key_id);
+    if (center < -wide_window) center = -wide_window;
+    if (center > wide_window) center = wide_window;
+    int lo = center - narrow_window < -wide_window ? -wide_window : center - narrow_window;
+    int hi = center + narrow_window > wide_window ? wide_window : center + narrow_window;
+
+    int ok = scan_range (key->hd, user_token, timestamp, digits, period, lo, hi, matched_delta, err_code);
+    // On a miss, try the rest of the wide window without repeating the offsets already computed
+    if (!ok && *err_code == NO_ERROR) {
+        ok = scan_range (key->hd, user_token, timestamp, digits, period, -wide_window, lo - 1,
+                         matched_delta, err_code);
+    }
+    if (!ok && *err_code == NO_ERROR) {
+        ok = scan_range (key->hd, user_token, timestamp, digits, period, hi + 1, wide_window,
+                         matched_delta, err_code);
+    }
+    cotp_key_free (key);
+
+    if (ok) {
+        // A full shard only costs the hint for this account, never the validation itself
+        (void)cotp_drift_tracker_record (dt, key_id, *matched_delta);
+    }
+    return ok;
+}
+
+
+int validate_totp_with_drift(cotp_drift_tracker* dt,
+                             uint64_t      key_id,
+                             const char*   user_code,
+                             const char*   base32_encoded_secret,
+                             long          timestamp,
+                             int           digits,
+                             int           period,
+                             int           sha_algo,
+                             int           narrow_window,
+                             int           wide_window,
+                             int*          matched_delta,
+                             cotp_error_t* err_code)
+{
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_VALIDATE_TOTP, sha_algo, wide_window);
+    cotp_error_t err = NO_ERROR;
+    int delta = 0;
+    int ok = scan_with_drift (dt, key_id, user_code, base32_encoded_secret, timestamp, digits, period, sha_algo,
+                              narrow_window, wide_window, &delta, &err);
+    trace_end (&span, err);
+    COTP_METRIC_VALIDATED (ok, delta, err);
+    if (matched_delta) *matched_delta = delta;
+    if (err_code) *err_code = err;
+    return ok;
+}
+
+#endif
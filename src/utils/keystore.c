@@ -0,0 +1,611 @@
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "../otp_internal.h"
+#include "secure_zero.h"
+
+#ifdef COTP_ENABLE_KEYSTORE
+
+// The segment is a header followed by a power-of-two array of slots, an open-addressing table
+// keyed by key id. One process writes; any number of processes map it read-only and read slots
+// under a per-slot seqlock, so readers never block the writer or each other. Removed slots become
+// tombstones rather than being shifted back, because a shift would move entries under a reader's feet.
+#define KEYSTORE_MAGIC        0x31534b50544f43ULL   // "COTPKS1"
+#define KEYSTORE_LAYOUT       1
+#define KEYSTORE_SECRET_WORDS (COTP_KEYSTORE_MAX_SECRET_LEN / 8)
+// Seqlock read attempts before a reader starts yielding to a writer that was preempted mid-update
+#define KEYSTORE_SPIN         64
+// A slot still mid-update after this long was left behind by a writer that died inside a put
+#define KEYSTORE_STALL_NS     1000000000L
+
+enum { SLOT_EMPTY = 0, SLOT_LIVE = 1, SLOT_REMOVED = 2 };
+
+// Every field is an atomic so readers racing the writer stay well defined; relaxed loads and
+// stores compile to plain moves, and the sequence counter orders them.
+typedef struct {
+    _Atomic uint32_t seq;      // odd while the writer is updating the slot
+    _Atomic uint32_t meta;     // state | algo << 8 | secret length << 16
+    _Atomic uint64_t key_id;
+    _Atomic uint64_t secret[KEYSTORE_SECRET_WORDS];
+} keystore_slot;
+
+typedef struct {
+    uint64_t         magic;
+    uint32_t         layout;
+    uint32_t         slot_size;
+    uint64_t         slots;
+    uint64_t         max_load;     // live slots plus tombstones
+    _Atomic uint64_t generation;   // bumped by every put and remove
+    _Atomic uint64_t live;
+    uint64_t         filled;       // writer only
+    uint64_t         reserved;
+} keystore_header;
+
+struct cotp_keystore {
+    keystore_header *hdr;
+    keystore_slot   *slots;
+    size_t           map_len;
+    int              fd;           // -1 for attachments that did not create the segment
+    pid_t            writer;       // process allowed to write, 0 for read-only attachments
+    char            *name;         // POSIX name to unlink when the writer closes, NULL for memfd
+    pthread_mutex_t  lock;         // serializes writer threads
+};
+
+// What a reader copies out of a slot
+typedef struct {
+    uint32_t meta;
+    uint64_t key_id;
+    uint8_t  secret[COTP_KEYSTORE_MAX_SECRET_LEN];
+} slot_view;
+
+static int
+meta_state (uint32_t meta)
+{
+    return (int)(meta & 0xff);
+}
+
+
+static int
+meta_algo (uint32_t meta)
+{
+    return (int)((meta >> 8) & 0xff);
+}
+
+
+static size_t
+meta_len (uint32_t meta)
+{
+    return (size_t)(meta >> 16);
+}
+
+
+static uint32_t
+make_meta (int    state,
+           int    algo,
+           size_t len)
+{
+    return (uint32_t)state | (uint32_t)algo << 8 | (uint32_t)len << 16;
+}
+
+
+static size_t
+home_slot (const cotp_keystore *ks,
+           uint64_t             key_id)
+{
+    return (size_t)(otp_mix64 (key_id) & (ks->hdr->slots - 1));
+}
+
+
+static long
+elapsed_ns (const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return (long)(now.tv_sec - since->tv_sec) * 1000000000L + (now.tv_nsec - since->tv_nsec);
+}
+
+
+/*
+ * Copies a consistent snapshot of the slot; the secret only when the slot is live for `key_id`.
+ * Returns -1 if the slot stays mid-update for KEYSTORE_STALL_NS, so readers never hang on a dead writer.
+ */
+static int
+read_slot (const keystore_slot *slot,
+           uint64_t             key_id,
+           slot_view           *out)
+{
+    struct timespec stalled_since;
+    for (unsigned attempt = 0;; attempt++) {
+        if (attempt == KEYSTORE_SPIN) {
+            clock_gettime (CLOCK_MONOTONIC, &stalled_since);
+        }
+        if (attempt >= KEYSTORE_SPIN) {
+            if (elapsed_ns (&stalled_since) >= KEYSTORE_STALL_NS) {
+                return -1;
+            }
+            sched_yield ();
+        }
+        uint32_t begin = atomic_load_explicit (&slot->seq, memory_order_acquire);
+        if (begin & 1) {
+            continue;
+        }
+        out->meta = atomic_load_explicit (&slot->meta, memory_order_relaxed);
+        out->key_id = atomic_load_explicit (&slot->key_id, memory_order_relaxed);
+        if (meta_state (out->meta) == SLOT_LIVE && out->key_id == key_id) {
+            for (size_t w = 0; w < KEYSTORE_SECRET_WORDS; w++) {
+                uint64_t word = atomic_load_explicit (&slot->secret[w], memory_order_relaxed);
+                memcpy (out->secret + 8 * w, &word, 8);
+            }
+        }
+        atomic_thread_fence (memory_order_acquire);
+        if (atomic_load_explicit (&slot->seq, memory_order_relaxed) == begin) {
+            return 0;
+        }
+    }
+}
+
+
+static void
+write_slot (keystore_slot *slot,
+            uint32_t       meta,
+            uint64_t       key_id,
+            const uint8_t *secret,
+            size_t         secret_len)
+{
+    uint32_t seq = atomic_load_explicit (&slot->seq, memory_order_relaxed);
+    atomic_store_explicit (&slot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence (memory_order_release);
+    atomic_store_explicit (&slot->meta, meta, memory_order_relaxed);
+    atomic_store_explicit (&slot->key_id, key_id, memory_order_relaxed);
+    for (size_t w = 0; w < KEYSTORE_SECRET_WORDS; w++) {
+        uint8_t bytes[8] = { 0 };
+        if (8 * w < secret_len) {
+            memcpy (bytes, secret + 8 * w, secret_len - 8 * w < 8 ? secret_len - 8 * w : 8);
+        }
+        uint64_t word;
+        memcpy (&word, bytes, 8);
+        atomic_store_explicit (&slot->secret[w], word, memory_order_relaxed);
+    }
+    atomic_store_explicit (&slot->seq, seq + 2, memory_order_release);
+}
+
+
+/*
+ * Looks key_id up. Stores in *index the slot and fills *view when it is live, or stores the slot
+ * count when it is absent. WHMAC_ERROR if a slot on the way was left mid-update by a dead writer.
+ */
+static cotp_error_t
+find_live (const cotp_keystore *ks,
+           uint64_t             key_id,
+           slot_view           *view,
+           size_t              *index)
+{
+    size_t mask = (size_t)ks->hdr->slots - 1;
+    size_t i = home_slot (ks, key_id);
+    *index = (size_t)ks->hdr->slots;
+    for (size_t probes = 0; probes <= mask; probes++, i = (i + 1) & mask) {
+        if (read_slot (&ks->slots[i], key_id, view) != 0) {
+            return WHMAC_ERROR;
+        }
+        int state = meta_state (view->meta);
+        if (state == SLOT_EMPTY) {
+            break;
+        }
+        if (state == SLOT_LIVE && view->key_id == key_id) {
+            *index = i;
+            break;
+        }
+    }
+    return NO_ERROR;
+}
+
+
+static cotp_keystore *
+map_segment (int           fd,
+             int           writable,
+             cotp_error_t *err_code)
+{
+    struct stat st;
+    if (fstat (fd, &st) != 0 || (size_t)st.st_size < sizeof(keystore_header)) {
+        *err_code = INVALID_USER_INPUT;
+        return NULL;
+    }
+    size_t len = (size_t)st.st_size;
+    void *map = mmap (NULL, len, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        *err_code = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    keystore_header *hdr = map;
+    uint64_t slots = hdr->slots;
+    if (hdr->magic != KEYSTORE_MAGIC || hdr->layout != KEYSTORE_LAYOUT || hdr->slot_size != sizeof(keystore_slot) ||
+        slots == 0 || (slots & (slots - 1)) != 0 ||
+        slots > (len - sizeof(keystore_header)) / sizeof(keystore_slot)) {
+        munmap (map, len);
+        *err_code = INVALID_USER_INPUT;
+        return NULL;
+    }
+
+    cotp_keystore *ks = calloc (1, sizeof(*ks));
+    if (ks == NULL) {
+        munmap (map, len);
+        *err_code = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    ks->hdr = hdr;
+    ks->slots = (keystore_slot *)(hdr + 1);
+    ks->map_len = len;
+    ks->fd = -1;
+    pthread_mutex_init (&ks->lock, NULL);
+    *err_code = NO_ERROR;
+    return ks;
+}
+
+
+cotp_keystore *
+cotp_keystore_create (const char   *name,
+                      size_t        capacity,
+                      cotp_error_t *err_code)
+{
+    cotp_error_t local_err = NO_ERROR;
+    cotp_error_t *errp = err_code ? err_code : &local_err;
+
+    if (capacity == 0 || capacity > (SIZE_MAX / 2 - sizeof(keystore_header)) / 2 / sizeof(keystore_slot)) {
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+    }
+    // 3/4 maximum load, counting tombstones, keeps probe chains short and always ends them
+    size_t slots = 16;
+    while (slots * 3 / 4 < capacity) {
+        slots <<= 1;
+    }
+    size_t len = sizeof(keystore_header) + slots * sizeof(keystore_slot);
+
+    int fd;
+    if (name != NULL) {
+        fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    } else {
+#ifdef __linux__
+        fd = memfd_create ("cotp-keystore", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+#endif
+    }
+    if (fd < 0) {
+        *errp = errno == EEXIST || errno == EINVAL || errno == ENAMETOOLONG ? INVALID_USER_INPUT
+                                                                            : MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    // The new segment reads as zeros: every slot starts empty with an even sequence
+    if (ftruncate (fd, (off_t)len) != 0) {
+        close (fd);
+        if (name != NULL) shm_unlink (name);
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+#ifdef __linux__
+    // Whoever receives the descriptor must not be able to resize the segment under other readers
+    if (name == NULL) {
+        (void)fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+    }
+#endif
+    void *map = mmap (NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close (fd);
+        if (name != NULL) shm_unlink (name);
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    keystore_header *hdr = map;
+    hdr->layout = KEYSTORE_LAYOUT;
+    hdr->slot_size = sizeof(keystore_slot);
+    hdr->slots = slots;
+    hdr->max_load = slots * 3 / 4;
+    // Readers check the magic last, so they never attach to a half-initialized header
+    atomic_thread_fence (memory_order_release);
+    hdr->magic = KEYSTORE_MAGIC;
+    munmap (map, len);
+
+    cotp_keystore *ks = map_segment (fd, 1, errp);
+    char *name_copy = name != NULL ? strdup (name) : NULL;
+    if (ks == NULL || (name != NULL && name_copy == NULL)) {
+        cotp_keystore_close (ks);
+        free (name_copy);
+        close (fd);
+        if (name != NULL) shm_unlink (name);
+        *errp = ks == NULL ? *errp : MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    ks->fd = fd;
+    ks->writer = getpid ();
+    ks->name = name_copy;
+    return ks;
+}
+
+
+cotp_keystore *
+cotp_keystore_open (const char   *name,
+                    cotp_error_t *err_code)
+{
+    cotp_error_t local_err = NO_ERROR;
+    cotp_error_t *errp = err_code ? err_code : &local_err;
+
+    if (name == NULL) {
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+    }
+    int fd = shm_open (name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+    }
+    cotp_keystore *ks = map_segment (fd, 0, errp);
+    // The mapping stays valid without the descriptor
+    close (fd);
+    return ks;
+}
+
+
+cotp_keystore *
+cotp_keystore_open_fd (int           fd,
+                       cotp_error_t *err_code)
+{
+    cotp_error_t local_err = NO_ERROR;
+    cotp_error_t *errp = err_code ? err_code : &local_err;
+
+    if (fd < 0) {
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+    }
+    return map_segment (fd, 0, errp);
+}
+
+
+int
+cotp_keystore_fd (const cotp_keystore *ks)
+{
+    return ks != NULL && ks->writer == getpid () ? ks->fd : -1;
+}
+
+
+void
+cotp_keystore_close (cotp_keystore *ks)
+{
+    if (!ks) return;
+    // A child that inherited the writer's handle over fork() only detaches
+    if (ks->writer == getpid ()) {
+        if (ks->name != NULL) {
+            shm_unlink (ks->name);
+        }
+    }
+    if (ks->fd >= 0) {
+        close (ks->fd);
+    }
+    munmap (ks->hdr, ks->map_len);
+    pthread_mutex_destroy (&ks->lock);
+    free (ks->name);
+    free (ks);
+}
+
+
+cotp_error_t
+cotp_keystore_put (cotp_keystore *ks,
+                   uint64_t       key_id,
+                   const char    *base32_encoded_secret,
+                   int            sha_algo)
+{
+    if (ks == NULL || ks->writer != getpid () || base32_encoded_secret == NULL) {
+        return INVALID_USER_INPUT;
+    }
+    if (sha_algo != COTP_SHA1 && sha_algo != COTP_SHA256 && sha_algo != COTP_SHA512) {
+        return INVALID_ALGO;
+    }
+    cotp_error_t err;
+    size_t secret_len = 0;
+    uint8_t *secret = otp_decode_secret (base32_encoded_secret, &secret_len, &err);
+    if (secret == NULL) {
+        return err;
+    }
+    if (secret_len > COTP_KEYSTORE_MAX_SECRET_LEN) {
+        cotp_secure_memzero (secret, secret_len);
+        free (secret);
+        return INVALID_USER_INPUT;
+    }
+
+    pthread_mutex_lock (&ks->lock);
+    keystore_header *hdr = ks->hdr;
+    size_t mask = (size_t)hdr->slots - 1;
+    size_t target = (size_t)hdr->slots;
+    size_t i = home_slot (ks, key_id);
+    // Walk the whole chain: the id may live past a tombstone that could take a new entry
+    for (;; i = (i + 1) & mask) {
+        uint32_t meta = atomic_load_explicit (&ks->slots[i].meta, memory_order_relaxed);
+        int state = meta_state (meta);
+        if (state == SLOT_LIVE && atomic_load_explicit (&ks->slots[i].key_id, memory_order_relaxed) == key_id) {
+            target = i;
+            break;
+        }
+        if (state == SLOT_REMOVED && target == hdr->slots) {
+            target = i;
+        }
+        if (state == SLOT_EMPTY) {
+            if (target == hdr->slots) {
+                if (hdr->filled >= hdr->max_load) {
+                    break;
+                }
+                target = i;
+                hdr->filled++;
+            }
+            atomic_fetch_add_explicit (&hdr->live, 1, memory_order_relaxed);
+            break;
+        }
+    }
+
+    err = NO_ERROR;
+    if (target == hdr->slots) {
+        err = MEMORY_ALLOCATION_ERROR;
+    } else {
+        write_slot (&ks->slots[target], make_meta (SLOT_LIVE, sha_algo, secret_len), key_id, secret, secret_len);
+        atomic_fetch_add_explicit (&hdr->generation, 1, memory_order_release);
+    }
+    pthread_mutex_unlock (&ks->lock);
+
+    cotp_secure_memzero (secret, secret_len);
+    free (secret);
+    return err;
+}
+
+
+cotp_error_t
+cotp_keystore_remove (cotp_keystore *ks,
+                      uint64_t       key_id)
+{
+    if (ks == NULL || ks->writer != getpid ()) {
+        return INVALID_USER_INPUT;
+    }
+
+    pthread_mutex_lock (&ks->lock);
+    slot_view view;
+    size_t i;
+    cotp_error_t err = find_live (ks, key_id, &view, &i);
+    cotp_secure_memzero (&view, sizeof(view));
+    if (err != NO_ERROR || i == ks->hdr->slots) {
+        pthread_mutex_unlock (&ks->lock);
+        return err != NO_ERROR ? err : INVALID_USER_INPUT;
+    }
+    // The tombstone keeps later members of the probe chain reachable; the secret is wiped
+    write_slot (&ks->slots[i], make_meta (SLOT_REMOVED, 0, 0), 0, NULL, 0);
+    // When the chain ends right after it, nothing lies beyond this tombstone and the ones just
+    // before it, so they can go back to empty and free their share of max_load
+    size_t mask = (size_t)ks->hdr->slots - 1;
+    uint32_t next = atomic_load_explicit (&ks->slots[(i + 1) & mask].meta, memory_order_relaxed);
+    if (meta_state (next) == SLOT_EMPTY) {
+        for (size_t n = 0; n <= mask; n++, i = (i - 1) & mask) {
+            uint32_t meta = atomic_load_explicit (&ks->slots[i].meta, memory_order_relaxed);
+            if (meta_state (meta) != SLOT_REMOVED) {
+                break;
+            }
+            write_slot (&ks->slots[i], make_meta (SLOT_EMPTY, 0, 0), 0, NULL, 0);
+            ks->hdr->filled--;
+        }
+    }
+    atomic_fetch_sub_explicit (&ks->hdr->live, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit (&ks->hdr->generation, 1, memory_order_release);
+    pthread_mutex_unlock (&ks->lock);
+    return NO_ERROR;
+}
+
+
+uint64_t
+cotp_keystore_generation (const cotp_keystore *ks)
+{
+    return ks != NULL ? atomic_load_explicit (&ks->hdr->generation, memory_order_acquire) : 0;
+}
+
+
+size_t
+cotp_keystore_count (const cotp_keystore *ks)
+{
+    return ks != NULL ? (size_t)atomic_load_explicit (&ks->hdr->live, memory_order_relaxed) : 0;
+}
+
+
+cotp_key *
+cotp_keystore_get_key (const cotp_keystore *ks,
+                       uint64_t             key_id,
+                       cotp_error_t        *err_code)
+{
+    cotp_error_t local_err = NO_ERROR;
+    cotp_error_t *errp = err_code ? err_code : &local_err;
+
+    if (ks == NULL) {
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+    }
+    if (whmac_check () == -1) {
+        *errp = WCRYPT_VERSION_MISMATCH;
+        return NULL;
+    }
+
+    slot_view view;
+    size_t i;
+    cotp_error_t err = find_live (ks, key_id, &view, &i);
+    if (err != NO_ERROR || i == ks->hdr->slots) {
+        cotp_secure_memzero (&view, sizeof(view));
+        *errp = err != NO_ERROR ? err : INVALID_USER_INPUT;
+        return NULL;
+    }
+    size_t len = meta_len (view.meta);
+    uint8_t *secret = malloc (len > 0 ? len : 1);
+    if (secret == NULL) {
+        cotp_secure_memzero (&view, sizeof(view));
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    memcpy (secret, view.secret, len);
+    int algo = meta_algo (view.meta);
+    cotp_secure_memzero (&view, sizeof(view));
+    return otp_key_adopt (secret, len, algo, errp);
+}
+
+
+cotp_error_t
+cotp_keystore_totp_at (const cotp_keystore *ks,
+                       uint64_t             key_id,
+                       long                 timestamp,
+                       int                  digits,
+                       int                  period,
+                       char                *out,
+                       size_t               out_len)
+{
+    if (out != NULL && out_len > 0) {
+        out[0] = '\0';
+    }
+    cotp_error_t err;
+    cotp_key *key = cotp_keystore_get_key (ks, key_id, &err);
+    if (key == NULL) {
+        return err;
+    }
+    err = cotp_key_totp_at (key, timestamp, digits, period, out, out_len);
+    cotp_key_free (key);
+    return err;
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+int
+cotp_keystore_validate_totp (const cotp_keystore *ks,
+                             uint64_t             key_id,
+                             const char          *user_code,
+                             long                 timestamp,
+                             int                  digits,
+                             int                  period,
+                             int                  window,
+                             int                 *matched_delta,
+                             cotp_error_t        *err_code)
+{
+    cotp_error_t err;
+    int delta = 0;
+    int ok = 0;
+    cotp_key *key = cotp_keystore_get_key (ks, key_id, &err);
+    if (key != NULL) {
+        ok = otp_scan_totp_keyed (key->hd, user_code, timestamp, digits, period, window, &delta, &err);
+        cotp_key_free (key);
+    }
+    if (matched_delta) *matched_delta = delta;
+    if (err_code) *err_code = err;
+    return ok;
+}
+#endif
+
+#endif
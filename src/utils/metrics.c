@@ -0,0 +1,314 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "metrics.h"
+
+// Counters are spread over cache-line aligned shards; each thread sticks to the shard it was
+// assigned on first use, so concurrent threads rarely share a line. Snapshots sum all shards.
+#define METRICS_SHARDS 16
+
+// Upper bound of latency bucket 0; each following bucket doubles it
+#define METRICS_LATENCY_BASE_SHIFT 6
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t codes_generated[COTP_METRICS_ALGOS];
+    _Atomic uint64_t validations;
+    _Atomic uint64_t validations_matched;
+    _Atomic uint64_t matched_delta[COTP_METRICS_DELTA_BUCKETS];
+    _Atomic uint64_t errors[COTP_METRICS_ERRORS];
+    _Atomic uint64_t hmac_latency[COTP_METRICS_ALGOS][COTP_METRICS_LATENCY_BUCKETS];
+    _Atomic uint64_t hmac_latency_sum_ns[COTP_METRICS_ALGOS];
+} metrics_shard;
+
+static metrics_shard       shards[METRICS_SHARDS];
+static atomic_uint         next_shard;
+static _Thread_local metrics_shard *tl_shard;
+
+static const char *algo_names[COTP_METRICS_ALGOS] = { "SHA1", "SHA256", "SHA512" };
+
+static const char *error_names[COTP_METRICS_ERRORS] = {
+    [NO_ERROR]                = "NO_ERROR",
+    [VALID]                   = "VALID",
+    [WCRYPT_VERSION_MISMATCH] = "WCRYPT_VERSION_MISMATCH",
+    [INVALID_B32_INPUT]       = "INVALID_B32_INPUT",
+    [INVALID_ALGO]            = "INVALID_ALGO",
+    [INVALID_DIGITS]          = "INVALID_DIGITS",
+    [INVALID_PERIOD]          = "INVALID_PERIOD",
+    [MEMORY_ALLOCATION_ERROR] = "MEMORY_ALLOCATION_ERROR",
+    [INVALID_USER_INPUT]      = "INVALID_USER_INPUT",
+    [EMPTY_STRING]            = "EMPTY_STRING",
+    [MISSING_LEADING_ZERO]    = "MISSING_LEADING_ZERO",
+    [INVALID_COUNTER]         = "INVALID_COUNTER",
+    [WHMAC_ERROR]             = "WHMAC_ERROR",
+    [REPLAY_DETECTED]         = "REPLAY_DETECTED",
+};
+
+
+static metrics_shard *
+my_shard (void)
+{
+    metrics_shard *s = tl_shard;
+    if (s == NULL) {
+        s = &shards[atomic_fetch_add_explicit (&next_shard, 1, memory_order_relaxed) % METRICS_SHARDS];
+        tl_shard = s;
+    }
+    return s;
+}
+
+
+static inline void
+bump (_Atomic uint64_t *c,
+      uint64_t          n)
+{
+    atomic_fetch_add_explicit (c, n, memory_order_relaxed);
+}
+
+
+static void
+count_error (metrics_shard *s,
+             cotp_error_t   err)
+{
+    if (err != NO_ERROR && err != VALID && (unsigned)err < COTP_METRICS_ERRORS) {
+        bump (&s->errors[err], 1);
+    }
+}
+
+
+void
+metrics_generated (int          algo,
+                   cotp_error_t err)
+{
+    metrics_shard *s = my_shard ();
+    if (err == NO_ERROR) {
+        if (algo >= 0 && algo < COTP_METRICS_ALGOS) {
+            bump (&s->codes_generated[algo], 1);
+        }
+    } else {
+        count_error (s, err);
+    }
+}
+
+
+void
+metrics_validated (int          matched,
+                   int          delta,
+                   cotp_error_t err)
+{
+    metrics_shard *s = my_shard ();
+    bump (&s->validations, 1);
+    if (matched) {
+        bump (&s->validations_matched, 1);
+        if (delta < -COTP_METRICS_DELTA_RANGE) {
+            delta = -COTP_METRICS_DELTA_RANGE;
+        } else if (delta > COTP_METRICS_DELTA_RANGE) {
+            delta = COTP_METRICS_DELTA_RANGE;
+        }
+        bump (&s->matched_delta[delta + COTP_METRICS_DELTA_RANGE], 1);
+    } else {
+        count_error (s, err);
+    }
+}
+
+
+void
+metrics_error (cotp_error_t err)
+{
+    count_error (my_shard (), err);
+}
+
+
+void
+metrics_hmac (size_t   digest_len,
+              uint64_t ns)
+{
+    int algo;
+    switch (digest_len) {
+        case 20: algo = COTP_SHA1;   break;
+        case 32: algo = COTP_SHA256; break;
+        case 64: algo = COTP_SHA512; break;
+        default: return;
+    }
+
+    // Smallest bucket whose bound 2^(i + BASE_SHIFT) ns is >= ns
+    int bucket = 0;
+    if (ns > 1) {
+        int log2_ceil = 64 - __builtin_clzll (ns - 1);
+        bucket = log2_ceil - METRICS_LATENCY_BASE_SHIFT;
+        if (bucket < 0) {
+            bucket = 0;
+        } else if (bucket > COTP_METRICS_LATENCY_BUCKETS - 1) {
+            bucket = COTP_METRICS_LATENCY_BUCKETS - 1;
+        }
+    }
+
+    metrics_shard *s = my_shard ();
+    bump (&s->hmac_latency[algo][bucket], 1);
+    bump (&s->hmac_latency_sum_ns[algo], ns);
+}
+
+
+static void
+sum (uint64_t               *dst,
+     const _Atomic uint64_t *src,
+     size_t                  n)
+{
+    for (size_t i = 0; i < n; i++) {
+        dst[i] += atomic_load_explicit (&src[i], memory_order_relaxed);
+    }
+}
+
+
+void
+cotp_metrics_snapshot (cotp_metrics *out)
+{
+    if (out == NULL) {
+        return;
+    }
+    *out = (cotp_metrics){ 0 };
+    for (int i = 0; i < METRICS_SHARDS; i++) {
+        const metrics_shard *s = &shards[i];
+        sum (out->codes_generated, s->codes_generated, COTP_METRICS_ALGOS);
+        sum (&out->validations, &s->validations, 1);
+        sum (&out->validations_matched, &s->validations_matched, 1);
+        sum (out->matched_delta, s->matched_delta, COTP_METRICS_DELTA_BUCKETS);
+        sum (out->errors, s->errors, COTP_METRICS_ERRORS);
+        for (int a = 0; a < COTP_METRICS_ALGOS; a++) {
+            sum (out->hmac_latency[a], s->hmac_latency[a], COTP_METRICS_LATENCY_BUCKETS);
+        }
+        sum (out->hmac_latency_sum_ns, s->hmac_latency_sum_ns, COTP_METRICS_ALGOS);
+    }
+}
+
+
+uint64_t
+cotp_metrics_latency_bound_ns (int bucket)
+{
+    if (bucket < 0 || bucket >= COTP_METRICS_LATENCY_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+    return 1ULL << (bucket + METRICS_LATENCY_BASE_SHIFT);
+}
+
+
+typedef struct {
+    char   *data;
+    size_t  len;
+    size_t  cap;
+    int     failed;
+} text_buf;
+
+
+__attribute__((format (printf, 2, 3)))
+static void
+append (text_buf   *b,
+        const char *fmt,
+        ...)
+{
+    if (b->failed) {
+        return;
+    }
+    for (;;) {
+        va_list ap;
+        va_start (ap, fmt);
+        int n = vsnprintf (b->data + b->len, b->cap - b->len, fmt, ap);
+        va_end (ap);
+        if (n < 0) {
+            b->failed = 1;
+            return;
+        }
+        if ((size_t)n < b->cap - b->len) {
+            b->len += (size_t)n;
+            return;
+        }
+        size_t cap = b->cap * 2 + (size_t)n;
+        char *data = realloc (b->data, cap);
+        if (data == NULL) {
+            b->failed = 1;
+            return;
+        }
+        b->data = data;
+        b->cap = cap;
+    }
+}
+
+
+char *
+cotp_metrics_format_prometheus (const cotp_metrics *m,
+                                cotp_error_t       *err_code)
+{
+    cotp_error_t local_err = NO_ERROR;
+    cotp_error_t *errp = err_code ? err_code : &local_err;
+
+    if (m == NULL) {
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+    }
+
+    text_buf b = { .cap = 4096 };
+    b.data = malloc (b.cap);
+    if (b.data == NULL) {
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    b.data[0] = '\0';
+
+    append (&b, "# HELP cotp_codes_generated_total Codes generated successfully.\n"
+                "# TYPE cotp_codes_generated_total counter\n");
+    for (int a = 0; a < COTP_METRICS_ALGOS; a++) {
+        append (&b, "cotp_codes_generated_total{algo=\"%s\"} %llu\n", algo_names[a],
+                (unsigned long long)m->codes_generated[a]);
+    }
+
+    append (&b, "# HELP cotp_validations_total Validation attempts.\n"
+                "# TYPE cotp_validations_total counter\n"
+                "cotp_validations_total %llu\n", (unsigned long long)m->validations);
+    append (&b, "# HELP cotp_validations_matched_total Validation attempts that matched a code.\n"
+                "# TYPE cotp_validations_matched_total counter\n"
+                "cotp_validations_matched_total %llu\n", (unsigned long long)m->validations_matched);
+
+    append (&b, "# HELP cotp_validation_matched_delta_total Matched window offsets; the outermost values include everything beyond them.\n"
+                "# TYPE cotp_validation_matched_delta_total counter\n");
+    for (int i = 0; i < COTP_METRICS_DELTA_BUCKETS; i++) {
+        append (&b, "cotp_validation_matched_delta_total{delta=\"%d\"} %llu\n", i - COTP_METRICS_DELTA_RANGE,
+                (unsigned long long)m->matched_delta[i]);
+    }
+
+    append (&b, "# HELP cotp_errors_total Errors returned by generation and validation calls.\n"
+                "# TYPE cotp_errors_total counter\n");
+    for (int e = 0; e < COTP_METRICS_ERRORS; e++) {
+        if (e == NO_ERROR || e == VALID) {
+            continue;
+        }
+        append (&b, "cotp_errors_total{error=\"%s\"} %llu\n", error_names[e], (unsigned long long)m->errors[e]);
+    }
+
+    append (&b, "# HELP cotp_hmac_duration_seconds Time spent in the HMAC backend per code.\n"
+                "# TYPE cotp_hmac_duration_seconds histogram\n");
+    for (int a = 0; a < COTP_METRICS_ALGOS; a++) {
+        uint64_t cumulative = 0;
+        for (int i = 0; i < COTP_METRICS_LATENCY_BUCKETS; i++) {
+            cumulative += m->hmac_latency[a][i];
+            if (i < COTP_METRICS_LATENCY_BUCKETS - 1) {
+                uint64_t bound_ns = cotp_metrics_latency_bound_ns (i);
+                append (&b, "cotp_hmac_duration_seconds_bucket{algo=\"%s\",le=\"%.9g\"} %llu\n", algo_names[a],
+                        (double)bound_ns / 1e9, (unsigned long long)cumulative);
+            } else {
+                append (&b, "cotp_hmac_duration_seconds_bucket{algo=\"%s\",le=\"+Inf\"} %llu\n", algo_names[a],
+                        (unsigned long long)cumulative);
+            }
+        }
+        append (&b, "cotp_hmac_duration_seconds_sum{algo=\"%s\"} %.9g\n", algo_names[a],
+                (double)m->hmac_latency_sum_ns[a] / 1e9);
+        append (&b, "cotp_hmac_duration_seconds_count{algo=\"%s\"} %llu\n", algo_names[a],
+                (unsigned long long)cumulative);
+    }
+
+    if (b.failed) {
+        free (b.data);
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    *errp = NO_ERROR;
+    return b.data;
+}
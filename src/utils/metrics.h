@@ -0,0 +1,46 @@
+#pragma once
+// Operational counters and histograms (COTP_ENABLE_METRICS builds only). The recording macros
+// expand to nothing when metrics are off.
+#include <stdint.h>
+#include <stddef.h>
+#include "../cotp.h"
+
+#ifdef COTP_ENABLE_METRICS
+#include <time.h>
+
+// Counts a generated code for `algo` when err is NO_ERROR, the error otherwise
+void metrics_generated  (int           algo,
+                         cotp_error_t  err);
+
+// Counts a validation attempt; `matched` attempts also record their window offset
+void metrics_validated  (int           matched,
+                         int           delta,
+                         cotp_error_t  err);
+
+// Counts an error returned by an entry point that is neither a generator nor a validator
+void metrics_error      (cotp_error_t  err);
+
+// Records the duration of one HMAC; the algorithm is told apart by its digest length
+void metrics_hmac       (size_t        digest_len,
+                         uint64_t      ns);
+
+static inline uint64_t
+metrics_now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#define COTP_METRIC_GENERATED(algo, err)          metrics_generated ((algo), (err))
+#define COTP_METRIC_VALIDATED(matched, delta, err) metrics_validated ((matched), (delta), (err))
+#define COTP_METRIC_ERROR(err)                    metrics_error ((err))
+#define COTP_METRIC_HMAC_START(var)               uint64_t var = metrics_now_ns ()
+#define COTP_METRIC_HMAC_STOP(len, var)           metrics_hmac ((len), metrics_now_ns () - (var))
+#else
+#define COTP_METRIC_GENERATED(algo, err)          do { } while (0)
+#define COTP_METRIC_VALIDATED(matched, delta, err) do { } while (0)
+#define COTP_METRIC_ERROR(err)                    do { } while (0)
+#define COTP_METRIC_HMAC_START(var)               do { } while (0)
+#define COTP_METRIC_HMAC_STOP(len, var)           do { } while (0)
+#endif
@@ -7,6 +7,7 @@
 #include <limits.h>
 #include "../cotp.h"
 #include "secure_zero.h"
+#include "trace.h"
 
 #define OTPAUTH_PREFIX     "otpauth://"
 #define OTPAUTH_PREFIX_LEN 10
@@ -99,8 +100,8 @@ cotp_otpauth_uri_free (cotp_otpauth_uri *u)
     free (u);
 }
 
-cotp_otpauth_uri *
-cotp_otpauth_uri_parse (const char *uri, cotp_error_t *err)
+static cotp_otpauth_uri *
+uri_parse (const char *uri, cotp_error_t *err)
 {
     cotp_error_t local_err = NO_ERROR;
     cotp_error_t *errp = err ? err : &local_err;
@@ -248,8 +249,8 @@ cotp_otpauth_uri_parse (const char *uri, cotp_error_t *err)
     return u;
 }
 
-char *
-cotp_otpauth_uri_build (const cotp_otpauth_uri *u, cotp_error_t *err)
+static char *
+uri_build (const cotp_otpauth_uri *u, cotp_error_t *err)
 {
     cotp_error_t local_err = NO_ERROR;
     cotp_error_t *errp = err ? err : &local_err;
@@ -340,3 +341,29 @@ cotp_otpauth_uri_build (const cotp_otpauth_uri *u, cotp_error_t *err)
     *errp = NO_ERROR;
     return out;
 }
+
+
+cotp_otpauth_uri *
+cotp_otpauth_uri_parse (const char *uri, cotp_error_t *err)
+{
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_URI_PARSE, -1, 0);
+    cotp_error_t e = NO_ERROR;
+    cotp_otpauth_uri *u = uri_parse (uri, &e);
+    trace_end (&span, e);
+    if (err) *err = e;
+    return u;
+}
+
+
+char *
+cotp_otpauth_uri_build (const cotp_otpauth_uri *u, cotp_error_t *err)
+{
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_URI_BUILD, u ? u->algo : -1, 0);
+    cotp_error_t e = NO_ERROR;
+    char *out = uri_build (u, &e);
+    trace_end (&span, e);
+    if (err) *err = e;
+    return out;
+}
@@ -0,0 +1,264 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pool.h"
+
+// A worker's deque is a contiguous range of chunk ids: the owner pops from the tail,
+// thieves take from the head, so stolen work is the part the owner would reach last.
+typedef struct {
+    pthread_mutex_t lock;
+    size_t          head;
+    size_t          tail;
+} pool_deque;
+
+struct cotp_pool {
+    int             nthreads;   // workers started
+    int             ndeques;    // deques initialized, may exceed nthreads if creation failed
+    pthread_t      *threads;
+    pool_deque     *deques;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  work_cv;
+    pthread_cond_t  done_cv;
+    unsigned long   generation;
+    int             shutdown;
+    int             busy;       // workers still inside the current run
+
+    pthread_mutex_t run_lock;   // one pool_run at a time
+
+    pool_fn         fn;
+    void           *arg;
+    size_t          n;
+    size_t          chunk;
+};
+
+typedef struct {
+    cotp_pool *pool;
+    int        id;
+} worker_arg;
+
+static int
+take_chunk (pool_deque *dq,
+            int         steal,
+            size_t     *chunk_id)
+{
+    int ok = 0;
+    pthread_mutex_lock (&dq->lock);
+    if (dq->head < dq->tail) {
+        *chunk_id = steal ? dq->head++ : --dq->tail;
+        ok = 1;
+    }
+    pthread_mutex_unlock (&dq->lock);
+    return ok;
+}
+
+
+static void
+drain (cotp_pool *pool,
+       int        id)
+{
+    size_t chunk_id;
+    for (;;) {
+        int found = take_chunk (&pool->deques[id], 0, &chunk_id);
+        for (int k = 1; !found && k < pool->nthreads; k++) {
+            found = take_chunk (&pool->deques[(id + k) % pool->nthreads], 1, &chunk_id);
+        }
+        if (!found) {
+            return;
+        }
+        size_t begin = chunk_id * pool->chunk;
+        size_t end = begin + pool->chunk < pool->n ? begin + pool->chunk : pool->n;
+        pool->fn (pool->arg, begin, end, id);
+    }
+}
+
+
+static void *
+worker_main (void *p)
+{
+    worker_arg *wa = p;
+    cotp_pool *pool = wa->pool;
+    int id = wa->id;
+    free (wa);
+
+    unsigned long seen = 0;
+    pthread_mutex_lock (&pool->lock);
+    for (;;) {
+        while (!pool->shutdown && pool->generation == seen) {
+            pthread_cond_wait (&pool->work_cv, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock (&pool->lock);
+
+        drain (pool, id);
+
+        pthread_mutex_lock (&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal (&pool->done_cv);
+        }
+    }
+    pthread_mutex_unlock (&pool->lock);
+    return NULL;
+}
+
+
+static void
+stop_workers (cotp_pool *pool,
+              int        started)
+{
+    pthread_mutex_lock (&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast (&pool->work_cv);
+    pthread_mutex_unlock (&pool->lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join (pool->threads[i], NULL);
+    }
+}
+
+
+cotp_pool *
+cotp_pool_create (int           threads,
+                  const int    *cpus,
+                  cotp_error_t *err_code)
+{
+    cotp_error_t local_err = NO_ERROR;
+    cotp_error_t *errp = err_code ? err_code : &local_err;
+
+    if (threads <= 0) {
+        long online = sysconf (_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (int)online : 1;
+    }
+    if (threads > COTP_POOL_MAX_THREADS) {
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+    }
+
+    cotp_pool *pool = calloc (1, sizeof(*pool));
+    if (pool == NULL) {
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    pool->nthreads = threads;
+    pool->threads = calloc ((size_t)threads, sizeof(pthread_t));
+    pool->deques = calloc ((size_t)threads, sizeof(pool_deque));
+    if (pool->threads == NULL || pool->deques == NULL) {
+        free (pool->threads);
+        free (pool->deques);
+        free (pool);
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    pthread_mutex_init (&pool->lock, NULL);
+    pthread_mutex_init (&pool->run_lock, NULL);
+    pthread_cond_init (&pool->work_cv, NULL);
+    pthread_cond_init (&pool->done_cv, NULL);
+    for (int i = 0; i < threads; i++) {
+        pthread_mutex_init (&pool->deques[i].lock, NULL);
+    }
+    pool->ndeques = threads;
+
+    for (int i = 0; i < threads; i++) {
+        worker_arg *wa = malloc (sizeof(*wa));
+        if (wa != NULL) {
+            wa->pool = pool;
+            wa->id = i;
+        }
+        if (wa == NULL || pthread_create (&pool->threads[i], NULL, worker_main, wa) != 0) {
+            free (wa);
+            pool->nthreads = i;
+            cotp_pool_free (pool);
+            *errp = MEMORY_ALLOCATION_ERROR;
+            return NULL;
+        }
+#ifdef __linux__
+        if (cpus != NULL && cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) {
+            cpu_set_t set;
+            CPU_ZERO (&set);
+            CPU_SET (cpus[i], &set);
+            // Best effort: a CPU outside the process' allowed set just leaves the thread unpinned
+            (void)pthread_setaffinity_np (pool->threads[i], sizeof(set), &set);
+        }
+#else
+        (void)cpus;
+#endif
+    }
+
+    *errp = NO_ERROR;
+    return pool;
+}
+
+
+void
+cotp_pool_free (cotp_pool *pool)
+{
+    if (!pool) return;
+    stop_workers (pool, pool->nthreads);
+    for (int i = 0; i < pool->ndeques; i++) {
+        pthread_mutex_destroy (&pool->deques[i].lock);
+    }
+    pthread_cond_destroy (&pool->work_cv);
+    pthread_cond_destroy (&pool->done_cv);
+    pthread_mutex_destroy (&pool->run_lock);
+    pthread_mutex_destroy (&pool->lock);
+    free (pool->deques);
+    free (pool->threads);
+    free (pool);
+}
+
+
+int
+pool_size (const cotp_pool *pool)
+{
+    return pool ? pool->nthreads : 1;
+}
+
+
+void
+pool_run (cotp_pool *pool,
+          pool_fn    fn,
+          void      *arg,
+          size_t     n,
+          size_t     chunk)
+{
+    if (n == 0) {
+        return;
+    }
+    if (chunk == 0) {
+        chunk = 1;
+    }
+    size_t nchunks = (n + chunk - 1) / chunk;
+    if (pool == NULL || nchunks == 1) {
+        for (size_t begin = 0; begin < n; begin += chunk) {
+            fn (arg, begin, begin + chunk < n ? begin + chunk : n, 0);
+        }
+        return;
+    }
+
+    pthread_mutex_lock (&pool->run_lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->n = n;
+    pool->chunk = chunk;
+    // Deal contiguous shares so each worker mostly walks adjacent (same-algorithm) items
+    for (int i = 0; i < pool->nthreads; i++) {
+        pool->deques[i].head = nchunks * (size_t)i / (size_t)pool->nthreads;
+        pool->deques[i].tail = nchunks * (size_t)(i + 1) / (size_t)pool->nthreads;
+    }
+
+    pthread_mutex_lock (&pool->lock);
+    pool->busy = pool->nthreads;
+    pool->generation++;
+    pthread_cond_broadcast (&pool->work_cv);
+    while (pool->busy > 0) {
+        pthread_cond_wait (&pool->done_cv, &pool->lock);
+    }
+    pthread_mutex_unlock (&pool->lock);
+    pthread_mutex_unlock (&pool->run_lock);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <stddef.h>
+#include "../cotp.h"
+
+// Called for every chunk [begin, end) of a pool_run; `worker` is in [0, pool_size) and is stable
+// for the calling thread, so callbacks can keep per-worker scratch state indexed by it.
+typedef void (*pool_fn) (void   *arg,
+                         size_t  begin,
+                         size_t  end,
+                         int     worker);
+
+// Number of workers a run on `pool` uses; 1 for a NULL pool
+int  pool_size (const cotp_pool *pool);
+
+/*
+ * Splits [0, n) into chunks of `chunk` items and runs fn on every chunk. Each worker starts on its own
+ * contiguous share of chunks and steals from the others once it runs dry. With a NULL pool everything
+ * runs on the calling thread. Returns once every chunk is done; concurrent callers are serialized.
+ */
+void pool_run  (cotp_pool *pool,
+                pool_fn    fn,
+                void      *arg,
+                size_t     n,
+                size_t     chunk);
@@ -0,0 +1,160 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+// Live threads' blocks hang off `threads`; when a thread exits its counts are folded into `retired`
+// and its block is freed. Snapshots report (live + retired) - baseline, so reset never has to
+// write into a block another thread owns.
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static prof_block     *threads;
+static cotp_stage_stats retired;
+static cotp_stage_stats baseline;
+
+static pthread_key_t  prof_key;
+static pthread_once_t prof_once = PTHREAD_ONCE_INIT;
+static int            prof_key_ok;
+
+static pthread_once_t rate_once = PTHREAD_ONCE_INIT;
+static uint64_t       tick_rate;
+
+_Thread_local prof_block *prof_tl_block;
+
+static const char *stage_names[COTP_STAGE_COUNT] = {
+    [COTP_STAGE_NORMALIZE_SECRET] = "normalize_secret",
+    [COTP_STAGE_BASE32_DECODE]    = "base32_decode",
+    [COTP_STAGE_HMAC_GETHANDLE]   = "whmac_gethandle",
+    [COTP_STAGE_HMAC_SETKEY]      = "whmac_setkey",
+    [COTP_STAGE_HMAC_FINALIZE]    = "whmac_finalize",
+    [COTP_STAGE_TRUNCATE]         = "truncate_otp",
+    [COTP_STAGE_FORMAT]           = "finalize",
+};
+
+
+static void
+add_block (cotp_stage_stats   *dst,
+           const prof_block   *b)
+{
+    for (int i = 0; i < COTP_STAGE_COUNT; i++) {
+        dst->calls[i] += atomic_load_explicit (&b->calls[i], memory_order_relaxed);
+        dst->ticks[i] += atomic_load_explicit (&b->ticks[i], memory_order_relaxed);
+    }
+}
+
+
+static void
+total_locked (cotp_stage_stats *out)
+{
+    *out = retired;
+    for (const prof_block *b = threads; b != NULL; b = b->next) {
+        add_block (out, b);
+    }
+}
+
+
+static void
+thread_exit (void *arg)
+{
+    prof_block *b = arg;
+    pthread_mutex_lock (&prof_lock);
+    add_block (&retired, b);
+    for (prof_block **p = &threads; *p != NULL; p = &(*p)->next) {
+        if (*p == b) {
+            *p = b->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock (&prof_lock);
+    prof_tl_block = NULL;
+    free (b);
+}
+
+
+static void
+create_key (void)
+{
+    prof_key_ok = pthread_key_create (&prof_key, thread_exit) == 0;
+}
+
+
+prof_block *
+prof_register_thread (void)
+{
+    pthread_once (&prof_once, create_key);
+    if (!prof_key_ok) {
+        return NULL;
+    }
+    prof_block *b = calloc (1, sizeof (*b));
+    if (b == NULL) {
+        return NULL;
+    }
+    if (pthread_setspecific (prof_key, b) != 0) {
+        free (b);
+        return NULL;
+    }
+    pthread_mutex_lock (&prof_lock);
+    b->next = threads;
+    threads = b;
+    pthread_mutex_unlock (&prof_lock);
+    prof_tl_block = b;
+    return b;
+}
+
+
+void
+cotp_stage_stats_snapshot (cotp_stage_stats *out)
+{
+    if (out == NULL) {
+        return;
+    }
+    cotp_stage_stats total;
+    pthread_mutex_lock (&prof_lock);
+    total_locked (&total);
+    for (int i = 0; i < COTP_STAGE_COUNT; i++) {
+        out->calls[i] = total.calls[i] - baseline.calls[i];
+        out->ticks[i] = total.ticks[i] - baseline.ticks[i];
+    }
+    pthread_mutex_unlock (&prof_lock);
+}
+
+
+void
+cotp_stage_stats_reset (void)
+{
+    pthread_mutex_lock (&prof_lock);
+    total_locked (&baseline);
+    pthread_mutex_unlock (&prof_lock);
+}
+
+
+const char *
+cotp_stage_name (cotp_stage stage)
+{
+    if ((int)stage < 0 || stage >= COTP_STAGE_COUNT) {
+        return NULL;
+    }
+    return stage_names[stage];
+}
+
+
+static void
+calibrate (void)
+{
+    struct timespec t0, t1, pause = { 0, 20 * 1000 * 1000 };
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    uint64_t c0 = prof_ticks ();
+    nanosleep (&pause, NULL);
+    uint64_t c1 = prof_ticks ();
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+
+    double ns = (double)(t1.tv_sec - t0.tv_sec) * 1e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+    tick_rate = ns > 0 ? (uint64_t)((double)(c1 - c0) * 1e9 / ns) : 0;
+}
+
+
+uint64_t
+cotp_stage_tick_rate (void)
+{
+    pthread_once (&rate_once, calibrate);
+    return tick_rate;
+}
@@ -0,0 +1,68 @@
+#pragma once
+// Per-stage cycle accounting for the OTP pipeline (COTP_ENABLE_PROFILING builds only).
+//
+//     COTP_PROF_START (t);
+//     ... stage ...
+//     COTP_PROF_STOP (COTP_STAGE_BASE32_DECODE, t);
+//
+// Both macros expand to nothing when profiling is off, so instrumented code is unchanged.
+#include "../cotp.h"
+
+#ifdef COTP_ENABLE_PROFILING
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Counters of one thread. Only the owning thread writes them, so plain load/store pairs suffice;
+// they are atomic only so that snapshots taken from other threads are well defined.
+typedef struct prof_block {
+    _Atomic uint64_t   calls[COTP_STAGE_COUNT];
+    _Atomic uint64_t   ticks[COTP_STAGE_COUNT];
+    struct prof_block *next;
+} prof_block;
+
+extern _Thread_local prof_block *prof_tl_block;
+
+// Allocates and registers the calling thread's block; NULL if out of memory (samples are dropped)
+prof_block *prof_register_thread (void);
+
+static inline uint64_t
+prof_ticks (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc ();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (v));
+    return v;
+#else
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline void
+prof_record (cotp_stage stage,
+             uint64_t   start)
+{
+    uint64_t elapsed = prof_ticks () - start;
+    prof_block *b = prof_tl_block;
+    if (b == NULL && (b = prof_register_thread ()) == NULL) {
+        return;
+    }
+    atomic_store_explicit (&b->calls[stage], atomic_load_explicit (&b->calls[stage], memory_order_relaxed) + 1,
+                           memory_order_relaxed);
+    atomic_store_explicit (&b->ticks[stage], atomic_load_explicit (&b->ticks[stage], memory_order_relaxed) + elapsed,
+                           memory_order_relaxed);
+}
+
+#define COTP_PROF_START(var)        uint64_t var = prof_ticks ()
+#define COTP_PROF_STOP(stage, var)  prof_record ((stage), (var))
+#else
+#define COTP_PROF_START(var)        do { } while (0)
+#define COTP_PROF_STOP(stage, var)  do { } while (0)
+#endif
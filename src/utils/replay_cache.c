@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "../otp_internal.h"
+#include "metrics.h"
+
+#ifdef COTP_ENABLE_VALIDATION
+
+// Independent shards, each behind its own mutex, so concurrent logins for different accounts
+// rarely contend. Entries live in open-addressing tables and expire in place.
+#define REPLAY_SHARDS 64
+
+typedef struct {
+    uint64_t key_id;
+    long     step;
+    long     expires_at;   // 0 marks a never-used bucket
+} replay_entry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    replay_entry   *entries;
+    size_t          mask;
+    size_t          used;      // occupied buckets, expired ones included until swept
+} replay_shard;
+
+struct cotp_replay_cache {
+    replay_shard shards[REPLAY_SHARDS];
+    size_t       max_load;     // per shard
+};
+
+static uint64_t
+hash_entry (uint64_t key_id,
+            long     step)
+{
+    return otp_mix64 (key_id ^ otp_mix64 ((uint64_t)step));
+}
+
+
+// Low bits pick the shard, the remaining ones the bucket inside it
+static size_t
+home_bucket (const replay_shard *shard,
+             uint64_t            key_id,
+             long                step)
+{
+    return (size_t)(hash_entry (key_id, step) / REPLAY_SHARDS) & shard->mask;
+}
+
+
+static void
+delete_at (replay_shard *shard,
+           size_t        i)
+{
+    // Backward-shift deletion: pull later members of the probe chain into the hole
+    for (size_t j = (i + 1) & shard->mask; shard->entries[j].expires_at != 0; j = (j + 1) & shard->mask) {
+        size_t home = home_bucket (shard, shard->entries[j].key_id, shard->entries[j].step);
+        int movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+        if (movable) {
+            shard->entries[i] = shard->entries[j];
+            i = j;
+        }
+    }
+    memset (&shard->entries[i], 0, sizeof(shard->entries[i]));
+    shard->used--;
+}
+
+
+static void
+sweep_expired (replay_shard *shard,
+               long          now)
+{
+    for (size_t i = 0; i <= shard->mask; i++) {
+        // A shift may move another expired entry into i, so re-check the same bucket
+        while (shard->entries[i].expires_at != 0 && shard->entries[i].expires_at <= now) {
+            delete_at (shard, i);
+        }
+    }
+}
+
+
+cotp_replay_cache *
+cotp_replay_cache_create (size_t        capacity,
+                          cotp_error_t *err_code)
+{
+    cotp_error_t local_err = NO_ERROR;
+    cotp_error_t *errp = err_code ? err_code : &local_err;
+
+    if (capacity == 0 || capacity > SIZE_MAX / 4 / sizeof(replay_entry)) {
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+    }
+
+    // Size every shard for its share of `capacity` at a 3/4 maximum load factor, plus headroom
+    // for keys that hash unevenly
+    size_t per_shard = (capacity + REPLAY_SHARDS - 1) / REPLAY_SHARDS;
+    size_t buckets = 16;
+    while (buckets * 3 / 4 < per_shard + per_shard / 4 + 1) {
+        buckets <<= 1;
+    }
+
+    cotp_replay_cache *rc = calloc (1, sizeof(*rc));
+    if (rc == NULL) {
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    rc->max_load = buckets * 3 / 4;
+    for (int i = 0; i < REPLAY_SHARDS; i++) {
+        rc->shards[i].entries = calloc (buckets, sizeof(replay_entry));
+        if (rc->shards[i].entries == NULL) {
+            for (int j = 0; j < i; j++) {
+                pthread_mutex_destroy (&rc->shards[j].lock);
+                free (rc->shards[j].entries);
+            }
+            free (rc);
+            *errp = MEMORY_ALLOCATION_ERROR;
+            return NULL;
+        }
+        rc->shards[i].mask = buckets - 1;
+        pthread_mutex_init (&rc->shards[i].lock, NULL);
+    }
+
+    *errp = NO_ERROR;
+    return rc;
+}
+
+
+void
+cotp_replay_cache_free (cotp_replay_cache *rc)
+{
+    if (!rc) return;
+    for (int i = 0; i < REPLAY_SHARDS; i++) {
+        pthread_mutex_destroy (&rc->shards[i].lock);
+        free (rc->shards[i].entries);
+    }
+    free (rc);
+}
+
+
+int
+cotp_replay_cache_check_and_mark (cotp_replay_cache *rc,
+                                  uint64_t           key_id,
+                                  long               step,
+                                  int                period,
+                                  int                window,
+                                  long               now,
+                                  cotp_error_t      *err_code)
+{
+    if (!rc || step < 0) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+    if (period <= 0 || period > 120) {
+        if (err_code) *err_code = INVALID_PERIOD;
+        return 0;
+    }
+    window = otp_normalize_window (window);
+    if (window < 0) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+
+    // `step` stays acceptable until now / period - window passes it, i.e. until (step + window + 1) * period
+    long expires_at;
+    if (__builtin_add_overflow (step, (long)window + 1, &expires_at) ||
+        __builtin_mul_overflow (expires_at, (long)period, &expires_at)) {
+        expires_at = LONG_MAX;
+    }
+    if (expires_at <= now) {
+        // Already outside every window that could accept it: nothing to remember
+        if (err_code) *err_code = NO_ERROR;
+        return 1;
+    }
+
+    replay_shard *shard = &rc->shards[hash_entry (key_id, step) % REPLAY_SHARDS];
+
+    pthread_mutex_lock (&shard->lock);
+    size_t i = home_bucket (shard, key_id, step);
+    for (; shard->entries[i].expires_at != 0; i = (i + 1) & shard->mask) {
+        replay_entry *e = &shard->entries[i];
+        if (e->key_id == key_id && e->step == step) {
+            if (e->expires_at > now) {
+                pthread_mutex_unlock (&shard->lock);
+                if (err_code) *err_code = REPLAY_DETECTED;
+                return 0;
+            }
+            // Same pair seen long ago (clock went backwards past the TTL): mark it again
+            e->expires_at = expires_at;
+            pthread_mutex_unlock (&shard->lock);
+            if (err_code) *err_code = NO_ERROR;
+            return 1;
+        }
+    }
+
+    if (shard->used >= rc->max_load) {
+        sweep_expired (shard, now);
+        if (shard->used >= rc->max_load) {
+            // Fail closed: accepting without remembering would reopen the replay window
+            pthread_mutex_unlock (&shard->lock);
+            if (err_code) *err_code = MEMORY_ALLOCATION_ERROR;
+            return 0;
+        }
+        // The sweep may have moved entries, find the free bucket again
+        i = home_bucket (shard, key_id, step);
+        while (shard->entries[i].expires_at != 0) {
+            i = (i + 1) & shard->mask;
+        }
+    }
+    shard->entries[i].key_id = key_id;
+    shard->entries[i].step = step;
+    shard->entries[i].expires_at = expires_at;
+    shard->used++;
+    pthread_mutex_unlock (&shard->lock);
+
+    if (err_code) *err_code = NO_ERROR;
+    return 1;
+}
+
+
+int validate_totp_in_window_once(cotp_replay_cache* rc,
+                                 uint64_t      key_id,
+                                 const char*   user_code,
+                                 const char*   base32_encoded_secret,
+                                 long          timestamp,
+                                 int           digits,
+                                 int           period,
+                                 int           sha_algo,
+                                 int           window,
+                                 int*          matched_delta,
+                                 cotp_error_t* err_code)
+{
+    if (!rc) {
+        if (matched_delta) *matched_delta = 0;
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+
+    int delta = 0;
+    cotp_error_t err = NO_ERROR;
+    if (!validate_totp_in_window (user_code, base32_encoded_secret, timestamp, digits, period,
+                                  sha_algo, window, &delta, &err)) {
+        if (matched_delta) *matched_delta = 0;
+        if (err_code) *err_code = err;
+        return 0;
+    }
+
+    // validate_totp_in_window only matches deltas whose timestamp did not overflow
+    long step = (timestamp + (long)delta * period) / period;
+    if (!cotp_replay_cache_check_and_mark (rc, key_id, step, period, window, timestamp, &err)) {
+        COTP_METRIC_ERROR (err);
+        if (matched_delta) *matched_delta = 0;
+        if (err_code) *err_code = err;
+        return 0;
+    }
+
+    if (matched_delta) *matched_delta = delta;
+    if (err_code) *err_code = VALID;
+    return 1;
+}
+
+#endif // COTP_ENABLE_VALIDATION
@@ -0,0 +1,69 @@
+#include <stdatomic.h>
+#include <time.h>
+#include "timestep.h"
+
+static _Atomic(const cotp_clock *) active_clock;
+
+// Last counter seen for each period. An outdated value is harmless: it is
+// only used after checking that the current time still falls inside it.
+static _Atomic long cached_step[121];
+
+
+void
+cotp_set_clock (const cotp_clock *clock)
+{
+    atomic_store_explicit (&active_clock, (clock && clock->now) ? clock : NULL, memory_order_release);
+}
+
+
+long
+timestep_now (void)
+{
+    const cotp_clock *clock = atomic_load_explicit (&active_clock, memory_order_acquire);
+    if (__builtin_expect (clock != NULL, 0)) {
+        return clock->now (clock->user_data);
+    }
+
+    struct timespec ts;
+#ifdef CLOCK_REALTIME_COARSE
+    // Served from the vDSO without reading the hardware counter; whole seconds are all TOTP needs
+    clock_gettime (CLOCK_REALTIME_COARSE, &ts);
+#else
+    clock_gettime (CLOCK_REALTIME, &ts);
+#endif
+    return (long)ts.tv_sec;
+}
+
+
+long
+timestep_current (int period)
+{
+    long now = timestep_now ();
+    if (now < 0) {
+        return now / period;
+    }
+
+    long step = atomic_load_explicit (&cached_step[period], memory_order_relaxed);
+    long start = step * period;
+    if (now >= start && now - start < period) {
+        return step;
+    }
+
+    // Crossed a boundary (or the clock moved back): one division, then cached until the next one
+    step = now / period;
+    atomic_store_explicit (&cached_step[period], step, memory_order_relaxed);
+    return step;
+}
+
+
+long
+cotp_time_step (int           period,
+                cotp_error_t *err_code)
+{
+    if (period <= 0 || period > 120) {
+        if (err_code) *err_code = INVALID_PERIOD;
+        return -1;
+    }
+    if (err_code) *err_code = NO_ERROR;
+    return timestep_current (period);
+}
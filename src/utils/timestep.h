@@ -0,0 +1,10 @@
+#pragma once
+// Current time for the TOTP generators that do not take a timestamp. The time-step counter of
+// each period is cached and only recomputed once the clock leaves the cached step.
+#include "../cotp.h"
+
+// Seconds since the Unix epoch from the installed cotp_clock, or the coarse realtime clock
+long timestep_now     (void);
+
+// TOTP counter for the current time and `period`, which must be in 1..120
+long timestep_current (int period);
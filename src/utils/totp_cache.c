@@ -0,0 +1,726 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "../otp_internal.h"
+#include "secure_zero.h"
+#include "metrics.h"
+#include "digits.h"
+
+#ifdef COTP_ENABLE_VALIDATION
+
+// Each key keeps a ring of precomputed tokens indexed by step % CACHE_SLOTS. A refresh at step s
+// fills [s - 1, s + 2], so one refresh per period keeps a ±1 window served from the table even
+// right after the boundary. Older steps are evicted simply by being overwritten.
+#define CACHE_SLOTS         4
+#define CACHE_REFRESH_CHUNK 256
+
+typedef struct {
+    long     step;      // -1 when the slot holds nothing
+    uint32_t token;
+} cache_slot;
+
+typedef struct {
+    uint64_t   key_id;
+    cotp_key  *key;     // NULL marks a free bucket
+    cache_slot slots[CACHE_SLOTS];
+} cache_entry;
+
+// Reverse index for one ring slot: (token, key id) pairs of every key whose slot holds `step`,
+// sorted by token so a code can be resolved to its candidate keys with a binary search.
+typedef struct {
+    uint32_t token;
+    uint64_t key_id;
+} index_item;
+
+typedef struct {
+    long        step;   // -1 until built
+    index_item *items;
+    size_t      n;
+} step_index;
+
+struct cotp_totp_cache {
+    pthread_mutex_t lock;
+    cache_entry    *entries;
+    step_index     *index;      // CACHE_SLOTS step indexes, NULL unless enabled
+    size_t          mask;       // bucket count - 1, bucket count is a power of two
+    size_t          max_keys;
+    size_t          count;
+    int             digits;
+    int             period;
+    int             algo;
+};
+
+static size_t
+hash_key_id (uint64_t key_id)
+{
+    return (size_t)otp_mix64 (key_id);
+}
+
+
+static cache_entry *
+find_entry (const cotp_totp_cache *cache,
+            uint64_t               key_id)
+{
+    for (size_t i = hash_key_id (key_id) & cache->mask; cache->entries[i].key != NULL; i = (i + 1) & cache->mask) {
+        if (cache->entries[i].key_id == key_id) {
+            return &cache->entries[i];
+        }
+    }
+    return NULL;
+}
+
+
+static void
+clear_slots (cache_entry *e)
+{
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        e->slots[i].step = -1;
+        e->slots[i].token = 0;
+    }
+}
+
+
+// Backward-shift deletion keeps linear probing free of tombstones
+static void
+remove_entry (cotp_totp_cache *cache,
+              cache_entry     *e)
+{
+    size_t i = (size_t)(e - cache->entries);
+    cotp_key_free (e->key);
+    for (size_t j = (i + 1) & cache->mask; cache->entries[j].key != NULL; j = (j + 1) & cache->mask) {
+        size_t home = hash_key_id (cache->entries[j].key_id) & cache->mask;
+        int movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+        if (movable) {
+            cache->entries[i] = cache->entries[j];
+            i = j;
+        }
+    }
+    memset (&cache->entries[i], 0, sizeof(cache->entries[i]));
+    cache->count--;
+}
+
+
+// What cache_validate needs from an entry once the lock is dropped: the ring, and a copy of the
+// secret when the window reaches steps the ring doesn't hold
+typedef struct {
+    cache_slot slots[CACHE_SLOTS];
+    uint8_t   *secret;
+    size_t     secret_len;
+    int        algo;
+    cotp_key  *key;         // built from the copy on the first miss, owns it from then on
+} entry_snapshot;
+
+// Step of `timestamp + delta * period`: 1 if valid, 0 if it overflows, -1 if it lies before the epoch
+static int
+window_step (const cotp_totp_cache *cache,
+             long                   timestamp,
+             int                    delta,
+             long                  *s)
+{
+    long step;
+    long t;
+    if (__builtin_mul_overflow((long)delta, (long)cache->period, &step) ||
+        __builtin_add_overflow(timestamp, step, &t)) {
+        return 0;
+    }
+    if (t < 0) {
+        return -1;
+    }
+    *s = t / cache->period;
+    return 1;
+}
+
+
+// Called with the lock held
+static cotp_error_t
+snapshot_entry (const cotp_totp_cache *cache,
+                const cache_entry     *e,
+                long                   timestamp,
+                int                    window,
+                entry_snapshot        *snap)
+{
+    memcpy (snap->slots, e->slots, sizeof(snap->slots));
+    int missing = 0;
+    for (int delta = -window; delta <= window && !missing; ++delta) {
+        long s;
+        int valid = window_step (cache, timestamp, delta, &s);
+        if (valid < 0) {
+            break;
+        }
+        missing = valid && snap->slots[s % CACHE_SLOTS].step != s;
+    }
+    if (!missing) {
+        return NO_ERROR;
+    }
+    snap->secret = malloc (e->key->secret_len);
+    if (snap->secret == NULL) {
+        return MEMORY_ALLOCATION_ERROR;
+    }
+    memcpy (snap->secret, e->key->secret, e->key->secret_len);
+    snap->secret_len = e->key->secret_len;
+    snap->algo = e->key->algo;
+    return NO_ERROR;
+}
+
+
+static cotp_error_t
+snapshot_token (const cotp_totp_cache *cache,
+                entry_snapshot        *snap,
+                long                   step,
+                uint32_t              *token)
+{
+    const cache_slot *slot = &snap->slots[step % CACHE_SLOTS];
+    if (slot->step == step) {
+        *token = slot->token;
+        return NO_ERROR;
+    }
+
+    cotp_error_t err;
+    if (snap->key == NULL) {
+        snap->key = otp_key_adopt (snap->secret, snap->secret_len, snap->algo, &err);
+        snap->secret = NULL;
+        if (snap->key == NULL) {
+            return err;
+        }
+    }
+    uint32_t bin_code;
+    err = key_token (snap->key, step, &bin_code);
+    if (err == NO_ERROR) {
+        *token = otp_code_reduce (bin_code, cache->digits);
+    }
+    return err;
+}
+
+
+static void
+snapshot_release (entry_snapshot *snap)
+{
+    cotp_key_free (snap->key);
+    if (snap->secret != NULL) {
+        cotp_secure_memzero (snap->secret, snap->secret_len);
+        free (snap->secret);
+    }
+    // The ring holds valid codes of a real account
+    cotp_secure_memzero (snap, sizeof(*snap));
+}
+
+
+static int
+compare_index_items (const void *a,
+                     const void *b)
+{
+    const index_item *x = a;
+    const index_item *y = b;
+    if (x->token != y->token) {
+        return x->token < y->token ? -1 : 1;
+    }
+    return (x->key_id > y->key_id) - (x->key_id < y->key_id);
+}
+
+
+// Only the slot whose step changed is rebuilt, the other steps of the window keep their index
+static void
+rebuild_index (cotp_totp_cache *cache,
+               long             step)
+{
+    step_index *idx = &cache->index[step % CACHE_SLOTS];
+    size_t n = 0;
+    for (size_t i = 0; i <= cache->mask; i++) {
+        const cache_entry *e = &cache->entries[i];
+        if (e->key != NULL && e->slots[step % CACHE_SLOTS].step == step) {
+            idx->items[n].token = e->slots[step % CACHE_SLOTS].token;
+            idx->items[n].key_id = e->key_id;
+            n++;
+        }
+    }
+    qsort (idx->items, n, sizeof(index_item), compare_index_items);
+    idx->n = n;
+    idx->step = step;
+}
+
+
+static size_t
+index_lower_bound (const step_index *idx,
+                   uint32_t          token)
+{
+    size_t lo = 0;
+    size_t hi = idx->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->items[mid].token < token) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+cotp_totp_cache *
+cotp_totp_cache_create (size_t        max_keys,
+                        int           digits,
+                        int           period,
+                        int           sha_algo,
+                        cotp_error_t *err_code)
+{
+    cotp_error_t local_err = NO_ERROR;
+    cotp_error_t *errp = err_code ? err_code : &local_err;
+
+    if (max_keys == 0 || max_keys > SIZE_MAX / 2 / sizeof(cache_entry)) {
+        *errp = INVALID_USER_INPUT;
+        return NULL;
+    }
+    if (digits < MIN_DIGITS || digits > MAX_DIGITS) {
+        *errp = INVALID_DIGITS;
+        return NULL;
+    }
+    if (period <= 0 || period > 120) {
+        *errp = INVALID_PERIOD;
+        return NULL;
+    }
+    if (sha_algo != COTP_SHA1 && sha_algo != COTP_SHA256 && sha_algo != COTP_SHA512) {
+        *errp = INVALID_ALGO;
+        return NULL;
+    }
+
+    // Keep the load factor at or below 1/2 so probe sequences stay short
+    size_t buckets = 16;
+    while (buckets < max_keys * 2) {
+        buckets <<= 1;
+    }
+
+    cotp_totp_cache *cache = calloc (1, sizeof(*cache));
+    if (cache == NULL) {
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    cache->entries = calloc (buckets, sizeof(cache_entry));
+    if (cache->entries == NULL || pthread_mutex_init (&cache->lock, NULL) != 0) {
+        free (cache->entries);
+        free (cache);
+        *errp = MEMORY_ALLOCATION_ERROR;
+        return NULL;
+    }
+    cache->mask = buckets - 1;
+    cache->max_keys = max_keys;
+    cache->digits = digits;
+    cache->period = period;
+    cache->algo = sha_algo;
+
+    *errp = NO_ERROR;
+    return cache;
+}
+
+
+void
+cotp_totp_cache_free (cotp_totp_cache *cache)
+{
+    if (!cache) return;
+    for (size_t i = 0; i <= cache->mask; i++) {
+        cotp_key_free (cache->entries[i].key);
+    }
+    cotp_secure_memzero (cache->entries, (cache->mask + 1) * sizeof(cache_entry));
+    free (cache->entries);
+    if (cache->index) {
+        for (int i = 0; i < CACHE_SLOTS; i++) {
+            cotp_secure_memzero (cache->index[i].items, cache->max_keys * sizeof(index_item));
+            free (cache->index[i].items);
+        }
+        free (cache->index);
+    }
+    pthread_mutex_destroy (&cache->lock);
+    free (cache);
+}
+
+
+cotp_error_t
+cotp_totp_cache_enable_index (cotp_totp_cache *cache)
+{
+    if (cache == NULL) {
+        return INVALID_USER_INPUT;
+    }
+
+    pthread_mutex_lock (&cache->lock);
+    if (cache->index != NULL) {
+        pthread_mutex_unlock (&cache->lock);
+        return NO_ERROR;
+    }
+    step_index *index = calloc (CACHE_SLOTS, sizeof(step_index));
+    if (index == NULL) {
+        pthread_mutex_unlock (&cache->lock);
+        return MEMORY_ALLOCATION_ERROR;
+    }
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        index[i].step = -1;
+        index[i].items = calloc (cache->max_keys, sizeof(index_item));
+        if (index[i].items == NULL) {
+            for (int j = 0; j < i; j++) {
+                free (index[j].items);
+            }
+            free (index);
+            pthread_mutex_unlock (&cache->lock);
+            return MEMORY_ALLOCATION_ERROR;
+        }
+    }
+    cache->index = index;
+    // Steps that are already cached become searchable right away
+    for (int i = 0; i < CACHE_SLOTS; i++) {
+        for (size_t k = 0; k <= cache->mask; k++) {
+            const cache_entry *e = &cache->entries[k];
+            if (e->key != NULL && e->slots[i].step >= 0) {
+                rebuild_index (cache, e->slots[i].step);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock (&cache->lock);
+
+    return NO_ERROR;
+}
+
+
+cotp_error_t
+cotp_totp_cache_add_key (cotp_totp_cache *cache,
+                         uint64_t         key_id,
+                         const char      *base32_encoded_secret)
+{
+    if (cache == NULL || base32_encoded_secret == NULL) {
+        return INVALID_USER_INPUT;
+    }
+
+    // Decode and key the HMAC outside the lock
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (base32_encoded_secret, cache->algo, &err);
+    if (key == NULL) {
+        return err;
+    }
+
+    pthread_mutex_lock (&cache->lock);
+    cache_entry *e = find_entry (cache, key_id);
+    if (e != NULL) {
+        // Re-enrollment: swap the secret and drop tokens derived from the old one
+        cotp_key_free (e->key);
+        e->key = key;
+        clear_slots (e);
+        pthread_mutex_unlock (&cache->lock);
+        return NO_ERROR;
+    }
+    if (cache->count == cache->max_keys) {
+        pthread_mutex_unlock (&cache->lock);
+        cotp_key_free (key);
+        return MEMORY_ALLOCATION_ERROR;
+    }
+    size_t i = hash_key_id (key_id) & cache->mask;
+    while (cache->entries[i].key != NULL) {
+        i = (i + 1) & cache->mask;
+    }
+    cache->entries[i].key_id = key_id;
+    cache->entries[i].key = key;
+    clear_slots (&cache->entries[i]);
+    cache->count++;
+    pthread_mutex_unlock (&cache->lock);
+
+    return NO_ERROR;
+}
+
+
+cotp_error_t
+cotp_totp_cache_remove_key (cotp_totp_cache *cache,
+                            uint64_t         key_id)
+{
+    if (cache == NULL) {
+        return INVALID_USER_INPUT;
+    }
+
+    pthread_mutex_lock (&cache->lock);
+    cache_entry *e = find_entry (cache, key_id);
+    if (e == NULL) {
+        pthread_mutex_unlock (&cache->lock);
+        return INVALID_USER_INPUT;
+    }
+    remove_entry (cache, e);
+    pthread_mutex_unlock (&cache->lock);
+
+    return NO_ERROR;
+}
+
+
+cotp_error_t
+cotp_totp_cache_refresh (cotp_totp_cache *cache,
+                         long             timestamp)
+{
+    if (cache == NULL) {
+        return INVALID_USER_INPUT;
+    }
+    if (timestamp < 0) {
+        return INVALID_COUNTER;
+    }
+
+    long step = timestamp / cache->period;
+    cotp_error_t result = NO_ERROR;
+    int dirty[CACHE_SLOTS] = {0};
+
+    // Work in chunks so validations can interleave with a refresh over a large key set
+    for (size_t base = 0; base <= cache->mask; base += CACHE_REFRESH_CHUNK) {
+        pthread_mutex_lock (&cache->lock);
+        for (size_t i = base; i <= cache->mask && i < base + CACHE_REFRESH_CHUNK; i++) {
+            cache_entry *e = &cache->entries[i];
+            if (e->key == NULL) {
+                continue;
+            }
+            for (long d = -1; d < CACHE_SLOTS - 1; d++) {
+                long s;
+                if (__builtin_add_overflow (step, d, &s) || s < 0) {
+                    continue;
+                }
+                cache_slot *slot = &e->slots[s % CACHE_SLOTS];
+                if (slot->step == s) {
+                    continue;
+                }
+                uint32_t bin_code;
+                cotp_error_t err = key_token (e->key, s, &bin_code);
+                if (err != NO_ERROR) {
+                    slot->step = -1;
+                    result = err;
+                    continue;
+                }
+                slot->token = otp_code_reduce (bin_code, cache->digits);
+                slot->step = s;
+                dirty[d + 1] = 1;
+            }
+        }
+        pthread_mutex_unlock (&cache->lock);
+    }
+
+    pthread_mutex_lock (&cache->lock);
+    if (cache->index != NULL) {
+        for (long d = -1; d < CACHE_SLOTS - 1; d++) {
+            long s;
+            if (__builtin_add_overflow (step, d, &s) || s < 0) {
+                continue;
+            }
+            if (dirty[d + 1] || cache->index[s % CACHE_SLOTS].step != s) {
+                rebuild_index (cache, s);
+            }
+        }
+    }
+    pthread_mutex_unlock (&cache->lock);
+
+    return result;
+}
+
+
+long
+cotp_totp_cache_next_refresh (const cotp_totp_cache *cache,
+                              long                   timestamp)
+{
+    if (cache == NULL || timestamp < 0) {
+        return -1;
+    }
+    long step = timestamp / cache->period;
+    long next;
+    // Last second of the current period; if we're already there, aim for the next one
+    if (__builtin_mul_overflow (step + 1, (long)cache->period, &next)) {
+        return LONG_MAX;
+    }
+    next -= 1;
+    if (next <= timestamp && __builtin_add_overflow (next, (long)cache->period, &next)) {
+        return LONG_MAX;
+    }
+    return next;
+}
+
+
+static int
+cache_validate (cotp_totp_cache *cache,
+                uint64_t         key_id,
+                const char      *user_code,
+                long             timestamp,
+                int              window,
+                int             *matched_delta,
+                cotp_error_t    *err_code)
+{
+    if (matched_delta) *matched_delta = 0;
+    if (!cache || !user_code) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+
+    window = otp_normalize_window (window);
+    if (window < 0) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+
+    uint32_t user_token;
+    int parsed = (otp_parse_code (user_code, cache->digits, &user_token) == 0);
+
+    pthread_mutex_lock (&cache->lock);
+    cache_entry *e = find_entry (cache, key_id);
+    if (e == NULL) {
+        pthread_mutex_unlock (&cache->lock);
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+    if (!parsed) {
+        // A code of the wrong length or with non-digits can't match any token
+        pthread_mutex_unlock (&cache->lock);
+        if (err_code) *err_code = NO_ERROR;
+        return 0;
+    }
+    // Only the copy is taken under the lock: steps missing from the ring cost HMACs, and those must
+    // not hold up the other validations and the refresh
+    entry_snapshot snap = { .secret = NULL, .key = NULL };
+    cotp_error_t err = snapshot_entry (cache, e, timestamp, window, &snap);
+    pthread_mutex_unlock (&cache->lock);
+
+    int ok = 0;
+    for (int delta = -window; delta <= window && err == NO_ERROR && !ok; ++delta) {
+        long s;
+        int valid = window_step (cache, timestamp, delta, &s);
+        if (valid < 0) {
+            err = INVALID_COUNTER;
+        } else if (valid) {
+            uint32_t token;
+            err = snapshot_token (cache, &snap, s, &token);
+            if (err == NO_ERROR && cotp_timing_safe_memcmp (&token, &user_token, sizeof(token)) == 0) {
+                if (matched_delta) *matched_delta = delta;
+                ok = 1;
+            }
+        }
+    }
+    snapshot_release (&snap);
+
+    if (err_code) *err_code = ok ? VALID : err;
+    return ok;
+}
+
+
+int
+cotp_totp_cache_validate (cotp_totp_cache *cache,
+                          uint64_t         key_id,
+                          const char      *user_code,
+                          long             timestamp,
+                          int              window,
+                          int             *matched_delta,
+                          cotp_error_t    *err_code)
+{
+    cotp_error_t err = NO_ERROR;
+    int delta = 0;
+    int ok = cache_validate (cache, key_id, user_code, timestamp, window, &delta, &err);
+    COTP_METRIC_VALIDATED (ok, delta, err);
+    if (matched_delta) *matched_delta = delta;
+    if (err_code) *err_code = err;
+    return ok;
+}
+
+
+// Step of `timestamp + delta * period`, if it is valid and the index currently covers it
+static int
+indexed_step (const cotp_totp_cache *cache,
+              long                   timestamp,
+              int                    delta,
+              long                  *s)
+{
+    // Only indexed steps are searched, run a refresh to cover the window
+    return window_step (cache, timestamp, delta, s) > 0 && cache->index[*s % CACHE_SLOTS].step == *s;
+}
+
+
+static int
+index_holds (const step_index *idx,
+             uint32_t          token,
+             uint64_t          key_id)
+{
+    for (size_t i = index_lower_bound (idx, token); i < idx->n && idx->items[i].token == token; i++) {
+        if (idx->items[i].key_id == key_id) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+static int
+entry_matches (const cache_entry *e,
+               long               s,
+               uint32_t           token)
+{
+    return e->slots[s % CACHE_SLOTS].step == s &&
+           cotp_timing_safe_memcmp (&e->slots[s % CACHE_SLOTS].token, &token, sizeof(token)) == 0;
+}
+
+
+size_t
+cotp_totp_cache_find (cotp_totp_cache *cache,
+                      const char      *user_code,
+                      long             timestamp,
+                      int              window,
+                      uint64_t        *key_ids,
+                      int             *matched_deltas,
+                      size_t           max_ids,
+                      cotp_error_t    *err_code)
+{
+    if (!cache || !user_code || (max_ids > 0 && !key_ids)) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+    window = otp_normalize_window (window);
+    if (window < 0) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+
+    uint32_t user_token;
+    if (otp_parse_code (user_code, cache->digits, &user_token) != 0) {
+        if (err_code) *err_code = NO_ERROR;
+        return 0;
+    }
+
+    pthread_mutex_lock (&cache->lock);
+    if (cache->index == NULL) {
+        pthread_mutex_unlock (&cache->lock);
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+
+    size_t found = 0;
+    for (int delta = -window; delta <= window; ++delta) {
+        long s;
+        if (!indexed_step (cache, timestamp, delta, &s)) {
+            continue;
+        }
+        const step_index *idx = &cache->index[s % CACHE_SLOTS];
+        for (size_t i = index_lower_bound (idx, user_token); i < idx->n && idx->items[i].token == user_token; i++) {
+            // Confirm against the live entry: the key may have been replaced or removed since the index was built
+            const cache_entry *e = find_entry (cache, idx->items[i].key_id);
+            if (e == NULL || !entry_matches (e, s, user_token)) {
+                continue;
+            }
+            // A key is counted at its first matching step only, whether or not its id is stored
+            int seen = 0;
+            for (int earlier = -window; earlier < delta && !seen; ++earlier) {
+                long es;
+                seen = indexed_step (cache, timestamp, earlier, &es) &&
+                       index_holds (&cache->index[es % CACHE_SLOTS], user_token, e->key_id) &&
+                       entry_matches (e, es, user_token);
+            }
+            if (seen) {
+                continue;
+            }
+            if (found < max_ids) {
+                key_ids[found] = e->key_id;
+                if (matched_deltas) matched_deltas[found] = delta;
+            }
+            found++;
+        }
+    }
+    pthread_mutex_unlock (&cache->lock);
+
+    if (err_code) *err_code = found > 0 ? VALID : NO_ERROR;
+    return found;
+}
+
+#endif // COTP_ENABLE_VALIDATION
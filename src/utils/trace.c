@@ -0,0 +1,46 @@
+#include <time.h>
+#include "trace.h"
+
+_Atomic(const cotp_trace_hooks *) trace_active;
+
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+void
+cotp_trace_set_hooks (const cotp_trace_hooks *hooks)
+{
+    atomic_store_explicit (&trace_active, hooks, memory_order_release);
+}
+
+
+void
+trace_begin_slow (trace_span   *sp,
+                  cotp_trace_op op,
+                  int           algo,
+                  int           window)
+{
+    sp->ev = (cotp_trace_event){ .op = op, .algo = algo, .window = window, .err = NO_ERROR };
+    if (sp->hooks->begin) {
+        sp->hooks->begin (&sp->ev, sp->hooks->user_data);
+    }
+    sp->start_ns = now_ns ();
+}
+
+
+void
+trace_end_slow (trace_span  *sp,
+                cotp_error_t err)
+{
+    sp->ev.duration_ns = now_ns () - sp->start_ns;
+    sp->ev.err = err;
+    if (sp->hooks->end) {
+        sp->hooks->end (&sp->ev, sp->hooks->user_data);
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+// Begin/end tracing around public entry points. With no hooks installed a span costs one atomic
+// load and one predictable branch at each end.
+#include <stdatomic.h>
+#include <stdint.h>
+#include "../cotp.h"
+
+typedef struct {
+    const cotp_trace_hooks *hooks;    // NULL unless hooks were installed when the span began
+    cotp_trace_event        ev;
+    uint64_t                start_ns;
+} trace_span;
+
+extern _Atomic(const cotp_trace_hooks *) trace_active;
+
+void trace_begin_slow (trace_span   *sp,
+                       cotp_trace_op op,
+                       int           algo,
+                       int           window);
+
+void trace_end_slow   (trace_span   *sp,
+                       cotp_error_t  err);
+
+static inline void
+trace_begin (trace_span   *sp,
+             cotp_trace_op op,
+             int           algo,
+             int           window)
+{
+    sp->hooks = atomic_load_explicit (&trace_active, memory_order_acquire);
+    if (__builtin_expect (sp->hooks != NULL, 0)) {
+        trace_begin_slow (sp, op, algo, window);
+    }
+}
+
+static inline void
+trace_end (trace_span  *sp,
+           cotp_error_t err)
+{
+    if (__builtin_expect (sp->hooks != NULL, 0)) {
+        trace_end_slow (sp, err);
+    }
+}
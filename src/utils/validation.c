@@ -1,22 +1,26 @@
+#include <stdatomic.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
-#include "../cotp.h"
+#include "../otp_internal.h"
+#include "pool.h"
 #include "secure_zero.h"
+#include "metrics.h"
+#include "trace.h"
+#include "digits.h"
 
 #ifdef COTP_ENABLE_VALIDATION
 
-#define COTP_MAX_VALIDATION_WINDOW 1024
-
-int validate_totp_in_window(const char* user_code,
-                            const char* base32_encoded_secret,
-                            long        timestamp,
-                            int         digits,
-                            int         period,
-                            int         sha_algo,
-                            int         window,
-                            int*        matched_delta,
-                            cotp_error_t* err_code)
+static int
+scan_totp (const char*   user_code,
+           const char*   base32_encoded_secret,
+           long          timestamp,
+           int           digits,
+           int           period,
+           int           sha_algo,
+           int           window,
+           int*          matched_delta,
+           cotp_error_t* err_code)
 {
     if (matched_delta) *matched_delta = 0;
     if (!user_code || !base32_encoded_secret) {
@@ -24,13 +28,8 @@ int validate_totp_in_window(const char* user_code,
         return 0;
     }
 
-    // Normalize window: handle INT_MIN safely (negation would overflow)
-    if (window == INT_MIN) {
-        window = COTP_MAX_VALIDATION_WINDOW;
-    } else if (window < 0) {
-        window = -window;
-    }
-    if (window > COTP_MAX_VALIDATION_WINDOW) {
+    window = otp_normalize_window (window);
+    if (window < 0) {
         if (err_code) *err_code = INVALID_USER_INPUT;
         return 0;
     }
@@ -47,7 +46,7 @@ int validate_totp_in_window(const char* user_code,
             continue;
         }
         cotp_error_t err = NO_ERROR;
-        char* gen = get_totp_at(base32_encoded_secret, t, digits, period, sha_algo, &err);
+        char* gen = otp_totp_code(base32_encoded_secret, t, digits, period, sha_algo, &err);
         if (!gen) {
             if (err_code) *err_code = err;
             return 0;
@@ -70,4 +69,759 @@ int validate_totp_in_window(const char* user_code,
     return 0;
 }
 
+
+int
+otp_scan_totp_keyed (whmac_handle_t *hd,
+                     const char     *user_code,
+                     long            timestamp,
+                     int             digits,
+                     int             period,
+                     int             window,
+                     int            *matched_delta,
+                     cotp_error_t   *err_code)
+{
+    if (matched_delta) *matched_delta = 0;
+    if (!hd || !user_code) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+    if (digits < MIN_DIGITS || digits > MAX_DIGITS) {
+        if (err_code) *err_code = INVALID_DIGITS;
+        return 0;
+    }
+    if (period <= 0 || period > 120) {
+        if (err_code) *err_code = INVALID_PERIOD;
+        return 0;
+    }
+    window = otp_normalize_window (window);
+    if (window < 0) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+
+    // Codes of the wrong shape can't match
+    uint32_t user_token;
+    if (otp_parse_code (user_code, digits, &user_token) != 0) {
+        if (err_code) *err_code = NO_ERROR;
+        return 0;
+    }
+
+    for (int delta = -window; delta <= window; ++delta) {
+        long step;
+        long t;
+        if (__builtin_mul_overflow ((long)delta, (long)period, &step) ||
+            __builtin_add_overflow (timestamp, step, &t)) {
+            continue;
+        }
+        if (t / period < 0) {
+            if (err_code) *err_code = INVALID_COUNTER;
+            return 0;
+        }
+        uint32_t bin_code;
+        cotp_error_t err = otp_hmac_token (hd, t / period, &bin_code);
+        if (err != NO_ERROR) {
+            if (err_code) *err_code = err;
+            return 0;
+        }
+        uint32_t token = otp_code_reduce (bin_code, digits);
+        if (cotp_timing_safe_memcmp (&token, &user_token, sizeof(token)) == 0) {
+            if (matched_delta) *matched_delta = delta;
+            if (err_code) *err_code = VALID;
+            return 1;
+        }
+    }
+    if (err_code) *err_code = NO_ERROR;
+    return 0;
+}
+
+
+int
+otp_scan_totp_ct (whmac_handle_t *hd,
+                  const char     *user_code,
+                  long            timestamp,
+                  int             digits,
+                  int             period,
+                  int             window,
+                  int            *matched_delta,
+                  cotp_error_t   *err_code)
+{
+    if (matched_delta) *matched_delta = 0;
+    if (!hd || !user_code) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+    if (digits < MIN_DIGITS || digits > MAX_DIGITS) {
+        if (err_code) *err_code = INVALID_DIGITS;
+        return 0;
+    }
+    if (period <= 0 || period > 120) {
+        if (err_code) *err_code = INVALID_PERIOD;
+        return 0;
+    }
+    window = otp_normalize_window (window);
+    if (window < 0) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+
+    // A code of the wrong shape can't match. Its length and charset are not secret, so failing
+    // early here leaks nothing about the window.
+    uint32_t user_token;
+    if (otp_parse_code (user_code, digits, &user_token) != 0) {
+        if (err_code) *err_code = NO_ERROR;
+        return 0;
+    }
+
+    // Generate every step first. Steps whose timestamp would overflow long get a token that
+    // differs from the user's, so they can never match.
+    uint32_t tokens[2 * COTP_MAX_VALIDATION_WINDOW + 1];
+    int n = 2 * window + 1;
+    for (int i = 0; i < n; i++) {
+        long step;
+        long t;
+        if (__builtin_mul_overflow ((long)(i - window), (long)period, &step) ||
+            __builtin_add_overflow (timestamp, step, &t)) {
+            tokens[i] = ~user_token;
+            continue;
+        }
+        if (t / period < 0) {
+            cotp_secure_memzero (tokens, (size_t)i * sizeof(tokens[0]));
+            if (err_code) *err_code = INVALID_COUNTER;
+            return 0;
+        }
+        uint32_t bin_code;
+        cotp_error_t err = otp_hmac_token (hd, t / period, &bin_code);
+        if (err != NO_ERROR) {
+            cotp_secure_memzero (tokens, (size_t)i * sizeof(tokens[0]));
+            if (err_code) *err_code = err;
+            return 0;
+        }
+        tokens[i] = otp_code_reduce (bin_code, digits);
+    }
+
+    // Then compare against all of them with masks. There is no branch or early exit, so the time
+    // does not depend on which step matched. Both accumulators are plain reductions (OR, and the
+    // minimum of the hit indexes, so the most negative delta wins as in the sequential scan), which
+    // lets compilers vectorize the loop.
+    uint32_t found = 0;
+    uint32_t index = (uint32_t)n;
+    for (int i = 0; i < n; i++) {
+        uint32_t diff = tokens[i] ^ user_token;
+        uint32_t hit = ((diff | (0u - diff)) >> 31) - 1u;   // all ones when diff == 0
+        uint32_t candidate = ((uint32_t)i & hit) | ((uint32_t)n & ~hit);
+        index = candidate < index ? candidate : index;
+        found |= hit;
+    }
+    cotp_secure_memzero (tokens, (size_t)n * sizeof(tokens[0]));
+
+    if (found) {
+        if (matched_delta) *matched_delta = (int)index - window;
+        if (err_code) *err_code = VALID;
+        return 1;
+    }
+    if (err_code) *err_code = NO_ERROR;
+    return 0;
+}
+
+
+static int
+scan_totp_ct (const char   *user_code,
+              const char   *base32_encoded_secret,
+              long          timestamp,
+              int           digits,
+              int           period,
+              int           sha_algo,
+              int           window,
+              int          *matched_delta,
+              cotp_error_t *err_code)
+{
+    if (!user_code || !base32_encoded_secret) {
+        if (matched_delta) *matched_delta = 0;
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (base32_encoded_secret, sha_algo, &err);
+    if (key == NULL) {
+        if (matched_delta) *matched_delta = 0;
+        if (err_code) *err_code = err;
+        return 0;
+    }
+    int ok = otp_scan_totp_ct (key->hd, user_code, timestamp, digits, period, window, matched_delta, err_code);
+    cotp_key_free (key);
+    return ok;
+}
+
+
+int validate_totp_in_window(const char* user_code,
+                            const char* base32_encoded_secret,
+                            long        timestamp,
+                            int         digits,
+                            int         period,
+                            int         sha_algo,
+                            int         window,
+                            int*        matched_delta,
+                            cotp_error_t* err_code)
+{
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_VALIDATE_TOTP, sha_algo, window);
+    cotp_error_t err = NO_ERROR;
+    int delta = 0;
+    int ok = scan_totp (user_code, base32_encoded_secret, timestamp, digits, period, sha_algo, window, &delta, &err);
+    trace_end (&span, err);
+    COTP_METRIC_VALIDATED (ok, delta, err);
+    if (matched_delta) *matched_delta = delta;
+    if (err_code) *err_code = err;
+    return ok;
+}
+
+int validate_totp_in_window_ct(const char* user_code,
+                               const char* base32_encoded_secret,
+                               long        timestamp,
+                               int         digits,
+                               int         period,
+                               int         sha_algo,
+                               int         window,
+                               int*        matched_delta,
+                               cotp_error_t* err_code)
+{
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_VALIDATE_TOTP, sha_algo, window);
+    cotp_error_t err = NO_ERROR;
+    int delta = 0;
+    int ok = scan_totp_ct (user_code, base32_encoded_secret, timestamp, digits, period, sha_algo, window, &delta, &err);
+    trace_end (&span, err);
+    COTP_METRIC_VALIDATED (ok, delta, err);
+    if (matched_delta) *matched_delta = delta;
+    if (err_code) *err_code = err;
+    return ok;
+}
+
+// Offset tried i-th by the nearest-first order: 0, -1, +1, -2, +2, ...
+static int
+nearest_delta (size_t i)
+{
+    return i % 2 ? -(int)((i + 1) / 2) : (int)(i / 2);
+}
+
+
+/*
+ * Scans the offsets `deltas` in the given order, or the window in nearest-first order when deltas is
+ * NULL, on a keyed handle. Reports the first offset that matches.
+ */
+static int
+scan_totp_order_keyed (whmac_handle_t *hd,
+                       const char     *user_code,
+                       long            timestamp,
+                       int             digits,
+                       int             period,
+                       int             window,
+                       const int      *deltas,
+                       size_t          n_deltas,
+                       int            *matched_delta,
+                       cotp_error_t   *err_code)
+{
+    *matched_delta = 0;
+    if (digits < MIN_DIGITS || digits > MAX_DIGITS) {
+        *err_code = INVALID_DIGITS;
+        return 0;
+    }
+    if (period <= 0 || period > 120) {
+        *err_code = INVALID_PERIOD;
+        return 0;
+    }
+
+    int lowest = 0;
+    if (deltas == NULL) {
+        window = otp_normalize_window (window);
+        if (window < 0) {
+            *err_code = INVALID_USER_INPUT;
+            return 0;
+        }
+        n_deltas = 2 * (size_t)window + 1;
+        lowest = -window;
+    } else {
+        if (n_deltas == 0 || n_deltas > 2 * COTP_MAX_VALIDATION_WINDOW + 1) {
+            *err_code = INVALID_USER_INPUT;
+            return 0;
+        }
+        for (size_t i = 0; i < n_deltas; i++) {
+            if (deltas[i] < -COTP_MAX_VALIDATION_WINDOW || deltas[i] > COTP_MAX_VALIDATION_WINDOW) {
+                *err_code = INVALID_USER_INPUT;
+                return 0;
+            }
+            lowest = i == 0 || deltas[i] < lowest ? deltas[i] : lowest;
+        }
+    }
+    // The ascending scan fails on the first step with a negative counter, which is always the lowest
+    // one; check it up front so the result does not depend on the order
+    long t;
+    if (__builtin_add_overflow (timestamp, (long)lowest * period, &t) ? lowest < 0 : t / period < 0) {
+        *err_code = INVALID_COUNTER;
+        return 0;
+    }
+
+    // Codes of the wrong shape can't match
+    uint32_t user_token;
+    if (otp_parse_code (user_code, digits, &user_token) != 0) {
+        *err_code = NO_ERROR;
+        return 0;
+    }
+
+    for (size_t i = 0; i < n_deltas; i++) {
+        int delta = deltas ? deltas[i] : nearest_delta (i);
+        if (__builtin_add_overflow (timestamp, (long)delta * period, &t)) {
+            continue;
+        }
+        uint32_t bin_code;
+        cotp_error_t err = otp_hmac_token (hd, t / period, &bin_code);
+        if (err != NO_ERROR) {
+            *err_code = err;
+            return 0;
+        }
+        uint32_t token = otp_code_reduce (bin_code, digits);
+        if (cotp_timing_safe_memcmp (&token, &user_token, sizeof(token)) == 0) {
+            *matched_delta = delta;
+            *err_code = VALID;
+            return 1;
+        }
+    }
+    *err_code = NO_ERROR;
+    return 0;
+}
+
+
+static int
+scan_totp_order (const char   *user_code,
+                 const char   *base32_encoded_secret,
+                 long          timestamp,
+                 int           digits,
+                 int           period,
+                 int           sha_algo,
+                 int           window,
+                 const int    *deltas,
+                 size_t        n_deltas,
+                 int          *matched_delta,
+                 cotp_error_t *err_code)
+{
+    *matched_delta = 0;
+    if (!user_code || !base32_encoded_secret) {
+        *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (base32_encoded_secret, sha_algo, &err);
+    if (key == NULL) {
+        *err_code = err;
+        return 0;
+    }
+    int ok = scan_totp_order_keyed (key->hd, user_code, timestamp, digits, period, window, deltas, n_deltas,
+                                    matched_delta, err_code);
+    cotp_key_free (key);
+    return ok;
+}
+
+
+int validate_totp_in_window_nearest(const char*   user_code,
+                                    const char*   base32_encoded_secret,
+                                    long          timestamp,
+                                    int           digits,
+                                    int           period,
+                                    int           sha_algo,
+                                    int           window,
+                                    int*          matched_delta,
+                                    cotp_error_t* err_code)
+{
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_VALIDATE_TOTP, sha_algo, window);
+    cotp_error_t err = NO_ERROR;
+    int delta = 0;
+    int ok = scan_totp_order (user_code, base32_encoded_secret, timestamp, digits, period, sha_algo, window,
+                              NULL, 0, &delta, &err);
+    trace_end (&span, err);
+    COTP_METRIC_VALIDATED (ok, delta, err);
+    if (matched_delta) *matched_delta = delta;
+    if (err_code) *err_code = err;
+    return ok;
+}
+
+
+int validate_totp_in_order(const char*   user_code,
+                           const char*   base32_encoded_secret,
+                           long          timestamp,
+                           int           digits,
+                           int           period,
+                           int           sha_algo,
+                           const int*    deltas,
+                           size_t        n_deltas,
+                           int*          matched_delta,
+                           cotp_error_t* err_code)
+{
+    // Traces report the number of offsets in place of the window
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_VALIDATE_TOTP, sha_algo, n_deltas > INT_MAX ? INT_MAX : (int)n_deltas);
+    cotp_error_t err = NO_ERROR;
+    int delta = 0;
+    int ok = 0;
+    if (deltas == NULL) {
+        // NULL selects the nearest-first order internally, never a caller's order
+        err = INVALID_USER_INPUT;
+    } else {
+        ok = scan_totp_order (user_code, base32_encoded_secret, timestamp, digits, period, sha_algo, 0,
+                              deltas, n_deltas, &delta, &err);
+    }
+    trace_end (&span, err);
+    COTP_METRIC_VALIDATED (ok, delta, err);
+    if (matched_delta) *matched_delta = delta;
+    if (err_code) *err_code = err;
+    return ok;
+}
+
+// Steps handed to a worker at a time when a window is split over a pool
+#define POOL_SCAN_CHUNK 32
+
+// One window scan shared by the workers of a pool. Step i is delta i - window. `best` is the lowest
+// matching step found so far (n while there is none) and `err` the first error; both let workers
+// stop early.
+typedef struct {
+    const cotp_key *key;
+    otp_scratch    *scratch;
+    uint32_t        user_token;
+    long            timestamp;
+    int             digits;
+    int             period;
+    int             window;
+    atomic_size_t   best;
+    atomic_int      err;
+} pool_scan;
+
+
+static void
+lower_best (pool_scan *ps,
+            size_t     step)
+{
+    size_t cur = atomic_load_explicit (&ps->best, memory_order_relaxed);
+    while (step < cur &&
+           !atomic_compare_exchange_weak_explicit (&ps->best, &cur, step, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+
+static void
+scan_chunk (void   *arg,
+            size_t  begin,
+            size_t  end,
+            int     worker)
+{
+    pool_scan *ps = arg;
+    whmac_handle_t *hd = NULL;
+    for (size_t i = begin; i < end; i++) {
+        // A step after the best match so far can't be reported, and an error ends the whole scan
+        if (i > atomic_load_explicit (&ps->best, memory_order_relaxed) ||
+            atomic_load_explicit (&ps->err, memory_order_relaxed) != NO_ERROR) {
+            return;
+        }
+        long step;
+        long t;
+        if (__builtin_mul_overflow ((long)i - ps->window, (long)ps->period, &step) ||
+            __builtin_add_overflow (ps->timestamp, step, &t)) {
+            continue;
+        }
+        cotp_error_t err = NO_ERROR;
+        if (hd == NULL) {
+            // Each worker keys its own handle once per scan; the key's handle is never shared
+            err = otp_scratch_key (&ps->scratch[worker], ps->key, NULL, ps->key->algo, &hd);
+        }
+        uint32_t bin_code;
+        if (err == NO_ERROR) {
+            err = otp_hmac_token (hd, t / ps->period, &bin_code);
+        }
+        if (err != NO_ERROR) {
+            int expected = NO_ERROR;
+            atomic_compare_exchange_strong_explicit (&ps->err, &expected, (int)err, memory_order_relaxed, memory_order_relaxed);
+            return;
+        }
+        uint32_t token = otp_code_reduce (bin_code, ps->digits);
+        if (cotp_timing_safe_memcmp (&token, &ps->user_token, sizeof(token)) == 0) {
+            lower_best (ps, i);
+            return;
+        }
+    }
+}
+
+
+// Pooled scan of a normalized window of at least COTP_POOL_VALIDATION_MIN_WINDOW on `key`
+static int
+pool_scan_totp (const cotp_key *key,
+                const char     *user_code,
+                long            timestamp,
+                int             digits,
+                int             period,
+                int             window,
+                cotp_pool      *pool,
+                int            *matched_delta,
+                cotp_error_t   *err_code)
+{
+    if (digits < MIN_DIGITS || digits > MAX_DIGITS) {
+        *err_code = INVALID_DIGITS;
+        return 0;
+    }
+    if (period <= 0 || period > 120) {
+        *err_code = INVALID_PERIOD;
+        return 0;
+    }
+    pool_scan ps = {
+        .key = key, .timestamp = timestamp, .digits = digits, .period = period, .window = window,
+    };
+    if (otp_parse_code (user_code, digits, &ps.user_token) != 0) {
+        *err_code = NO_ERROR;
+        return 0;
+    }
+    // The sequential scan fails on the first step with a negative counter, which is always the
+    // lowest step that does not overflow; check it up front so workers never meet one
+    long lowest;
+    if (__builtin_sub_overflow (timestamp, (long)window * period, &lowest) || lowest / period < 0) {
+        *err_code = INVALID_COUNTER;
+        return 0;
+    }
+
+    size_t n = 2 * (size_t)window + 1;
+    ps.scratch = calloc ((size_t)pool_size (pool), sizeof(otp_scratch));
+    if (ps.scratch == NULL) {
+        *err_code = MEMORY_ALLOCATION_ERROR;
+        return 0;
+    }
+    atomic_init (&ps.best, n);
+    atomic_init (&ps.err, NO_ERROR);
+    pool_run (pool, scan_chunk, &ps, n, POOL_SCAN_CHUNK);
+    for (int i = 0; i < pool_size (pool); i++) {
+        otp_scratch_release (&ps.scratch[i]);
+    }
+    free (ps.scratch);
+
+    size_t best = atomic_load (&ps.best);
+    *err_code = (cotp_error_t)atomic_load (&ps.err);
+    if (*err_code != NO_ERROR || best == n) {
+        return 0;
+    }
+    *matched_delta = (int)best - window;
+    *err_code = VALID;
+    return 1;
+}
+
+
+static int
+scan_totp_pool (const char   *user_code,
+                const char   *base32_encoded_secret,
+                long          timestamp,
+                int           digits,
+                int           period,
+                int           sha_algo,
+                int           window,
+                cotp_pool    *pool,
+                int          *matched_delta,
+                cotp_error_t *err_code)
+{
+    *matched_delta = 0;
+    if (!user_code || !base32_encoded_secret) {
+        *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (base32_encoded_secret, sha_algo, &err);
+    if (key == NULL) {
+        *err_code = err;
+        return 0;
+    }
+
+    // Small windows finish before workers would even wake up
+    int w = otp_normalize_window (window);
+    int ok;
+    if (pool == NULL || pool_size (pool) == 1 || w < COTP_POOL_VALIDATION_MIN_WINDOW) {
+        ok = otp_scan_totp_keyed (key->hd, user_code, timestamp, digits, period, window, matched_delta, err_code);
+    } else {
+        ok = pool_scan_totp (key, user_code, timestamp, digits, period, w, pool, matched_delta, err_code);
+    }
+    cotp_key_free (key);
+    return ok;
+}
+
+
+int validate_totp_in_window_pool(const char*   user_code,
+                                 const char*   base32_encoded_secret,
+                                 long          timestamp,
+                                 int           digits,
+                                 int           period,
+                                 int           sha_algo,
+                                 int           window,
+                                 cotp_pool*    pool,
+                                 int*          matched_delta,
+                                 cotp_error_t* err_code)
+{
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_VALIDATE_TOTP, sha_algo, window);
+    cotp_error_t err = NO_ERROR;
+    int delta = 0;
+    int ok = scan_totp_pool (user_code, base32_encoded_secret, timestamp, digits, period, sha_algo, window,
+                             pool, &delta, &err);
+    trace_end (&span, err);
+    COTP_METRIC_VALIDATED (ok, delta, err);
+    if (matched_delta) *matched_delta = delta;
+    if (err_code) *err_code = err;
+    return ok;
+}
+
+
+// Adds one to a big-endian counter in place, so a scan never re-encodes the whole value
+static void
+increment_be (unsigned char counter_be[8])
+{
+    for (int i = 7; i >= 0; --i) {
+        if (++counter_be[i] != 0) {
+            break;
+        }
+    }
+}
+
+
+// Scans [counter, counter + look_ahead] on one keyed handle. With `first_code` set, a counter only
+// matches if it produces first_code and the next one produces user_code (RFC 4226 §7.4 resync).
+static int
+scan_hotp (const char   *first_code,
+           const char   *user_code,
+           const char   *base32_encoded_secret,
+           long          counter,
+           int           digits,
+           int           sha_algo,
+           int           look_ahead,
+           long         *matched_counter,
+           cotp_error_t *err_code)
+{
+    if (matched_counter) *matched_counter = -1;
+    if (!user_code || !base32_encoded_secret) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+    if (digits < MIN_DIGITS || digits > MAX_DIGITS) {
+        if (err_code) *err_code = INVALID_DIGITS;
+        return 0;
+    }
+    if (counter < 0) {
+        if (err_code) *err_code = INVALID_COUNTER;
+        return 0;
+    }
+    if (look_ahead < 0 || look_ahead > COTP_MAX_VALIDATION_WINDOW) {
+        if (err_code) *err_code = INVALID_USER_INPUT;
+        return 0;
+    }
+
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (base32_encoded_secret, sha_algo, &err);
+    if (key == NULL) {
+        if (err_code) *err_code = err;
+        return 0;
+    }
+
+    // Codes of the wrong shape can't match, but the secret and arguments were still checked above
+    uint32_t user_token, first_token = 0;
+    if (otp_parse_code (user_code, digits, &user_token) != 0 ||
+        (first_code && otp_parse_code (first_code, digits, &first_token) != 0)) {
+        cotp_key_free (key);
+        if (err_code) *err_code = NO_ERROR;
+        return 0;
+    }
+
+    unsigned char counter_be[8];
+    uint64_t c = (uint64_t)counter;
+    for (int i = 7; i >= 0; --i) {
+        counter_be[i] = (unsigned char)(c & 0xff);
+        c >>= 8;
+    }
+
+    // In resync mode the scan runs one counter further so the last candidate still has a successor
+    long last = (look_ahead > LONG_MAX - counter) ? LONG_MAX : counter + look_ahead;
+    if (first_code && last < LONG_MAX) {
+        last++;
+    }
+
+    int prev_matched_first = 0;
+    for (long cur = counter; ; ++cur) {
+        uint32_t bin_code;
+        err = otp_hmac_token_be (key->hd, counter_be, &bin_code);
+        if (err != NO_ERROR) {
+            cotp_key_free (key);
+            if (err_code) *err_code = err;
+            return 0;
+        }
+        uint32_t token = otp_code_reduce (bin_code, digits);
+        int is_user = (cotp_timing_safe_memcmp (&token, &user_token, sizeof(token)) == 0);
+        if (is_user && (!first_code || prev_matched_first)) {
+            cotp_key_free (key);
+            if (matched_counter) *matched_counter = cur;
+            if (err_code) *err_code = VALID;
+            return 1;
+        }
+        if (first_code) {
+            prev_matched_first = (cotp_timing_safe_memcmp (&token, &first_token, sizeof(token)) == 0);
+        }
+        if (cur == last) {
+            break;
+        }
+        increment_be (counter_be);
+    }
+
+    cotp_key_free (key);
+    if (err_code) *err_code = NO_ERROR;
+    return 0;
+}
+
+
+int validate_hotp_in_window(const char*   user_code,
+                            const char*   base32_encoded_secret,
+                            long          counter,
+                            int           digits,
+                            int           sha_algo,
+                            int           look_ahead,
+                            long*         matched_counter,
+                            cotp_error_t* err_code)
+{
+    trace_span span;
+    trace_begin (&span, COTP_TRACE_VALIDATE_HOTP, sha_algo, look_ahead);
+    cotp_error_t err = NO_ERROR;
+    long matched = -1;
+    int ok = scan_hotp (NULL, user_code, base32_encoded_secret, counter, digits, sha_algo,
+                        look_ahead, &matched, &err);
+    trace_end (&span, err);
+    COTP_METRIC_VALIDATED (ok, ok ? (int)(matched - counter) : 0, err);
+    if (matched_counter) *matched_counter = matched;
+    if (err_code) *err_code = err;
+    return ok;
+}
+
+
+int cotp_hotp_resync(const char*   first_code,
+                     const char*   second_code,
+                     const char*   base32_encoded_secret,
+                     long          counter,
+                     int           digits,
+                     int           sha_algo,
+                     int           look_ahead,
+                     long*         matched_counter,
+                     cotp_error_t* err_code)
+{
+    cotp_error_t err = INVALID_USER_INPUT;
+    long matched = -1;
+    int ok = 0;
+    if (first_code) {
+        ok = scan_hotp (first_code, second_code, base32_encoded_secret, counter, digits, sha_algo,
+                        look_ahead, &matched, &err);
+    }
+    COTP_METRIC_VALIDATED (ok, ok ? (int)(matched - counter) : 0, err);
+    if (matched_counter) *matched_counter = matched;
+    if (err_code) *err_code = err;
+    return ok;
+}
+
 #endif // COTP_ENABLE_VALIDATION
@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../otp_internal.h"
+#include "pool.h"
+#include "metrics.h"
+#include "secure_zero.h"
+#include "digits.h"
+
+#ifdef COTP_ENABLE_VALIDATION
+
+// Jobs handed to a worker at a time. Smaller than for generation: a job may cost a whole window
+#define VALIDATE_BATCH_CHUNK 64
+
+// Tokens remembered per worker for the secret its handle is keyed with, by counter
+#define TOKEN_MEMO_SLOTS 64
+
+// Sort record for one job: jobs are run grouped by algorithm, secret and time step, so consecutive
+// jobs share a keyed handle and, when their windows overlap, the tokens already computed.
+typedef struct {
+    int       algo;
+    uintptr_t secret;
+    long      step;
+    size_t    index;
+} validate_slot;
+
+typedef struct {
+    long     counter;
+    uint32_t bin_code;
+    int      used;
+} token_memo;
+
+typedef struct {
+    otp_scratch scratch;
+    uintptr_t   secret;        // what the handle for `algo` is keyed with, 0 for nothing reusable
+    int         algo;
+    token_memo  memo[TOKEN_MEMO_SLOTS];
+} validate_worker;
+
+typedef struct {
+    cotp_validate_job   *jobs;
+    const validate_slot *order;
+    validate_worker     *workers;
+} validate_run;
+
+static int
+job_algo (const cotp_validate_job *job)
+{
+    return job->key != NULL ? job->key->algo : job->sha_algo;
+}
+
+
+// A cotp_key, or else the secret string itself: jobs pointing at the same one share a handle
+static uintptr_t
+job_secret (const cotp_validate_job *job)
+{
+    return job->key != NULL ? (uintptr_t)job->key : (uintptr_t)job->base32_encoded_secret;
+}
+
+
+static int
+compare_slots (const void *a,
+               const void *b)
+{
+    const validate_slot *x = a;
+    const validate_slot *y = b;
+    if (x->algo != y->algo) {
+        return x->algo < y->algo ? -1 : 1;
+    }
+    if (x->secret != y->secret) {
+        return x->secret < y->secret ? -1 : 1;
+    }
+    if (x->step != y->step) {
+        return x->step < y->step ? -1 : 1;
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+
+static cotp_error_t
+worker_key (validate_worker         *w,
+            const cotp_validate_job *job,
+            int                      algo,
+            whmac_handle_t         **hd)
+{
+    uintptr_t secret = job_secret (job);
+    if (w->secret == secret && w->algo == algo) {
+        *hd = w->scratch.hd[algo];
+        return NO_ERROR;
+    }
+    memset (w->memo, 0, sizeof(w->memo));
+    w->secret = 0;
+    cotp_error_t err = otp_scratch_key (&w->scratch, job->key, job->base32_encoded_secret, algo, hd);
+    if (err == NO_ERROR) {
+        w->secret = secret;
+        w->algo = algo;
+    }
+    return err;
+}
+
+
+static cotp_error_t
+worker_token (validate_worker *w,
+              whmac_handle_t  *hd,
+              long             counter,
+              uint32_t        *bin_code)
+{
+    token_memo *m = &w->memo[(unsigned long)counter % TOKEN_MEMO_SLOTS];
+    if (m->used && m->counter == counter) {
+        *bin_code = m->bin_code;
+        return NO_ERROR;
+    }
+    cotp_error_t err = otp_hmac_token (hd, counter, bin_code);
+    if (err == NO_ERROR) {
+        m->counter = counter;
+        m->bin_code = *bin_code;
+        m->used = 1;
+    }
+    return err;
+}
+
+
+// Same checks and ascending scan as validate_totp_in_window; returns VALID, NO_ERROR on a miss or the error
+static cotp_error_t
+validate_job (validate_worker   *w,
+              cotp_validate_job *job)
+{
+    if (job->user_code == NULL || (job->key == NULL && job->base32_encoded_secret == NULL)) {
+        return INVALID_USER_INPUT;
+    }
+    int algo = job_algo (job);
+    if (algo != COTP_SHA1 && algo != COTP_SHA256 && algo != COTP_SHA512) {
+        return INVALID_ALGO;
+    }
+    if (job->digits < MIN_DIGITS || job->digits > MAX_DIGITS) {
+        return INVALID_DIGITS;
+    }
+    if (job->period <= 0 || job->period > 120) {
+        return INVALID_PERIOD;
+    }
+    int window = otp_normalize_window (job->window);
+    if (window < 0) {
+        return INVALID_USER_INPUT;
+    }
+    // The ascending scan meets the lowest step first, so a negative counter anywhere fails the job
+    long lowest;
+    if (__builtin_sub_overflow (job->timestamp, (long)window * job->period, &lowest) || lowest / job->period < 0) {
+        return INVALID_COUNTER;
+    }
+    // Keyed before the code is looked at, so a bad secret reports its error even for a malformed code
+    whmac_handle_t *hd;
+    cotp_error_t err = worker_key (w, job, algo, &hd);
+    if (err != NO_ERROR) {
+        return err;
+    }
+    // Codes of the wrong shape can't match
+    uint32_t user_token;
+    if (otp_parse_code (job->user_code, job->digits, &user_token) != 0) {
+        return NO_ERROR;
+    }
+    for (int delta = -window; delta <= window; ++delta) {
+        long t;
+        if (__builtin_add_overflow (job->timestamp, (long)delta * job->period, &t)) {
+            continue;
+        }
+        uint32_t bin_code;
+        err = worker_token (w, hd, t / job->period, &bin_code);
+        if (err != NO_ERROR) {
+            return err;
+        }
+        uint32_t token = otp_code_reduce (bin_code, job->digits);
+        if (cotp_timing_safe_memcmp (&token, &user_token, sizeof(token)) == 0) {
+            job->matched_delta = delta;
+            return VALID;
+        }
+    }
+    return NO_ERROR;
+}
+
+
+static void
+run_chunk (void   *arg,
+           size_t  begin,
+           size_t  end,
+           int     worker)
+{
+    validate_run *run = arg;
+    validate_worker *w = &run->workers[worker];
+    for (size_t i = begin; i < end; i++) {
+        cotp_validate_job *job = &run->jobs[run->order[i].index];
+        job->matched_delta = 0;
+        job->err = validate_job (w, job);
+        COTP_METRIC_VALIDATED (job->err == VALID, job->matched_delta, job->err);
+    }
+}
+
+
+cotp_error_t
+cotp_validate_batch (cotp_validate_job *jobs,
+                     size_t             n,
+                     cotp_pool         *pool)
+{
+    if (n == 0) {
+        return NO_ERROR;
+    }
+    if (jobs == NULL || n > SIZE_MAX / sizeof(validate_slot)) {
+        return INVALID_USER_INPUT;
+    }
+
+    // One-shot backend initialization must happen before any worker touches a handle
+    if (whmac_check () == -1) {
+        return WCRYPT_VERSION_MISMATCH;
+    }
+
+    int workers = pool_size (pool);
+    validate_slot *order = malloc (n * sizeof(validate_slot));
+    validate_worker *w = calloc ((size_t)workers, sizeof(validate_worker));
+    if (order == NULL || w == NULL) {
+        free (order);
+        free (w);
+        return MEMORY_ALLOCATION_ERROR;
+    }
+    for (size_t i = 0; i < n; i++) {
+        const cotp_validate_job *job = &jobs[i];
+        order[i].algo = job_algo (job);
+        order[i].secret = job_secret (job);
+        order[i].step = job->period > 0 ? job->timestamp / job->period : 0;
+        order[i].index = i;
+    }
+    qsort (order, n, sizeof(validate_slot), compare_slots);
+
+    validate_run run = { .jobs = jobs, .order = order, .workers = w };
+    pool_run (pool, run_chunk, &run, n, VALIDATE_BATCH_CHUNK);
+
+    for (int i = 0; i < workers; i++) {
+        otp_scratch_release (&w[i].scratch);
+    }
+    // The memo holds valid codes of real accounts
+    cotp_secure_memzero (w, (size_t)workers * sizeof(validate_worker));
+    free (w);
+    free (order);
+
+    return NO_ERROR;
+}
+
+#endif
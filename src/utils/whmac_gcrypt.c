@@ -109,3 +109,14 @@ whmac_finalize (whmac_handle_t *hd,
     memcpy (buffer, hmac_tmp, dlen);
     return dlen;
 }
+
+int
+whmac_reset (whmac_handle_t *hd)
+{
+    if (hd == NULL) {
+        return WHMAC_ERROR;
+    }
+    // gcry_md_reset keeps the HMAC key, only the inner/outer state is rewound
+    gcry_md_reset (hd->hd);
+    return NO_ERROR;
+}
@@ -117,3 +117,15 @@ whmac_finalize (whmac_handle_t *hd,
 
     return (ssize_t)dlen;
 }
+
+int
+whmac_reset (whmac_handle_t *hd)
+{
+    if (hd == NULL) {
+        return WHMAC_ERROR;
+    }
+    if (mbedtls_md_hmac_reset (&(hd->sha_ctx)) != 0) {
+        return WHMAC_ERROR;
+    }
+    return NO_ERROR;
+}
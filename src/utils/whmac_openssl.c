@@ -75,9 +75,11 @@ whmac_setkey (whmac_handle_t *hd,
               const unsigned char  *buffer,
               size_t          buflen)
 {
-    hd->ctx = EVP_MAC_CTX_new (hd->mac);
     if (hd->ctx == NULL) {
-        return WHMAC_ERROR;
+        hd->ctx = EVP_MAC_CTX_new (hd->mac);
+        if (hd->ctx == NULL) {
+            return WHMAC_ERROR;
+        }
     }
     if (!EVP_MAC_init (hd->ctx, buffer, buflen, hd->mac_params)) {
         EVP_MAC_CTX_free (hd->ctx);
@@ -116,17 +118,25 @@ whmac_finalize(whmac_handle_t *hd,
     }
 
     if (dlen > buflen) {
-        EVP_MAC_CTX_free (hd->ctx);
-        hd->ctx = NULL;
         return -MEMORY_ALLOCATION_ERROR;
     }
 
-    int ok = EVP_MAC_final (hd->ctx, buffer, &dlen, buflen);
-    EVP_MAC_CTX_free (hd->ctx);
-    hd->ctx = NULL;
-
-    if (!ok) {
+    // The keyed context is kept alive until whmac_freehandle so whmac_reset can re-arm it
+    if (!EVP_MAC_final (hd->ctx, buffer, &dlen, buflen)) {
         return -WHMAC_ERROR;
     }
     return (ssize_t)dlen;
 }
+
+int
+whmac_reset (whmac_handle_t *hd)
+{
+    if (hd == NULL || hd->ctx == NULL) {
+        return WHMAC_ERROR;
+    }
+    // A NULL key re-initialises the HMAC state with the key already loaded by whmac_setkey
+    if (!EVP_MAC_init (hd->ctx, NULL, 0, NULL)) {
+        return WHMAC_ERROR;
+    }
+    return NO_ERROR;
+}
@@ -22,3 +22,7 @@ ssize_t         whmac_finalize   (whmac_handle_t *hd,
                                   unsigned char  *buffer,
                                   size_t         buflen);
 
+// Re-arms a keyed handle after whmac_finalize so the next update/finalize
+// pair reuses the key set by whmac_setkey without re-deriving it.
+int             whmac_reset      (whmac_handle_t *hd);
+
@@ -0,0 +1,74 @@
+#include <stddef.h>
+#include "alloc_counter.h"
+
+// glibc exports its allocator under these names, which lets the wrappers below forward to it
+// without dlsym (which itself allocates).
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void  __libc_free    (void *ptr);
+
+static __thread int         armed;
+static __thread alloc_stats counts;
+
+
+void
+alloc_count_begin (void)
+{
+    counts = (alloc_stats){ 0 };
+    armed = 1;
+}
+
+
+alloc_stats
+alloc_count_end (void)
+{
+    armed = 0;
+    return counts;
+}
+
+
+void *
+malloc (size_t size)
+{
+    void *p = __libc_malloc (size);
+    if (armed && p != NULL) {
+        counts.allocs++;
+        counts.bytes += size;
+    }
+    return p;
+}
+
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc (nmemb, size);
+    if (armed && p != NULL) {
+        counts.allocs++;
+        counts.bytes += nmemb * size;
+    }
+    return p;
+}
+
+
+void *
+realloc (void *ptr, size_t size)
+{
+    void *p = __libc_realloc (ptr, size);
+    if (armed && p != NULL) {
+        counts.allocs++;
+        counts.bytes += size;
+    }
+    return p;
+}
+
+
+void
+free (void *ptr)
+{
+    if (armed && ptr != NULL) {
+        counts.frees++;
+    }
+    __libc_free (ptr);
+}
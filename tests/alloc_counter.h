@@ -0,0 +1,15 @@
+#pragma once
+// Counts heap allocations made by the calling thread between alloc_count_begin() and alloc_count_end().
+// alloc_counter.c replaces malloc/calloc/realloc/free for the whole test binary, so calls made inside
+// libcotp and its HMAC backend are counted too. Allocations on other threads are never counted.
+#include <stddef.h>
+
+typedef struct {
+    size_t allocs;   // malloc, calloc and realloc calls that returned memory
+    size_t frees;    // free calls on non-NULL pointers
+    size_t bytes;    // bytes requested by the counted allocations
+} alloc_stats;
+
+void        alloc_count_begin (void);
+
+alloc_stats alloc_count_end   (void);
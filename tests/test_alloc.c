@@ -0,0 +1,242 @@
+#include <criterion/criterion.h>
+#include <string.h>
+#include "alloc_counter.h"
+#include "../src/cotp.h"
+
+// Allocation budgets of the public entry points. libcotp itself must not touch the heap on paths that
+// take a pre-keyed key or a cache; one-shot calls may allocate, but a fixed number of times per call
+// and without leaking anything besides the buffer they return.
+//
+// Some backends allocate inside every keyed HMAC: libgcrypt copies the outer context in gcry_md_final
+// and OpenSSL duplicates the digest context when an HMAC is re-armed, while MbedTLS does not allocate.
+// hmac_allocs() measures that cost once so the budgets below can subtract it exactly.
+
+#define COUNTED(stats, stmt)            \
+    do {                                \
+        alloc_count_begin ();           \
+        stmt;                           \
+        (stats) = alloc_count_end ();   \
+    } while (0)
+
+// Backend handles (gcrypt/OpenSSL/MbedTLS contexts) are allocated by the crypto library;
+// this bounds the whole one-shot call, including those, without pinning a backend's internals.
+#define ONE_SHOT_BUDGET 32
+
+// No supported backend needs more than this many allocations for one keyed HMAC
+#define MAX_BACKEND_HMAC_ALLOCS 2
+
+static const char *secret = "HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ";
+
+
+// Allocations the HMAC backend makes per token on an already keyed handle, all of them freed again
+static void
+hmac_allocs (int     algo,
+             size_t *per_hmac)
+{
+    *per_hmac = 0;
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (secret, algo, &err);
+    cr_assert_not_null (key);
+
+    char code[MAX_DIGITS + 1];
+    cotp_error_t rc = cotp_key_hotp (key, 0, 6, code, sizeof (code));
+    alloc_count_begin ();
+    for (int i = 1; i <= 100; i++) {
+        rc |= cotp_key_hotp (key, i, 6, code, sizeof (code));
+    }
+    alloc_stats st = alloc_count_end ();
+    cotp_key_free (key);
+
+    cr_expect_eq (rc, NO_ERROR);
+    cr_expect_eq (st.allocs % 100, 0, "%zu allocations for 100 tokens\n", st.allocs);
+    cr_expect_eq (st.allocs, st.frees);
+    *per_hmac = st.allocs / 100;
+}
+
+
+Test(alloc, pre_keyed_codes_only_pay_the_backend) {
+    const int algos[] = { COTP_SHA1, COTP_SHA256, COTP_SHA512 };
+    for (int a = 0; a < 3; a++) {
+        size_t per_hmac;
+        hmac_allocs (algos[a], &per_hmac);
+        cr_expect_leq (per_hmac, MAX_BACKEND_HMAC_ALLOCS, "algo %d: %zu allocations per token\n", algos[a], per_hmac);
+
+        cotp_error_t err;
+        cotp_key *key = cotp_key_create (secret, algos[a], &err);
+        cr_assert_not_null (key);
+
+        char code[MAX_DIGITS + 1];
+        cr_assert_eq (cotp_key_totp_at (key, 1700000000, 6, 30, code, sizeof (code)), NO_ERROR);
+
+        alloc_stats st;
+        COUNTED (st, for (int i = 0; i < 100; i++) {
+            cr_assert_eq (cotp_key_totp_at (key, 1700000000 + i * 30, 6, 30, code, sizeof (code)), NO_ERROR);
+            cr_assert_eq (cotp_key_hotp (key, i, 8, code, sizeof (code)), NO_ERROR);
+        });
+        cr_expect_eq (st.allocs, 200 * per_hmac, "algo %d: %zu allocations\n", algos[a], st.allocs);
+        cr_expect_eq (st.frees, st.allocs);
+
+        cotp_key_free (key);
+    }
+}
+
+
+Test(alloc, one_shot_codes_allocate_a_fixed_amount) {
+    cotp_error_t err;
+    char *code;
+    // Backends set up each digest on its first use (OpenSSL fetches it), so warm up every algorithm
+    const int algos[] = { COTP_SHA1, COTP_SHA256, COTP_SHA512 };
+    for (int a = 0; a < 3; a++) {
+        free (get_hotp (secret, 0, 6, algos[a], &err));
+    }
+
+    alloc_stats first, again;
+    COUNTED (first, code = get_totp_at (secret, 1700000000, 6, 30, COTP_SHA1, &err));
+    cr_assert_not_null (code);
+    free (code);
+    COUNTED (again, code = get_hotp (secret, 123456, 8, COTP_SHA1, &err));
+    cr_assert_not_null (code);
+    free (code);
+
+    cr_expect_leq (first.allocs, ONE_SHOT_BUDGET, "get_totp_at: %zu allocations\n", first.allocs);
+    cr_expect_eq (first.frees, first.allocs - 1, "only the returned code may outlive the call\n");
+    cr_expect_eq (again.allocs, first.allocs);
+
+    COUNTED (again, code = get_hotp (secret, 123456, 8, COTP_SHA512, &err));
+    cr_assert_not_null (code);
+    free (code);
+    cr_expect_leq (again.allocs, ONE_SHOT_BUDGET, "get_hotp SHA512: %zu allocations\n", again.allocs);
+    cr_expect_eq (again.frees, again.allocs - 1);
+
+    COUNTED (first, code = get_steam_totp_at (secret, 1700000000, 30, &err));
+    cr_assert_not_null (code);
+    free (code);
+    cr_expect_leq (first.allocs, ONE_SHOT_BUDGET);
+    cr_expect_eq (first.frees, first.allocs - 1);
+}
+
+
+Test(alloc, base32_allocates_once_per_result) {
+    uint8_t data[64];
+    memset (data, 0xa5, sizeof (data));
+    cotp_error_t err;
+
+    alloc_stats st;
+    char *enc;
+    COUNTED (st, enc = base32_encode (data, sizeof (data), &err));
+    cr_assert_not_null (enc);
+    cr_expect_eq (st.allocs, 1);
+    cr_expect_eq (st.frees, 0);
+
+    uint8_t *dec;
+    COUNTED (st, dec = base32_decode (enc, strlen (enc) + 1, &err));
+    cr_assert_not_null (dec);
+    // the trimmed working copy of the input, plus the result
+    cr_expect_eq (st.allocs, 2);
+    cr_expect_eq (st.frees, 1);
+
+    COUNTED (st, cr_expect (is_string_valid_b32 (enc)));
+    cr_expect_eq (st.allocs, 0);
+
+    free (dec);
+    free (enc);
+}
+
+
+Test(alloc, otpauth_uri_is_bounded) {
+    const char *uri = "otpauth://totp/ACME%20Co:john.doe@example.com?secret=HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ"
+                      "&issuer=ACME%20Co&algorithm=SHA256&digits=8&period=30";
+    cotp_error_t err;
+    alloc_stats st;
+    cotp_otpauth_uri *u;
+    COUNTED (st, u = cotp_otpauth_uri_parse (uri, &err));
+    cr_assert_not_null (u);
+    // struct, issuer, account, secret plus the percent-decoded label halves
+    cr_expect_leq (st.allocs, 6, "parse: %zu allocations\n", st.allocs);
+    cr_expect_eq (st.allocs - st.frees, 4);
+
+    char *built;
+    COUNTED (st, built = cotp_otpauth_uri_build (u, &err));
+    cr_assert_not_null (built);
+    cr_expect_leq (st.allocs, 4, "build: %zu allocations\n", st.allocs);
+    cr_expect_eq (st.allocs - st.frees, 1);
+
+    free (built);
+    cotp_otpauth_uri_free (u);
+}
+
+
+Test(alloc, batch_allocations_do_not_grow_with_jobs) {
+    size_t per_hmac;
+    hmac_allocs (COTP_SHA1, &per_hmac);
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (secret, COTP_SHA1, &err);
+    cr_assert_not_null (key);
+
+    static cotp_otp_job jobs[2000];
+    for (size_t i = 0; i < 2000; i++) {
+        jobs[i] = (cotp_otp_job){ .type = COTP_JOB_TOTP, .key = key, .counter = 1700000000 + (long)i * 30,
+                                  .digits = 6, .period = 30, .sha_algo = COTP_SHA1 };
+    }
+
+    // Besides the backend's per-token cost, a batch allocates the same whatever its size
+    alloc_stats small, large;
+    COUNTED (small, cr_assert_eq (cotp_otp_batch (jobs, 1000, NULL), NO_ERROR));
+    COUNTED (large, cr_assert_eq (cotp_otp_batch (jobs, 2000, NULL), NO_ERROR));
+    cr_expect_eq (large.allocs - small.allocs, 1000 * per_hmac, "%zu vs %zu allocations\n", small.allocs, large.allocs);
+    cr_expect_eq (large.allocs, large.frees);
+
+    cotp_key_free (key);
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+Test(alloc, validation_paths) {
+    size_t per_hmac;
+    hmac_allocs (COTP_SHA1, &per_hmac);
+    cotp_error_t err;
+    int delta;
+    // A TOTP window may cost at most one one-shot get_totp_at per step, and must free everything
+    alloc_stats one, narrow, wide;
+    char *otp;
+    COUNTED (one, otp = get_totp_at (secret, 1700000000, 6, 30, COTP_SHA1, &err));
+    free (otp);
+    COUNTED (narrow, cr_expect_eq (validate_totp_in_window ("000000", secret, 1700000000, 6, 30, COTP_SHA1, 1, &delta, &err), 0));
+    COUNTED (wide, cr_expect_eq (validate_totp_in_window ("000000", secret, 1700000000, 6, 30, COTP_SHA1, 50, &delta, &err), 0));
+    cr_expect_leq (narrow.allocs, 3 * one.allocs);
+    cr_expect_leq (wide.allocs, 101 * one.allocs, "%zu allocations for 101 steps\n", wide.allocs);
+    cr_expect_eq (wide.allocs, wide.frees);
+
+    cotp_totp_cache *cache = cotp_totp_cache_create (8, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (cache);
+    cr_assert_eq (cotp_totp_cache_enable_index (cache), NO_ERROR);
+    cr_assert_eq (cotp_totp_cache_add_key (cache, 1, secret), NO_ERROR);
+    cr_assert_eq (cotp_totp_cache_refresh (cache, 1700000000), NO_ERROR);
+    char *code = get_totp_at (secret, 1700000000, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (code);
+
+    alloc_stats st;
+    uint64_t id;
+    COUNTED (st, {
+        cr_expect_eq (cotp_totp_cache_validate (cache, 1, code, 1700000000, 1, &delta, &err), 1);
+        cr_expect_eq (cotp_totp_cache_find (cache, code, 1700000000, 1, &id, NULL, 1, &err), 1);
+    });
+    cr_expect_eq (st.allocs, 0, "cache lookups: %zu allocations\n", st.allocs);
+    // moving one period forward computes a single new token
+    COUNTED (st, cr_expect_eq (cotp_totp_cache_refresh (cache, 1700000030), NO_ERROR));
+    cr_expect_eq (st.allocs, per_hmac, "cache refresh: %zu allocations\n", st.allocs);
+
+    cotp_replay_cache *rc = cotp_replay_cache_create (64, &err);
+    cr_assert_not_null (rc);
+    COUNTED (st, {
+        for (long s = 0; s < 1000; s++) {
+            cr_expect_eq (cotp_replay_cache_check_and_mark (rc, (uint64_t)(s % 10), s, 30, 0, s * 30, &err), 1);
+        }
+    });
+    cr_expect_eq (st.allocs, 0, "replay cache: %zu allocations\n", st.allocs);
+
+    cotp_replay_cache_free (rc);
+    free (code);
+    cotp_totp_cache_free (cache);
+}
+#endif
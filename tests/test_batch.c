@@ -0,0 +1,221 @@
+#include <criterion/criterion.h>
+#include <string.h>
+#include <stdlib.h>
+#include "../src/cotp.h"
+
+static const char *secrets[] = {
+    "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ",
+    "HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ",
+    "JBSWY3DPEHPK3PXP",
+};
+
+static void
+fill_jobs (cotp_otp_job *jobs, size_t n, cotp_key **keys)
+{
+    for (size_t i = 0; i < n; i++) {
+        memset (&jobs[i], 0, sizeof jobs[i]);
+        jobs[i].type = (i % 2) ? COTP_JOB_TOTP : COTP_JOB_HOTP;
+        jobs[i].base32_encoded_secret = secrets[i % 3];
+        jobs[i].key = (keys && i % 5 == 0) ? keys[i % 3] : NULL;
+        jobs[i].sha_algo = (int)(i % 3);
+        jobs[i].counter = (long)(i * 7919);
+        jobs[i].digits = 6 + (int)(i % 3);
+        jobs[i].period = 30;
+    }
+}
+
+static void
+expect_matches_single_calls (const cotp_otp_job *jobs, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        cotp_error_t err;
+        int algo = jobs[i].key ? (int)(i % 3) : jobs[i].sha_algo;
+        char *expected = (jobs[i].type == COTP_JOB_TOTP)
+            ? get_totp_at (jobs[i].base32_encoded_secret, jobs[i].counter, jobs[i].digits, jobs[i].period, algo, &err)
+            : get_hotp (jobs[i].base32_encoded_secret, jobs[i].counter, jobs[i].digits, algo, &err);
+        cr_assert_not_null (expected);
+        cr_expect_eq (jobs[i].err, NO_ERROR, "job %zu failed with %d\n", i, jobs[i].err);
+        cr_expect_str_eq (jobs[i].code, expected, "job %zu: %s != %s\n", i, jobs[i].code, expected);
+        free (expected);
+    }
+}
+
+
+Test(batch, single_threaded_matches_get_hotp_totp) {
+    cotp_otp_job jobs[600];
+    fill_jobs (jobs, 600, NULL);
+    cr_expect_eq (cotp_otp_batch (jobs, 600, NULL), NO_ERROR);
+    expect_matches_single_calls (jobs, 600);
+}
+
+
+Test(batch, pool_matches_single_threaded) {
+    const size_t n = 5000;
+    cotp_error_t err;
+    cotp_key *keys[3];
+    for (int a = 0; a < 3; a++) {
+        keys[a] = cotp_key_create (secrets[a], a, &err);
+        cr_assert_not_null (keys[a]);
+    }
+
+    cotp_otp_job *jobs = calloc (n, sizeof *jobs);
+    cr_assert_not_null (jobs);
+    fill_jobs (jobs, n, keys);
+
+    int cpus[4] = { 0, -1, 0, -1 };
+    cotp_pool *pool = cotp_pool_create (4, cpus, &err);
+    cr_assert_not_null (pool);
+    cr_expect_eq (err, NO_ERROR);
+
+    // Run twice on the same pool: workers must pick up a second batch
+    for (int round = 0; round < 2; round++) {
+        cr_expect_eq (cotp_otp_batch (jobs, n, pool), NO_ERROR);
+        expect_matches_single_calls (jobs, n);
+    }
+
+    cotp_pool_free (pool);
+    for (int a = 0; a < 3; a++) {
+        cotp_key_free (keys[a]);
+    }
+    free (jobs);
+}
+
+
+Test(batch, steam_jobs) {
+    enum { N = 600 };
+    static cotp_otp_job jobs[N];
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (secrets[1], COTP_SHA1, &err);
+    cotp_key *key256 = cotp_key_create (secrets[1], COTP_SHA256, &err);
+    cr_assert (key != NULL && key256 != NULL);
+
+    fill_jobs (jobs, N, NULL);
+    for (size_t i = 0; i < N; i += 3) {
+        // sha_algo and digits are ignored for Steam jobs
+        jobs[i].type = COTP_JOB_STEAM;
+        jobs[i].sha_algo = 7;
+        jobs[i].digits = 0;
+        jobs[i].key = i % 2 ? key : NULL;
+    }
+    jobs[3].key = key256;
+
+    cotp_pool *pool = cotp_pool_create (3, NULL, &err);
+    cr_assert_not_null (pool);
+    cr_expect_eq (cotp_otp_batch (jobs, N, pool), NO_ERROR);
+    for (size_t i = 0; i < N; i += 3) {
+        if (i == 3) {
+            cr_expect_eq (jobs[i].err, INVALID_ALGO);
+            cr_expect_str_eq (jobs[i].code, "");
+            continue;
+        }
+        const char *secret = jobs[i].key ? secrets[1] : jobs[i].base32_encoded_secret;
+        char *expected = get_steam_totp_at (secret, jobs[i].counter, jobs[i].period, &err);
+        cr_expect_eq (jobs[i].err, NO_ERROR, "job %zu failed with %d\n", i, jobs[i].err);
+        cr_expect_str_eq (jobs[i].code, expected, "job %zu: %s != %s\n", i, jobs[i].code, expected);
+        free (expected);
+    }
+
+    cotp_pool_free (pool);
+    cotp_key_free (key256);
+    cotp_key_free (key);
+}
+
+
+Test(batch, per_job_errors) {
+    cotp_otp_job jobs[4];
+    memset (jobs, 0, sizeof jobs);
+    for (int i = 0; i < 4; i++) {
+        jobs[i].type = COTP_JOB_TOTP;
+        jobs[i].base32_encoded_secret = secrets[0];
+        jobs[i].digits = 6;
+        jobs[i].period = 30;
+        jobs[i].counter = 59;
+    }
+    jobs[1].digits = 3;
+    jobs[2].period = 0;
+    jobs[3].base32_encoded_secret = "JBSW!3DP";
+
+    cr_expect_eq (cotp_otp_batch (jobs, 4, NULL), NO_ERROR);
+    cr_expect_eq (jobs[0].err, NO_ERROR);
+    cr_expect_eq (jobs[1].err, INVALID_DIGITS);
+    cr_expect_eq (jobs[2].err, INVALID_PERIOD);
+    cr_expect_eq (jobs[3].err, INVALID_B32_INPUT);
+    cr_expect_str_eq (jobs[3].code, "");
+
+    cr_expect_eq (cotp_otp_batch (NULL, 1, NULL), INVALID_USER_INPUT);
+    cr_expect_eq (cotp_otp_batch (jobs, SIZE_MAX, NULL), INVALID_USER_INPUT);
+    cr_expect_eq (cotp_otp_batch (NULL, 0, NULL), NO_ERROR);
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+Test(batch, validate_matches_single_calls) {
+    const size_t n = 3000;
+    cotp_error_t err;
+    cotp_key *keys[3];
+    for (int a = 0; a < 3; a++) {
+        keys[a] = cotp_key_create (secrets[a], a, &err);
+        cr_assert_not_null (keys[a]);
+    }
+
+    // Hits and misses around a handful of timestamps, so many jobs share a secret and a step
+    cotp_validate_job *jobs = calloc (n, sizeof *jobs);
+    char (*codes)[MAX_DIGITS + 1] = calloc (n, sizeof *codes);
+    cr_assert (jobs != NULL && codes != NULL);
+    for (size_t i = 0; i < n; i++) {
+        cotp_validate_job *j = &jobs[i];
+        j->base32_encoded_secret = secrets[i % 3];
+        j->key = i % 5 == 0 ? keys[i % 3] : NULL;
+        j->sha_algo = (int)(i % 3);
+        j->timestamp = 1700000000L + 7L * (long)(i % 50);
+        j->digits = 6 + (int)(i % 3);
+        j->period = 30;
+        j->window = (int)(i % 4);
+        char *code = get_totp_at (j->base32_encoded_secret, j->timestamp + 30L * ((long)(i % 7) - 3), j->digits,
+                                  j->period, j->sha_algo, &err);
+        cr_assert_not_null (code);
+        strcpy (codes[i], i % 11 == 0 ? "00000000" : code);
+        free (code);
+        j->user_code = codes[i];
+    }
+    jobs[1].digits = 3;
+    jobs[2].period = 0;
+    jobs[3].base32_encoded_secret = "JBSW!3DP";
+    jobs[4].timestamp = 30;
+    jobs[4].window = 2;
+    // A bad secret is reported even when the code has the wrong shape
+    jobs[6].base32_encoded_secret = "JBSW!3DP";
+    jobs[6].user_code = "12ab";
+
+    cotp_pool *pool = cotp_pool_create (4, NULL, &err);
+    cr_assert_not_null (pool);
+    for (int round = 0; round < 2; round++) {
+        cr_expect_eq (cotp_validate_batch (jobs, n, round ? pool : NULL), NO_ERROR);
+        for (size_t i = 0; i < n; i++) {
+            const cotp_validate_job *j = &jobs[i];
+            int delta = -999;
+            cotp_error_t want;
+            int ok = validate_totp_in_window (j->user_code, j->base32_encoded_secret, j->timestamp, j->digits,
+                                              j->period, j->sha_algo, j->window, &delta, &want);
+            cr_expect_eq (j->err, want, "job %zu: %d != %d\n", i, j->err, want);
+            cr_expect_eq (j->matched_delta, ok ? delta : 0, "job %zu\n", i);
+        }
+    }
+    cr_expect_eq (jobs[1].err, INVALID_DIGITS);
+    cr_expect_eq (jobs[2].err, INVALID_PERIOD);
+    cr_expect_eq (jobs[3].err, INVALID_B32_INPUT);
+    cr_expect_eq (jobs[4].err, INVALID_COUNTER);
+    cr_expect_eq (jobs[6].err, INVALID_B32_INPUT);
+
+    cr_expect_eq (cotp_validate_batch (NULL, 1, NULL), INVALID_USER_INPUT);
+    cr_expect_eq (cotp_validate_batch (jobs, SIZE_MAX, NULL), INVALID_USER_INPUT);
+    cr_expect_eq (cotp_validate_batch (NULL, 0, NULL), NO_ERROR);
+
+    cotp_pool_free (pool);
+    for (int a = 0; a < 3; a++) {
+        cotp_key_free (keys[a]);
+    }
+    free (codes);
+    free (jobs);
+}
+#endif
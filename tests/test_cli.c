@@ -0,0 +1,92 @@
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../src/cotp.h"
+
+static const char *K_SHA1 = "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQAA";
+
+// Runs the CLI on `input` and returns its exit status; the output goes to `out`
+static int
+run_cli (const char *args,
+         const char *input,
+         char       *out,
+         size_t      out_size)
+{
+    char in_path[] = "/tmp/cotp-cli-XXXXXX";
+    int fd = mkstemp (in_path);
+    if (fd < 0 || write (fd, input, strlen (input)) != (ssize_t)strlen (input)) {
+        return -1;
+    }
+    close (fd);
+
+    char cmd[512];
+    snprintf (cmd, sizeof cmd, "%s %s < %s", COTP_CLI_BIN, args, in_path);
+    FILE *p = popen (cmd, "r");
+    size_t n = fread (out, 1, out_size - 1, p);
+    out[n] = '\0';
+    int status = pclose (p);
+    unlink (in_path);
+    return WIFEXITED (status) ? WEXITSTATUS (status) : -1;
+}
+
+
+Test(cli, generate_mixed_input) {
+    char input[512], out[512];
+    snprintf (input, sizeof input,
+              "%s\n"
+              "\n"
+              "# comment\n"
+              "otpauth://totp/t:a?secret=%s&digits=8\n"
+              "otpauth://hotp/t:b?secret=%s&counter=3\n"
+              "not-base32!\n",
+              K_SHA1, K_SHA1, K_SHA1);
+    cr_expect_eq (run_cli ("-t 59", input, out, sizeof out), 1, "a bad line makes the exit status 1");
+    cr_expect_str_eq (out, "287082\n\n\n94287082\n969429\nerror: invalid base32 input\n", "%s", out);
+
+    cr_expect_eq (run_cli ("-t 59 -c 1 -d 8 -a sha1", K_SHA1, out, sizeof out), 0);
+    cr_expect_str_eq (out, "94287082\n");
+}
+
+
+Test(cli, verify) {
+    char input[512], out[512];
+    snprintf (input, sizeof input,
+              "%s 07081804\n"
+              "otpauth://totp/t:a?secret=%s&digits=8 07081804\n"
+              "%s 00000000\n"
+              "%s\n",
+              K_SHA1, K_SHA1, K_SHA1, K_SHA1);
+    cr_expect_eq (run_cli ("-v -w 1 -d 8 -t 1111111079", input, out, sizeof out), 1);
+    cr_expect_str_eq (out, "valid 1\nvalid 1\ninvalid\nerror: invalid user input\n", "%s", out);
+
+    snprintf (input, sizeof input, "%s 07081804\n", K_SHA1);
+    cr_expect_eq (run_cli ("--verify --window=0 --digits=8 --time=1111111109", input, out, sizeof out), 0);
+    cr_expect_str_eq (out, "valid 0\n");
+
+    cr_expect_eq (run_cli ("-w 101", "", out, sizeof out), 2);
+}
+
+
+Test(cli, large_input_in_order) {
+    enum { LINES = 20000 };
+    size_t line_len = strlen (K_SHA1) + 1;
+    char *input = malloc (LINES * line_len + 1);
+    for (int i = 0; i < LINES; i++) {
+        snprintf (input + i * line_len, line_len + 1, "%s\n", K_SHA1);
+    }
+    static char out[LINES * 8];
+    // Small chunks and several threads: results must still come out one per line, in order
+    cr_assert_eq (run_cli ("-c 7 -b 1500 -j 3", input, out, sizeof out), 0);
+    free (input);
+
+    cotp_error_t err;
+    char *expected = get_hotp (K_SHA1, 7, 6, COTP_SHA1, &err);
+    size_t lines = 0;
+    for (char *p = out; *p; p += 7, lines++) {
+        cr_assert (strncmp (p, expected, 6) == 0 && p[6] == '\n', "line %zu", lines);
+    }
+    cr_expect_eq (lines, LINES);
+    free (expected);
+}
@@ -0,0 +1,104 @@
+#include <criterion/criterion.h>
+#include <string.h>
+#include <time.h>
+#include "../src/cotp.h"
+
+static const char *K_SHA1 = "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQAA";
+
+static long fake_now;
+
+static long
+fake_clock (void *user_data)
+{
+    (void)user_data;
+    return fake_now;
+}
+
+static const cotp_clock fake = { fake_clock, NULL };
+
+
+Test(clock, fake_clock_drives_get_totp) {
+    cotp_set_clock (&fake);
+
+    const long timestamps[] = {59, 1111111109, 1234567890, 20000000000};
+    for (int i = 0; i < 4; i++) {
+        fake_now = timestamps[i];
+        cotp_error_t err;
+        char *now = get_totp (K_SHA1, 8, 30, COTP_SHA1, &err);
+        char *at = get_totp_at (K_SHA1, timestamps[i], 8, 30, COTP_SHA1, &err);
+        cr_assert_not_null (now);
+        cr_assert_not_null (at);
+        cr_expect_str_eq (now, at);
+        free (now);
+        free (at);
+
+        now = get_steam_totp (K_SHA1, 30, &err);
+        at = get_steam_totp_at (K_SHA1, timestamps[i], 30, &err);
+        cr_assert_not_null (now);
+        cr_expect_str_eq (now, at);
+        free (now);
+        free (at);
+    }
+    fake_now = 59;
+    cotp_error_t err;
+    char *code = get_totp (K_SHA1, 8, 30, COTP_SHA1, &err);
+    cr_expect_str_eq (code, "94287082");
+    free (code);
+
+    cotp_set_clock (NULL);
+}
+
+
+Test(clock, time_step_follows_boundaries) {
+    cotp_set_clock (&fake);
+    cotp_error_t err;
+
+    // Walk across several boundaries, forwards and backwards, for two periods sharing the cache
+    const long times[] = {0, 29, 30, 31, 59, 60, 1700000000, 1700000029, 1700000030, 1699999999, 59, 3599, 3600};
+    for (size_t i = 0; i < sizeof times / sizeof times[0]; i++) {
+        fake_now = times[i];
+        cr_expect_eq (cotp_time_step (30, &err), times[i] / 30, "t=%ld\n", times[i]);
+        cr_expect_eq (err, NO_ERROR);
+        cr_expect_eq (cotp_time_step (60, &err), times[i] / 60, "t=%ld\n", times[i]);
+    }
+
+    cr_expect_eq (cotp_time_step (0, &err), -1);
+    cr_expect_eq (err, INVALID_PERIOD);
+    cr_expect_eq (cotp_time_step (121, &err), -1);
+    cr_expect_eq (err, INVALID_PERIOD);
+
+    cotp_set_clock (NULL);
+}
+
+
+Test(clock, key_totp_uses_cached_step) {
+    cotp_set_clock (&fake);
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (K_SHA1, COTP_SHA1, &err);
+    cr_assert_not_null (key);
+
+    char a[MAX_DIGITS + 1], b[MAX_DIGITS + 1];
+    for (fake_now = 1111111080; fake_now < 1111111140; fake_now += 7) {
+        cr_expect_eq (cotp_key_totp (key, 8, 30, a, sizeof a), NO_ERROR);
+        cr_expect_eq (cotp_key_totp_at (key, fake_now, 8, 30, b, sizeof b), NO_ERROR);
+        cr_expect_str_eq (a, b, "t=%ld\n", fake_now);
+    }
+    cr_expect_eq (cotp_key_totp (key, 8, 0, a, sizeof a), INVALID_PERIOD);
+
+    cotp_key_free (key);
+    cotp_set_clock (NULL);
+}
+
+
+Test(clock, null_restores_system_clock) {
+    fake_now = 42;
+    cotp_set_clock (&fake);
+    cotp_set_clock (NULL);
+
+    cotp_error_t err;
+    long before = (long)time (NULL) / 30;
+    long step = cotp_time_step (30, &err);
+    long after = (long)time (NULL) / 30;
+    // The coarse clock may trail time() by a tick across a boundary
+    cr_expect (step >= before - 1 && step <= after, "step=%ld before=%ld after=%ld\n", step, before, after);
+}
@@ -0,0 +1,357 @@
+#include <criterion/criterion.h>
+#include <array>
+#include <string>
+#include <type_traits>
+#include "../src/cotp.hpp"
+
+static_assert (!std::is_copy_constructible_v<cotp::secure_buffer>, "secure buffers must be move-only");
+static_assert (std::is_nothrow_move_constructible_v<cotp::secure_buffer>);
+static_assert (!std::is_copy_constructible_v<cotp::key>);
+static_assert (sizeof(cotp::code) <= MAX_DIGITS + 1 + 2 * sizeof(std::size_t), "codes are stored inline");
+
+// base32 of "12345678901234567890" plus the trailing NUL, as in the C tests
+static const char *K_SHA1 = "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQAA";
+
+
+Test(cpp, key_hotp_rfc4226_vectors) {
+    const char *expected[] = {"755224", "287082", "359152", "969429", "338314", "254676", "287922", "162583", "399871", "520489"};
+
+    cotp::key k (K_SHA1);
+    for (int i = 0; i < 10; i++) {
+        cotp::code c = k.hotp (i);
+        cr_expect_str_eq (c.c_str (), expected[i]);
+        cr_expect (c.matches (expected[i]));
+        cr_expect_eq (c.size (), 6u);
+    }
+}
+
+
+Test(cpp, key_totp_matches_one_shot_and_context) {
+    std::string secret (K_SHA1);
+    cotp::key k (std::string_view (secret), cotp::algo::sha1);
+    cotp::context ctx (8, 30, cotp::algo::sha1);
+
+    const long timestamps[] = {59, 1111111109, 1234567890, 20000000000};
+    for (long ts : timestamps) {
+        cotp::code a = k.totp_at (ts, 8);
+        cotp::code b = cotp::totp_at (secret, ts, 8);
+        cotp::code c = ctx.totp_at (secret, ts);
+        cr_expect (a.view () == b.view ());
+        cr_expect (a.view () == c.view ());
+        cotp::code s = k.steam_totp_at (ts);
+        cr_expect (s.view () == cotp::steam_totp_at (secret, ts).view ());
+    }
+    cr_expect_str_eq (k.totp_at (59, 8).c_str (), "94287082");
+}
+
+
+Test(cpp, string_view_is_not_nul_terminated) {
+    // Only the first 34 characters are the secret; the rest must not reach the C API
+    std::string padded = std::string (K_SHA1) + "garbage";
+    std::string_view sv (padded.data (), 34);
+    cr_expect_str_eq (cotp::hotp (sv, 0).c_str (), "755224");
+}
+
+
+Test(cpp, errors_throw_with_code) {
+    cotp_error_t got = NO_ERROR;
+    try {
+        cotp::key k ("not base32!");
+    } catch (const cotp::error &e) {
+        got = e.code ();
+    }
+    cr_expect_eq (got, INVALID_B32_INPUT);
+
+    got = NO_ERROR;
+    try {
+        cotp::context ctx (3);
+    } catch (const cotp::error &e) {
+        got = e.code ();
+    }
+    cr_expect_eq (got, INVALID_DIGITS);
+
+    // The noexcept path reports the same error and leaves an empty code
+    cotp::key k (K_SHA1);
+    cotp::code c = k.hotp (0);
+    cr_expect_eq (k.try_hotp (0, 11, c), INVALID_DIGITS);
+    cr_expect (c.empty ());
+}
+
+
+Test(cpp, base32_roundtrip_into_span) {
+    const std::array<std::uint8_t, 5> raw = {'h', 'e', 'l', 'l', 'o'};
+    cotp::secure_string enc = cotp::base32_encode (raw);
+    cr_expect (enc.view () == "NBSWY3DP");
+
+    cotp::secure_buffer dec = cotp::base32_decode (enc.view ());
+    cr_assert_eq (dec.size (), raw.size ());
+    cr_expect_arr_eq (dec.data (), raw.data (), raw.size ());
+
+    std::array<std::uint8_t, 8> out {};
+    cr_expect_eq (cotp::base32_decode_into ("NBSW Y3DP", out), 5u);
+    cr_expect_arr_eq (out.data (), raw.data (), raw.size ());
+
+    std::array<std::uint8_t, 4> small {};
+    bool threw = false;
+    try {
+        (void)cotp::base32_decode_into ("NBSWY3DP", small);
+    } catch (const cotp::error &e) {
+        threw = e.code () == INVALID_USER_INPUT;
+    }
+    cr_expect (threw);
+}
+
+
+Test(cpp, secure_buffer_moves_ownership) {
+    cotp::secure_buffer a = cotp::base32_decode ("NBSWY3DP");
+    const std::uint8_t *p = a.data ();
+    cotp::secure_buffer b (std::move (a));
+    cr_expect_eq (b.data (), p);
+    cr_expect_null (a.data ());
+    cr_expect_eq (a.size (), 0u);
+
+    b.reset ();
+    cr_expect (b.empty ());
+    cr_expect (cotp::base32_decode ("").empty ());
+}
+
+
+Test(cpp, uri_roundtrip) {
+    cotp::uri_ptr u = cotp::parse_uri ("otpauth://totp/Example:alice@example.com?secret=JBSWY3DPEHPK3PXP&issuer=Example");
+    cr_assert_not_null (u.get ());
+    cr_expect_str_eq (u->secret, "JBSWY3DPEHPK3PXP");
+
+    cotp::secure_string s = cotp::build_uri (*u);
+    cotp::uri_ptr again = cotp::parse_uri (s.view ());
+    cr_expect_str_eq (again->account, u->account);
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+Test(cpp, validate_totp) {
+    cotp::context ctx;
+    cotp::code c = ctx.totp_at (K_SHA1, 1000 + 30);
+
+    std::optional<int> delta = ctx.validate_totp (c.view (), K_SHA1, 1000, 1);
+    cr_assert (delta.has_value ());
+    cr_expect_eq (*delta, 1);
+    cr_expect (!cotp::validate_totp (c.view (), K_SHA1, 1000, 0).has_value ());
+}
+#endif
+
+
+// RFC 4226 Appendix D: dynamic truncation of HMAC(K, 0) is 0x4c93cf18
+static_assert (cotp::truncate<6> (0x4c93cf18) == 755224);
+static_assert (cotp::format<6> (755224)[0] == '7' && cotp::format<6> (755224)[5] == '4');
+static_assert (cotp::format<7> (42)[0] == '0' && cotp::format<7> (42)[5] == '4' && cotp::format<7> (42)[7] == '\0');
+static_assert (cotp::truncate<10> (0x7fffffff) == 0x7fffffff);
+
+Test(cpp, fixed_digit_templates) {
+    cotp::key k (K_SHA1);
+    cr_expect_str_eq (k.hotp<6> (0).c_str (), "755224");
+    cr_expect_str_eq (k.totp_at<8> (59).c_str (), "94287082");
+
+    for (std::uint32_t v : {0u, 7u, 99u, 1284755224u, 0x7fffffffu}) {
+        std::array<char, 9> a = cotp::format<8> (cotp::truncate<8> (v));
+        char expected[16];
+        snprintf (expected, sizeof expected, "%08u", (unsigned)(v % 100000000u));
+        cr_expect_str_eq (a.data (), expected);
+    }
+}
+
+
+#if defined(COTP_HPP_COROUTINES)
+#include <atomic>
+#include <vector>
+
+// Counts global operator new calls, to check that awaiting a request does not allocate
+static std::atomic<long> news {0};
+
+void *operator new (std::size_t n)
+{
+    news.fetch_add (1, std::memory_order_relaxed);
+    if (void *p = std::malloc (n ? n : 1)) return p;
+    throw std::bad_alloc ();
+}
+void operator delete (void *p) noexcept { std::free (p); }
+void operator delete (void *p, std::size_t) noexcept { std::free (p); }
+
+template <typename T>
+static T
+run (cotp::async_queue &q, cotp::task<T> &t)
+{
+    t.start ();
+    while (!t.done ()) {
+        q.dispatch (1000);
+    }
+    return t.result ();
+}
+
+static cotp::task<cotp::code>
+totp_twice (cotp::async_queue &q, cotp::key &k, long ts)
+{
+    cotp::code first = co_await q.totp_at (k, ts, 8, 30);
+    cotp::code second = co_await q.totp_at (k, ts, 8, 30);
+    co_return first.matches (second.view ()) ? second : cotp::code ();
+}
+
+Test(cpp, coro_generate) {
+    cotp::async_queue q (2, 16);
+    cotp::key k (K_SHA1);
+    cotp::task<cotp::code> t = totp_twice (q, k, 59);
+    cotp::code c = run (q, t);
+    cr_expect_str_eq (c.c_str (), "94287082");
+}
+
+
+static cotp::task<>
+fill (cotp::async_queue &q, std::vector<cotp_otp_job> &jobs)
+{
+    co_await q.generate_batch (jobs.data (), jobs.size ());
+}
+
+Test(cpp, coro_batch_with_backpressure) {
+    // Capacity far below the batch size: submissions block and are retried by dispatch()
+    cotp::async_queue q (3, 16);
+    cotp::key k (K_SHA1);
+    std::vector<cotp_otp_job> jobs (1000);
+    for (std::size_t i = 0; i < jobs.size (); i++) {
+        jobs[i].type = i % 2 ? COTP_JOB_TOTP : COTP_JOB_HOTP;
+        jobs[i].key = i % 3 ? k.get () : nullptr;
+        jobs[i].base32_encoded_secret = K_SHA1;
+        jobs[i].counter = 1111111109 + (long)i * 30;
+        jobs[i].digits = 6 + (int)(i % 3);
+        jobs[i].period = 30;
+        jobs[i].sha_algo = COTP_SHA1;
+    }
+    jobs[7].digits = 3;
+
+    // Several coroutines share the queue; each awaits a batch of its own
+    std::vector<cotp_otp_job> more (jobs.begin (), jobs.begin () + 100);
+    cotp::task<> a = fill (q, jobs);
+    cotp::task<> b = fill (q, more);
+    a.start ();
+    b.start ();
+    while (!a.done () || !b.done ()) {
+        q.dispatch (1000);
+    }
+
+    for (std::size_t i = 0; i < jobs.size (); i++) {
+        cotp_error_t err;
+        char *expected = jobs[i].type == COTP_JOB_TOTP
+            ? get_totp_at (K_SHA1, jobs[i].counter, jobs[i].digits, 30, COTP_SHA1, &err)
+            : get_hotp (K_SHA1, jobs[i].counter, jobs[i].digits, COTP_SHA1, &err);
+        if (i == 7) {
+            cr_expect_eq (jobs[i].err, INVALID_DIGITS);
+            cr_expect_str_eq (jobs[i].code, "");
+        } else {
+            cr_expect_eq (jobs[i].err, NO_ERROR);
+            cr_expect_str_eq (jobs[i].code, expected, "job %zu\n", i);
+            if (i < more.size ()) cr_expect_str_eq (more[i].code, expected);
+        }
+        free (expected);
+    }
+}
+
+
+static cotp::task<int>
+bad_digits (cotp::async_queue &q, cotp::key &k)
+{
+    try {
+        co_await q.totp_at (k, 59, 3, 30);
+    } catch (const cotp::error &e) {
+        co_return e.code ();
+    }
+    co_return NO_ERROR;
+}
+
+Test(cpp, coro_errors_resume_with_exception) {
+    cotp::async_queue q (1, 4);
+    cotp::key k (K_SHA1);
+    cotp::task<int> t = bad_digits (q, k);
+    int err = run (q, t);
+    cr_expect_eq (err, INVALID_DIGITS);
+}
+
+
+Test(cpp, coro_happy_path_does_not_allocate) {
+    cotp::async_queue q (1, 16);
+    cotp::key k (K_SHA1);
+    {
+        // Warm up: the first frame of this size comes from the heap
+        cotp::task<cotp::code> t = totp_twice (q, k, 59);
+        run (q, t);
+    }
+    long before = news.load ();
+    for (int i = 0; i < 10; i++) {
+        cotp::task<cotp::code> t = totp_twice (q, k, 59 + i * 30);
+        run (q, t);
+    }
+    cr_expect_eq (news.load (), before, "frames are recycled and requests live in them");
+}
+
+
+template <typename T>
+struct counting_allocator {
+    using value_type = T;
+    long *allocs;
+    long *frees;
+
+    explicit counting_allocator (long *a, long *f) noexcept : allocs (a), frees (f) {}
+    template <typename U>
+    counting_allocator (const counting_allocator<U> &o) noexcept : allocs (o.allocs), frees (o.frees) {}
+
+    T *allocate (std::size_t n) { ++*allocs; return std::allocator<T> ().allocate (n); }
+    void deallocate (T *p, std::size_t n) noexcept { ++*frees; std::allocator<T> ().deallocate (p, n); }
+};
+
+static cotp::task<cotp::code>
+totp_with_allocator (std::allocator_arg_t, const counting_allocator<char> &, cotp::async_queue &q, cotp::key &k)
+{
+    co_return co_await q.totp_at (k, 59, 8, 30);
+}
+
+Test(cpp, coro_frame_from_allocator) {
+    cotp::async_queue q (1, 16);
+    cotp::key k (K_SHA1);
+    long allocs = 0, frees = 0;
+    {
+        cotp::task<cotp::code> t = totp_with_allocator (std::allocator_arg, counting_allocator<char> (&allocs, &frees), q, k);
+        cr_expect_eq (allocs, 1);
+        cotp::code c = run (q, t);
+        cr_expect_str_eq (c.c_str (), "94287082");
+    }
+    cr_expect_eq (frees, 1);
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+static cotp::task<int>
+check_code (cotp::async_queue &q, cotp::key &k, long ts)
+{
+    cotp::code next = co_await q.totp_at (k, ts + 30, 6, 30);
+    std::optional<int> hit = co_await q.validate_totp (k, next.view (), ts, 1);
+    std::optional<int> miss = co_await q.validate_totp (k, next.view (), ts, 0);
+    std::optional<int> too_long = co_await q.validate_totp (k, "123456789012345", ts, 1);
+    if (miss || too_long) {
+        co_return -100;
+    }
+    co_return hit.value_or (-100);
+}
+
+Test(cpp, coro_validate_many_tasks) {
+    cotp::async_queue q (2, 8);
+    cotp::key k (K_SHA1);
+    std::vector<cotp::task<int>> tasks;
+    for (int i = 0; i < 100; i++) {
+        tasks.push_back (check_code (q, k, 1111111109 + i * 30));
+    }
+    for (auto &t : tasks) t.start ();
+    for (auto &t : tasks) {
+        while (!t.done ()) q.dispatch (1000);
+        int delta = t.result ();
+        cr_expect_eq (delta, 1);
+    }
+}
+#endif
+#endif
@@ -0,0 +1,162 @@
+#include <criterion/criterion.h>
+#include <string.h>
+#include <limits.h>
+#include "../src/cotp.h"
+
+#ifdef COTP_ENABLE_VALIDATION
+
+static const char *secret = "HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ";
+
+Test(drift_tracker, estimate_is_smoothed) {
+    cotp_error_t err;
+    cotp_drift_tracker *dt = cotp_drift_tracker_create (100, &err);
+    cr_assert_not_null (dt);
+
+    int expected = cotp_drift_tracker_expected (dt, 1);
+    cr_expect_eq (expected, 0, "unknown key ids have no drift");
+
+    cr_expect_eq (cotp_drift_tracker_record (dt, 1, 4), NO_ERROR);
+    expected = cotp_drift_tracker_expected (dt, 1);
+    cr_expect_eq (expected, 4, "the first offset is taken as is");
+
+    // One stray offset only moves the estimate a quarter of the way
+    cr_expect_eq (cotp_drift_tracker_record (dt, 1, 0), NO_ERROR);
+    expected = cotp_drift_tracker_expected (dt, 1);
+    cr_expect_eq (expected, 3);
+    for (int i = 0; i < 16; i++) {
+        cr_expect_eq (cotp_drift_tracker_record (dt, 1, -2), NO_ERROR);
+    }
+    expected = cotp_drift_tracker_expected (dt, 1);
+    cr_expect_eq (expected, -2);
+
+    expected = cotp_drift_tracker_expected (dt, 2);
+    cr_expect_eq (expected, 0, "key ids are tracked separately");
+    cotp_drift_tracker_forget (dt, 1);
+    expected = cotp_drift_tracker_expected (dt, 1);
+    cr_expect_eq (expected, 0);
+
+    cr_expect_eq (cotp_drift_tracker_record (dt, 1, 1025), INVALID_USER_INPUT);
+    cr_expect_eq (cotp_drift_tracker_record (NULL, 1, 0), INVALID_USER_INPUT);
+    cotp_drift_tracker_forget (NULL, 1);
+    cotp_drift_tracker_free (dt);
+
+    cr_expect_null (cotp_drift_tracker_create (0, &err));
+    cr_expect_eq (err, INVALID_USER_INPUT);
+}
+
+
+Test(drift_tracker, forget_keeps_other_keys) {
+    cotp_error_t err;
+    // Small enough that probe chains form, so deletion has to shift entries back
+    cotp_drift_tracker *dt = cotp_drift_tracker_create (64, &err);
+    cr_assert_not_null (dt);
+    for (uint64_t id = 0; id < 200; id++) {
+        cr_assert_eq (cotp_drift_tracker_record (dt, id, (int)(id % 7) - 3), NO_ERROR, "id %lu", (unsigned long)id);
+    }
+    for (uint64_t id = 0; id < 200; id += 2) {
+        cotp_drift_tracker_forget (dt, id);
+    }
+    for (uint64_t id = 0; id < 200; id++) {
+        int expected = cotp_drift_tracker_expected (dt, id);
+        cr_expect_eq (expected, id % 2 ? (int)(id % 7) - 3 : 0, "id %lu", (unsigned long)id);
+    }
+    cotp_drift_tracker_free (dt);
+}
+
+
+Test(drift_tracker, validate_follows_drift) {
+    cotp_error_t err;
+    cotp_drift_tracker *dt = cotp_drift_tracker_create (100, &err);
+    cr_assert_not_null (dt);
+    const long now = 1700000000;
+
+    // The device runs five periods ahead: the first login needs the wide window, then the narrow one is enough
+    for (int i = 0; i < 4; i++) {
+        char *code = get_totp_at (secret, now + 30L * i + 150, 6, 30, COTP_SHA1, &err);
+        int delta = -999;
+        int ok = validate_totp_with_drift (dt, 7, code, secret, now + 30L * i, 6, 30, COTP_SHA1, 1, 10, &delta, &err);
+        cr_expect_eq (ok, 1, "login %d", i);
+        cr_expect_eq (err, VALID);
+        cr_expect_eq (delta, 5);
+        free (code);
+    }
+    int expected = cotp_drift_tracker_expected (dt, 7);
+    cr_expect_eq (expected, 5);
+
+    // Every offset of the wide window is still accepted, nothing outside it is
+    for (int d = -12; d <= 12; d++) {
+        char *code = get_totp_at (secret, now + 30L * d, 6, 30, COTP_SHA1, &err);
+        int delta = -999;
+        int want_delta = -999;
+        cotp_error_t want_err;
+        int ok = validate_totp_with_drift (dt, 8, code, secret, now, 6, 30, COTP_SHA1, 1, 10, &delta, &err);
+        int want = validate_totp_in_window (code, secret, now, 6, 30, COTP_SHA1, 10, &want_delta, &want_err);
+        cr_expect_eq (ok, want, "offset %d", d);
+        cr_expect_eq (err, want_err, "offset %d", d);
+        cr_expect_eq (delta, want_delta, "offset %d", d);
+        free (code);
+    }
+
+    int delta;
+    cr_expect_eq (validate_totp_with_drift (dt, 7, "000000", secret, now, 6, 30, COTP_SHA1, 1, 10, &delta, &err), 0);
+    cr_expect_eq (err, NO_ERROR);
+    expected = cotp_drift_tracker_expected (dt, 7);
+    cr_expect_eq (expected, 5, "a miss leaves the estimate alone");
+
+    cotp_drift_tracker_free (dt);
+}
+
+
+Test(drift_tracker, narrow_window_wider_than_wide_one) {
+    cotp_error_t err;
+    cotp_drift_tracker *dt = cotp_drift_tracker_create (10, &err);
+    cr_assert_not_null (dt);
+    const long now = 1700000000;
+
+    // A narrow window larger than the wide one is cut down to it: offsets up to 2 match, 3 does not
+    for (int d = -3; d <= 3; d++) {
+        char *code = get_totp_at (secret, now + 30L * d, 6, 30, COTP_SHA1, &err);
+        int delta = -999;
+        int ok = validate_totp_with_drift (dt, 1, code, secret, now, 6, 30, COTP_SHA1, 1024, 2, &delta, &err);
+        cr_expect_eq (ok, d >= -2 && d <= 2, "offset %d", d);
+        cr_expect_eq (err, ok ? VALID : NO_ERROR, "offset %d", d);
+        if (ok) {
+            cr_expect_eq (delta, d);
+        }
+        free (code);
+    }
+    int delta;
+    cr_expect_eq (validate_totp_with_drift (dt, 1, "123456", secret, now, 6, 30, COTP_SHA1, 1024, 2, &delta, &err), 0);
+    cr_expect_eq (err, NO_ERROR);
+
+    cotp_drift_tracker_free (dt);
+}
+
+
+Test(drift_tracker, validate_rejects_bad_input) {
+    cotp_error_t err;
+    cotp_drift_tracker *dt = cotp_drift_tracker_create (10, &err);
+    cr_assert_not_null (dt);
+    int delta;
+
+    cr_expect_eq (validate_totp_with_drift (NULL, 1, "123456", secret, 1700000000, 6, 30, COTP_SHA1, 1, 10, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (validate_totp_with_drift (dt, 1, "123456", secret, 1700000000, 6, 30, COTP_SHA1, -1, 10, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (validate_totp_with_drift (dt, 1, "123456", secret, 1700000000, 6, 30, COTP_SHA1, 1, 1025, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (validate_totp_with_drift (dt, 1, "123456", secret, 1700000000, 6, 30, COTP_SHA1, 1025, 2, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (validate_totp_with_drift (dt, 1, "123456", secret, 1700000000, 6, 30, COTP_SHA1, INT_MAX, 2, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (validate_totp_with_drift (dt, 1, "123456", secret, 1700000000, 3, 30, COTP_SHA1, 1, 10, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_DIGITS);
+    cr_expect_eq (validate_totp_with_drift (dt, 1, "123456", secret, 60, 6, 30, COTP_SHA1, 1, 10, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_COUNTER);
+    cr_expect_eq (validate_totp_with_drift (dt, 1, "123456", "not base32!", 1700000000, 6, 30, COTP_SHA1, 1, 10, &delta, &err), 0);
+    cr_expect_neq (err, NO_ERROR);
+
+    cotp_drift_tracker_free (dt);
+}
+
+#endif
@@ -0,0 +1,111 @@
+#include <criterion/criterion.h>
+#include <string.h>
+#include "../src/cotp.h"
+
+Test(key, hotp_rfc4226_vectors) {
+    const char *K = "12345678901234567890";
+    const char *expected_hotp[] = {"755224", "287082", "359152", "969429", "338314", "254676", "287922", "162583", "399871", "520489"};
+
+    cotp_error_t cotp_err;
+    char *K_base32 = base32_encode ((const uint8_t *)K, strlen(K)+1, &cotp_err);
+
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (K_base32, COTP_SHA1, &err);
+    cr_assert_not_null (key);
+    cr_expect_eq (err, NO_ERROR);
+
+    // The same key is reused for every counter
+    char code[MAX_DIGITS + 1];
+    for (int i = 0; i < 10; i++) {
+        cr_expect_eq (cotp_key_hotp (key, i, 6, code, sizeof code), NO_ERROR);
+        cr_expect_str_eq (code, expected_hotp[i], "Expected %s to be equal to %s\n", code, expected_hotp[i]);
+    }
+
+    cotp_key_free (key);
+    free (K_base32);
+}
+
+
+Test(key, totp_matches_get_totp_at) {
+    const char *secrets[] = {"12345678901234567890", "12345678901234567890123456789012", "1234567890123456789012345678901234567890123456789012345678901234"};
+    const int algos[] = {COTP_SHA1, COTP_SHA256, COTP_SHA512};
+    const long timestamps[] = {59, 1111111109, 1234567890, 20000000000};
+
+    for (int a = 0; a < 3; a++) {
+        cotp_error_t err;
+        char *K_base32 = base32_encode ((const uint8_t *)secrets[a], strlen(secrets[a])+1, &err);
+        cotp_key *key = cotp_key_create (K_base32, algos[a], &err);
+        cr_assert_not_null (key);
+
+        for (int i = 0; i < 4; i++) {
+            char code[MAX_DIGITS + 1];
+            cr_expect_eq (cotp_key_totp_at (key, timestamps[i], 8, 30, code, sizeof code), NO_ERROR);
+            char *expected = get_totp_at (K_base32, timestamps[i], 8, 30, algos[a], &err);
+            cr_expect_str_eq (code, expected);
+            free (expected);
+        }
+
+        cotp_key_free (key);
+        free (K_base32);
+    }
+}
+
+
+Test(key, steam_matches_get_steam_totp_at) {
+    const char *secret = "ON2XAZLSMR2XAZLSONSWG4TFOQ======";
+    const long timestamps[] = {0, 59, 3000030, 1700000000, 20000000000};
+
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (secret, COTP_SHA1, &err);
+    cr_assert_not_null (key);
+
+    char code[COTP_STEAM_DIGITS + 1];
+    cr_expect_eq (cotp_key_steam_totp_at (key, 3000030, 30, code, sizeof code), NO_ERROR);
+    cr_expect_str_eq (code, "YRGQJ");
+    for (int i = 0; i < 5; i++) {
+        cr_expect_eq (cotp_key_steam_totp_at (key, timestamps[i], 30, code, sizeof code), NO_ERROR);
+        char *expected = get_steam_totp_at (secret, timestamps[i], 30, &err);
+        cr_expect_str_eq (code, expected);
+        free (expected);
+    }
+    cr_expect_eq (cotp_key_steam_totp (key, 30, code, sizeof code), NO_ERROR);
+    cr_expect_eq (strlen (code), COTP_STEAM_DIGITS);
+
+    cr_expect_eq (cotp_key_steam_totp_at (key, 59, 30, code, COTP_STEAM_DIGITS), INVALID_USER_INPUT);
+    cr_expect_eq (cotp_key_steam_totp_at (key, 59, 0, code, sizeof code), INVALID_PERIOD);
+    cr_expect_eq (cotp_key_steam_totp_at (key, -30, 30, code, sizeof code), INVALID_COUNTER);
+    cotp_key_free (key);
+
+    // Steam is defined over HMAC-SHA1 only
+    key = cotp_key_create (secret, COTP_SHA256, &err);
+    cr_assert_not_null (key);
+    cr_expect_eq (cotp_key_steam_totp_at (key, 59, 30, code, sizeof code), INVALID_ALGO);
+    cotp_key_free (key);
+}
+
+
+Test(key, invalid_arguments) {
+    cotp_error_t err = NO_ERROR;
+    cr_expect_null (cotp_key_create (NULL, COTP_SHA1, &err));
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_null (cotp_key_create ("JBSWY3DPEHPK3PXP", 7, &err));
+    cr_expect_eq (err, INVALID_ALGO);
+    cr_expect_null (cotp_key_create ("JBSW!3DP", COTP_SHA1, &err));
+    cr_expect_eq (err, INVALID_B32_INPUT);
+    cr_expect_null (cotp_key_create ("", COTP_SHA1, &err));
+    cr_expect_eq (err, EMPTY_STRING);
+
+    cotp_key *key = cotp_key_create ("JBSWY3DPEHPK3PXP", COTP_SHA1, &err);
+    cr_assert_not_null (key);
+
+    char small[4];
+    char code[MAX_DIGITS + 1];
+    cr_expect_eq (cotp_key_hotp (key, 1, 6, small, sizeof small), INVALID_USER_INPUT);
+    cr_expect_eq (cotp_key_hotp (key, 1, 3, code, sizeof code), INVALID_DIGITS);
+    cr_expect_eq (cotp_key_hotp (key, -1, 6, code, sizeof code), INVALID_COUNTER);
+    cr_expect_eq (cotp_key_totp_at (key, 59, 6, 0, code, sizeof code), INVALID_PERIOD);
+    cr_expect_eq (cotp_key_hotp (NULL, 1, 6, code, sizeof code), INVALID_USER_INPUT);
+
+    cotp_key_free (key);
+    cotp_key_free (NULL);
+}
@@ -0,0 +1,291 @@
+#include <criterion/criterion.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../src/cotp.h"
+
+static const char *S1 = "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ";
+static const char *S2 = "HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ";
+
+static void
+expect_code (const cotp_keystore *ks, uint64_t id, const char *secret, int algo)
+{
+    cotp_error_t err;
+    char code[MAX_DIGITS + 1];
+    char *want = get_totp_at (secret, 1700000000, 8, 30, algo, &err);
+    cr_assert_not_null (want);
+    cotp_error_t got = cotp_keystore_totp_at (ks, id, 1700000000, 8, 30, code, sizeof code);
+    cr_expect_eq (got, NO_ERROR, "id %lu", (unsigned long)id);
+    cr_expect_str_eq (code, want, "id %lu", (unsigned long)id);
+    free (want);
+}
+
+
+Test(keystore, put_replace_remove) {
+    cotp_error_t err;
+    cotp_keystore *ks = cotp_keystore_create (NULL, 100, &err);
+    cr_assert_not_null (ks, "%d", err);
+    cr_expect_geq (cotp_keystore_fd (ks), 0);
+
+    for (uint64_t id = 0; id < 100; id++) {
+        cr_assert_eq (cotp_keystore_put (ks, id, id % 2 ? S1 : S2, (int)(id % 3)), NO_ERROR, "id %lu", (unsigned long)id);
+    }
+    size_t count = cotp_keystore_count (ks);
+    cr_expect_eq (count, 100);
+    uint64_t gen = cotp_keystore_generation (ks);
+    cr_expect_eq (gen, 100);
+    for (uint64_t id = 0; id < 100; id++) {
+        expect_code (ks, id, id % 2 ? S1 : S2, (int)(id % 3));
+    }
+
+    // Replacing keeps the count, removing leaves the other keys reachable
+    cr_expect_eq (cotp_keystore_put (ks, 7, S2, COTP_SHA512), NO_ERROR);
+    expect_code (ks, 7, S2, COTP_SHA512);
+    for (uint64_t id = 0; id < 100; id += 3) {
+        cr_expect_eq (cotp_keystore_remove (ks, id), NO_ERROR);
+    }
+    count = cotp_keystore_count (ks);
+    cr_expect_eq (count, 66);
+    for (uint64_t id = 1; id < 100; id++) {
+        if (id % 3 != 0 && id != 7) {
+            expect_code (ks, id, id % 2 ? S1 : S2, (int)(id % 3));
+        }
+    }
+    char code[MAX_DIGITS + 1];
+    cr_expect_eq (cotp_keystore_totp_at (ks, 3, 1700000000, 8, 30, code, sizeof code), INVALID_USER_INPUT);
+    cr_expect_eq (cotp_keystore_remove (ks, 3), INVALID_USER_INPUT);
+
+    // Tombstones are reused, so removing and adding back never fills the store
+    for (int round = 0; round < 10; round++) {
+        for (uint64_t id = 1000; id < 1030; id++) {
+            cr_assert_eq (cotp_keystore_put (ks, id, S1, COTP_SHA1), NO_ERROR);
+        }
+        for (uint64_t id = 1000; id < 1030; id++) {
+            cr_assert_eq (cotp_keystore_remove (ks, id), NO_ERROR);
+        }
+    }
+
+    // A 129-byte secret does not fit a slot
+    char long_secret[240];
+    memset (long_secret, 'A', 232);
+    long_secret[232] = '\0';
+    cr_expect_eq (cotp_keystore_put (ks, 1, long_secret, COTP_SHA1), INVALID_USER_INPUT);
+    cr_expect_eq (cotp_keystore_put (ks, 1, S1, 7), INVALID_ALGO);
+    cr_expect_eq (cotp_keystore_put (ks, 1, "JBSW!3DP", COTP_SHA1), INVALID_B32_INPUT);
+    expect_code (ks, 1, S1, COTP_SHA256);
+
+    cotp_keystore_close (ks);
+    cotp_keystore_close (NULL);
+    cr_expect_null (cotp_keystore_create (NULL, 0, &err));
+    cr_expect_eq (err, INVALID_USER_INPUT);
+}
+
+
+Test(keystore, full_store) {
+    cotp_error_t err;
+    cotp_keystore *ks = cotp_keystore_create (NULL, 12, &err);
+    cr_assert_not_null (ks);
+    uint64_t id = 0;
+    while (cotp_keystore_put (ks, id, S1, COTP_SHA1) == NO_ERROR) {
+        id++;
+    }
+    cr_expect_geq (id, 12);
+    cr_expect_eq (cotp_keystore_put (ks, id, S1, COTP_SHA1), MEMORY_ALLOCATION_ERROR);
+    // Existing keys can still be replaced
+    cr_expect_eq (cotp_keystore_put (ks, 0, S2, COTP_SHA1), NO_ERROR);
+    cotp_keystore_close (ks);
+}
+
+
+Test(keystore, enrollment_churn_never_fills_the_store) {
+    cotp_error_t err;
+    cotp_keystore *ks = cotp_keystore_create (NULL, 12, &err);
+    cr_assert_not_null (ks);
+    // Fresh ids every round, as a long-running writer enrolling and retiring accounts would use
+    for (uint64_t round = 0; round < 50; round++) {
+        for (uint64_t id = round * 8; id < round * 8 + 8; id++) {
+            cr_assert_eq (cotp_keystore_put (ks, id, S1, COTP_SHA1), NO_ERROR, "round %lu id %lu",
+                          (unsigned long)round, (unsigned long)id);
+        }
+        for (uint64_t id = round * 8; id < round * 8 + 8; id++) {
+            cr_assert_eq (cotp_keystore_remove (ks, id), NO_ERROR);
+        }
+    }
+    size_t count = cotp_keystore_count (ks);
+    cr_expect_eq (count, 0);
+    // The full capacity is still available
+    for (uint64_t id = 0; id < 12; id++) {
+        cr_expect_eq (cotp_keystore_put (ks, 1000 + id, S2, COTP_SHA1), NO_ERROR);
+    }
+    for (uint64_t id = 0; id < 12; id++) {
+        expect_code (ks, 1000 + id, S2, COTP_SHA1);
+    }
+    cotp_keystore_close (ks);
+}
+
+
+Test(keystore, readers_give_up_on_a_dead_writer) {
+    cotp_error_t err;
+    cotp_keystore *ks = cotp_keystore_create (NULL, 4, &err);
+    cr_assert_not_null (ks);
+    const uint64_t id = 0xc07dc07dc07dc07dULL;
+    cr_assert_eq (cotp_keystore_put (ks, id, S1, COTP_SHA1), NO_ERROR);
+
+    // Leave the slot the way a writer killed inside a put would: a slot's sequence counter sits
+    // 8 bytes before its key id, and an odd value marks an update in progress
+    int fd = cotp_keystore_fd (ks);
+    struct stat st;
+    cr_assert_eq (fstat (fd, &st), 0);
+    uint8_t *map = mmap (NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    cr_assert (map != MAP_FAILED);
+    uint32_t *seq = NULL;
+    for (size_t off = 8; off + 8 <= (size_t)st.st_size; off += 8) {
+        if (memcmp (map + off, &id, 8) == 0) {
+            seq = (uint32_t *)(map + off - 8);
+        }
+    }
+    cr_assert_not_null (seq);
+    (*seq)++;
+
+    char code[MAX_DIGITS + 1];
+    cr_expect_eq (cotp_keystore_totp_at (ks, id, 1700000000, 6, 30, code, sizeof code), WHMAC_ERROR);
+    cr_expect_null (cotp_keystore_get_key (ks, id, &err));
+    cr_expect_eq (err, WHMAC_ERROR);
+
+    munmap (map, (size_t)st.st_size);
+    cotp_keystore_close (ks);
+}
+
+
+Test(keystore, readers_in_other_processes) {
+    cotp_error_t err;
+    char name[64];
+    snprintf (name, sizeof name, "/cotp-test-%d", (int)getpid ());
+    cotp_keystore *ks = cotp_keystore_create (name, 16, &err);
+    cr_assert_not_null (ks, "%d", err);
+    cr_expect_null (cotp_keystore_create (name, 16, &err), "the name must not exist yet");
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_assert_eq (cotp_keystore_put (ks, 42, S1, COTP_SHA1), NO_ERROR);
+
+    int to_child[2], to_parent[2];
+    cr_assert (pipe (to_child) == 0 && pipe (to_parent) == 0);
+    pid_t pid = fork ();
+    if (pid == 0) {
+        // Read by name, then again after the parent replaced the secret
+        char a[MAX_DIGITS + 1] = "", b[MAX_DIGITS + 1] = "", go;
+        cotp_keystore *r = cotp_keystore_open (name, &err);
+        int ok = r != NULL && cotp_keystore_totp_at (r, 42, 1700000000, 6, 30, a, sizeof a) == NO_ERROR;
+        // Neither the read-only mapping nor the inherited writer handle may write
+        ok = ok && cotp_keystore_put (r, 43, S1, COTP_SHA1) == INVALID_USER_INPUT;
+        ok = ok && cotp_keystore_put (ks, 43, S1, COTP_SHA1) == INVALID_USER_INPUT;
+        ok = ok && write (to_parent[1], "r", 1) == 1 && read (to_child[0], &go, 1) == 1;
+        ok = ok && cotp_keystore_totp_at (r, 42, 1700000000, 6, 30, b, sizeof b) == NO_ERROR;
+        char line[64];
+        snprintf (line, sizeof line, "%d %s %s", ok, a, b);
+        ok = write (to_parent[1], line, strlen (line)) > 0;
+        cotp_keystore_close (r);
+        _exit (ok ? 0 : 1);
+    }
+    cr_assert_gt (pid, 0);
+
+    char c;
+    cr_assert_eq (read (to_parent[0], &c, 1), 1);
+    cr_assert_eq (cotp_keystore_put (ks, 42, S2, COTP_SHA1), NO_ERROR);
+    cr_assert_eq (write (to_child[1], "g", 1), 1);
+    char line[64] = "";
+    ssize_t n = read (to_parent[0], line, sizeof line - 1);
+    int status;
+    waitpid (pid, &status, 0);
+    cr_assert_gt (n, 0);
+    line[n] = '\0';
+
+    char *before = get_totp_at (S1, 1700000000, 6, 30, COTP_SHA1, &err);
+    char *after = get_totp_at (S2, 1700000000, 6, 30, COTP_SHA1, &err);
+    char want[64];
+    snprintf (want, sizeof want, "1 %s %s", before, after);
+    cr_expect_str_eq (line, want);
+    cr_expect (WIFEXITED (status) && WEXITSTATUS (status) == 0);
+    free (before);
+    free (after);
+
+    cotp_keystore_close (ks);
+    cr_expect_null (cotp_keystore_open (name, &err), "the writer unlinks the name on close");
+}
+
+
+typedef struct {
+    cotp_keystore *ks;
+    char           valid[2][MAX_DIGITS + 1];
+    int            bad;
+    int            reads;
+} reader_arg;
+
+static void *
+reader (void *p)
+{
+    reader_arg *a = p;
+    for (int i = 0; i < 20000; i++) {
+        char code[MAX_DIGITS + 1];
+        if (cotp_keystore_totp_at (a->ks, 5, 1700000000, 8, 30, code, sizeof code) != NO_ERROR ||
+            (strcmp (code, a->valid[0]) != 0 && strcmp (code, a->valid[1]) != 0)) {
+            a->bad++;
+        }
+        a->reads++;
+    }
+    return NULL;
+}
+
+
+Test(keystore, readers_never_see_a_torn_secret) {
+    cotp_error_t err;
+    cotp_keystore *ks = cotp_keystore_create (NULL, 16, &err);
+    cr_assert_not_null (ks);
+    cr_assert_eq (cotp_keystore_put (ks, 5, S1, COTP_SHA256), NO_ERROR);
+
+    // A second read-only mapping of the same segment, as another process would have
+    cotp_keystore *ro = cotp_keystore_open_fd (cotp_keystore_fd (ks), &err);
+    cr_assert_not_null (ro);
+    reader_arg a = { .ks = ro };
+    char *c1 = get_totp_at (S1, 1700000000, 8, 30, COTP_SHA256, &err);
+    char *c2 = get_totp_at (S2, 1700000000, 8, 30, COTP_SHA256, &err);
+    strcpy (a.valid[0], c1);
+    strcpy (a.valid[1], c2);
+    free (c1);
+    free (c2);
+
+    pthread_t t;
+    cr_assert_eq (pthread_create (&t, NULL, reader, &a), 0);
+    for (int i = 0; i < 20000; i++) {
+        cr_assert_eq (cotp_keystore_put (ks, 5, i % 2 ? S1 : S2, COTP_SHA256), NO_ERROR);
+    }
+    pthread_join (t, NULL);
+    cr_expect_eq (a.bad, 0, "%d of %d reads saw a mixed secret", a.bad, a.reads);
+
+    cotp_keystore_close (ro);
+    cotp_keystore_close (ks);
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+Test(keystore, validate) {
+    cotp_error_t err;
+    cotp_keystore *ks = cotp_keystore_create (NULL, 16, &err);
+    cr_assert_not_null (ks);
+    cr_assert_eq (cotp_keystore_put (ks, 9, S2, COTP_SHA512), NO_ERROR);
+    char *code = get_totp_at (S2, 1700000000 - 30, 6, 30, COTP_SHA512, &err);
+    int delta = -999;
+    cr_expect_eq (cotp_keystore_validate_totp (ks, 9, code, 1700000000, 6, 30, 1, &delta, &err), 1);
+    cr_expect_eq (err, VALID);
+    cr_expect_eq (delta, -1);
+    cr_expect_eq (cotp_keystore_validate_totp (ks, 9, code, 1700000000, 6, 30, 0, &delta, &err), 0);
+    cr_expect_eq (err, NO_ERROR);
+    cr_expect_eq (cotp_keystore_validate_totp (ks, 10, code, 1700000000, 6, 30, 1, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    free (code);
+    cotp_keystore_close (ks);
+}
+#endif
@@ -0,0 +1,180 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <string.h>
+#include "../src/cotp.h"
+
+#ifdef COTP_ENABLE_METRICS
+
+static const char *secret = "HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ";
+
+// Counters are process-wide and only grow, so every test works on the difference of two snapshots
+static uint64_t
+hmac_count (const cotp_metrics *m,
+            int                 algo)
+{
+    uint64_t n = 0;
+    for (int i = 0; i < COTP_METRICS_LATENCY_BUCKETS; i++) {
+        n += m->hmac_latency[algo][i];
+    }
+    return n;
+}
+
+
+Test(metrics, generation_and_errors) {
+    cotp_metrics before, after;
+    cotp_metrics_snapshot (&before);
+
+    cotp_error_t err;
+    for (int i = 0; i < 5; i++) {
+        free (get_totp_at (secret, 1700000000 + i * 30, 6, 30, COTP_SHA256, &err));
+    }
+    free (get_hotp (secret, 1, 6, COTP_SHA1, &err));
+    cr_expect_null (get_hotp (secret, 1, 3, COTP_SHA1, &err));
+    cr_expect_null (get_totp_at ("&&&", 0, 6, 30, COTP_SHA1, &err));
+
+    cotp_metrics_snapshot (&after);
+    cr_expect_eq (after.codes_generated[COTP_SHA256] - before.codes_generated[COTP_SHA256], 5);
+    cr_expect_eq (after.codes_generated[COTP_SHA1] - before.codes_generated[COTP_SHA1], 1);
+    cr_expect_eq (after.errors[INVALID_DIGITS] - before.errors[INVALID_DIGITS], 1);
+    cr_expect_eq (after.errors[INVALID_B32_INPUT] - before.errors[INVALID_B32_INPUT], 1);
+    cr_expect_eq (hmac_count (&after, COTP_SHA256) - hmac_count (&before, COTP_SHA256), 5);
+    cr_expect_geq (after.hmac_latency_sum_ns[COTP_SHA256], before.hmac_latency_sum_ns[COTP_SHA256]);
+}
+
+
+Test(metrics, pre_keyed_and_batch) {
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (secret, COTP_SHA512, &err);
+    cr_assert_not_null (key);
+
+    cotp_otp_job jobs[3] = {
+        { .type = COTP_JOB_HOTP, .key = key, .counter = 1, .digits = 6 },
+        { .type = COTP_JOB_TOTP, .base32_encoded_secret = secret, .counter = 59, .digits = 8, .period = 30, .sha_algo = COTP_SHA1 },
+        { .type = COTP_JOB_TOTP, .base32_encoded_secret = secret, .counter = 59, .digits = 8, .period = 0, .sha_algo = COTP_SHA1 },
+    };
+
+    cotp_metrics before, after;
+    cotp_metrics_snapshot (&before);
+    char code[MAX_DIGITS + 1];
+    cr_expect_eq (cotp_key_totp_at (key, 1700000000, 6, 30, code, sizeof (code)), NO_ERROR);
+    cr_expect_eq (cotp_key_totp_at (key, 1700000000, 6, 0, code, sizeof (code)), INVALID_PERIOD);
+    cr_expect_eq (cotp_otp_batch (jobs, 3, NULL), NO_ERROR);
+    cotp_metrics_snapshot (&after);
+
+    cr_expect_eq (after.codes_generated[COTP_SHA512] - before.codes_generated[COTP_SHA512], 2);
+    cr_expect_eq (after.codes_generated[COTP_SHA1] - before.codes_generated[COTP_SHA1], 1);
+    cr_expect_eq (after.errors[INVALID_PERIOD] - before.errors[INVALID_PERIOD], 2);
+
+    cotp_key_free (key);
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+Test(metrics, validation_offsets) {
+    cotp_error_t err;
+    char *prev = get_totp_at (secret, 1700000000 - 30, 6, 30, COTP_SHA1, &err);
+    char *hotp = get_hotp (secret, 13, 6, COTP_SHA1, &err);
+    cr_assert_not_null (prev);
+    cr_assert_not_null (hotp);
+
+    cotp_metrics before, after;
+    cotp_metrics_snapshot (&before);
+    int delta;
+    long matched;
+    cr_expect_eq (validate_totp_in_window (prev, secret, 1700000000, 6, 30, COTP_SHA1, 2, &delta, &err), 1);
+    cr_expect_eq (validate_totp_in_window ("000000", secret, 1700000000, 6, 30, COTP_SHA1, 2, &delta, &err), 0);
+    cr_expect_eq (validate_hotp_in_window (hotp, secret, 10, 6, COTP_SHA1, 5, &matched, &err), 1);
+    cr_expect_eq (validate_totp_in_window (prev, secret, 1700000000, 6, 30, COTP_SHA1, 5000, &delta, &err), 0);
+    cotp_metrics_snapshot (&after);
+
+    cr_expect_eq (after.validations - before.validations, 4);
+    cr_expect_eq (after.validations_matched - before.validations_matched, 2);
+    cr_expect_eq (after.matched_delta[COTP_METRICS_DELTA_RANGE - 1] - before.matched_delta[COTP_METRICS_DELTA_RANGE - 1], 1);
+    cr_expect_eq (after.matched_delta[COTP_METRICS_DELTA_RANGE + 3] - before.matched_delta[COTP_METRICS_DELTA_RANGE + 3], 1);
+    cr_expect_eq (after.errors[INVALID_USER_INPUT] - before.errors[INVALID_USER_INPUT], 1);
+    // window steps are not reported as generated codes
+    for (int a = 0; a < COTP_METRICS_ALGOS; a++) {
+        cr_expect_eq (after.codes_generated[a], before.codes_generated[a]);
+    }
+
+    free (prev);
+    free (hotp);
+}
+#endif
+
+
+static void *
+worker (void *arg)
+{
+    cotp_key *key = arg;
+    char code[MAX_DIGITS + 1];
+    for (int i = 0; i < 1000; i++) {
+        if (cotp_key_hotp (key, i, 6, code, sizeof (code)) != NO_ERROR) {
+            return arg;
+        }
+    }
+    return NULL;
+}
+
+
+Test(metrics, concurrent_updates_are_not_lost) {
+    cotp_error_t err;
+    cotp_key *keys[4];
+    pthread_t t[4];
+
+    cotp_metrics before, after;
+    cotp_metrics_snapshot (&before);
+    for (int i = 0; i < 4; i++) {
+        keys[i] = cotp_key_create (secret, COTP_SHA1, &err);
+        cr_assert_not_null (keys[i]);
+        cr_assert_eq (pthread_create (&t[i], NULL, worker, keys[i]), 0);
+    }
+    for (int i = 0; i < 4; i++) {
+        void *ret;
+        pthread_join (t[i], &ret);
+        cr_expect_null (ret);
+        cotp_key_free (keys[i]);
+    }
+    cotp_metrics_snapshot (&after);
+
+    cr_expect_eq (after.codes_generated[COTP_SHA1] - before.codes_generated[COTP_SHA1], 4000);
+    cr_expect_eq (hmac_count (&after, COTP_SHA1) - hmac_count (&before, COTP_SHA1), 4000);
+}
+
+
+Test(metrics, prometheus_text) {
+    cotp_error_t err;
+    free (get_hotp (secret, 1, 6, COTP_SHA1, &err));
+
+    cotp_metrics m;
+    cotp_metrics_snapshot (&m);
+    char *text = cotp_metrics_format_prometheus (&m, &err);
+    cr_assert_not_null (text);
+    cr_expect_eq (err, NO_ERROR);
+
+    cr_expect_not_null (strstr (text, "# TYPE cotp_codes_generated_total counter\n"));
+    cr_expect_not_null (strstr (text, "cotp_codes_generated_total{algo=\"SHA1\"} "));
+    cr_expect_not_null (strstr (text, "cotp_errors_total{error=\"REPLAY_DETECTED\"} "));
+    cr_expect_null (strstr (text, "error=\"VALID\""));
+    cr_expect_not_null (strstr (text, "cotp_validation_matched_delta_total{delta=\"-8\"} "));
+    cr_expect_not_null (strstr (text, "cotp_hmac_duration_seconds_bucket{algo=\"SHA512\",le=\"6.4e-08\"} "));
+    cr_expect_not_null (strstr (text, "cotp_hmac_duration_seconds_bucket{algo=\"SHA1\",le=\"+Inf\"} "));
+
+    // The +Inf bucket equals _count
+    char expect[128];
+    uint64_t count = 0;
+    for (int i = 0; i < COTP_METRICS_LATENCY_BUCKETS; i++) {
+        count += m.hmac_latency[COTP_SHA1][i];
+    }
+    snprintf (expect, sizeof (expect), "cotp_hmac_duration_seconds_count{algo=\"SHA1\"} %llu\n", (unsigned long long)count);
+    cr_expect_not_null (strstr (text, expect));
+    cr_expect_gt (count, 0);
+
+    free (text);
+    cr_expect_null (cotp_metrics_format_prometheus (NULL, &err));
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (cotp_metrics_latency_bound_ns (0), 64);
+    cr_expect_eq (cotp_metrics_latency_bound_ns (COTP_METRICS_LATENCY_BUCKETS - 1), UINT64_MAX);
+}
+
+#endif // COTP_ENABLE_METRICS
@@ -702,3 +702,26 @@ Test(totp_boundary, test_10_digits_no_sign_artefact) {
     }
     free (K_base32);
 }
+
+
+// Every code length is the low-order suffix of the 10-digit code, which holds the whole 31-bit value
+Test(totp_boundary, test_shorter_codes_are_suffixes) {
+    const char *K = "12345678901234567890";
+
+    cotp_error_t cotp_err;
+    char *K_base32 = base32_encode ((const uint8_t *)K, strlen(K)+1, &cotp_err);
+
+    for (long counter = 0; counter < 200; counter++) {
+        cotp_error_t err = NO_ERROR;
+        char *full = get_hotp (K_base32, counter, MAX_DIGITS, COTP_SHA1, &err);
+        cr_assert_not_null (full);
+        for (int digits = MIN_DIGITS; digits < MAX_DIGITS; digits++) {
+            char *code = get_hotp (K_base32, counter, digits, COTP_SHA1, &err);
+            cr_assert_not_null (code);
+            cr_expect_str_eq (code, full + (MAX_DIGITS - digits), "counter=%ld digits=%d: %s vs %s\n", counter, digits, code, full);
+            free (code);
+        }
+        free (full);
+    }
+    free (K_base32);
+}
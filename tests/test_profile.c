@@ -0,0 +1,93 @@
+#include <criterion/criterion.h>
+#include <pthread.h>
+#include <string.h>
+#include "../src/cotp.h"
+
+#ifdef COTP_ENABLE_PROFILING
+
+static const char *secret = "HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ";
+
+
+Test(profile, one_shot_codes_cover_every_stage) {
+    cotp_stage_stats st;
+    cotp_stage_stats_reset ();
+    cotp_stage_stats_snapshot (&st);
+    for (int i = 0; i < COTP_STAGE_COUNT; i++) {
+        cr_expect_eq (st.calls[i], 0);
+        cr_expect_eq (st.ticks[i], 0);
+    }
+
+    cotp_error_t err;
+    for (int i = 0; i < 10; i++) {
+        char *code = get_totp_at (secret, 1700000000 + i * 30, 6, 30, COTP_SHA1, &err);
+        cr_assert_not_null (code);
+        free (code);
+    }
+
+    cotp_stage_stats_snapshot (&st);
+    for (int i = 0; i < COTP_STAGE_COUNT; i++) {
+        cr_expect_eq (st.calls[i], 10, "%s: %llu calls\n", cotp_stage_name (i), (unsigned long long)st.calls[i]);
+    }
+    cr_expect_gt (st.ticks[COTP_STAGE_HMAC_FINALIZE], 0);
+
+    cotp_stage_stats_reset ();
+    cotp_stage_stats_snapshot (&st);
+    cr_expect_eq (st.calls[COTP_STAGE_BASE32_DECODE], 0);
+}
+
+
+Test(profile, pre_keyed_path_skips_decoding) {
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (secret, COTP_SHA256, &err);
+    cr_assert_not_null (key);
+
+    cotp_stage_stats st;
+    cotp_stage_stats_reset ();
+    char out[MAX_DIGITS + 1];
+    for (int i = 0; i < 5; i++) {
+        cr_assert_eq (cotp_key_hotp (key, i, 8, out, sizeof (out)), NO_ERROR);
+    }
+    cotp_stage_stats_snapshot (&st);
+    cr_expect_eq (st.calls[COTP_STAGE_BASE32_DECODE], 0);
+    cr_expect_eq (st.calls[COTP_STAGE_HMAC_SETKEY], 0);
+    cr_expect_eq (st.calls[COTP_STAGE_HMAC_FINALIZE], 5);
+    cr_expect_eq (st.calls[COTP_STAGE_FORMAT], 5);
+
+    cotp_key_free (key);
+}
+
+
+static void *
+worker (void *arg)
+{
+    (void)arg;
+    cotp_error_t err;
+    for (int i = 0; i < 7; i++) {
+        free (get_hotp (secret, i, 6, COTP_SHA1, &err));
+    }
+    return NULL;
+}
+
+
+Test(profile, exited_threads_are_kept) {
+    cotp_stage_stats_reset ();
+    pthread_t t[3];
+    for (int i = 0; i < 3; i++) {
+        cr_assert_eq (pthread_create (&t[i], NULL, worker, NULL), 0);
+    }
+    for (int i = 0; i < 3; i++) {
+        pthread_join (t[i], NULL);
+    }
+    cotp_stage_stats st;
+    cotp_stage_stats_snapshot (&st);
+    cr_expect_eq (st.calls[COTP_STAGE_NORMALIZE_SECRET], 21);
+}
+
+
+Test(profile, names_and_rate) {
+    cr_expect_str_eq (cotp_stage_name (COTP_STAGE_BASE32_DECODE), "base32_decode");
+    cr_expect_null (cotp_stage_name (COTP_STAGE_COUNT));
+    cr_expect_gt (cotp_stage_tick_rate (), 0);
+}
+
+#endif // COTP_ENABLE_PROFILING
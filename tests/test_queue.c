@@ -0,0 +1,221 @@
+#include <criterion/criterion.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include "../src/cotp.h"
+
+#define N_REQ 1000
+
+static const char *K_SHA1 = "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQAA";
+
+static cotp_async_request
+generate_request (cotp_key *key,
+                  long      timestamp,
+                  uint64_t  user_data)
+{
+    cotp_async_request r;
+    memset (&r, 0, sizeof r);
+    r.op = COTP_ASYNC_GENERATE;
+    r.user_data = user_data;
+    r.job.type = COTP_JOB_TOTP;
+    r.job.key = key;
+    r.job.base32_encoded_secret = key ? NULL : K_SHA1;
+    r.job.counter = timestamp;
+    r.job.digits = 8;
+    r.job.period = 30;
+    r.job.sha_algo = COTP_SHA1;
+    return r;
+}
+
+
+// Submits everything, respecting backpressure, and collects all completions indexed by user_data
+static void
+run_all (cotp_queue                  *q,
+         const cotp_async_request    *reqs,
+         size_t                       n,
+         cotp_async_completion       *by_id)
+{
+    size_t sent = 0, got = 0;
+    cotp_async_completion buf[64];
+    while (got < n) {
+        if (sent < n) {
+            cotp_error_t err;
+            sent += cotp_queue_submit (q, reqs + sent, n - sent, &err);
+            cr_expect_eq (err, NO_ERROR);
+        }
+        size_t k = cotp_queue_wait (q, buf, 64, 1000);
+        for (size_t i = 0; i < k; i++) {
+            by_id[buf[i].user_data] = buf[i];
+        }
+        got += k;
+    }
+}
+
+
+Test(queue, generate_matches_get_totp_at) {
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (K_SHA1, COTP_SHA1, &err);
+    cr_assert_not_null (key);
+    // Small capacity so submission hits backpressure
+    cotp_queue *q = cotp_queue_create (4, 64, &err);
+    cr_assert_not_null (q);
+
+    static cotp_async_request reqs[N_REQ];
+    static cotp_async_completion done[N_REQ];
+    for (size_t i = 0; i < N_REQ; i++) {
+        // Mix pre-keyed and string-secret requests so groups get reordered
+        reqs[i] = generate_request (i % 3 ? key : NULL, 1111111109 + (long)i * 30, i);
+    }
+    run_all (q, reqs, N_REQ, done);
+
+    for (size_t i = 0; i < N_REQ; i++) {
+        char *expected = get_totp_at (K_SHA1, 1111111109 + (long)i * 30, 8, 30, COTP_SHA1, &err);
+        cr_expect_eq (done[i].user_data, i);
+        cr_expect_eq (done[i].op, COTP_ASYNC_GENERATE);
+        cr_expect_eq (done[i].err, NO_ERROR);
+        cr_expect_str_eq (done[i].code, expected, "request %zu\n", i);
+        free (expected);
+    }
+    cr_expect_eq (cotp_queue_poll (q, done, 1), 0);
+
+    cotp_queue_free (q);
+    cotp_key_free (key);
+}
+
+
+Test(queue, keys_freed_between_submissions) {
+    static const char *secrets[] = { "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQAA", "HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ" };
+    cotp_error_t err;
+    cotp_queue *q = cotp_queue_create (1, 16, &err);
+    cr_assert_not_null (q);
+
+    // The allocator hands the freed key's address to the next one, which must still be keyed afresh
+    for (int i = 0; i < 200; i++) {
+        cotp_key *key = cotp_key_create (secrets[i % 2], COTP_SHA1, &err);
+        cr_assert_not_null (key);
+        cotp_async_request r = generate_request (key, 1700000000, (uint64_t)i);
+        cr_assert_eq (cotp_queue_submit (q, &r, 1, &err), 1);
+        cotp_async_completion c;
+        cr_assert_eq (cotp_queue_wait (q, &c, 1, 1000), 1);
+        cotp_key_free (key);
+
+        char *expected = get_totp_at (secrets[i % 2], 1700000000, 8, 30, COTP_SHA1, &err);
+        cr_expect_eq (c.err, NO_ERROR);
+        cr_expect_str_eq (c.code, expected, "request %d\n", i);
+        free (expected);
+    }
+
+    cotp_queue_free (q);
+}
+
+
+Test(queue, errors_are_per_request) {
+    cotp_error_t err;
+    cotp_queue *q = cotp_queue_create (2, 16, &err);
+    cr_assert_not_null (q);
+
+    cotp_async_request reqs[3];
+    reqs[0] = generate_request (NULL, 59, 0);
+    reqs[1] = generate_request (NULL, 59, 1);
+    reqs[1].job.digits = 3;
+    reqs[2] = generate_request (NULL, 59, 2);
+    reqs[2].job.base32_encoded_secret = "not base32!";
+
+    cotp_async_completion done[3];
+    run_all (q, reqs, 3, done);
+    cr_expect_eq (done[0].err, NO_ERROR);
+    cr_expect_str_eq (done[0].code, "94287082");
+    cr_expect_eq (done[1].err, INVALID_DIGITS);
+    cr_expect_str_eq (done[1].code, "");
+    cr_expect_eq (done[2].err, INVALID_B32_INPUT);
+
+    cr_expect_eq (cotp_queue_submit (NULL, reqs, 1, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_null (cotp_queue_create (1, 0, &err));
+    cr_expect_eq (err, INVALID_USER_INPUT);
+
+    cotp_queue_free (q);
+}
+
+
+Test(queue, eventfd_signals_completions) {
+    cotp_error_t err;
+    cotp_queue *q = cotp_queue_create (1, 8, &err);
+    cr_assert_not_null (q);
+    int fd = cotp_queue_eventfd (q);
+#ifdef __linux__
+    cr_assert_geq (fd, 0);
+#else
+    cr_assert_eq (fd, -1);
+    cotp_queue_free (q);
+    return;
+#endif
+
+    cotp_async_request r = generate_request (NULL, 59, 7);
+    cr_assert_eq (cotp_queue_submit (q, &r, 1, &err), 1);
+
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    cr_assert_eq (poll (&pfd, 1, 5000), 1);
+    uint64_t count;
+    cr_expect_eq (read (fd, &count, sizeof count), (ssize_t)sizeof count);
+
+    cotp_async_completion c;
+    cr_assert_eq (cotp_queue_poll (q, &c, 1), 1);
+    cr_expect_eq (c.user_data, 7);
+    cr_expect_str_eq (c.code, "94287082");
+
+    // Drained and reset: nothing pending, fd not readable
+    cr_expect_eq (poll (&pfd, 1, 0), 0);
+    cotp_queue_free (q);
+}
+
+
+Test(queue, free_discards_pending_work) {
+    cotp_error_t err;
+    cotp_queue *q = cotp_queue_create (1, 256, &err);
+    cr_assert_not_null (q);
+    static cotp_async_request reqs[256];
+    for (size_t i = 0; i < 256; i++) {
+        reqs[i] = generate_request (NULL, 59, i);
+    }
+    cr_expect_eq (cotp_queue_submit (q, reqs, 256, &err), 256);
+    cr_expect_eq (cotp_queue_submit (q, reqs, 1, &err), 0, "queue is at capacity");
+    cotp_queue_free (q);
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+Test(queue, validate_totp) {
+    cotp_error_t err;
+    cotp_key *key = cotp_key_create (K_SHA1, COTP_SHA1, &err);
+    cr_assert_not_null (key);
+    cotp_queue *q = cotp_queue_create (2, 32, &err);
+    cr_assert_not_null (q);
+
+    const long ts = 1111111109;
+    char *next = get_totp_at (K_SHA1, ts + 30, 8, 30, COTP_SHA1, &err);
+
+    cotp_async_request reqs[4];
+    for (int i = 0; i < 4; i++) {
+        reqs[i] = generate_request (i % 2 ? key : NULL, ts, (uint64_t)i);
+        reqs[i].op = COTP_ASYNC_VALIDATE_TOTP;
+        reqs[i].window = 1;
+        strcpy (reqs[i].user_code, next);
+    }
+    reqs[2].window = 0;                       // the code belongs to the next step: miss
+    strcpy (reqs[3].user_code, "1234");       // wrong length: miss
+
+    cotp_async_completion done[4];
+    run_all (q, reqs, 4, done);
+    cr_expect_eq (done[0].err, VALID);
+    cr_expect_eq (done[0].matched_delta, 1);
+    cr_expect_eq (done[1].err, VALID);
+    cr_expect_eq (done[1].matched_delta, 1);
+    cr_expect_eq (done[2].err, NO_ERROR);
+    cr_expect_eq (done[3].err, NO_ERROR);
+
+    free (next);
+    cotp_queue_free (q);
+    cotp_key_free (key);
+}
+#endif
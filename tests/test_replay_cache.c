@@ -0,0 +1,110 @@
+#include <criterion/criterion.h>
+#include <string.h>
+#include <limits.h>
+#include "../src/cotp.h"
+
+#ifdef COTP_ENABLE_VALIDATION
+
+static const char *secret = "HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ";
+
+Test(replay_cache, second_use_is_rejected) {
+    cotp_error_t err;
+    cotp_replay_cache *rc = cotp_replay_cache_create (1000, &err);
+    cr_assert_not_null (rc);
+
+    char *code = get_totp_at (secret, 1700000000, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (code);
+
+    int delta = -999;
+    cr_expect_eq (validate_totp_in_window_once (rc, 1, code, secret, 1700000000, 6, 30, COTP_SHA1, 1, &delta, &err), 1);
+    cr_expect_eq (err, VALID);
+    cr_expect_eq (delta, 0);
+
+    // Same code again, even one period later through delta -1, is a replay
+    cr_expect_eq (validate_totp_in_window_once (rc, 1, code, secret, 1700000005, 6, 30, COTP_SHA1, 1, &delta, &err), 0);
+    cr_expect_eq (err, REPLAY_DETECTED);
+    cr_expect_eq (validate_totp_in_window_once (rc, 1, code, secret, 1700000030, 6, 30, COTP_SHA1, 1, &delta, &err), 0);
+    cr_expect_eq (err, REPLAY_DETECTED);
+
+    // Another account using the same secret is tracked separately
+    cr_expect_eq (validate_totp_in_window_once (rc, 2, code, secret, 1700000000, 6, 30, COTP_SHA1, 1, &delta, &err), 1);
+
+    // A wrong code reports the validator's result, not a replay
+    cr_expect_eq (validate_totp_in_window_once (rc, 1, "000000", secret, 1700000000, 6, 30, COTP_SHA1, 0, &delta, &err), 0);
+    cr_expect_neq (err, REPLAY_DETECTED);
+
+    free (code);
+    cotp_replay_cache_free (rc);
+}
+
+
+Test(replay_cache, records_expire_with_period_and_window) {
+    cotp_error_t err;
+    cotp_replay_cache *rc = cotp_replay_cache_create (16, &err);
+    cr_assert_not_null (rc);
+
+    // step 100 with period 30 and window 1 is acceptable until (100 + 2) * 30 = 3060
+    cr_expect_eq (cotp_replay_cache_check_and_mark (rc, 9, 100, 30, 1, 3000, &err), 1);
+    cr_expect_eq (cotp_replay_cache_check_and_mark (rc, 9, 100, 30, 1, 3059, &err), 0);
+    cr_expect_eq (err, REPLAY_DETECTED);
+    cr_expect_eq (cotp_replay_cache_check_and_mark (rc, 9, 100, 30, 1, 3060, &err), 1);
+    cr_expect_eq (cotp_replay_cache_check_and_mark (rc, 9, 101, 30, 1, 3060, &err), 1);
+
+    cotp_replay_cache_free (rc);
+}
+
+
+Test(replay_cache, expired_records_are_reclaimed) {
+    cotp_error_t err;
+    cotp_replay_cache *rc = cotp_replay_cache_create (64, &err);
+    cr_assert_not_null (rc);
+
+    // Far more pairs than the capacity go through as long as older ones expire
+    long now = 0;
+    for (long step = 0; step < 20000; step++) {
+        now = step * 30;
+        int ok = cotp_replay_cache_check_and_mark (rc, (uint64_t)(step % 50), step, 30, 0, now, &err);
+        cr_assert_eq (ok, 1, "step %ld rejected with %d\n", step, err);
+    }
+
+    cotp_replay_cache_free (rc);
+}
+
+
+Test(replay_cache, fails_closed_when_full) {
+    cotp_error_t err;
+    cotp_replay_cache *rc = cotp_replay_cache_create (1, &err);
+    cr_assert_not_null (rc);
+
+    int rejected = 0;
+    for (uint64_t id = 0; id < 100000 && !rejected; id++) {
+        if (!cotp_replay_cache_check_and_mark (rc, id, 10, 30, 1, 300, &err)) {
+            cr_expect_eq (err, MEMORY_ALLOCATION_ERROR);
+            rejected = 1;
+        }
+    }
+    cr_expect (rejected);
+
+    cotp_replay_cache_free (rc);
+}
+
+
+Test(replay_cache, invalid_input) {
+    cotp_error_t err;
+    cr_expect_null (cotp_replay_cache_create (0, &err));
+    cr_expect_eq (err, INVALID_USER_INPUT);
+
+    cotp_replay_cache *rc = cotp_replay_cache_create (8, &err);
+    cr_assert_not_null (rc);
+    cr_expect_eq (cotp_replay_cache_check_and_mark (rc, 1, -1, 30, 1, 0, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (cotp_replay_cache_check_and_mark (rc, 1, 1, 0, 1, 0, &err), 0);
+    cr_expect_eq (err, INVALID_PERIOD);
+    cr_expect_eq (cotp_replay_cache_check_and_mark (rc, 1, LONG_MAX, 30, 1, 0, &err), 1);
+    cr_expect_eq (validate_totp_in_window_once (NULL, 1, "123456", secret, 0, 6, 30, COTP_SHA1, 1, NULL, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cotp_replay_cache_free (rc);
+    cotp_replay_cache_free (NULL);
+}
+
+#endif // COTP_ENABLE_VALIDATION
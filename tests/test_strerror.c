@@ -17,6 +17,7 @@ Test(strerror, every_enum_value_has_message) {
         MISSING_LEADING_ZERO,
         INVALID_COUNTER,
         WHMAC_ERROR,
+        REPLAY_DETECTED,
     };
     const size_t n = sizeof(codes) / sizeof(codes[0]);
     for (size_t i = 0; i < n; i++) {
@@ -0,0 +1,279 @@
+#include <criterion/criterion.h>
+#include <string.h>
+#include <pthread.h>
+#include "../src/cotp.h"
+
+#ifdef COTP_ENABLE_VALIDATION
+
+static const char *secret_a = "HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ";
+static const char *secret_b = "JBSWY3DPEHPK3PXP";
+
+Test(totp_cache, validate_after_refresh) {
+    cotp_error_t err;
+    cotp_totp_cache *cache = cotp_totp_cache_create (4, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (cache);
+    cr_expect_eq (cotp_totp_cache_add_key (cache, 1, secret_a), NO_ERROR);
+    cr_expect_eq (cotp_totp_cache_add_key (cache, 2, secret_b), NO_ERROR);
+    cr_expect_eq (cotp_totp_cache_refresh (cache, 1700000000), NO_ERROR);
+
+    char *code = get_totp_at (secret_a, 1700000000, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (code);
+
+    int matched_delta = -999;
+    cr_expect_eq (cotp_totp_cache_validate (cache, 1, code, 1700000000, 1, &matched_delta, &err), 1);
+    cr_expect_eq (matched_delta, 0);
+    cr_expect_eq (err, VALID);
+
+    // One period later the code matches at delta -1
+    cr_expect_eq (cotp_totp_cache_validate (cache, 1, code, 1700000030, 1, &matched_delta, &err), 1);
+    cr_expect_eq (matched_delta, -1);
+
+    // A code of key 1 is not accepted for key 2
+    int ok = cotp_totp_cache_validate (cache, 2, code, 1700000000, 1, &matched_delta, &err);
+    cr_expect_eq (ok, 0);
+    cr_expect_eq (err, NO_ERROR);
+
+    free (code);
+    cotp_totp_cache_free (cache);
+}
+
+
+Test(totp_cache, agrees_with_validate_totp_in_window) {
+    cotp_error_t err;
+    cotp_totp_cache *cache = cotp_totp_cache_create (1, 8, 30, COTP_SHA256, &err);
+    cr_assert_not_null (cache);
+    cr_expect_eq (cotp_totp_cache_add_key (cache, 42, secret_a), NO_ERROR);
+    cr_expect_eq (cotp_totp_cache_refresh (cache, 1700000000), NO_ERROR);
+
+    // Deltas inside and outside the precomputed range must give the same answer as the plain validator
+    for (int d = -4; d <= 4; d++) {
+        char *code = get_totp_at (secret_a, 1700000000 + d * 30, 8, 30, COTP_SHA256, &err);
+        cr_assert_not_null (code);
+        int cached_delta = 0, plain_delta = 0;
+        cotp_error_t cached_err, plain_err;
+        int cached = cotp_totp_cache_validate (cache, 42, code, 1700000000, 3, &cached_delta, &cached_err);
+        int plain = validate_totp_in_window (code, secret_a, 1700000000, 8, 30, COTP_SHA256, 3, &plain_delta, &plain_err);
+        cr_expect_eq (cached, plain, "delta %d: cache=%d plain=%d\n", d, cached, plain);
+        cr_expect_eq (cached_delta, plain_delta);
+        cr_expect_eq (cached_err, plain_err);
+        free (code);
+    }
+
+    cotp_totp_cache_free (cache);
+}
+
+
+typedef struct {
+    cotp_totp_cache *cache;
+    const char      *code;
+    int              bad;
+} wide_validator;
+
+static void *
+validate_wide (void *p)
+{
+    wide_validator *v = p;
+    for (int i = 0; i < 200; i++) {
+        cotp_error_t err;
+        int delta;
+        // Reaches far outside the ring, so most steps are computed after the lock is dropped
+        int ok = cotp_totp_cache_validate (v->cache, 42, v->code, 1700000000, 20, &delta, &err);
+        if ((ok && delta != -15) || (!ok && err != INVALID_USER_INPUT)) {
+            v->bad++;
+        }
+    }
+    return NULL;
+}
+
+
+Test(totp_cache, wide_windows_while_keys_change) {
+    cotp_error_t err;
+    cotp_totp_cache *cache = cotp_totp_cache_create (4, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (cache);
+    cr_assert_eq (cotp_totp_cache_add_key (cache, 42, secret_a), NO_ERROR);
+    char *code = get_totp_at (secret_a, 1700000000 - 15 * 30, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (code);
+
+    wide_validator v[2] = { { cache, code, 0 }, { cache, code, 0 } };
+    pthread_t t[2];
+    for (int i = 0; i < 2; i++) {
+        cr_assert_eq (pthread_create (&t[i], NULL, validate_wide, &v[i]), 0);
+    }
+    // The key a validation copied may be removed, replaced and refreshed under it
+    for (int i = 0; i < 200; i++) {
+        cr_expect_eq (cotp_totp_cache_remove_key (cache, 42), NO_ERROR);
+        cr_expect_eq (cotp_totp_cache_add_key (cache, 42, secret_a), NO_ERROR);
+        cr_expect_eq (cotp_totp_cache_refresh (cache, 1700000000 + (i % 3) * 30), NO_ERROR);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join (t[i], NULL);
+        cr_expect_eq (v[i].bad, 0);
+    }
+
+    free (code);
+    cotp_totp_cache_free (cache);
+}
+
+
+Test(totp_cache, replace_and_remove_key) {
+    cotp_error_t err;
+    cotp_totp_cache *cache = cotp_totp_cache_create (2, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (cache);
+    cr_expect_eq (cotp_totp_cache_add_key (cache, 7, secret_a), NO_ERROR);
+    cr_expect_eq (cotp_totp_cache_refresh (cache, 1700000000), NO_ERROR);
+
+    // Re-enrolling the id drops tokens derived from the old secret
+    cr_expect_eq (cotp_totp_cache_add_key (cache, 7, secret_b), NO_ERROR);
+    char *old_code = get_totp_at (secret_a, 1700000000, 6, 30, COTP_SHA1, &err);
+    char *new_code = get_totp_at (secret_b, 1700000000, 6, 30, COTP_SHA1, &err);
+    int delta;
+    cr_expect_eq (cotp_totp_cache_validate (cache, 7, old_code, 1700000000, 0, &delta, &err), 0);
+    cr_expect_eq (cotp_totp_cache_validate (cache, 7, new_code, 1700000000, 0, &delta, &err), 1);
+
+    cr_expect_eq (cotp_totp_cache_remove_key (cache, 7), NO_ERROR);
+    cr_expect_eq (cotp_totp_cache_remove_key (cache, 7), INVALID_USER_INPUT);
+    cr_expect_eq (cotp_totp_cache_validate (cache, 7, new_code, 1700000000, 0, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+
+    free (old_code);
+    free (new_code);
+    cotp_totp_cache_free (cache);
+}
+
+
+Test(totp_cache, bounded_capacity) {
+    cotp_error_t err;
+    cotp_totp_cache *cache = cotp_totp_cache_create (3, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (cache);
+    for (uint64_t id = 0; id < 3; id++) {
+        cr_expect_eq (cotp_totp_cache_add_key (cache, id, secret_a), NO_ERROR);
+    }
+    cr_expect_eq (cotp_totp_cache_add_key (cache, 3, secret_a), MEMORY_ALLOCATION_ERROR);
+
+    // Removing from the middle of a probe chain keeps the other ids reachable
+    cr_expect_eq (cotp_totp_cache_remove_key (cache, 1), NO_ERROR);
+    cr_expect_eq (cotp_totp_cache_add_key (cache, 3, secret_a), NO_ERROR);
+    cr_expect_eq (cotp_totp_cache_remove_key (cache, 0), NO_ERROR);
+    cr_expect_eq (cotp_totp_cache_remove_key (cache, 2), NO_ERROR);
+    cr_expect_eq (cotp_totp_cache_remove_key (cache, 3), NO_ERROR);
+
+    cotp_totp_cache_free (cache);
+}
+
+
+Test(totp_cache, next_refresh_and_invalid_input) {
+    cotp_error_t err;
+    cr_expect_null (cotp_totp_cache_create (0, 6, 30, COTP_SHA1, &err));
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_null (cotp_totp_cache_create (1, 3, 30, COTP_SHA1, &err));
+    cr_expect_eq (err, INVALID_DIGITS);
+    cr_expect_null (cotp_totp_cache_create (1, 6, 0, COTP_SHA1, &err));
+    cr_expect_eq (err, INVALID_PERIOD);
+
+    cotp_totp_cache *cache = cotp_totp_cache_create (1, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (cache);
+    cr_expect_eq (cotp_totp_cache_next_refresh (cache, 1700000000), 1700000009);
+    cr_expect_eq (cotp_totp_cache_next_refresh (cache, 1700000009), 1700000039);
+    cr_expect_eq (cotp_totp_cache_add_key (cache, 1, "JBSW!3DP"), INVALID_B32_INPUT);
+    cr_expect_eq (cotp_totp_cache_validate (cache, 1, NULL, 0, 0, NULL, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cotp_totp_cache_free (cache);
+    cotp_totp_cache_free (NULL);
+}
+
+Test(totp_cache, find_resolves_code_to_key) {
+    const char *secrets[] = {"HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ", "JBSWY3DPEHPK3PXP", "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ", "MFRGGZDFMZTWQ2LK"};
+
+    cotp_error_t err;
+    cotp_totp_cache *cache = cotp_totp_cache_create (8, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (cache);
+    cr_expect_eq (cotp_totp_cache_enable_index (cache), NO_ERROR);
+    for (int i = 0; i < 4; i++) {
+        cr_expect_eq (cotp_totp_cache_add_key (cache, 100 + i, secrets[i]), NO_ERROR);
+    }
+    cr_expect_eq (cotp_totp_cache_refresh (cache, 1700000000), NO_ERROR);
+
+    for (int i = 0; i < 4; i++) {
+        char *code = get_totp_at (secrets[i], 1700000000 - 30, 6, 30, COTP_SHA1, &err);
+        uint64_t ids[4];
+        int deltas[4];
+        size_t n = cotp_totp_cache_find (cache, code, 1700000000, 1, ids, deltas, 4, &err);
+        cr_assert_geq (n, 1);
+        cr_expect_eq (err, VALID);
+        int hit = 0;
+        for (size_t k = 0; k < n && k < 4; k++) {
+            if (ids[k] == (uint64_t)(100 + i)) {
+                hit = 1;
+                cr_expect_eq (deltas[k], -1);
+            }
+        }
+        cr_expect (hit, "key %d not found for its own code\n", 100 + i);
+        free (code);
+    }
+
+    // Removed keys are filtered out by the confirmation step even before the next refresh
+    char *code = get_totp_at (secrets[0], 1700000000, 6, 30, COTP_SHA1, &err);
+    cr_expect_eq (cotp_totp_cache_remove_key (cache, 100), NO_ERROR);
+    uint64_t id;
+    size_t n = cotp_totp_cache_find (cache, code, 1700000000, 0, &id, NULL, 1, &err);
+    cr_expect_eq (n, 0);
+    cr_expect_eq (err, NO_ERROR);
+    free (code);
+
+    cotp_totp_cache_free (cache);
+}
+
+
+Test(totp_cache, find_counts_each_key_once) {
+    cotp_error_t err;
+    // With 4 digits, some step soon repeats the code of the one before it
+    long step = 1700000000 / 30;
+    char *code = NULL;
+    for (;; step++) {
+        char *a = get_totp_at (secret_a, step * 30, 4, 30, COTP_SHA1, &err);
+        char *b = get_totp_at (secret_a, (step + 1) * 30, 4, 30, COTP_SHA1, &err);
+        cr_assert_not_null (a);
+        cr_assert_not_null (b);
+        int same = strcmp (a, b) == 0;
+        free (b);
+        if (same) {
+            code = a;
+            break;
+        }
+        free (a);
+    }
+
+    cotp_totp_cache *cache = cotp_totp_cache_create (2, 4, 30, COTP_SHA1, &err);
+    cr_assert_not_null (cache);
+    cr_assert_eq (cotp_totp_cache_enable_index (cache), NO_ERROR);
+    cr_assert_eq (cotp_totp_cache_add_key (cache, 1, secret_a), NO_ERROR);
+    cr_assert_eq (cotp_totp_cache_refresh (cache, step * 30), NO_ERROR);
+
+    // The code matches key 1 at two steps of the window, which must not count it twice
+    size_t n = cotp_totp_cache_find (cache, code, step * 30, 1, NULL, NULL, 0, &err);
+    cr_expect_eq (n, 1, "count only: %zu keys\n", n);
+    cr_expect_eq (err, VALID);
+    uint64_t id = 0;
+    int delta = -999;
+    n = cotp_totp_cache_find (cache, code, step * 30, 1, &id, &delta, 1, &err);
+    cr_expect_eq (n, 1);
+    cr_expect_eq (id, 1);
+    cr_expect_eq (delta, 0, "a key is reported at its first matching step");
+
+    free (code);
+    cotp_totp_cache_free (cache);
+}
+
+
+Test(totp_cache, find_requires_index) {
+    cotp_error_t err;
+    cotp_totp_cache *cache = cotp_totp_cache_create (1, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (cache);
+    uint64_t id;
+    size_t n = cotp_totp_cache_find (cache, "123456", 1700000000, 1, &id, NULL, 1, &err);
+    cr_expect_eq (n, 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cotp_totp_cache_free (cache);
+}
+
+#endif // COTP_ENABLE_VALIDATION
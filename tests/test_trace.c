@@ -0,0 +1,121 @@
+#include <criterion/criterion.h>
+#include <string.h>
+#include "../src/cotp.h"
+
+static const char *secret = "HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ";
+
+typedef struct {
+    int              begins;
+    int              ends;
+    cotp_trace_event last_begin;
+    cotp_trace_event last_end;
+} recorder;
+
+
+static void
+on_begin (const cotp_trace_event *ev, void *user_data)
+{
+    recorder *r = user_data;
+    r->begins++;
+    r->last_begin = *ev;
+}
+
+
+static void
+on_end (const cotp_trace_event *ev, void *user_data)
+{
+    recorder *r = user_data;
+    r->ends++;
+    r->last_end = *ev;
+}
+
+
+Test(trace, generation_events) {
+    recorder r = { 0 };
+    cotp_trace_hooks hooks = { .begin = on_begin, .end = on_end, .user_data = &r };
+    cotp_trace_set_hooks (&hooks);
+
+    cotp_error_t err;
+    char *code = get_totp_at (secret, 1700000000, 6, 30, COTP_SHA256, &err);
+    cr_assert_not_null (code);
+    free (code);
+
+    // One span per public call, even though get_totp_at computes an HOTP internally
+    cr_expect_eq (r.begins, 1);
+    cr_expect_eq (r.ends, 1);
+    cr_expect_eq (r.last_begin.op, COTP_TRACE_TOTP);
+    cr_expect_eq (r.last_end.op, COTP_TRACE_TOTP);
+    cr_expect_eq (r.last_end.algo, COTP_SHA256);
+    cr_expect_eq (r.last_end.window, 0);
+    cr_expect_eq (r.last_end.err, NO_ERROR);
+    cr_expect_gt (r.last_end.duration_ns, 0);
+
+    cr_expect_null (get_hotp (secret, 1, 12, COTP_SHA1, &err));
+    cr_expect_eq (r.ends, 2);
+    cr_expect_eq (r.last_end.op, COTP_TRACE_HOTP);
+    cr_expect_eq (r.last_end.err, INVALID_DIGITS);
+
+    free (get_steam_totp_at (secret, 1700000000, 30, &err));
+    cr_expect_eq (r.last_end.op, COTP_TRACE_STEAM_TOTP);
+
+    cotp_trace_set_hooks (NULL);
+    free (get_hotp (secret, 1, 6, COTP_SHA1, &err));
+    cr_expect_eq (r.begins, 3);
+    cr_expect_eq (r.ends, 3);
+}
+
+
+Test(trace, uri_events) {
+    recorder r = { 0 };
+    cotp_trace_hooks hooks = { .end = on_end, .user_data = &r };
+    cotp_trace_set_hooks (&hooks);
+
+    cotp_error_t err;
+    cr_expect_null (cotp_otpauth_uri_parse ("https://example.com", &err));
+    cr_expect_eq (r.last_end.op, COTP_TRACE_URI_PARSE);
+    cr_expect_eq (r.last_end.algo, -1);
+    cr_expect_eq (r.last_end.err, INVALID_USER_INPUT);
+
+    cotp_otpauth_uri *u = cotp_otpauth_uri_parse ("otpauth://totp/Acme:alice?secret=HXDMVJECJJWSRB3HWIZR4IFUGFTMXBOZ&algorithm=SHA512", &err);
+    cr_assert_not_null (u);
+    cr_expect_eq (r.last_end.err, NO_ERROR);
+    char *uri = cotp_otpauth_uri_build (u, &err);
+    cr_assert_not_null (uri);
+    cr_expect_eq (r.last_end.op, COTP_TRACE_URI_BUILD);
+    cr_expect_eq (r.last_end.algo, COTP_SHA512);
+    cr_expect_eq (r.begins, 0);
+    cr_expect_eq (r.ends, 3);
+
+    cotp_trace_set_hooks (NULL);
+    free (uri);
+    cotp_otpauth_uri_free (u);
+}
+
+
+#ifdef COTP_ENABLE_VALIDATION
+Test(trace, validation_events) {
+    recorder r = { 0 };
+    cotp_trace_hooks hooks = { .begin = on_begin, .end = on_end, .user_data = &r };
+
+    cotp_error_t err;
+    char *code = get_totp_at (secret, 1700000000, 6, 30, COTP_SHA1, &err);
+    cr_assert_not_null (code);
+
+    cotp_trace_set_hooks (&hooks);
+    int delta;
+    cr_expect_eq (validate_totp_in_window (code, secret, 1700000030, 6, 30, COTP_SHA1, 3, &delta, &err), 1);
+    cr_expect_eq (r.begins, 1);
+    cr_expect_eq (r.last_begin.op, COTP_TRACE_VALIDATE_TOTP);
+    cr_expect_eq (r.last_begin.window, 3);
+    cr_expect_eq (r.last_end.err, VALID);
+
+    long matched;
+    cr_expect_eq (validate_hotp_in_window ("000000", secret, 0, 6, COTP_SHA1, 20, &matched, &err), 0);
+    cr_expect_eq (r.last_end.op, COTP_TRACE_VALIDATE_HOTP);
+    cr_expect_eq (r.last_end.window, 20);
+    cr_expect_eq (r.ends, 2);
+
+    cotp_trace_set_hooks (NULL);
+    free (code);
+}
+#endif
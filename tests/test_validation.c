@@ -155,4 +155,224 @@ Test(validation, test_overflow_guard_large_timestamp) {
     free (K_base32);
 }
 
+Test(validation, test_constant_time_matches_sequential) {
+    const char *K = "12345678901234567890";
+    const int algos[] = {COTP_SHA1, COTP_SHA256, COTP_SHA512};
+
+    cotp_error_t cotp_err;
+    char *K_base32 = base32_encode ((const uint8_t *)K, strlen(K)+1, &cotp_err);
+
+    // Every offset of a window of 3, a miss and a mis-shaped code, for each algorithm
+    for (int a = 0; a < 3; a++) {
+        for (int d = -4; d <= 4; d++) {
+            cotp_error_t err;
+            char *code = get_totp_at (K_base32, 1111111109 + d * 30, 8, 30, algos[a], &err);
+            cr_assert_not_null (code);
+            const char *inputs[] = {code, "00000000", "1234567"};
+            for (int i = 0; i < 3; i++) {
+                int seq_delta = -999, ct_delta = -999;
+                cotp_error_t seq_err, ct_err;
+                int seq = validate_totp_in_window (inputs[i], K_base32, 1111111109, 8, 30, algos[a], 3, &seq_delta, &seq_err);
+                int ct = validate_totp_in_window_ct (inputs[i], K_base32, 1111111109, 8, 30, algos[a], 3, &ct_delta, &ct_err);
+                cr_expect_eq (ct, seq, "algo %d delta %d input %d\n", algos[a], d, i);
+                cr_expect_eq (ct_delta, seq_delta);
+                cr_expect_eq (ct_err, seq_err);
+            }
+            free (code);
+        }
+    }
+
+    // Overflowing steps are skipped, as in the sequential scan
+    cotp_error_t err;
+    char *code = get_totp_at (K_base32, LONG_MAX - 60, 8, 30, COTP_SHA1, &err);
+    int delta = -999;
+    cr_expect_eq (validate_totp_in_window_ct (code, K_base32, LONG_MAX - 60, 8, 30, COTP_SHA1, 1024, &delta, &err), 1);
+    cr_expect_eq (delta, 0);
+    free (code);
+
+    cr_expect_eq (validate_totp_in_window_ct ("12345678", K_base32, 59, 8, 30, COTP_SHA1, 1025, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (validate_totp_in_window_ct ("12345678", K_base32, 30, 8, 30, COTP_SHA1, 2, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_COUNTER);
+    cr_expect_eq (validate_totp_in_window_ct ("12345678", K_base32, 59, 8, 30, 7, 1, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_ALGO);
+    cr_expect_eq (validate_totp_in_window_ct (NULL, K_base32, 59, 8, 30, COTP_SHA1, 1, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+
+    free (K_base32);
+}
+
+Test(validation, test_nearest_and_custom_order) {
+    const char *K = "12345678901234567890";
+    const long ts = 1111111109;
+
+    cotp_error_t err;
+    char *K_base32 = base32_encode ((const uint8_t *)K, strlen(K)+1, &err);
+
+    // Same verdicts as the ascending scan, inside and outside the window
+    for (int d = -4; d <= 4; d++) {
+        char *code = get_totp_at (K_base32, ts + d * 30L, 8, 30, COTP_SHA1, &err);
+        int seq_delta = -999, near_delta = -999;
+        cotp_error_t seq_err, near_err;
+        int seq = validate_totp_in_window (code, K_base32, ts, 8, 30, COTP_SHA1, 3, &seq_delta, &seq_err);
+        int near = validate_totp_in_window_nearest (code, K_base32, ts, 8, 30, COTP_SHA1, 3, &near_delta, &near_err);
+        cr_expect_eq (near, seq, "delta %d\n", d);
+        cr_expect_eq (near_delta, seq_delta);
+        cr_expect_eq (near_err, seq_err);
+        free (code);
+    }
+
+    // Only the listed offsets are accepted, whatever their order
+    const int order[] = {0, -1, 2};
+    for (int d = -2; d <= 2; d++) {
+        char *code = get_totp_at (K_base32, ts + d * 30L, 8, 30, COTP_SHA256, &err);
+        int delta = -999;
+        int ok = validate_totp_in_order (code, K_base32, ts, 8, 30, COTP_SHA256, order, 3, &delta, &err);
+        int listed = d == 0 || d == -1 || d == 2;
+        cr_expect_eq (ok, listed, "delta %d\n", d);
+        cr_expect_eq (delta, listed ? d : 0);
+        cr_expect_eq (err, listed ? VALID : NO_ERROR);
+        free (code);
+    }
+
+    int delta;
+    const int too_far[] = {0, 1025};
+    cr_expect_eq (validate_totp_in_order ("12345678", K_base32, ts, 8, 30, COTP_SHA1, too_far, 2, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (validate_totp_in_order ("12345678", K_base32, ts, 8, 30, COTP_SHA1, order, 0, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (validate_totp_in_order ("12345678", K_base32, ts, 8, 30, COTP_SHA1, NULL, 3, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    // A negative counter anywhere in the list fails the call, as in the ascending scan
+    const int late[] = {0, -3};
+    cr_expect_eq (validate_totp_in_order ("12345678", K_base32, 60, 8, 30, COTP_SHA1, late, 2, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_COUNTER);
+    cr_expect_eq (validate_totp_in_window_nearest ("12345678", K_base32, 60, 8, 30, COTP_SHA1, 3, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_COUNTER);
+    cr_expect_eq (validate_totp_in_window_nearest ("12345678", K_base32, ts, 8, 30, COTP_SHA1, 1025, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+
+    free (K_base32);
+}
+
+Test(validation, test_pool_matches_sequential) {
+    const char *K = "12345678901234567890";
+    const long ts = 1700000000;
+
+    cotp_error_t err;
+    char *K_base32 = base32_encode ((const uint8_t *)K, strlen(K)+1, &err);
+    cotp_pool *pool = cotp_pool_create (4, NULL, &err);
+    cr_assert_not_null (pool);
+
+    // Offsets at both edges, in the middle and in different workers' shares, plus a miss
+    const int deltas[] = {-1024, -1000, -1, 0, 1, 513, 1024};
+    const int windows[] = {5, COTP_POOL_VALIDATION_MIN_WINDOW, 1024};
+    for (size_t w = 0; w < 3; w++) {
+        for (size_t d = 0; d <= 7; d++) {
+            char *code = d < 7 ? get_totp_at (K_base32, ts + deltas[d] * 30L, 6, 30, COTP_SHA256, &err)
+                               : strdup ("000000");
+            int seq_delta = -999, pool_delta = -999;
+            cotp_error_t seq_err, pool_err;
+            int seq = validate_totp_in_window (code, K_base32, ts, 6, 30, COTP_SHA256, windows[w], &seq_delta, &seq_err);
+            int par = validate_totp_in_window_pool (code, K_base32, ts, 6, 30, COTP_SHA256, windows[w], pool,
+                                                    &pool_delta, &pool_err);
+            cr_expect_eq (par, seq, "window %d delta index %zu\n", windows[w], d);
+            cr_expect_eq (pool_delta, seq_delta, "window %d: %d != %d\n", windows[w], pool_delta, seq_delta);
+            cr_expect_eq (pool_err, seq_err);
+            free (code);
+        }
+    }
+
+    int delta;
+    cr_expect_eq (validate_totp_in_window_pool ("123456", K_base32, 300, 6, 30, COTP_SHA1, 100, pool, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_COUNTER);
+    cr_expect_eq (validate_totp_in_window_pool ("123456", K_base32, ts, 6, 30, COTP_SHA1, 1025, pool, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (validate_totp_in_window_pool ("123456", K_base32, ts, 3, 30, COTP_SHA1, 100, pool, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_DIGITS);
+    cr_expect_eq (validate_totp_in_window_pool ("123456", "JBSW!3DP", ts, 6, 30, COTP_SHA1, 100, pool, &delta, &err), 0);
+    cr_expect_eq (err, INVALID_B32_INPUT);
+
+    // A NULL pool scans on the calling thread
+    char *code = get_totp_at (K_base32, ts - 300 * 30L, 6, 30, COTP_SHA1, &err);
+    cr_expect_eq (validate_totp_in_window_pool (code, K_base32, ts, 6, 30, COTP_SHA1, 300, NULL, &delta, &err), 1);
+    cr_expect_eq (delta, -300);
+    free (code);
+
+    cotp_pool_free (pool);
+    free (K_base32);
+}
+
+Test(validation, test_hotp_look_ahead) {
+    const char *K = "12345678901234567890";
+    const char *expected_hotp[] = {"755224", "287082", "359152", "969429", "338314", "254676", "287922", "162583", "399871", "520489"};
+
+    cotp_error_t cotp_err;
+    char *K_base32 = base32_encode ((const uint8_t *)K, strlen(K)+1, &cotp_err);
+
+    cotp_error_t err;
+    long matched = -999;
+    int result = validate_hotp_in_window (expected_hotp[7], K_base32, 2, 6, COTP_SHA1, 5, &matched, &err);
+    cr_expect_eq (result, 1, "Expected match within look-ahead\n");
+    cr_expect_eq (matched, 7, "Expected counter 7, got %ld\n", matched);
+    cr_expect_eq (err, VALID);
+
+    // Counter 8 is just past counter + look_ahead
+    result = validate_hotp_in_window (expected_hotp[8], K_base32, 2, 6, COTP_SHA1, 5, &matched, &err);
+    cr_expect_eq (result, 0);
+    cr_expect_eq (matched, -1);
+    cr_expect_eq (err, NO_ERROR);
+
+    // Codes behind the counter are never accepted
+    result = validate_hotp_in_window (expected_hotp[1], K_base32, 2, 6, COTP_SHA1, 5, &matched, &err);
+    cr_expect_eq (result, 0);
+
+    free (K_base32);
+}
+
+
+Test(validation, test_hotp_resync_two_codes) {
+    const char *K = "12345678901234567890";
+    const char *expected_hotp[] = {"755224", "287082", "359152", "969429", "338314", "254676", "287922", "162583", "399871", "520489"};
+
+    cotp_error_t cotp_err;
+    char *K_base32 = base32_encode ((const uint8_t *)K, strlen(K)+1, &cotp_err);
+
+    cotp_error_t err;
+    long matched = -999;
+    int result = cotp_hotp_resync (expected_hotp[6], expected_hotp[7], K_base32, 0, 6, COTP_SHA1, 6, &matched, &err);
+    cr_expect_eq (result, 1, "Expected resync to succeed\n");
+    cr_expect_eq (matched, 7, "Expected counter 7, got %ld\n", matched);
+    cr_expect_eq (err, VALID);
+
+    // Two valid but non-consecutive codes are rejected
+    result = cotp_hotp_resync (expected_hotp[5], expected_hotp[7], K_base32, 0, 6, COTP_SHA1, 9, &matched, &err);
+    cr_expect_eq (result, 0);
+    cr_expect_eq (err, NO_ERROR);
+
+    free (K_base32);
+}
+
+
+Test(validation, test_hotp_invalid_input) {
+    cotp_error_t err;
+    long matched;
+    cr_expect_eq (validate_hotp_in_window (NULL, "JBSWY3DPEHPK3PXP", 0, 6, COTP_SHA1, 1, &matched, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (validate_hotp_in_window ("123456", "JBSWY3DPEHPK3PXP", -1, 6, COTP_SHA1, 1, &matched, &err), 0);
+    cr_expect_eq (err, INVALID_COUNTER);
+    cr_expect_eq (validate_hotp_in_window ("123456", "JBSWY3DPEHPK3PXP", 0, 6, COTP_SHA1, 2000, &matched, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+    cr_expect_eq (validate_hotp_in_window ("123456", "JBSWY3DPEHPK3PXP", 0, 6, 9, 1, &matched, &err), 0);
+    cr_expect_eq (err, INVALID_ALGO);
+    cr_expect_eq (validate_hotp_in_window ("12345", "JBSWY3DPEHPK3PXP", 0, 6, COTP_SHA1, 1, &matched, &err), 0);
+    cr_expect_eq (err, NO_ERROR);
+    cr_expect_eq (cotp_hotp_resync (NULL, "123456", "JBSWY3DPEHPK3PXP", 0, 6, COTP_SHA1, 1, &matched, &err), 0);
+    cr_expect_eq (err, INVALID_USER_INPUT);
+
+    // Scanning up to LONG_MAX must stop instead of wrapping around
+    cr_expect_eq (validate_hotp_in_window ("123456", "JBSWY3DPEHPK3PXP", LONG_MAX - 1, 6, COTP_SHA1, 10, &matched, &err), 0);
+    cr_expect_eq (err, NO_ERROR);
+}
+
 #endif // COTP_ENABLE_VALIDATION
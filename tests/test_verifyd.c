@@ -0,0 +1,190 @@
+#include <criterion/criterion.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "verifyd_client.h"
+
+extern char **environ;
+
+static const char *K_SHA1 = "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQAA";
+
+typedef struct {
+    char  dir[64];
+    char  socket_path[96];
+    char  key_path[96];
+    pid_t pid;
+} daemon_run;
+
+
+static int
+start_daemon (daemon_run *d)
+{
+    strcpy (d->dir, "/tmp/cotp-verifyd-XXXXXX");
+    if (mkdtemp (d->dir) == NULL) {
+        return -1;
+    }
+    snprintf (d->socket_path, sizeof d->socket_path, "%s/sock", d->dir);
+    snprintf (d->key_path, sizeof d->key_path, "%s/keys", d->dir);
+
+    FILE *f = fopen (d->key_path, "w");
+    if (f == NULL) {
+        return -1;
+    }
+    fprintf (f, "# test keys\n\n");
+    fprintf (f, "totp8 otpauth://totp/t:a?secret=%s&digits=8&period=30\n", K_SHA1);
+    fprintf (f, "hotp  otpauth://hotp/t:b?secret=%s&counter=0\n", K_SHA1);
+    fclose (f);
+
+    char *argv[] = { VERIFYD_BIN, "-s", d->socket_path, "-k", d->key_path, "-t", "2", NULL };
+    if (posix_spawn (&d->pid, VERIFYD_BIN, NULL, NULL, argv, environ) != 0) {
+        return -1;
+    }
+    // Wait for the socket to accept connections
+    for (int i = 0; i < 500; i++) {
+        verifyd_client *c = verifyd_connect (d->socket_path, NULL);
+        if (c != NULL) {
+            verifyd_close (c);
+            return 0;
+        }
+        usleep (10000);
+    }
+    return -1;
+}
+
+
+static int
+stop_daemon (daemon_run *d)
+{
+    int status = -1;
+    kill (d->pid, SIGTERM);
+    waitpid (d->pid, &status, 0);
+    unlink (d->key_path);
+    int leftover = access (d->socket_path, F_OK) == 0;
+    unlink (d->socket_path);
+    rmdir (d->dir);
+    return WIFEXITED (status) && WEXITSTATUS (status) == 0 && !leftover ? 0 : -1;
+}
+
+
+Test(verifyd, generate_and_validate) {
+    daemon_run d;
+    cr_assert_eq (start_daemon (&d), 0);
+    verifyd_client *c = verifyd_connect (d.socket_path, NULL);
+    cr_assert_not_null (c);
+
+    verifyd_result r;
+    cr_expect_eq (verifyd_generate (c, "totp8", 59, &r), VERIFYD_OK);
+    cr_expect_eq (r.err, NO_ERROR);
+    cr_expect_str_eq (r.code, "94287082");
+
+    cr_expect_eq (verifyd_generate (c, "hotp", 1, &r), VERIFYD_OK);
+    cr_expect_str_eq (r.code, "287082");
+
+    cr_expect_eq (verifyd_generate (c, "nope", 59, &r), VERIFYD_OK);
+    cr_expect_eq (r.err, VERIFYD_UNKNOWN_KEY);
+    cr_expect_str_eq (r.code, "");
+
+    // Code of the next step: found one step ahead, missed with a zero window
+    cr_expect_eq (verifyd_validate (c, "totp8", "07081804", 1111111109 - 30, 1, &r), VERIFYD_OK);
+    cr_expect_eq (r.err, VALID);
+    cr_expect_eq (r.matched_delta, 1);
+    cr_expect_eq (verifyd_validate (c, "totp8", "07081804", 1111111109 - 30, 0, &r), VERIFYD_OK);
+    cr_expect_eq (r.err, NO_ERROR);
+    // HOTP validation looks ahead only
+    cr_expect_eq (verifyd_validate (c, "hotp", "969429", 1, 2, &r), VERIFYD_OK);
+    cr_expect_eq (r.err, VALID);
+    cr_expect_eq (r.matched_delta, 2);
+    cr_expect_eq (verifyd_validate (c, "totp8", "07081804", -30, 1, &r), VERIFYD_OK);
+    cr_expect_eq (r.err, INVALID_COUNTER);
+
+    cr_expect_eq (verifyd_validate (c, "totp8", "07081804", 0, VERIFYD_MAX_WINDOW + 1, &r), VERIFYD_ERR_ARGUMENT);
+
+    verifyd_close (c);
+    cr_expect_eq (stop_daemon (&d), 0);
+}
+
+
+Test(verifyd, pipelined_batches) {
+    daemon_run d;
+    cr_assert_eq (start_daemon (&d), 0);
+    verifyd_client *c = verifyd_connect (d.socket_path, NULL);
+    cr_assert_not_null (c);
+
+    enum { FRAMES = 20, ITEMS = 200 };
+    uint32_t ids[FRAMES];
+    for (int f = 0; f < FRAMES; f++) {
+        cr_assert_eq (verifyd_begin (c, VERIFYD_OP_GENERATE), VERIFYD_OK);
+        for (int i = 0; i < ITEMS; i++) {
+            cr_assert_eq (verifyd_add_generate (c, i % 2 ? "totp8" : "hotp", f * ITEMS + i), VERIFYD_OK);
+        }
+        cr_assert_eq (verifyd_send (c, &ids[f]), VERIFYD_OK);
+    }
+
+    static verifyd_result results[ITEMS];
+    for (int f = 0; f < FRAMES; f++) {
+        uint32_t id;
+        size_t n;
+        cr_assert_eq (verifyd_recv (c, &id, results, ITEMS, &n), VERIFYD_OK);
+        cr_expect_eq (id, ids[f], "responses come back in request order");
+        cr_assert_eq (n, ITEMS);
+        for (int i = 0; i < ITEMS; i++) {
+            cotp_error_t err;
+            long at = f * ITEMS + i;
+            char *expected = i % 2 ? get_totp_at (K_SHA1, at, 8, 30, COTP_SHA1, &err)
+                                   : get_hotp (K_SHA1, at, 6, COTP_SHA1, &err);
+            cr_expect_eq (results[i].err, NO_ERROR);
+            cr_expect_str_eq (results[i].code, expected);
+            free (expected);
+        }
+    }
+
+    verifyd_close (c);
+    cr_expect_eq (stop_daemon (&d), 0);
+}
+
+
+Test(verifyd, malformed_frames) {
+    daemon_run d;
+    cr_assert_eq (start_daemon (&d), 0);
+    verifyd_client *c = verifyd_connect (d.socket_path, NULL);
+    cr_assert_not_null (c);
+
+    // A well-framed request with a truncated item is answered with an error frame...
+    int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy (addr.sun_path, d.socket_path);
+    cr_assert_eq (connect (fd, (struct sockaddr *)&addr, sizeof addr), 0);
+    uint8_t frame[4 + VERIFYD_HEADER_SIZE + 3];
+    verifyd_header h = { .version = VERIFYD_VERSION, .op = VERIFYD_OP_GENERATE, .count = 1, .id = 77 };
+    verifyd_put_u32 (frame, VERIFYD_HEADER_SIZE + 3);
+    verifyd_put_header (frame + 4, &h);
+    memcpy (frame + 4 + VERIFYD_HEADER_SIZE, "\x05" "ab", 3);
+    cr_assert_eq (write (fd, frame, sizeof frame), (ssize_t)sizeof frame);
+    uint8_t reply[4 + VERIFYD_HEADER_SIZE];
+    cr_assert_eq (recv (fd, reply, sizeof reply, MSG_WAITALL), (ssize_t)sizeof reply);
+    verifyd_get_header (reply + 4, &h);
+    cr_expect_eq (h.op, VERIFYD_OP_ERROR | VERIFYD_OP_RESPONSE);
+    cr_expect_eq (h.id, 77);
+    cr_expect_eq (h.count, 0);
+
+    // ...while an impossible length drops the connection
+    verifyd_put_u32 (frame, VERIFYD_MAX_FRAME + 1);
+    cr_assert_eq (write (fd, frame, 4), 4);
+    cr_expect_eq (recv (fd, reply, sizeof reply, 0), 0);
+    close (fd);
+
+    // Other clients are unaffected
+    verifyd_result r;
+    cr_expect_eq (verifyd_generate (c, "totp8", 59, &r), VERIFYD_OK);
+    cr_expect_str_eq (r.code, "94287082");
+
+    verifyd_close (c);
+    cr_expect_eq (stop_daemon (&d), 0);
+}